@@ -0,0 +1,368 @@
+/**************************************************************************************
+ 解码器性能测试, 数据由gen-synthetic生成, 也可以用真实数据(文件名需与gen-synthetic的输出一致)
+ 微基准: RuleTable::find_matched_rules_for_prefixes, CandBeam::add, LanguageModel::cal_increased_lm_score,
+ 		 以及generate_kbest_for_span(通过立方体剪枝阶段的计时统计)
+ 整体测试: 不同线程数下的解码速度(句子/秒)和进程的峰值内存
+ 内存检查: span级并行时重复解码, 峰值内存不应随轮数增长, 否则以非0状态退出
+************************************************************************************* */
+#include "../translator.h"
+#include <random>
+#include <iomanip>
+
+struct BenchConfig
+{
+	string dir = "synthetic";
+	vector<int> thread_nums = {1,2,4};
+	size_t span_thread_num = 2;					//内存检查时的span级线程数
+	size_t repeat = 3;							//每个微基准重复的轮数, 取最快的一轮
+	Parameter para;
+	Weight weight;
+};
+
+void report(const string &name, size_t op_num, double best_time)
+{
+	cout<<left<<setw(36)<<name<<right<<setw(12)<<op_num<<" ops "<<setw(12)<<fixed<<setprecision(1)
+		<<(op_num>0?best_time*1e9/op_num:0.0)<<" ns/op "<<setw(14)<<setprecision(0)<<(best_time>0?op_num/best_time:0.0)<<" ops/s\n";
+	cout.unsetf(ios::floatfield);
+	cout<<setprecision(6);
+}
+
+//将输入句子转换为源端id序列, 未登录词的id为-1
+vector<vector<int> > load_input(const string &input_file, Vocab *src_vocab, vector<string> &input_sen)
+{
+	vector<vector<int> > sen_wids;
+	ifstream fin(input_file.c_str());
+	if (!fin.is_open())
+	{
+		cerr<<"cannot open input file!\n";
+		exit(EXIT_FAILURE);
+	}
+	string line;
+	while(getline(fin,line))
+	{
+		TrimLine(line);
+		input_sen.push_back(line);
+		vector<string> vs;
+		Split(vs,line);
+		vector<int> wids;
+		for (const auto &word_tag : vs)
+		{
+			wids.push_back(src_vocab->get_id(word_tag.substr(0,word_tag.find("#"))));
+		}
+		sen_wids.push_back(wids);
+	}
+	return sen_wids;
+}
+
+void bench_find_matched_rules(const BenchConfig &conf, RuleTable *ruletable, const vector<vector<int> > &sen_wids)
+{
+	double best_time = 1e30;
+	size_t op_num = 0;
+	for (size_t r=0;r<conf.repeat;r++)
+	{
+		op_num = 0;
+		double beg = wall_time();
+		for (const auto &wids : sen_wids)
+		{
+			for (size_t pos=0;pos<wids.size();pos++)
+			{
+				ruletable->find_matched_rules_for_prefixes(wids,pos);
+				op_num++;
+			}
+		}
+		best_time = min(best_time,wall_time()-beg);
+	}
+	report("find_matched_rules_for_prefixes",op_num,best_time);
+}
+
+void bench_cand_beam_add(const BenchConfig &conf)
+{
+	const size_t CAND_NUM = 200000;
+	mt19937 gen(1);
+	uniform_int_distribution<int> wid_dist(0,49);						//词表小, 使假设重组经常发生
+	uniform_int_distribution<int> len_dist(1,8);
+	normal_distribution<double> score_dist(-20.0,5.0);
+	double best_time = 1e30;
+	for (size_t r=0;r<conf.repeat;r++)
+	{
+		vector<Cand*> cands(CAND_NUM);
+		for (auto &cand : cands)
+		{
+			cand = new Cand;
+			int len = len_dist(gen);
+			for (int i=0;i<len;i++)
+			{
+				cand->tgt_wids.push_back(wid_dist(gen));
+			}
+			cand->score = score_dist(gen);
+		}
+		CandBeam candbeam;
+		double beg = wall_time();
+		for (auto &cand : cands)
+		{
+			candbeam.add(cand,conf.para.BEAM_SIZE);
+		}
+		best_time = min(best_time,wall_time()-beg);
+		candbeam.free();
+	}
+	report("CandBeam::add",CAND_NUM,best_time);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 测试语言模型打分的速度
+ 2. 入口参数: 测试参数, 模型, 输入句子的id序列
+ 3. 出口参数: 无
+ 4. 算法简介: 先用输入句子匹配到的短语规则生成不含子候选的候选, 再用形如AX和AXB的规则
+ 			  与这些候选组合生成含子候选的候选, 分别计时; 得分缓存在各轮之间保持不变,
+ 			  因此开启缓存时反映的是缓存命中时的速度, 用-lm-cache 0测试KenLM本身的速度
+************************************************************************************* */
+void bench_lm(const BenchConfig &conf, const Models &models, const vector<vector<int> > &sen_wids)
+{
+	int src_nt_id = models.src_vocab->get_id("[X][X]");
+	vector<Cand*> phrase_cands;
+	vector<TgtRule*> hiero_rules;
+	for (const auto &wids : sen_wids)
+	{
+		for (size_t pos=0;pos<wids.size();pos++)
+		{
+			vector<vector<TgtRule>* > matched_rules = models.ruletable->find_matched_rules_for_prefixes(wids,pos);
+			for (auto tgt_rules : matched_rules)
+			{
+				if (tgt_rules == NULL)
+					continue;
+				for (auto &tgt_rule : *tgt_rules)
+				{
+					Cand *cand = new Cand;
+					cand->tgt_wids.assign(tgt_rule.tgt->wids,tgt_rule.tgt->wids+tgt_rule.tgt->len);
+					cand->applied_rule.tgt_rule = &tgt_rule;
+					phrase_cands.push_back(cand);
+				}
+			}
+			vector<int> pattern = {wids.at(pos),src_nt_id};
+			if (pos+2 < wids.size())
+			{
+				pattern.push_back(wids.at(pos+2));
+			}
+			matched_rules = models.ruletable->find_matched_rules_for_prefixes(pattern,0);
+			for (size_t i=1;i<matched_rules.size();i++)
+			{
+				if (matched_rules.at(i) == NULL)
+					continue;
+				for (auto &tgt_rule : *matched_rules.at(i))
+				{
+					if (tgt_rule.tgt->nt_pos[0] >= 0 && tgt_rule.tgt->nt_pos[1] < 0)
+					{
+						hiero_rules.push_back(&tgt_rule);
+					}
+				}
+			}
+		}
+	}
+	for (auto cand : phrase_cands)
+	{
+		models.lm_model->cal_increased_lm_score(cand);
+	}
+	vector<Cand> hiero_cands(hiero_rules.size());
+	for (size_t i=0;i<hiero_rules.size();i++)
+	{
+		hiero_cands.at(i).applied_rule.tgt_rule = hiero_rules.at(i);
+		hiero_cands.at(i).child_x1 = phrase_cands.empty() ? NULL : phrase_cands.at(i%phrase_cands.size());
+	}
+
+	double best_phrase_time = 1e30;
+	double best_hiero_time = 1e30;
+	double sum = 0.0;
+	for (size_t r=0;r<conf.repeat;r++)
+	{
+		double beg = wall_time();
+		for (auto cand : phrase_cands)
+		{
+			sum += models.lm_model->cal_increased_lm_score(cand);
+		}
+		double mid = wall_time();
+		for (auto &cand : hiero_cands)
+		{
+			sum += models.lm_model->cal_increased_lm_score(&cand);
+		}
+		best_phrase_time = min(best_phrase_time,mid-beg);
+		best_hiero_time = min(best_hiero_time,wall_time()-mid);
+	}
+	report("cal_increased_lm_score (phrase)",phrase_cands.size(),best_phrase_time);
+	report("cal_increased_lm_score (hiero)",hiero_cands.size(),best_hiero_time);
+	for (auto cand : phrase_cands)
+	{
+		delete cand;
+	}
+	if (sum == 1.0)
+	{
+		cout<<sum<<endl;													//防止打分被优化掉
+	}
+}
+
+//单线程解码所有句子, 用各阶段计时中的立方体剪枝时间衡量generate_kbest_for_span
+void bench_generate_kbest(const BenchConfig &conf, const Models &models, const vector<string> &input_sen)
+{
+	Parameter para = conf.para;
+	para.PROFILE = true;
+	para.SPAN_THREAD_NUM = 1;
+	double best_time = 1e30;
+	size_t span_num = 0;
+	size_t pop_num = 0;
+	for (size_t r=0;r<conf.repeat;r++)
+	{
+		SenProfile total_profile;
+		span_num = 0;
+		for (const auto &sen : input_sen)
+		{
+			SentenceTranslator sen_translator(models,para,conf.weight,sen);
+			sen_translator.translate_sentence();
+			size_t len = sen_translator.get_src_sen_len();
+			span_num += len*(len-1)/2;											//跨度大于1的span数
+			total_profile.merge(sen_translator.get_profile());
+		}
+		pop_num = total_profile.counters[COUNTER_POP];
+		best_time = min(best_time,total_profile.phase_times[PHASE_CUBE_PRUNING]);
+	}
+	report("generate_kbest_for_span (per span)",span_num,best_time);
+	report("generate_kbest_for_span (per pop)",pop_num,best_time);
+}
+
+//在不同线程数下解码全部句子
+void bench_throughput(const BenchConfig &conf, const Models &models, const vector<string> &input_sen)
+{
+	cout<<"\nthreads  sentences/s  speedup  peak RSS(MB)\n";
+	double base_speed = 0.0;
+	for (int thread_num : conf.thread_nums)
+	{
+		double beg = wall_time();
+#pragma omp parallel for num_threads(thread_num) schedule(dynamic)
+		for (size_t i=0;i<input_sen.size();i++)
+		{
+			SentenceTranslator sen_translator(models,conf.para,conf.weight,input_sen.at(i));
+			sen_translator.translate_sentence();
+		}
+		double speed = input_sen.size()/(wall_time()-beg);
+		if (base_speed == 0.0)
+		{
+			base_speed = speed;
+		}
+		cout<<setw(7)<<thread_num<<setw(13)<<speed<<setw(9)<<speed/base_speed<<setw(14)<<peak_rss_kb()/1024.0<<endl;
+	}
+}
+
+/**************************************************************************************
+ 1. 函数功能: 检查span级并行时进程内存是否有界
+ 2. 入口参数: 测试参数, 模型, 输入句子
+ 3. 出口参数: 内存是否有界
+ 4. 算法简介: 句子级和span级都用多个线程, 重复解码全部句子若干轮; 嵌套的线程组每次创建新线程,
+ 			  按线程分配的资源(如语言模型得分缓存)若不复用, 峰值内存会随轮数增长.
+ 			  第一轮之后峰值内存的增长超过第一轮峰值的10%时认为无界
+************************************************************************************* */
+bool check_span_thread_memory(const BenchConfig &conf, const Models &models, const vector<string> &input_sen)
+{
+	const size_t ROUND_NUM = 3;
+	Parameter para = conf.para;
+	para.SPAN_THREAD_NUM = conf.span_thread_num;
+	int sen_thread_num = *max_element(conf.thread_nums.begin(),conf.thread_nums.end());
+	cout<<"\nspan-thread memory check ("<<sen_thread_num<<" sentence threads x "<<para.SPAN_THREAD_NUM<<" span threads)\nround  peak RSS(MB)\n";
+	double first_peak = 0.0;
+	double peak = 0.0;
+	for (size_t r=0;r<ROUND_NUM;r++)
+	{
+#pragma omp parallel for num_threads(sen_thread_num) schedule(dynamic)
+		for (size_t i=0;i<input_sen.size();i++)
+		{
+			SentenceTranslator sen_translator(models,para,conf.weight,input_sen.at(i));
+			sen_translator.translate_sentence();
+		}
+		peak = peak_rss_kb()/1024.0;
+		if (r == 0)
+		{
+			first_peak = peak;
+		}
+		cout<<setw(5)<<r+1<<setw(14)<<peak<<endl;
+	}
+	bool bounded = peak <= first_peak*1.1;
+	cout<<(bounded?"memory bounded\n":"FAILED: memory grows with the number of decoded sentences\n");
+	return bounded;
+}
+
+vector<int> parse_thread_nums(const string &s)
+{
+	vector<int> thread_nums;
+	stringstream ss(s);
+	string num;
+	while (getline(ss,num,','))
+	{
+		thread_nums.push_back(stoi(num));
+	}
+	return thread_nums;
+}
+
+int main(int argc, char *argv[])
+{
+	BenchConfig conf;
+	conf.para.RULE_NUM_LIMIT = 20;
+	conf.para.BEAM_SIZE = 100;
+	conf.para.CUBE_SIZE = 300;
+	conf.para.SEN_THREAD_NUM = 1;
+	conf.para.SPAN_THREAD_NUM = 1;
+	conf.para.NBEST_NUM = 1;
+	conf.para.PRINT_NBEST = 0;
+	conf.para.DUMP_RULE = 0;
+	conf.para.DROP_OOV = 0;
+	conf.para.LM_CACHE_SIZE = 65536;
+	conf.weight.trans = {0.77,1.66,1.25,1.04};
+	conf.weight.lm = 3.26;
+	conf.weight.len = 2.90;
+	conf.weight.rule_num = -0.06;
+	conf.weight.glue = 0.96;
+	conf.weight.fw = 0;
+	conf.weight.fwverb = 0;
+	string lm_file = "lm.arpa";
+	for (int i=1;i+1<argc;i+=2)
+	{
+		string arg(argv[i]);
+		if (arg == "-dir") conf.dir = argv[i+1];
+		else if (arg == "-lm") lm_file = argv[i+1];
+		else if (arg == "-threads") conf.thread_nums = parse_thread_nums(argv[i+1]);
+		else if (arg == "-repeat") conf.repeat = stoi(argv[i+1]);
+		else if (arg == "-beam") conf.para.BEAM_SIZE = stoi(argv[i+1]);
+		else if (arg == "-cube") conf.para.CUBE_SIZE = stoi(argv[i+1]);
+		else if (arg == "-lm-cache") conf.para.LM_CACHE_SIZE = stoi(argv[i+1]);
+		else if (arg == "-span-threads") conf.span_thread_num = max(stoi(argv[i+1]),2);
+		else
+		{
+			cout<<"usage: ./bench-decoder [-dir synthetic] [-lm lm.arpa] [-threads 1,2,4] [-repeat 3] [-beam 100] [-cube 300] [-lm-cache 65536] [-span-threads 2]\n";
+			return 1;
+		}
+	}
+	omp_set_nested(1);
+	double load_beg = wall_time();
+	LoadOption load_option = {util::LAZY,false,false};
+	Vocab *src_vocab = new Vocab(conf.dir+"/vocab.ch");
+	Vocab *tgt_vocab = new Vocab(conf.dir+"/vocab.en");
+	RuleTable *ruletable = new RuleTable(conf.para.RULE_NUM_LIMIT,conf.weight,conf.dir+"/prob.bin",load_option);
+	LanguageModel *lm_model = LanguageModel::create(conf.dir+"/"+lm_file,tgt_vocab,conf.para.LM_CACHE_SIZE,load_option);
+	ruletable->fill_kenlm_ids(lm_model);
+	set<int> src_function_words;
+	ifstream ffw((conf.dir+"/fw.txt").c_str());
+	string line;
+	while (getline(ffw,line))
+	{
+		TrimLine(line);
+		src_function_words.insert(src_vocab->add_word(line));
+	}
+	vector<string> input_sen;
+	src_vocab->add_word("[X][X]");
+	vector<vector<int> > sen_wids = load_input(conf.dir+"/input.txt",src_vocab,input_sen);
+	Models models = {src_vocab,tgt_vocab,ruletable,lm_model,&src_function_words};
+	cout<<"loading time: "<<wall_time()-load_beg<<"s, "<<input_sen.size()<<" sentences, peak RSS "<<peak_rss_kb()/1024.0<<"MB\n\n";
+
+	bench_find_matched_rules(conf,ruletable,sen_wids);
+	bench_cand_beam_add(conf);
+	bench_lm(conf,models,sen_wids);
+	bench_generate_kbest(conf,models,input_sen);
+	bench_throughput(conf,models,input_sen);
+	return check_span_thread_memory(conf,models,input_sen) ? 0 : 1;
+}
@@ -0,0 +1,314 @@
+/**************************************************************************************
+ 生成用于性能测试的合成数据, 包括源端和目标端词表(vocab.ch, vocab.en), 二进制规则表(prob.bin),
+ ARPA格式的语言模型(lm.arpa), 虚词表(fw.txt), 输入句子(input.txt)以及可以直接运行hiero的config.ini
+ 单词按Zipf分布抽样, 规则源端从与输入句子同分布的语料中截取, 以保证解码时能匹配到足够多的规则
+************************************************************************************* */
+#include "../stdafx.h"
+#include <random>
+#include <sys/stat.h>
+
+struct GenConfig
+{
+	string dir = "synthetic";
+	size_t src_vocab_size = 5000;
+	size_t tgt_vocab_size = 5000;
+	size_t rule_num = 200000;				//规则源端的个数
+	size_t tgt_per_src = 5;					//每个源端的目标端个数
+	size_t lm_order = 5;
+	size_t lm_sen_num = 20000;				//用来统计语言模型的目标端句子数
+	size_t input_sen_num = 200;
+	size_t sen_len = 25;
+	size_t seed = 1;
+};
+
+//按Zipf分布抽样单词, 返回值从0开始
+class ZipfSampler
+{
+	public:
+		ZipfSampler(size_t n, mt19937 &i_gen) : gen(i_gen)
+		{
+			vector<double> weights(n);
+			for (size_t i=0;i<n;i++)
+			{
+				weights[i] = 1.0/(i+1);
+			}
+			dist = discrete_distribution<size_t>(weights.begin(),weights.end());
+		};
+		size_t sample() {return dist(gen);};
+	private:
+		mt19937 &gen;
+		discrete_distribution<size_t> dist;
+};
+
+string src_word(size_t i) {return "s"+to_string(i);}
+string tgt_word(size_t i) {return "t"+to_string(i);}
+
+void write_vocab(const string &file, const vector<string> &words)
+{
+	ofstream fout(file.c_str());
+	for (size_t i=0;i<words.size();i++)
+	{
+		fout<<words[i]<<' '<<i<<'\n';
+	}
+}
+
+void write_rule(ofstream &fout, const vector<int> &src_ids, const vector<int> &tgt_ids, const vector<double> &probs, short int rule_type)
+{
+	short int src_len = src_ids.size();
+	short int tgt_len = tgt_ids.size();
+	fout.write((char*)&src_len,sizeof(short int));
+	fout.write((char*)&src_ids[0],sizeof(int)*src_len);
+	fout.write((char*)&tgt_len,sizeof(short int));
+	fout.write((char*)&tgt_ids[0],sizeof(int)*tgt_len);
+	fout.write((char*)&probs[0],sizeof(double)*PROB_NUM);
+	fout.write((char*)&rule_type,sizeof(short int));
+}
+
+/**************************************************************************************
+ 1. 函数功能: 生成规则表和词表
+ 2. 入口参数: 生成参数, 随机数生成器
+ 3. 出口参数: 无
+ 4. 算法简介: 源端id为单词编号, 最后一个id为[X][X]; 目标端同理. 每个源端从随机句子中截取长度为
+ 			  1到5的片段, 其中一部分把内部或两端的子片段换成非终结符(两个非终结符不相邻),
+ 			  与ruletable2bin一样, 最后写入glue规则
+************************************************************************************* */
+void gen_rule_table(const GenConfig &conf, mt19937 &gen)
+{
+	ZipfSampler src_sampler(conf.src_vocab_size,gen);
+	ZipfSampler tgt_sampler(conf.tgt_vocab_size,gen);
+	const int src_nt = conf.src_vocab_size;
+	const int tgt_nt = conf.tgt_vocab_size;
+	uniform_real_distribution<double> prob_dist(-3.0,0.0);
+	uniform_int_distribution<int> len_dist(1,5);
+	uniform_int_distribution<int> coin(0,99);
+
+	ofstream fout((conf.dir+"/prob.bin").c_str(),ios::binary);
+	vector<double> probs(PROB_NUM);
+	set<vector<int> > seen;
+	//保证每个源端单词都有短语规则
+	for (size_t w=0;w<conf.src_vocab_size;w++)
+	{
+		vector<int> src_ids = {(int)w};
+		seen.insert(src_ids);
+		for (size_t k=0;k<conf.tgt_per_src;k++)
+		{
+			vector<int> tgt_ids = {(int)tgt_sampler.sample()};
+			for (auto &p : probs) p = prob_dist(gen);
+			write_rule(fout,src_ids,tgt_ids,probs,0);
+		}
+	}
+	while (seen.size() < conf.rule_num)
+	{
+		int len = len_dist(gen);
+		vector<int> src_ids;
+		for (int i=0;i<len;i++)
+		{
+			src_ids.push_back(src_sampler.sample());
+		}
+		int nt_num = 0;
+		int r = coin(gen);
+		if (len >= 2 && r < 30)					//一个非终结符, 替换开头, 结尾或中间的一个单词
+		{
+			src_ids[coin(gen)%len] = src_nt;
+			nt_num = 1;
+		}
+		else if (len >= 3 && r < 50)			//两个不相邻的非终结符
+		{
+			int p1 = coin(gen)%(len-2);
+			int p2 = p1+2+coin(gen)%(len-p1-2);
+			src_ids[p1] = src_nt;
+			src_ids[p2] = src_nt;
+			nt_num = 2;
+		}
+		if (!seen.insert(src_ids).second)
+			continue;
+		for (size_t k=0;k<conf.tgt_per_src;k++)
+		{
+			int tgt_len = max(nt_num,len_dist(gen));
+			vector<int> tgt_ids;
+			for (int i=0;i<tgt_len;i++)
+			{
+				tgt_ids.push_back(tgt_sampler.sample());
+			}
+			short int rule_type = 0;
+			if (nt_num == 1)
+			{
+				tgt_ids[coin(gen)%tgt_len] = tgt_nt;
+				rule_type = 1;
+			}
+			else if (nt_num == 2)
+			{
+				int p1 = coin(gen)%(tgt_len-1);
+				int p2 = p1+1+coin(gen)%(tgt_len-p1-1);
+				tgt_ids[p1] = tgt_nt;
+				tgt_ids[p2] = tgt_nt;
+				rule_type = coin(gen)<80?2:3;
+			}
+			for (auto &p : probs) p = prob_dist(gen);
+			write_rule(fout,src_ids,tgt_ids,probs,rule_type);
+		}
+	}
+	vector<int> glue_src = {src_nt,src_nt};
+	vector<int> glue_tgt = {tgt_nt,tgt_nt};
+	vector<double> glue_probs = {0,0,0,0};
+	write_rule(fout,glue_src,glue_tgt,glue_probs,4);
+	fout.close();
+
+	vector<string> src_words,tgt_words;
+	for (size_t i=0;i<conf.src_vocab_size;i++)
+	{
+		src_words.push_back(src_word(i));
+	}
+	src_words.push_back("[X][X]");
+	for (size_t i=0;i<conf.tgt_vocab_size;i++)
+	{
+		tgt_words.push_back(tgt_word(i));
+	}
+	tgt_words.push_back("[X][X]");
+	write_vocab(conf.dir+"/vocab.ch",src_words);
+	write_vocab(conf.dir+"/vocab.en",tgt_words);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 生成ARPA格式的语言模型
+ 2. 入口参数: 生成参数, 随机数生成器
+ 3. 出口参数: 无
+ 4. 算法简介: 随机生成目标端句子, 统计其中所有不超过lm_order阶的n元组, 这样每个n元组的前缀和
+ 			  后缀都在模型中; 概率取相对频率的对数, 回退权重取随机值
+************************************************************************************* */
+void gen_lm(const GenConfig &conf, mt19937 &gen)
+{
+	ZipfSampler tgt_sampler(conf.tgt_vocab_size,gen);
+	uniform_int_distribution<int> len_dist(5,30);
+	uniform_real_distribution<double> backoff_dist(-0.8,0.0);
+	vector<map<vector<int>,size_t> > ngram_counts(conf.lm_order+1);
+	const int BOS = conf.tgt_vocab_size;
+	const int EOS = conf.tgt_vocab_size+1;
+	for (size_t s=0;s<conf.lm_sen_num;s++)
+	{
+		vector<int> sen = {BOS};
+		int len = len_dist(gen);
+		for (int i=0;i<len;i++)
+		{
+			sen.push_back(tgt_sampler.sample());
+		}
+		sen.push_back(EOS);
+		for (size_t beg=0;beg<sen.size();beg++)
+		{
+			for (size_t n=1;n<=conf.lm_order && beg+n<=sen.size();n++)
+			{
+				ngram_counts[n][vector<int>(sen.begin()+beg,sen.begin()+beg+n)]++;
+			}
+		}
+	}
+	auto word_str = [&](int w) { return w==BOS?string("<s>"):(w==EOS?string("</s>"):tgt_word(w)); };
+	size_t unigram_total = 0;
+	for (auto &kv : ngram_counts[1])
+	{
+		unigram_total += kv.second;
+	}
+	ofstream fout((conf.dir+"/lm.arpa").c_str());
+	fout<<"\n\\data\\\n";
+	for (size_t n=1;n<=conf.lm_order;n++)
+	{
+		fout<<"ngram "<<n<<"="<<ngram_counts[n].size()+(n==1?1:0)<<'\n';
+	}
+	for (size_t n=1;n<=conf.lm_order;n++)
+	{
+		fout<<"\n\\"<<n<<"-grams:\n";
+		if (n == 1)
+		{
+			fout<<"-6\t<unk>\t0\n";
+		}
+		for (auto &kv : ngram_counts[n])
+		{
+			double prob;
+			if (n == 1)
+			{
+				prob = kv.first[0]==BOS ? -99 : log10(double(kv.second)/unigram_total);
+			}
+			else
+			{
+				vector<int> context(kv.first.begin(),kv.first.end()-1);
+				prob = log10(0.9*kv.second/ngram_counts[n-1][context]);
+			}
+			fout<<prob<<'\t';
+			for (size_t i=0;i<kv.first.size();i++)
+			{
+				fout<<(i==0?"":" ")<<word_str(kv.first[i]);
+			}
+			if (n < conf.lm_order)
+			{
+				fout<<'\t'<<(kv.first.back()==EOS?0.0:backoff_dist(gen));
+			}
+			fout<<'\n';
+		}
+	}
+	fout<<"\n\\end\\\n";
+}
+
+void gen_input(const GenConfig &conf, mt19937 &gen)
+{
+	ZipfSampler src_sampler(conf.src_vocab_size,gen);
+	uniform_int_distribution<int> len_dist(max(1,(int)conf.sen_len/2),conf.sen_len*3/2);
+	uniform_int_distribution<int> coin(0,99);
+	ofstream fout((conf.dir+"/input.txt").c_str());
+	for (size_t s=0;s<conf.input_sen_num;s++)
+	{
+		int len = len_dist(gen);
+		for (int i=0;i<len;i++)
+		{
+			fout<<(i==0?"":" ")<<src_word(src_sampler.sample())<<(coin(gen)<20?"#VV":"#NN");
+		}
+		fout<<'\n';
+	}
+	ofstream ffw((conf.dir+"/fw.txt").c_str());
+	for (size_t i=0;i<10 && i<conf.src_vocab_size;i++)
+	{
+		ffw<<src_word(i)<<'\n';
+	}
+}
+
+void write_config(const GenConfig &conf)
+{
+	ofstream fout((conf.dir+"/config.ini").c_str());
+	fout<<"[input-file]\ninput.txt\n[output-file]\noutput.txt\n[nbest-file]\nnbest.txt\n"
+		<<"[src-vocab-file]\nvocab.ch\n[tgt-vocab-file]\nvocab.en\n[rule-table-file]\nprob.bin\n"
+		<<"[lm-file]\nlm.arpa\n[function-words-file]\nfw.txt\n\n"
+		<<"[RULE-NUM-LIMIT]\n20\n[BEAM-SIZE]\n100\n[CUBE-SIZE]\n300\n[SEN-THREAD-NUM]\n4\n[SPAN-THREAD-NUM]\n1\n"
+		<<"[NBEST-NUM]\n100\n[PRINT-NBEST]\n0\n[DUMP-RULE]\n0\n[DROP-OOV]\n0\n[LM-CACHE-SIZE]\n65536\n\n"
+		<<"[weight]\ntrans1 0.77\ntrans2 1.66\ntrans3 1.25\ntrans4 1.04\nlm 3.26\nlen 2.90\nrule-num -0.06\nglue 0.96\nfw 0\nfwverb 0\n";
+}
+
+int main(int argc, char *argv[])
+{
+	GenConfig conf;
+	for (int i=1;i+1<argc;i+=2)
+	{
+		string arg(argv[i]);
+		if (arg == "-dir") conf.dir = argv[i+1];
+		else if (arg == "-src-vocab") conf.src_vocab_size = stoi(argv[i+1]);
+		else if (arg == "-tgt-vocab") conf.tgt_vocab_size = stoi(argv[i+1]);
+		else if (arg == "-rules") conf.rule_num = stoi(argv[i+1]);
+		else if (arg == "-tgt-per-src") conf.tgt_per_src = stoi(argv[i+1]);
+		else if (arg == "-lm-order") conf.lm_order = stoi(argv[i+1]);
+		else if (arg == "-lm-sentences") conf.lm_sen_num = stoi(argv[i+1]);
+		else if (arg == "-input-sentences") conf.input_sen_num = stoi(argv[i+1]);
+		else if (arg == "-sen-len") conf.sen_len = stoi(argv[i+1]);
+		else if (arg == "-seed") conf.seed = stoi(argv[i+1]);
+		else
+		{
+			cout<<"usage: ./gen-synthetic [-dir synthetic] [-src-vocab 5000] [-tgt-vocab 5000] [-rules 200000] [-tgt-per-src 5]\n"
+				<<"       [-lm-order 5] [-lm-sentences 20000] [-input-sentences 200] [-sen-len 25] [-seed 1]\n";
+			return 1;
+		}
+	}
+	mkdir(conf.dir.c_str(),0755);
+	mt19937 gen(conf.seed);
+	gen_rule_table(conf,gen);
+	gen_lm(conf,gen);
+	gen_input(conf,gen);
+	write_config(conf);
+	cout<<"synthetic data written to "<<conf.dir<<endl;
+	return 0;
+}
@@ -0,0 +1,390 @@
+#include "blockruletable.h"
+#include "lm.h"
+#include "util/exception.hh"
+
+BlockRuleTable::BlockRuleTable(const size_t size_limit, const Weight &i_weight, const string &rule_table_file, size_t cache_mb, const LoadOption &load_option)
+{
+	rule_num_limit = size_limit;
+	weight = i_weight;
+	lm_model = NULL;
+	filter = NULL;
+	shard_bytes_limit = max(cache_mb*1024*1024/RULE_BLOCK_SHARD_NUM,(size_t)1);
+	next_ticket = 0;
+	for (size_t i=0;i<RULE_BLOCK_SHARD_NUM;i++)
+	{
+		pthread_mutex_init(&shards[i].mutex,NULL);
+		shards[i].bytes = 0;
+		shards[i].hit_num = 0;
+		shards[i].miss_num = 0;
+	}
+	pthread_mutex_init(&reclaim_mutex,NULL);
+
+	size_t file_size = 0;
+	try
+	{
+		file_size = load_file(rule_table_file,load_option,mem);
+	}
+	catch (util::Exception &e)
+	{
+		cerr<<"cannot open rule table file, bye\n";
+		exit(EXIT_FAILURE);
+	}
+	header = (const RuleBlockHeader*)mem.begin();
+	if (file_size < sizeof(RuleBlockHeader) || memcmp(header->magic,RULE_BLOCK_MAGIC,sizeof(header->magic)) != 0
+		|| header->index_offset > file_size
+		|| file_size-header->index_offset != header->block_num*sizeof(RuleBlockIndexEntry)+header->key_word_num*sizeof(int))
+	{
+		cerr<<rule_table_file<<" is not a block compressed rule table, bye\n";
+		exit(EXIT_FAILURE);
+	}
+	index = (const RuleBlockIndexEntry*)(mem.begin()+header->index_offset);
+	key_words = (const int*)(index+header->block_num);
+	cout<<"load rule table file "<<rule_table_file<<" over, "<<header->rule_num<<" rules in "<<header->block_num<<" blocks\n";
+}
+
+BlockRuleTable::~BlockRuleTable()
+{
+	for (size_t i=0;i<RULE_BLOCK_SHARD_NUM;i++)
+	{
+		for (auto block : shards[i].lru)
+		{
+			delete block;
+		}
+		pthread_mutex_destroy(&shards[i].mutex);
+	}
+	for (auto &stamp_block : retired_blocks)
+	{
+		delete stamp_block.second;
+	}
+	pthread_mutex_destroy(&reclaim_mutex);
+	delete filter;
+}
+
+//按文件头判断规则表是否为按块压缩的格式, prob.bin的开头是源端长度, 不会与之相同
+bool BlockRuleTable::is_block_file(const string &rule_table_file)
+{
+	ifstream fin(rule_table_file.c_str(),ios::binary);
+	char magic[sizeof(RULE_BLOCK_MAGIC)];
+	if (!fin.read(magic,sizeof(magic)))
+		return false;
+	return memcmp(magic,RULE_BLOCK_MAGIC,sizeof(magic)) == 0;
+}
+
+void BlockRuleTable::load_filter(const string &filter_file,const LoadOption &load_option)
+{
+	filter = new PatternFilter;
+	if (!filter->load(filter_file,header->rule_source_hash,load_option))
+	{
+		delete filter;
+		filter = NULL;
+	}
+}
+
+//句子开始查找规则前取一个编号, 结束时归还; 编号比淘汰时的next_ticket小的句子都结束后, 淘汰的块才释放
+size_t BlockRuleTable::begin_sentence(const vector<int> &)
+{
+	pthread_mutex_lock(&reclaim_mutex);
+	size_t ticket = next_ticket++;
+	active_tickets.insert(ticket);
+	pthread_mutex_unlock(&reclaim_mutex);
+	return ticket;
+}
+
+void BlockRuleTable::end_sentence(size_t ticket)
+{
+	vector<RuleBlock*> free_blocks;
+	pthread_mutex_lock(&reclaim_mutex);
+	active_tickets.erase(ticket);
+	size_t min_ticket = active_tickets.empty() ? next_ticket : *active_tickets.begin();
+	size_t kept_num = 0;
+	for (auto &stamp_block : retired_blocks)
+	{
+		if (stamp_block.first <= min_ticket)
+		{
+			free_blocks.push_back(stamp_block.second);
+		}
+		else
+		{
+			retired_blocks[kept_num++] = stamp_block;
+		}
+	}
+	retired_blocks.resize(kept_num);
+	pthread_mutex_unlock(&reclaim_mutex);
+	for (auto block : free_blocks)
+	{
+		delete block;
+	}
+}
+
+void BlockRuleTable::retire_blocks(const vector<RuleBlock*> &blocks)
+{
+	pthread_mutex_lock(&reclaim_mutex);
+	for (auto block : blocks)
+	{
+		retired_blocks.push_back(make_pair(next_ticket,block));
+	}
+	pthread_mutex_unlock(&reclaim_mutex);
+}
+
+vector<vector<TgtRule>* > BlockRuleTable::find_matched_rules_for_prefixes(const vector<int> &src_wids,const size_t pos,size_t)
+{
+	vector<vector<TgtRule>* > matched_rules_for_prefixes;
+	uint64_t h = PatternFilter::start_hash();
+	for (size_t i=pos;i<src_wids.size() && i-pos<RULE_LEN_MAX;i++)
+	{
+		if (filter != NULL)
+		{
+			h = PatternFilter::extend_hash(h,src_wids[i]);
+			if (!filter->may_contain(h))							//没有以当前前缀开头的规则
+			{
+				matched_rules_for_prefixes.push_back(NULL);
+				return matched_rules_for_prefixes;
+			}
+		}
+		bool prefix_exists;
+		vector<TgtRule> *matched_rules = match_pattern(&src_wids[pos],i-pos+1,prefix_exists);
+		matched_rules_for_prefixes.push_back(matched_rules);
+		if (!prefix_exists)
+			return matched_rules_for_prefixes;
+	}
+	return matched_rules_for_prefixes;
+}
+
+vector<TgtRule>* BlockRuleTable::find_matched_rules(const vector<int> &src_ids,size_t)
+{
+	if (src_ids.size() > RULE_LEN_MAX || src_ids.empty())
+		return NULL;
+	if (filter != NULL)
+	{
+		uint64_t h = PatternFilter::start_hash();
+		for (auto wid : src_ids)
+		{
+			h = PatternFilter::extend_hash(h,wid);
+		}
+		if (!filter->may_contain(h))
+			return NULL;
+	}
+	bool prefix_exists;
+	return match_pattern(src_ids.data(),src_ids.size(),prefix_exists);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 查找源端与给定pattern完全相同的规则, 并判断是否有以pattern为前缀的规则源端
+ 2. 入口参数: pattern的单词id序列及长度
+ 3. 出口参数: 匹配的规则目标端, 没有时为NULL; 是否有以pattern为前缀的规则源端
+ 4. 算法简介: 在块索引中二分找到第一个源端不大于pattern的最后一个块, 再在块内二分找第一个不小于pattern的源端;
+ 			  块内没有时该源端是下一个块的第一个源端, 直接比较块索引中的key, 不必解压下一个块
+************************************************************************************* */
+vector<TgtRule>* BlockRuleTable::match_pattern(const int *words, size_t len, bool &prefix_exists)
+{
+	size_t lo = 0, hi = header->block_num;
+	while (lo < hi)
+	{
+		size_t mid = (lo+hi)/2;
+		const int *key = key_words+index[mid].key_beg;
+		if (lexicographical_compare(words,words+len,key,key+index[mid].key_len))
+		{
+			hi = mid;
+		}
+		else
+		{
+			lo = mid+1;
+		}
+	}
+	if (lo == 0)
+	{
+		prefix_exists = header->block_num > 0 && key_has_prefix(0,words,len);
+		return NULL;
+	}
+	RuleBlock *block = get_block(lo-1);
+	const int *src_words = block->src_words.data();
+	auto it = lower_bound(block->patterns.begin(),block->patterns.end(),len,[&](const BlockPattern &pattern, size_t)
+			{
+				return lexicographical_compare(src_words+pattern.src_beg,src_words+pattern.src_beg+pattern.src_len,words,words+len);
+			});
+	if (it == block->patterns.end())
+	{
+		prefix_exists = lo < header->block_num && key_has_prefix(lo,words,len);
+		return NULL;
+	}
+	prefix_exists = it->src_len >= len && equal(words,words+len,src_words+it->src_beg);
+	if (!prefix_exists || it->src_len != len || it->tgt_rules.empty())
+		return NULL;
+	return &(it->tgt_rules);
+}
+
+bool BlockRuleTable::key_has_prefix(size_t block_id, const int *words, size_t len)
+{
+	const RuleBlockIndexEntry &entry = index[block_id];
+	return entry.key_len >= len && equal(words,words+len,key_words+entry.key_beg);
+}
+
+//从LRU缓存中取块, 没有时在锁外解压, 加入后淘汰最久未使用的块
+BlockRuleTable::RuleBlock* BlockRuleTable::get_block(size_t block_id)
+{
+	CacheShard &shard = shards[block_id%RULE_BLOCK_SHARD_NUM];
+	pthread_mutex_lock(&shard.mutex);
+	auto it = shard.block2pos.find(block_id);
+	if (it != shard.block2pos.end())
+	{
+		shard.lru.splice(shard.lru.begin(),shard.lru,it->second);
+		shard.hit_num++;
+		RuleBlock *block = *(it->second);
+		pthread_mutex_unlock(&shard.mutex);
+		return block;
+	}
+	shard.miss_num++;
+	pthread_mutex_unlock(&shard.mutex);
+
+	RuleBlock *block = load_block(block_id);
+	vector<RuleBlock*> evicted_blocks;
+	pthread_mutex_lock(&shard.mutex);
+	it = shard.block2pos.find(block_id);
+	if (it != shard.block2pos.end())										//其他线程已经解压了同一个块
+	{
+		evicted_blocks.push_back(block);
+		block = *(it->second);
+	}
+	else
+	{
+		shard.lru.push_front(block);
+		shard.block2pos[block_id] = shard.lru.begin();
+		shard.bytes += block->bytes;
+		while (shard.bytes > shard_bytes_limit && shard.lru.size() > 1)
+		{
+			RuleBlock *evicted_block = shard.lru.back();
+			shard.lru.pop_back();
+			shard.block2pos.erase(evicted_block->block_id);
+			shard.bytes -= evicted_block->bytes;
+			evicted_blocks.push_back(evicted_block);
+		}
+	}
+	pthread_mutex_unlock(&shard.mutex);
+	if (!evicted_blocks.empty())
+	{
+		retire_blocks(evicted_blocks);
+	}
+	return block;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 解压一个块, 生成其中所有规则的目标端
+ 2. 入口参数: 块的编号
+ 3. 出口参数: 解压后的块
+ 4. 算法简介: 源端相同的规则在块中是连续的, 按RuleTable加载时的方式限制每个源端的目标端个数;
+ 			  规则的目标端放在块自己的目标端池中, 随块一起释放
+************************************************************************************* */
+BlockRuleTable::RuleBlock* BlockRuleTable::load_block(size_t block_id)
+{
+	const RuleBlockIndexEntry &entry = index[block_id];
+	string raw(entry.raw_size,'\0');
+	uLongf raw_size = entry.raw_size;
+	if (uncompress((Bytef*)&raw[0],&raw_size,(const Bytef*)mem.begin()+entry.offset,entry.compressed_size) != Z_OK
+		|| raw_size != entry.raw_size)
+	{
+		cerr<<"rule block "<<block_id<<" is corrupted, bye\n";
+		exit(EXIT_FAILURE);
+	}
+	RuleBlock *block = new RuleBlock;
+	block->block_id = block_id;
+	const char *cur = raw.data();
+	const char *end = raw.data()+raw.size();
+	vector<int> src_wids;
+	vector<int> tgt_wids;
+	while (cur < end)
+	{
+		src_wids.resize(read_varint(cur));
+		for (auto &wid : src_wids)
+		{
+			wid = read_varint(cur);
+		}
+		if (block->patterns.empty() || block->patterns.back().src_len != src_wids.size()
+			|| !equal(src_wids.begin(),src_wids.end(),block->src_words.begin()+block->patterns.back().src_beg))
+		{
+			BlockPattern pattern;
+			pattern.src_beg = block->src_words.size();
+			pattern.src_len = src_wids.size();
+			block->patterns.push_back(pattern);
+			block->src_words.insert(block->src_words.end(),src_wids.begin(),src_wids.end());
+		}
+
+		TgtRule tgt_rule;
+		tgt_wids.resize(read_varint(cur));
+		if (tgt_wids.size() > RULE_LEN_MAX)
+		{
+			cout<<"error, rule length exceed, bye\n";
+			exit(EXIT_FAILURE);
+		}
+		for (auto &wid : tgt_wids)
+		{
+			wid = read_varint(cur);
+		}
+		tgt_rule.tgt = block->tgt_pool.intern(tgt_wids.data(),tgt_wids.size());
+		tgt_rule.probs.resize(PROB_NUM);
+		memcpy(&(tgt_rule.probs[0]),cur,sizeof(double)*PROB_NUM);
+		cur += sizeof(double)*PROB_NUM;
+		tgt_rule.score = 0;
+		for( size_t i=0; i<weight.trans.size() && i<PROB_NUM; i++ )
+		{
+			tgt_rule.score += tgt_rule.probs[i]*weight.trans[i];
+		}
+		tgt_rule.rule_type = (uint8_t)*cur++;
+		add_rule_with_limit(block->patterns.back().tgt_rules,tgt_rule,rule_num_limit);
+	}
+	if (lm_model != NULL)
+	{
+		block->tgt_pool.fill_kenlm_ids(lm_model);
+	}
+	block->bytes = sizeof(RuleBlock) + block->src_words.capacity()*sizeof(int) + block->patterns.capacity()*sizeof(BlockPattern)
+				 + block->tgt_pool.memory_bytes();
+	for (auto &pattern : block->patterns)
+	{
+		block->bytes += pattern.tgt_rules.capacity()*sizeof(TgtRule);
+		for (auto &tgt_rule : pattern.tgt_rules)
+		{
+			block->bytes += tgt_rule.probs.capacity()*sizeof(double);
+		}
+	}
+	return block;
+}
+
+//已经解压的块在此一并填写语言模型id, 之后解压的块在加入缓存前填写
+void BlockRuleTable::fill_kenlm_ids(LanguageModel *i_lm_model)
+{
+	lm_model = i_lm_model;
+	for (size_t i=0;i<RULE_BLOCK_SHARD_NUM;i++)
+	{
+		pthread_mutex_lock(&shards[i].mutex);
+		for (auto block : shards[i].lru)
+		{
+			block->tgt_pool.fill_kenlm_ids(lm_model);
+		}
+		pthread_mutex_unlock(&shards[i].mutex);
+	}
+}
+
+//块索引和当前缓存的块占用的内存, 不包括按需mmap的压缩数据
+size_t BlockRuleTable::memory_bytes()
+{
+	size_t bytes = header->block_num*sizeof(RuleBlockIndexEntry) + header->key_word_num*sizeof(int);
+	for (size_t i=0;i<RULE_BLOCK_SHARD_NUM;i++)
+	{
+		pthread_mutex_lock(&shards[i].mutex);
+		bytes += shards[i].bytes;
+		pthread_mutex_unlock(&shards[i].mutex);
+	}
+	return bytes + (filter==NULL?0:filter->memory_bytes());
+}
+
+void BlockRuleTable::get_cache_stats(size_t &hit_num, size_t &miss_num)
+{
+	hit_num = 0;
+	miss_num = 0;
+	for (size_t i=0;i<RULE_BLOCK_SHARD_NUM;i++)
+	{
+		pthread_mutex_lock(&shards[i].mutex);
+		hit_num += shards[i].hit_num;
+		miss_num += shards[i].miss_num;
+		pthread_mutex_unlock(&shards[i].mutex);
+	}
+}
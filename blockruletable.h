@@ -0,0 +1,108 @@
+#ifndef BLOCKRULETABLE_H
+#define BLOCKRULETABLE_H
+
+#include "stdafx.h"
+#include "ruletable.h"
+#include "fileloader.h"
+#include "patternfilter.h"
+#include "lmtrace.h"
+#include <list>
+
+const char RULE_BLOCK_MAGIC[8] = {'H','I','E','R','O','R','B','2'};
+const size_t RULE_BLOCK_SIZE = 64*1024;			//每个块压缩前的目标大小, 源端相同的规则不跨块, 因此块可能略大
+const size_t RULE_BLOCK_SHARD_NUM = 16;
+
+//按块压缩的规则表(ruletable2bin -blocks生成)的文件头, 之后依次为:
+//各个块的zlib压缩数据, 块索引(RuleBlockIndexEntry, block_num个), 各个块第一个规则源端的单词id(int32, key_word_num个)
+//规则按源端排序后依次放入各个块, 源端相同时保持原规则表中的顺序; 每条规则压缩前为源端长度, 源端单词id,
+//目标端长度, 目标端单词id(均为write_varint编码), PROB_NUM个double类型的概率, 1个字节的规则类型
+struct RuleBlockHeader
+{
+	char magic[8];
+	uint64_t block_num;
+	uint64_t rule_num;
+	uint64_t index_offset;						//块索引在文件中的位置
+	uint64_t key_word_num;
+	uint64_t rule_source_hash;					//所有规则源端的内容哈希, 见PatternFilter::add_rule_source, 加载时不必解压所有块
+};
+
+struct RuleBlockIndexEntry
+{
+	uint64_t offset;							//压缩数据在文件中的位置
+	uint32_t compressed_size;
+	uint32_t raw_size;
+	uint32_t key_beg;							//块中第一个规则源端在key单词中的起始位置
+	uint32_t key_len;
+};
+
+//按块压缩的规则表, 文件按需mmap, 解码时只解压用到的块, 解压后的块放在按字节数限制大小的LRU缓存中
+//规则源端的查找先在块索引中二分找到所在的块, 再在块内二分; 块被淘汰后延迟到之前开始的句子都结束时才释放,
+//每次解压的块有新的目标端池, 语言模型得分缓存靠池的serial区分先后占用同一地址的目标端
+class BlockRuleTable : public RuleSource
+{
+	public:
+		BlockRuleTable(const size_t size_limit, const Weight &i_weight, const string &rule_table_file, size_t cache_mb, const LoadOption &load_option);
+		~BlockRuleTable();
+		static bool is_block_file(const string &rule_table_file);
+		void load_filter(const string &filter_file,const LoadOption &load_option);
+		size_t begin_sentence(const vector<int> &);
+		void end_sentence(size_t ticket);
+		vector<vector<TgtRule>* > find_matched_rules_for_prefixes(const vector<int> &src_wids,const size_t pos,size_t ticket=NO_SENTENCE_TICKET);
+		vector<TgtRule>* find_matched_rules(const vector<int> &src_ids,size_t ticket=NO_SENTENCE_TICKET);
+		void fill_kenlm_ids(LanguageModel *i_lm_model);
+		size_t memory_bytes();
+		void get_cache_stats(size_t &hit_num, size_t &miss_num);
+
+	private:
+		//块中源端相同的所有规则
+		struct BlockPattern
+		{
+			uint32_t src_beg;						//源端在RuleBlock::src_words中的起始位置
+			uint32_t src_len;
+			vector<TgtRule> tgt_rules;
+		};
+		//解压后的块, patterns按源端排序
+		struct RuleBlock
+		{
+			size_t block_id;
+			size_t bytes;
+			vector<int> src_words;
+			vector<BlockPattern> patterns;
+			TgtPool tgt_pool;						//块中规则的目标端
+		};
+		struct CacheShard
+		{
+			pthread_mutex_t mutex;
+			list<RuleBlock*> lru;					//最近使用的块在前面
+			unordered_map<size_t,list<RuleBlock*>::iterator> block2pos;
+			size_t bytes;
+			size_t hit_num;
+			size_t miss_num;
+		};
+
+		vector<TgtRule>* match_pattern(const int *words, size_t len, bool &prefix_exists);
+		bool key_has_prefix(size_t block_id, const int *words, size_t len);
+		RuleBlock* get_block(size_t block_id);
+		RuleBlock* load_block(size_t block_id);
+		void retire_blocks(const vector<RuleBlock*> &blocks);
+
+	private:
+		util::scoped_memory mem;
+		const RuleBlockHeader *header;
+		const RuleBlockIndexEntry *index;
+		const int *key_words;
+
+		size_t rule_num_limit;
+		Weight weight;
+		LanguageModel *lm_model;
+		PatternFilter *filter;						//规则源端及其前缀的过滤器, 为NULL时直接查块
+		size_t shard_bytes_limit;					//每个分片缓存的解压后的块最多占用的字节数
+		CacheShard shards[RULE_BLOCK_SHARD_NUM];
+
+		pthread_mutex_t reclaim_mutex;				//保护以下三项
+		size_t next_ticket;
+		set<size_t> active_tickets;					//正在解码的句子的编号
+		vector<pair<size_t,RuleBlock*> > retired_blocks;	//已淘汰的块和淘汰时的next_ticket, 编号更小的句子结束后才释放
+};
+
+#endif
@@ -27,6 +27,7 @@ void CandBeam::add(Cand *&cand_ptr,int beam_size)
 	{
 		if (is_bound_same(cand_ptr,e_cand_ptr))
 		{
+			recombined_num++;
 			if (cand_ptr->score > e_cand_ptr->score)
 			{
 				swap(e_cand_ptr,cand_ptr);
@@ -7,7 +7,7 @@
 //生成候选所使用的规则信息
 struct Rule
 {
-	vector<int> src_ids;      //规则源端符号（包括终结符和非终结符）id序列
+	int pattern_id;           //规则源端在句子的RuleChart中的编号, 源端符号序列由RuleChart保存
 	pair<int,int> span_x1;    //用来表示规则目标端第一个非终结符在源端的起始位置和跨度长度
 	pair<int,int> span_x2;    //同上
 	TgtRule *tgt_rule;        //规则目标端
@@ -16,6 +16,7 @@ struct Rule
 	int fwverb_terminal_flag; //该规则的终结符是否只包含虚词和动词
 	Rule ()
 	{
+		pattern_id = -1;
 		span_x1 = make_pair(-1,-1);
 		span_x2 = make_pair(-1,-1);
 		tgt_rule = NULL;
@@ -52,6 +53,7 @@ struct Cand
 
 	//语言模型状态信息
 	lm::ngram::ChartState lm_state;
+	uint64_t lm_record;			//记录语言模型查询轨迹时, 生成lm_state的打分编号加1, 为0表示没有记录
 
 	Cand ()
 	{
@@ -72,6 +74,7 @@ struct Cand
 
 		child_x1 = NULL;
 		child_x2 = NULL;
+		lm_record = 0;
 	}
 };
 
@@ -90,17 +93,20 @@ bool smaller( const Cand *pl, const Cand *pr );
 class CandBeam
 {
 	public:
+		CandBeam() {recombined_num = 0;};
 		void add(Cand *&cand_ptr,int beam_size);
 		Cand* top() { return data.front(); }
 		Cand* at(size_t i) { return data.at(i);}
 		int size() { return data.size();  }
 		void sort() { std::sort(data.begin(),data.end(),larger); }
 		void free();
+		size_t get_recombined_num() { return recombined_num; }
 	private:
 		bool is_bound_same(const Cand *a, const Cand *b);
 
 	private:
 		vector<Cand*> data;
+		size_t recombined_num;		//因边界词相同而被合并的候选数
 };
 
 typedef priority_queue<Cand*, vector<Cand*>, cmp> Candpq;
@@ -0,0 +1,236 @@
+#include "config.h"
+#include "myutils.h"
+#include "fileloader.h"
+
+void read_config(Filenames &fns,Parameter &para, Weight &weight, const string &config_file)
+{
+	ifstream fin;
+	fin.open(config_file.c_str());
+	if (!fin.is_open())
+	{
+		cerr<<"fail to open config file\n";
+		return;
+	}
+	string line;
+	while(getline(fin,line))
+	{
+		TrimLine(line);
+		if (line == "[input-file]")
+		{
+			getline(fin,line);
+			fns.input_file = line;
+		}
+		else if (line == "[output-file]")
+		{
+			getline(fin,line);
+			fns.output_file = line;
+		}
+		else if (line == "[nbest-file]")
+		{
+			getline(fin,line);
+			fns.nbest_file = line;
+		}
+		else if (line == "[src-vocab-file]")
+		{
+			getline(fin,line);
+			fns.src_vocab_file = line;
+		}
+		else if (line == "[tgt-vocab-file]")
+		{
+			getline(fin,line);
+			fns.tgt_vocab_file = line;
+		}
+		else if (line == "[rule-table-file]")
+		{
+			getline(fin,line);
+			fns.rule_table_file = line;
+		}
+		else if (line == "[rule-filter-file]")
+		{
+			getline(fin,line);
+			fns.rule_filter_file = line;
+		}
+		else if (line == "[sa-corpus-file]")
+		{
+			getline(fin,line);
+			fns.sa_corpus_file = line;
+		}
+		else if (line == "[rule-servers]")
+		{
+			getline(fin,line);
+			fns.rule_servers = line;
+		}
+		else if (line == "[lm-file]")
+		{
+			getline(fin,line);
+			fns.lm_file = line;
+		}
+		else if (line == "[function-words-file]")
+		{
+			getline(fin,line);
+			fns.fw_file = line;
+		}
+		else if (line == "[trans-cache-file]")
+		{
+			getline(fin,line);
+			fns.trans_cache_file = line;
+		}
+		else if (line == "[profile-file]")
+		{
+			getline(fin,line);
+			fns.profile_file = line;
+			para.PROFILE = (line != "");
+		}
+		else if (line == "[trace-file]")
+		{
+			getline(fin,line);
+			fns.trace_file = line;
+		}
+		else if (line == "[lm-trace-file]")
+		{
+			getline(fin,line);
+			fns.lm_trace_file = line;
+		}
+		else if (line == "[BEAM-SIZE]")
+		{
+			getline(fin,line);
+			para.BEAM_SIZE = stoi(line);
+		}
+		else if (line == "[CUBE-SIZE]")
+		{
+			getline(fin,line);
+			para.CUBE_SIZE = stoi(line);
+		}
+		else if (line == "[SEN-THREAD-NUM]")
+		{
+			getline(fin,line);
+			para.SEN_THREAD_NUM = stoi(line);
+		}
+		else if (line == "[SPAN-THREAD-NUM]")
+		{
+			getline(fin,line);
+			para.SPAN_THREAD_NUM = stoi(line);
+		}
+		else if (line == "[NBEST-NUM]")
+		{
+			getline(fin,line);
+			para.NBEST_NUM = stoi(line);
+		}
+		else if (line == "[RULE-NUM-LIMIT]")
+		{
+			getline(fin,line);
+			para.RULE_NUM_LIMIT = stoi(line);
+		}
+		else if (line == "[PRINT-NBEST]")
+		{
+			getline(fin,line);
+			para.PRINT_NBEST = stoi(line);
+		}
+		else if (line == "[DUMP-RULE]")
+		{
+			getline(fin,line);
+			para.DUMP_RULE = stoi(line);
+		}
+		else if (line == "[DROP-OOV]")
+		{
+			getline(fin,line);
+			para.DROP_OOV = stoi(line);
+		}
+		else if (line == "[LM-CACHE-SIZE]")
+		{
+			getline(fin,line);
+			para.LM_CACHE_SIZE = stoi(line);
+		}
+		else if (line == "[LOAD-METHOD]")
+		{
+			getline(fin,line);
+			TrimLine(line);
+			if (!parse_load_method(line,para.LOAD_METHOD))
+			{
+				cerr<<"unknown load method "<<line<<", use lazy\n";
+			}
+		}
+		else if (line == "[HUGE-PAGES]")
+		{
+			getline(fin,line);
+			para.HUGE_PAGES = stoi(line);
+		}
+		else if (line == "[PREFAULT]")
+		{
+			getline(fin,line);
+			para.PREFAULT = stoi(line);
+		}
+		else if (line == "[WARM-UP]")
+		{
+			getline(fin,line);
+			para.WARM_UP = stoi(line);
+		}
+		else if (line == "[SEN-MEMORY-LIMIT]")
+		{
+			getline(fin,line);
+			para.SEN_MEMORY_LIMIT = stoi(line);
+		}
+		else if (line == "[PIPELINE-THREAD-NUM]")
+		{
+			getline(fin,line);
+			istringstream buff(line);
+			buff>>para.MATCH_THREAD_NUM>>para.SEARCH_THREAD_NUM>>para.OUTPUT_THREAD_NUM;
+		}
+		else if (line == "[SA-SAMPLE-SIZE]")
+		{
+			getline(fin,line);
+			para.SA_SAMPLE_SIZE = stoi(line);
+		}
+		else if (line == "[RULE-BLOCK-CACHE-SIZE]")
+		{
+			getline(fin,line);
+			para.RULE_BLOCK_CACHE_SIZE = stoi(line);
+		}
+		else if (line == "[RULE-SERVER-CACHE-SIZE]")
+		{
+			getline(fin,line);
+			para.RULE_SERVER_CACHE_SIZE = stoi(line);
+		}
+		else if (line == "[weight]")
+		{
+			while(getline(fin,line))
+			{
+				if (line == "")
+					break;
+				stringstream ss(line);
+				string feature;
+				ss >> feature;
+				if (feature.find("trans") != string::npos)
+				{
+					double w;
+					ss>>w;
+					weight.trans.push_back(w);
+				}
+				else if(feature == "len")
+				{
+					ss>>weight.len;
+				}
+				else if(feature == "lm")
+				{
+					ss>>weight.lm;
+				}
+				else if(feature == "rule-num")
+				{
+					ss>>weight.rule_num;
+				}
+				else if(feature == "glue")
+				{
+					ss>>weight.glue;
+				}
+				else if(feature == "fw")
+				{
+					ss>>weight.fw;
+				}
+				else if(feature == "fwverb")
+				{
+					ss>>weight.fwverb;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,10 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "stdafx.h"
+
+//读取解码器的配置文件, 每个配置项为"[名称]"一行, 值在下一行; 文件中没有的项保持原值
+//解码器, 模型热替换和ruletable_query共用
+void read_config(Filenames &fns,Parameter &para, Weight &weight, const string &config_file);
+
+#endif
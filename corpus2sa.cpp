@@ -0,0 +1,205 @@
+#include "myutils.h"
+#include "vocab.h"
+#include "sagrammar.h"
+
+//把句子中的单词转换为id, 新词加到词表末尾
+void words_to_ids(vector<string> &words, unordered_map<string,int> &vocab, vector<string> &vocab_vec, vector<int> &ids)
+{
+	ids.clear();
+	for (const auto &word : words)
+	{
+		auto it = vocab.find(word);
+		if (it == vocab.end())
+		{
+			it = vocab.insert(make_pair(word,(int)vocab_vec.size())).first;
+			vocab_vec.push_back(word);
+		}
+		ids.push_back(it->second);
+	}
+}
+
+void write_vocab(const string &vocab_file, const vector<string> &vocab_vec)
+{
+	ofstream fout(vocab_file.c_str());
+	if (!fout.is_open())
+	{
+		cout<<"fail open "<<vocab_file<<" to write!\n";
+		return;
+	}
+	for (size_t i=0;i<vocab_vec.size();i++)
+	{
+		fout<<vocab_vec.at(i)+" "+to_string(i)+"\n";
+	}
+	fout.close();
+	Vocab::write_binary(vocab_file+".bin",vocab_vec,vector<lm::WordIndex>(),0,0);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 由词对齐统计词汇翻译概率t(e|f)和t(f|e)
+ 2. 入口参数: 每个词对的共现次数, 未对齐的单词与空词共现
+ 3. 出口参数: 按(f,e)排序的词汇翻译表
+ 4. 算法简介: t(e|f) = c(f,e)/c(f), t(f|e) = c(f,e)/c(e), 与Koehn(2003)相同
+************************************************************************************* */
+void cal_lex_table(const map<pair<int,int>,double> &pair2count, vector<SALexEntry> &lex_entries)
+{
+	unordered_map<int,double> f2count, e2count;
+	for (const auto &kv : pair2count)
+	{
+		f2count[kv.first.first] += kv.second;
+		e2count[kv.first.second] += kv.second;
+	}
+	for (const auto &kv : pair2count)
+	{
+		SALexEntry entry;
+		entry.f = kv.first.first;
+		entry.e = kv.first.second;
+		entry.e_given_f = kv.second/f2count[entry.f];
+		entry.f_given_e = kv.second/e2count[entry.e];
+		lex_entries.push_back(entry);
+	}
+}
+
+/**************************************************************************************
+ 1. 函数功能: 为词对齐的平行语料建立后缀数组索引
+ 2. 入口参数: 源端语料, 目标端语料, 词对齐文件(每行为若干"源端位置-目标端位置"), 索引文件
+ 3. 出口参数: 无
+ 4. 算法简介: 源端语料的每个非分隔符位置按之后的至多RULE_LEN_MAX个单词排序, 相同时按位置排序;
+ 			  同时生成解码器使用的中英文词表, 词表中包含非终结符[X][X]
+************************************************************************************* */
+void corpus2sa(const string &src_filename, const string &tgt_filename, const string &align_filename, const string &index_filename)
+{
+	ifstream fsrc(src_filename.c_str()), ftgt(tgt_filename.c_str()), falign(align_filename.c_str());
+	if (!fsrc.is_open() || !ftgt.is_open() || !falign.is_open())
+	{
+		cout<<"fail to open corpus files\n";
+		return;
+	}
+	unordered_map<string,int> ch_vocab, en_vocab;
+	vector<string> ch_vocab_vec, en_vocab_vec;
+	vector<int> src_tokens, tgt_tokens;
+	vector<uint32_t> src_sen_starts, tgt_sen_starts, align_starts;
+	vector<uint16_t> links;
+	map<pair<int,int>,double> pair2count;
+	size_t skipped_num = 0;
+	string src_line, tgt_line, align_line;
+	while (getline(fsrc,src_line) && getline(ftgt,tgt_line) && getline(falign,align_line))
+	{
+		vector<string> src_words, tgt_words, align_strs;
+		Split(src_words,src_line);
+		Split(tgt_words,tgt_line);
+		Split(align_strs,align_line);
+		if (src_words.empty() || tgt_words.empty() || src_words.size() > UINT16_MAX || tgt_words.size() > UINT16_MAX)
+		{
+			skipped_num++;
+			continue;
+		}
+		vector<int> src_ids, tgt_ids;
+		words_to_ids(src_words,ch_vocab,ch_vocab_vec,src_ids);
+		words_to_ids(tgt_words,en_vocab,en_vocab_vec,tgt_ids);
+		vector<bool> src_aligned(src_ids.size(),false), tgt_aligned(tgt_ids.size(),false);
+		align_starts.push_back(links.size()/2);
+		string sep = "-";
+		for (auto &align_str : align_strs)
+		{
+			vector<string> pos_pair;
+			Split(pos_pair,align_str,sep);
+			if (pos_pair.size() != 2)
+				continue;
+			size_t i = stoi(pos_pair[0]), j = stoi(pos_pair[1]);
+			if (i >= src_ids.size() || j >= tgt_ids.size())
+				continue;
+			links.push_back(i);
+			links.push_back(j);
+			src_aligned[i] = true;
+			tgt_aligned[j] = true;
+			pair2count[make_pair(src_ids[i],tgt_ids[j])] += 1;
+		}
+		for (size_t i=0;i<src_ids.size();i++)
+		{
+			if (!src_aligned[i])
+			{
+				pair2count[make_pair(src_ids[i],SA_NULL_WORD)] += 1;
+			}
+		}
+		for (size_t j=0;j<tgt_ids.size();j++)
+		{
+			if (!tgt_aligned[j])
+			{
+				pair2count[make_pair(SA_NULL_WORD,tgt_ids[j])] += 1;
+			}
+		}
+		src_sen_starts.push_back(src_tokens.size());
+		src_tokens.insert(src_tokens.end(),src_ids.begin(),src_ids.end());
+		src_tokens.push_back(SA_SEPARATOR);
+		tgt_sen_starts.push_back(tgt_tokens.size());
+		tgt_tokens.insert(tgt_tokens.end(),tgt_ids.begin(),tgt_ids.end());
+	}
+	src_sen_starts.push_back(src_tokens.size());
+	tgt_sen_starts.push_back(tgt_tokens.size());
+	align_starts.push_back(links.size()/2);
+	size_t sen_num = src_sen_starts.size()-1;
+
+	vector<uint32_t> sa;
+	for (size_t pos=0;pos<src_tokens.size();pos++)
+	{
+		if (src_tokens[pos] != SA_SEPARATOR)
+		{
+			sa.push_back(pos);
+		}
+	}
+	const int *tokens = src_tokens.data();
+	sort(sa.begin(),sa.end(),[tokens](uint32_t a, uint32_t b)
+			{
+				int cmp = compare_sa_suffix(tokens+a,tokens+b,RULE_LEN_MAX);
+				return cmp<0 || (cmp==0 && a<b);
+			});
+	vector<SALexEntry> lex_entries;
+	cal_lex_table(pair2count,lex_entries);
+
+	SAIndexHeader header;
+	memset(&header,0,sizeof(header));
+	memcpy(header.magic,SA_INDEX_MAGIC,sizeof(header.magic));
+	header.src_token_num = src_tokens.size();
+	header.sa_size = sa.size();
+	header.sen_num = sen_num;
+	header.tgt_token_num = tgt_tokens.size();
+	header.align_num = links.size()/2;
+	header.lex_num = lex_entries.size();
+	ofstream fout(index_filename.c_str(),ios::binary);
+	if (!fout.is_open())
+	{
+		cout<<"fail open index file to write!\n";
+		return;
+	}
+	fout.write((char*)&header,sizeof(header));
+	fout.write((char*)src_tokens.data(),sizeof(int)*src_tokens.size());
+	fout.write((char*)sa.data(),sizeof(uint32_t)*sa.size());
+	fout.write((char*)src_sen_starts.data(),sizeof(uint32_t)*src_sen_starts.size());
+	fout.write((char*)tgt_tokens.data(),sizeof(int)*tgt_tokens.size());
+	fout.write((char*)tgt_sen_starts.data(),sizeof(uint32_t)*tgt_sen_starts.size());
+	fout.write((char*)align_starts.data(),sizeof(uint32_t)*align_starts.size());
+	fout.write((char*)links.data(),sizeof(uint16_t)*links.size());
+	fout.write((char*)lex_entries.data(),sizeof(SALexEntry)*lex_entries.size());
+	fout.close();
+
+	vector<string> nt_words = {"[X][X]"};
+	vector<int> nt_ids;
+	words_to_ids(nt_words,ch_vocab,ch_vocab_vec,nt_ids);
+	words_to_ids(nt_words,en_vocab,en_vocab_vec,nt_ids);
+	write_vocab("vocab.ch",ch_vocab_vec);
+	write_vocab("vocab.en",en_vocab_vec);
+	cout<<"suffix array index: "<<sen_num<<" sentence pairs ("<<skipped_num<<" skipped), "<<sa.size()<<" source words, "
+		<<header.align_num<<" alignment links, "<<lex_entries.size()<<" lexical entries\n";
+}
+
+int main(int argc,char* argv[])
+{
+	if (argc < 4)
+	{
+		cout<<"usage: ./corpus2sa source.txt target.txt alignment.txt [index_file]\n";
+		return 0;
+	}
+	string index_filename = argc > 4 ? argv[4] : "corpus.sa";
+	corpus2sa(argv[1],argv[2],argv[3],index_filename);
+	return 0;
+}
@@ -0,0 +1,134 @@
+#include "fileloader.h"
+#include "util/file.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <exception>
+
+const char* LOAD_METHOD_NAMES[] = {"lazy","populate_or_lazy","populate_or_read","read","parallel_read"};
+const size_t PARALLEL_READ_BLOCK = 64<<20;
+
+bool parse_load_method(const string &name, util::LoadMethod &load_method)
+{
+	for (size_t i=0;i<sizeof(LOAD_METHOD_NAMES)/sizeof(LOAD_METHOD_NAMES[0]);i++)
+	{
+		if (name == LOAD_METHOD_NAMES[i])
+		{
+			load_method = (util::LoadMethod)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+string load_method_name(util::LoadMethod load_method)
+{
+	return LOAD_METHOD_NAMES[load_method];
+}
+
+/**************************************************************************************
+ 1. 函数功能: 分配匿名内存, 优先使用大页
+ 2. 入口参数: 内存大小
+ 3. 出口参数: 分配的内存
+ 4. 算法简介: 先尝试MAP_HUGETLB(需要系统预留大页), 失败时退回普通匿名映射并用
+ 			  madvise(MADV_HUGEPAGE)请求透明大页
+************************************************************************************* */
+static void map_huge_anonymous(size_t size, util::scoped_memory &mem)
+{
+	void *data = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	const size_t huge_page_size = 2<<20;
+	size_t huge_size = (size+huge_page_size-1)/huge_page_size*huge_page_size;
+	data = mmap(NULL,huge_size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+	if (data != MAP_FAILED)
+	{
+		mem.reset(data,huge_size,util::scoped_memory::MMAP_ALLOCATED);
+		return;
+	}
+#endif
+	util::MapAnonymous(size,mem);
+#ifdef MADV_HUGEPAGE
+	madvise(mem.get(),size,MADV_HUGEPAGE);
+#endif
+}
+
+/**************************************************************************************
+ 1. 函数功能: 按照指定的加载方式将整个文件载入内存
+ 2. 入口参数: 文件名, 加载方式
+ 3. 出口参数: 文件内容, 返回文件大小(使用大页时mem的大小按大页对齐, 可能大于文件大小)
+ 4. 算法简介: 不使用大页时直接调用util::MapRead; 使用大页时文件内容必须复制到匿名内存中,
+ 			  因为Linux不支持对普通文件的mmap使用大页. parallel_read用OpenMP分块pread
+************************************************************************************* */
+size_t load_file(const string &file_name, const LoadOption &load_option, util::scoped_memory &mem)
+{
+	util::scoped_fd fd(util::OpenReadOrThrow(file_name.c_str()));
+	size_t size = util::SizeOrThrow(fd.get());
+	if (size == 0)
+	{
+		mem.reset();
+		return 0;
+	}
+	util::LoadMethod load_method = load_option.load_method;
+	if (!load_option.huge_pages && load_method != util::PARALLEL_READ)
+	{
+		util::MapRead(load_method,fd.get(),0,size,mem);
+	}
+	else
+	{
+		if (load_option.huge_pages)
+		{
+			map_huge_anonymous(size,mem);
+		}
+		else
+		{
+			util::MapAnonymous(size,mem);
+		}
+		if (load_method == util::PARALLEL_READ)
+		{
+			size_t block_num = (size+PARALLEL_READ_BLOCK-1)/PARALLEL_READ_BLOCK;
+			exception_ptr read_error;								//异常不能抛出OpenMP并行区域, 记录第一个, 并行区域结束后再抛出
+#pragma omp parallel for
+			for (size_t i=0;i<block_num;i++)
+			{
+				size_t offset = i*PARALLEL_READ_BLOCK;
+				try
+				{
+					util::PReadOrThrow(fd.get(),(char*)mem.get()+offset,min(PARALLEL_READ_BLOCK,size-offset),offset);
+				}
+				catch (...)
+				{
+#pragma omp critical(parallel_read_error)
+					if (!read_error)
+					{
+						read_error = current_exception();
+					}
+				}
+			}
+			if (read_error)
+			{
+				rethrow_exception(read_error);
+			}
+		}
+		else
+		{
+			util::PReadOrThrow(fd.get(),mem.get(),size,0);
+		}
+	}
+	if (load_option.prefault)
+	{
+		prefault_memory(mem.get(),size);
+	}
+	return size;
+}
+
+//逐页读一个字节, 使所有页都驻留在内存中
+void prefault_memory(const void *data, size_t size)
+{
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	volatile char sum = 0;
+	for (size_t i=0;i<size;i+=page_size)
+	{
+		sum += ((const volatile char*)data)[i];
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef FILELOADER_H
+#define FILELOADER_H
+
+#include "stdafx.h"
+#include "util/mmap.hh"
+
+//模型文件的加载方式, 语言模型和规则表共用
+struct LoadOption
+{
+	util::LoadMethod load_method;			//lazy: 按需mmap; populate_or_lazy/populate_or_read: mmap并预先填充页表;
+											//read: 分配内存后读入; parallel_read: 分配内存后多线程读入
+	bool huge_pages;						//是否使用大页
+	bool prefault;							//加载后是否逐页访问一遍, 避免解码时发生缺页中断
+};
+
+bool parse_load_method(const string &name, util::LoadMethod &load_method);
+string load_method_name(util::LoadMethod load_method);
+size_t load_file(const string &file_name, const LoadOption &load_option, util::scoped_memory &mem);
+void prefault_memory(const void *data, size_t size);
+
+#endif
@@ -1,11 +1,16 @@
 #include "lm.h"
+#include "lm/binary_format.hh"
+#include "lm/read_arpa.hh"
+#include "util/file_piece.hh"
+#include <sys/stat.h>
+#include <atomic>
 
 struct ID_converter : public lm::EnumerateVocab 
 {
 	ID_converter(vector<lm::WordIndex>* out, Vocab* vocab) : sub_to_kenlm_id(out), UNK_ID(0),tgt_vocab(vocab) { sub_to_kenlm_id->clear(); }
 	void Add(lm::WordIndex index, const StringPiece &str) 
 	{
-		const int ori_id = tgt_vocab->get_id(str.as_string());
+		const int ori_id = tgt_vocab->add_word(str);
 		if (ori_id >= sub_to_kenlm_id->size())
 		{
 			sub_to_kenlm_id->resize(ori_id + 1, UNK_ID);
@@ -17,16 +22,261 @@ struct ID_converter : public lm::EnumerateVocab
 	Vocab* tgt_vocab;
 };
 
-LanguageModel::LanguageModel(const string &lm_file, Vocab *tgt_vocab)
+LMScoreCache::LMScoreCache(size_t size)
 {
+	size_t slot_num = 1;
+	while (slot_num < size)
+	{
+		slot_num <<= 1;
+	}
+	Entry empty_entry;
+	memset(&empty_entry,0,sizeof(Entry));
+	entries.resize(slot_num,empty_entry);
+	mask = slot_num - 1;
+	hit_num = 0;
+	miss_num = 0;
+}
+
+size_t LMScoreCache::cal_slot(const TgtPhrase *tgt, const ChartState &state_x1, const ChartState &state_x2)
+{
+	uint64_t h = util::MurmurHashNative(&tgt,sizeof(const TgtPhrase*),hash_value(state_x1));
+	return util::MurmurHashNative(&h,sizeof(uint64_t),hash_value(state_x2)) & mask;
+}
+
+bool LMScoreCache::find(const TgtPhrase *tgt, const ChartState &state_x1, const ChartState &state_x2, double &score, ChartState &state, uint64_t &record)
+{
+	const Entry &entry = entries[cal_slot(tgt,state_x1,state_x2)];
+	if (entry.tgt == tgt && entry.tgt_serial == tgt->serial && entry.state_x1 == state_x1 && entry.state_x2 == state_x2)
+	{
+		score = entry.score;
+		state = entry.state;
+		record = entry.record;
+		hit_num++;
+		return true;
+	}
+	miss_num++;
+	return false;
+}
+
+void LMScoreCache::insert(const TgtPhrase *tgt, const ChartState &state_x1, const ChartState &state_x2, double score, const ChartState &state, uint64_t record)
+{
+	Entry &entry = entries[cal_slot(tgt,state_x1,state_x2)];
+	entry.tgt = tgt;
+	entry.tgt_serial = tgt->serial;
+	entry.state_x1 = state_x1;
+	entry.state_x2 = state_x2;
+	entry.score = score;
+	entry.state = state;
+	entry.record = record;
+}
+
+static atomic<size_t> lm_serial_counter(0);
+
+//还未析构的语言模型实例, 线程结束时据此判断缓存能否归还; 不释放, 避免主线程的线程局部变量析构时已被销毁
+static pthread_mutex_t live_models_mutex = PTHREAD_MUTEX_INITIALIZER;
+static map<size_t,LanguageModel*> *live_models = new map<size_t,LanguageModel*>;
+
+//线程正在使用的得分缓存, 每个语言模型实例一个; 线程结束时把缓存归还给仍然存在的实例,
+//嵌套的OpenMP线程组每次会创建新线程, 缓存的总数因此只取决于同时打分的线程数, 与解码的句子数无关
+struct ThreadLMCaches
+{
+	vector<pair<size_t,LMScoreCache*> > caches;		//(语言模型实例的编号, 缓存)
+	~ThreadLMCaches()
+	{
+		pthread_mutex_lock(&live_models_mutex);
+		for (const auto &serial_cache : caches)
+		{
+			auto it = live_models->find(serial_cache.first);
+			if (it != live_models->end())
+			{
+				it->second->return_cache(serial_cache.second);
+			}
+		}
+		pthread_mutex_unlock(&live_models_mutex);
+	}
+};
+
+/**************************************************************************************
+ 1. 函数功能: 加载语言模型
+ 2. 入口参数: 语言模型文件, 目标端词表, 每个线程的得分缓存的项数, 加载方式
+ 3. 出口参数: 对应具体模型类型的语言模型
+ 4. 算法简介: 用RecognizeBinary识别二进制文件的模型类型, ARPA文件按ProbingModel加载
+ 			  KenLM对自己分配的匿名内存都会madvise(MADV_HUGEPAGE), 而文件mmap无法使用大页,
+ 			  因此要求大页时将mmap类的加载方式换成read; 要求预先访问时将lazy换成populate
+************************************************************************************* */
+LanguageModel* LanguageModel::create(const string &lm_file, Vocab *tgt_vocab, size_t cache_size, const LoadOption &load_option)
+{
+	util::LoadMethod load_method = load_option.load_method;
+	if (load_option.huge_pages && load_method != util::PARALLEL_READ)
+	{
+		load_method = util::READ;
+	}
+	else if (load_option.prefault && load_method == util::LAZY)
+	{
+		load_method = util::POPULATE_OR_LAZY;
+	}
+	ModelType model_type;
+	if (!RecognizeBinary(lm_file.c_str(),model_type))
+	{
+		model_type = PROBING;
+	}
+	switch (model_type)
+	{
+		case PROBING:
+			return new KenLanguageModel<ProbingModel>(lm_file,tgt_vocab,cache_size,load_method);
+		case REST_PROBING:
+			return new KenLanguageModel<RestProbingModel>(lm_file,tgt_vocab,cache_size,load_method);
+		case TRIE:
+			return new KenLanguageModel<TrieModel>(lm_file,tgt_vocab,cache_size,load_method);
+		case QUANT_TRIE:
+			return new KenLanguageModel<QuantTrieModel>(lm_file,tgt_vocab,cache_size,load_method);
+		case ARRAY_TRIE:
+			return new KenLanguageModel<ArrayTrieModel>(lm_file,tgt_vocab,cache_size,load_method);
+		case QUANT_ARRAY_TRIE:
+			return new KenLanguageModel<QuantArrayTrieModel>(lm_file,tgt_vocab,cache_size,load_method);
+		default:
+			cerr<<"unrecognized language model type "<<model_type<<", bye\n";
+			exit(EXIT_FAILURE);
+	}
+}
+
+LanguageModel::LanguageModel(size_t i_cache_size)
+{
+	cache_size = i_cache_size;
+	recorder = NULL;
+	model_bytes = 0;
+	serial = ++lm_serial_counter;
+	pthread_mutex_init(&caches_mutex,NULL);
+	pthread_mutex_lock(&live_models_mutex);
+	live_models->insert(make_pair(serial,this));
+	pthread_mutex_unlock(&live_models_mutex);
+}
+
+LanguageModel::~LanguageModel()
+{
+	pthread_mutex_lock(&live_models_mutex);
+	live_models->erase(serial);
+	pthread_mutex_unlock(&live_models_mutex);
+	for (auto cache : caches)
+	{
+		delete cache;
+	}
+	pthread_mutex_destroy(&caches_mutex);
+}
+
+template <class M> KenLanguageModel<M>::KenLanguageModel(const string &lm_file, Vocab *tgt_vocab, size_t i_cache_size, util::LoadMethod load_method) : LanguageModel(i_cache_size)
+{
+	struct stat st;
+	uint64_t lm_file_size = stat(lm_file.c_str(),&st)==0 ? st.st_size : 0;
 	ID_converter id_converter(&ori_to_kenlm_id,tgt_vocab);
 	Config conf;
-	conf.enumerate_vocab = &id_converter;
-	kenlm = new Model(lm_file.c_str(), conf);
-	EOS = convert_to_kenlm_id(tgt_vocab->get_id("</s>"));
-	nonterminal_wid = tgt_vocab->get_id("[X][X]");
-	cout<<"load language model file "<<lm_file<<" over\n";
-};
+	conf.load_method = load_method;
+	kenlm = NULL;
+	if (tgt_vocab->has_lm_ids(lm_file_size))										//二进制词表中有预先计算的映射, 不用遍历KenLM的词表
+	{
+		kenlm = new M(lm_file.c_str(), conf);
+		if (!tgt_vocab->get_lm_ids(kenlm->GetVocabulary().Bound(),lm_file_size,ori_to_kenlm_id))
+		{
+			cout<<"KenLM id table in target vocab does not match "<<lm_file<<", enumerate language model vocab\n";
+			delete kenlm;
+			kenlm = NULL;
+		}
+	}
+	if (kenlm == NULL)
+	{
+		conf.enumerate_vocab = &id_converter;
+		kenlm = new M(lm_file.c_str(), conf);
+	}
+	ModelType model_type;
+	if (RecognizeBinary(lm_file.c_str(),model_type))
+	{
+		model_bytes = lm_file_size;												//二进制文件整体映射或读入内存
+	}
+	else
+	{
+		util::FilePiece f(lm_file.c_str());
+		vector<uint64_t> counts;
+		lm::ReadARPACounts(f,counts);
+		model_bytes = M::Size(counts,conf);
+	}
+	EOS = convert_to_kenlm_id(tgt_vocab->add_word("</s>"));
+	nonterminal_wid = tgt_vocab->add_word("[X][X]");
+	cout<<"load language model file "<<lm_file<<" over, model type "<<M::kModelType<<", load method "<<load_method_name(load_method)<<"\n";
+}
+
+template <class M> KenLanguageModel<M>::~KenLanguageModel()
+{
+	delete kenlm;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 获取当前线程的语言模型得分缓存
+ 2. 入口参数: 无
+ 3. 出口参数: 当前线程的缓存
+ 4. 算法简介: 线程局部变量记录每个缓存所属的语言模型实例, 线程第一次使用某个实例时优先取已结束的线程归还的缓存,
+ 			  没有时新建并登记到语言模型中, 用于统计命中率以及析构时释放; 热替换模型期间同一线程
+ 			  会交替使用新旧两个实例, 因此按实例分别保留缓存. 实例的编号不重复, 已释放实例的缓存不会再被找到,
+ 			  取新缓存时顺便删掉这些记录
+************************************************************************************* */
+LMScoreCache* LanguageModel::get_thread_cache()
+{
+	static thread_local ThreadLMCaches tls_caches;
+	vector<pair<size_t,LMScoreCache*> > &thread_caches = tls_caches.caches;
+	for (size_t i=thread_caches.size();i>0;i--)
+	{
+		if (thread_caches[i-1].first == serial)
+			return thread_caches[i-1].second;
+	}
+	pthread_mutex_lock(&live_models_mutex);
+	size_t live_num = 0;
+	for (const auto &serial_cache : thread_caches)
+	{
+		if (live_models->count(serial_cache.first) > 0)
+		{
+			thread_caches[live_num++] = serial_cache;
+		}
+	}
+	thread_caches.resize(live_num);
+	pthread_mutex_unlock(&live_models_mutex);
+	LMScoreCache *cache = NULL;
+	pthread_mutex_lock(&caches_mutex);
+	if (!free_caches.empty())
+	{
+		cache = free_caches.back();
+		free_caches.pop_back();
+	}
+	pthread_mutex_unlock(&caches_mutex);
+	if (cache == NULL)
+	{
+		cache = new LMScoreCache(cache_size);
+		pthread_mutex_lock(&caches_mutex);
+		caches.push_back(cache);
+		pthread_mutex_unlock(&caches_mutex);
+	}
+	thread_caches.push_back(make_pair(serial,cache));
+	return cache;
+}
+
+//结束的线程归还缓存, 缓存的内容与线程无关, 留给之后的线程继续使用
+void LanguageModel::return_cache(LMScoreCache *cache)
+{
+	pthread_mutex_lock(&caches_mutex);
+	free_caches.push_back(cache);
+	pthread_mutex_unlock(&caches_mutex);
+}
+
+void LanguageModel::get_cache_stats(size_t &hit_num, size_t &miss_num)
+{
+	hit_num = 0;
+	miss_num = 0;
+	pthread_mutex_lock(&caches_mutex);
+	for (auto cache : caches)
+	{
+		hit_num += cache->hit_num;
+		miss_num += cache->miss_num;
+	}
+	pthread_mutex_unlock(&caches_mutex);
+}
 
 lm::WordIndex LanguageModel::convert_to_kenlm_id(int wid)
 {
@@ -36,9 +286,21 @@ lm::WordIndex LanguageModel::convert_to_kenlm_id(int wid)
 		return ori_to_kenlm_id[wid];
 }
 
-double LanguageModel::cal_increased_lm_score(Cand* cand) 
+template <class M> double KenLanguageModel<M>::cal_increased_lm_score(Cand* cand)
 {
-	RuleScore<Model> rule_score(*kenlm,cand->lm_state);
+	static const ChartState empty_state = ChartState();
+	const TgtPhrase *tgt = cand->applied_rule.tgt_rule == NULL ? NULL : cand->applied_rule.tgt_rule->tgt;
+	const ChartState &state_x1 = cand->child_x1 == NULL ? empty_state : cand->child_x1->lm_state;
+	const ChartState &state_x2 = cand->child_x2 == NULL ? empty_state : cand->child_x2->lm_state;
+	LMScoreCache *cache = NULL;
+	if (tgt != NULL && cache_size > 0)                       //OOV候选不使用缓存
+	{
+		cache = get_thread_cache();
+		double cached_score;
+		if (cache->find(tgt,state_x1,state_x2,cached_score,cand->lm_state,cand->lm_record) && (recorder == NULL || cand->lm_record != 0))
+			return cached_score;								//开始记录之前(如预热时)加入的缓存项没有打分编号, 重新打分
+	}
+	RuleScore<M> rule_score(*kenlm,cand->lm_state);
 	if (cand->applied_rule.tgt_rule == NULL)            //OOV候选
 	{
 		const lm::WordIndex ken_lm_id = convert_to_kenlm_id(cand->tgt_wids.at(0));
@@ -46,39 +308,77 @@ double LanguageModel::cal_increased_lm_score(Cand* cand)
 	}
 	else
 	{
-		int nt_num = 1;
-		for (auto wid : cand->applied_rule.tgt_rule->wids)
+		const lm::WordIndex *kenlm_wids = tgt->kenlm_wids;
+		const size_t len = tgt->len;
+		const ChartState *child_states[2] = {&state_x1,&state_x2};
+		size_t cur = 0;
+		for (size_t nt=0;nt<2 && tgt->nt_pos[nt]>=0;nt++)
 		{
-			if (wid == nonterminal_wid)
+			for (;cur<tgt->nt_pos[nt];cur++)
 			{
-				if (nt_num == 1)
-				{
-					rule_score.NonTerminal((cand->child_x1)->lm_state);
-					nt_num += 1;
-				}
-				else
-				{
-					rule_score.NonTerminal((cand->child_x2)->lm_state);
-				}
-			}
-			else
-			{
-				const lm::WordIndex ken_lm_id = convert_to_kenlm_id(wid);
-				rule_score.Terminal(ken_lm_id);
+				rule_score.Terminal(kenlm_wids[cur]);
 			}
+			rule_score.NonTerminal(*child_states[nt]);
+			cur++;
+		}
+		for (;cur<len;cur++)
+		{
+			rule_score.Terminal(kenlm_wids[cur]);
 		}
 	}
 	double increased_lm_score = rule_score.Finish();
 	cand->lm_state.ZeroRemaining();
+	if (recorder != NULL)
+	{
+		cand->lm_record = recorder->record(cand,false);
+	}
+	if (cache != NULL)
+	{
+		cache->insert(tgt,state_x1,state_x2,increased_lm_score,cand->lm_state,cand->lm_record);
+	}
 	return increased_lm_score;
 }
 
-double LanguageModel::cal_final_increased_lm_score(Cand* cand) 
+void LanguageModel::fill_kenlm_ids(TgtPhrase &tgt)
+{
+	tgt.nt_pos[0] = -1;
+	tgt.nt_pos[1] = -1;
+	int nt_num = 0;
+	for (size_t i=0;i<tgt.len;i++)
+	{
+		if (tgt.wids[i] == nonterminal_wid)
+		{
+			if (nt_num < 2)
+			{
+				tgt.nt_pos[nt_num] = i;
+			}
+			nt_num++;
+			tgt.kenlm_wids[i] = 0;
+		}
+		else
+		{
+			tgt.kenlm_wids[i] = convert_to_kenlm_id(tgt.wids[i]);
+		}
+	}
+}
+
+template <class M> double KenLanguageModel<M>::cal_final_increased_lm_score(Cand* cand)
 {
 	ChartState cstate;
-	RuleScore<Model> rule_score(*kenlm, cstate);
+	RuleScore<M> rule_score(*kenlm, cstate);
 	rule_score.BeginSentence();
 	rule_score.NonTerminal(cand->lm_state, 0.0f);
 	rule_score.Terminal(EOS);
+	if (recorder != NULL)
+	{
+		recorder->record(cand,true);
+	}
 	return rule_score.Finish();
 }
+
+template class KenLanguageModel<ProbingModel>;
+template class KenLanguageModel<RestProbingModel>;
+template class KenLanguageModel<TrieModel>;
+template class KenLanguageModel<QuantTrieModel>;
+template class KenLanguageModel<ArrayTrieModel>;
+template class KenLanguageModel<QuantArrayTrieModel>;
@@ -1,23 +1,87 @@
 #include "stdafx.h"
 #include "cand.h"
 #include "vocab.h"
+#include "fileloader.h"
+#include "lmtrace.h"
 #include "lm/model.hh"
 #include "lm/left.hh"
 #include "lm/enumerate_vocab.hh"
 using namespace lm::ngram;
 
-class LanguageModel
+//规则语言模型得分缓存, 每个线程同一时刻使用一个, 大小固定, 采用直接映射, 冲突时覆盖旧的项
+//键为(去重后的规则目标端, x1子候选的语言模型状态, x2子候选的语言模型状态), 值为(语言模型增量得分, 生成的语言模型状态)
+//源端不同但目标端相同的规则共用缓存项
+class LMScoreCache
 {
 	public:
-		LanguageModel(const string &lm_file, Vocab *tgt_vocab);
-		double cal_increased_lm_score(Cand* cand);
-		double cal_final_increased_lm_score(Cand* cand);
+		LMScoreCache(size_t size);
+		bool find(const TgtPhrase *tgt, const ChartState &state_x1, const ChartState &state_x2, double &score, ChartState &state, uint64_t &record);
+		void insert(const TgtPhrase *tgt, const ChartState &state_x1, const ChartState &state_x2, double score, const ChartState &state, uint64_t record);
+
+	private:
+		size_t cal_slot(const TgtPhrase *tgt, const ChartState &state_x1, const ChartState &state_x2);
 
 	private:
+		struct Entry
+		{
+			const TgtPhrase *tgt;					//为NULL表示该项为空
+			ChartState state_x1;
+			ChartState state_x2;
+			float score;
+			uint32_t tgt_serial;					//目标端的serial, 区分先后占用同一地址的目标端
+			ChartState state;
+			uint64_t record;						//记录查询轨迹时生成state的打分编号加1, 见LMQueryRecorder
+		};
+		vector<Entry> entries;
+		size_t mask;
+	public:
+		size_t hit_num;
+		size_t miss_num;
+};
+
+//语言模型接口, 具体的KenLM模型类型在加载时根据二进制文件识别
+//打分的内层循环在KenLanguageModel中对具体模型类型实例化, 不经过KenLM的虚函数接口
+class LanguageModel
+{
+	public:
+		static LanguageModel* create(const string &lm_file, Vocab *tgt_vocab, size_t cache_size, const LoadOption &load_option);
+		virtual ~LanguageModel();
+		virtual double cal_increased_lm_score(Cand* cand)=0;
+		virtual double cal_final_increased_lm_score(Cand* cand)=0;
+		void get_cache_stats(size_t &hit_num, size_t &miss_num);
+		void fill_kenlm_ids(TgtPhrase &tgt);
+		void set_recorder(LMQueryRecorder *i_recorder) {recorder = i_recorder;};
+		size_t memory_bytes() {return model_bytes;};
+
+	protected:
+			LanguageModel(size_t i_cache_size);
 			lm::WordIndex convert_to_kenlm_id(int wid);
+			LMScoreCache* get_thread_cache();
 	private:
-		Model *kenlm;
+			friend struct ThreadLMCaches;
+			void return_cache(LMScoreCache *cache);
+	protected:
 		vector<lm::WordIndex> ori_to_kenlm_id;
 		lm::WordIndex EOS;
 		int nonterminal_wid;
+		size_t cache_size;							//每个线程的得分缓存的项数, 为0时不使用缓存
+		size_t serial;								//区分不同语言模型实例的编号
+		vector<LMScoreCache*> caches;				//创建过的所有得分缓存, 个数不超过同时打分的线程数的峰值
+		vector<LMScoreCache*> free_caches;			//已结束的线程归还的缓存, 新线程优先复用
+		LMQueryRecorder *recorder;					//记录对KenLM的调用, 为NULL时不记录
+		size_t model_bytes;							//KenLM模型占用的内存
+		pthread_mutex_t caches_mutex;
+};
+
+//M为KenLM的具体模型类型, 如ProbingModel, QuantArrayTrieModel等
+template <class M> class KenLanguageModel : public LanguageModel
+{
+	public:
+		KenLanguageModel(const string &lm_file, Vocab *tgt_vocab, size_t i_cache_size, util::LoadMethod load_method);
+		~KenLanguageModel();
+		double cal_increased_lm_score(Cand* cand);
+		double cal_final_increased_lm_score(Cand* cand);
+
+	private:
+		M *kenlm;
 };
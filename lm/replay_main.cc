@@ -0,0 +1,322 @@
+// Replays a trace of RuleScore calls recorded by the hiero decoder (see lmtrace.h) against any
+// KenLM binary type, so that model layouts can be compared without running the decoder.
+#include "lmtrace.h"
+#include "lm/left.hh"
+#include "lm/model.hh"
+#include "util/usage.hh"
+
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+const uint32_t kNoSlot = std::numeric_limits<uint32_t>::max();
+
+struct Op {
+  unsigned char code;
+  // Terminal: word index in the trace vocabulary.  NonTerminal: state slot or kNoSlot for an empty state.
+  uint32_t arg;
+};
+
+// One RuleScore object: ops[begin, end) followed by Finish() into slot out (kNoSlot if never used again).
+struct Record {
+  std::size_t begin, end;
+  uint32_t out;
+};
+
+struct Trace {
+  std::vector<std::string> words;
+  std::vector<Op> ops;
+  std::vector<Record> records;
+  uint32_t slots;
+  std::size_t terminals, non_terminals;
+};
+
+double WallTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Decodes the trace and replaces references to earlier records by state slots.  A slot is taken when a
+// record that is used later finishes and released after the last record that reads it, so memory is bounded
+// by the number of live states rather than the length of the trace.
+void ReadTrace(const char *file, Trace &trace) {
+  std::ifstream in(file, std::ios::binary);
+  UTIL_THROW_IF(!in, util::Exception, "Cannot open trace " << file);
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  UTIL_THROW_IF(data.size() < sizeof(LMTRACE_MAGIC) + sizeof(uint64_t) || memcmp(data.data(), LMTRACE_MAGIC, sizeof(LMTRACE_MAGIC)),
+      util::Exception, file << " is not an lm trace");
+  uint64_t words_offset;
+  memcpy(&words_offset, data.data() + sizeof(LMTRACE_MAGIC), sizeof(uint64_t));
+  UTIL_THROW_IF(words_offset == 0 || words_offset > data.size(), util::Exception, "Trace " << file << " was not closed properly");
+
+  const char *p = data.data() + words_offset;
+  trace.words.resize(read_varint(p));
+  for (std::vector<std::string>::iterator i = trace.words.begin(); i != trace.words.end(); ++i) {
+    uint64_t length = read_varint(p);
+    i->assign(p, length);
+    p += length;
+  }
+
+  // First pass: decode.  Each thread of the decoder writes its records in blocks, so records are put back into
+  // id order, in which every child state comes before the record that reads it.  NonTerminal arguments are the
+  // child's record id plus one, or 0 for an empty state.
+  const char *end = data.data() + words_offset;
+  p = data.data() + sizeof(LMTRACE_MAGIC) + sizeof(uint64_t);
+  std::vector<Op> ops;
+  std::vector<Record> file_records;
+  std::size_t begin = 0;
+  trace.terminals = trace.non_terminals = 0;
+  while (p < end) {
+    Op op;
+    op.code = *p++;
+    op.arg = 0;
+    switch (op.code) {
+      case LMTRACE_BEGIN_SENTENCE:
+        break;
+      case LMTRACE_TERMINAL:
+        op.arg = read_varint(p);
+        UTIL_THROW_IF(op.arg >= trace.words.size(), util::Exception, "Bad word index in trace");
+        ++trace.terminals;
+        break;
+      case LMTRACE_NON_TERMINAL: {
+        uint64_t reference = read_varint(p);
+        UTIL_THROW_IF(reference >= kNoSlot, util::Exception, "Bad state reference in trace");
+        op.arg = reference ? reference - 1 : kNoSlot;
+        ++trace.non_terminals;
+        break;
+      }
+      case LMTRACE_FINISH: {
+        uint64_t id = read_varint(p);
+        UTIL_THROW_IF(id >= kNoSlot, util::Exception, "Bad record id in trace");
+        Record record;
+        record.begin = begin;
+        record.end = ops.size();
+        record.out = id;
+        file_records.push_back(record);
+        begin = ops.size();
+        continue;
+      }
+      default:
+        UTIL_THROW(util::Exception, "Bad op " << static_cast<int>(op.code) << " in trace");
+    }
+    ops.push_back(op);
+  }
+  std::vector<std::size_t> id_to_file(file_records.size(), file_records.size());
+  for (std::size_t i = 0; i < file_records.size(); ++i) {
+    uint32_t id = file_records[i].out;
+    UTIL_THROW_IF(id >= id_to_file.size() || id_to_file[id] != file_records.size(), util::Exception, "Bad record id in trace");
+    id_to_file[id] = i;
+  }
+  std::vector<uint64_t> last_use(file_records.size(), 0);
+  for (std::size_t r = 0; r < id_to_file.size(); ++r) {
+    const Record &from = file_records[id_to_file[r]];
+    Record record;
+    record.begin = trace.ops.size();
+    for (std::size_t i = from.begin; i < from.end; ++i) {
+      const Op &op = ops[i];
+      if (op.code == LMTRACE_NON_TERMINAL && op.arg != kNoSlot) {
+        UTIL_THROW_IF(op.arg >= r, util::Exception, "Bad state reference in trace");
+        last_use[op.arg] = r;
+      }
+      trace.ops.push_back(op);
+    }
+    record.end = trace.ops.size();
+    record.out = kNoSlot;
+    trace.records.push_back(record);
+  }
+
+  // Second pass: assign slots.  The output slot is taken before the children are released so a record
+  // never writes into a state it is still reading.
+  std::vector<uint32_t> record_slot(trace.records.size(), kNoSlot);
+  std::vector<uint32_t> free_slots;
+  trace.slots = 0;
+  for (std::size_t r = 0; r < trace.records.size(); ++r) {
+    Record &rec = trace.records[r];
+    std::vector<uint32_t> children;
+    for (std::size_t i = rec.begin; i < rec.end; ++i) {
+      if (trace.ops[i].code == LMTRACE_NON_TERMINAL && trace.ops[i].arg != kNoSlot) {
+        children.push_back(trace.ops[i].arg);
+        trace.ops[i].arg = record_slot[trace.ops[i].arg];
+      }
+    }
+    if (last_use[r]) {
+      if (free_slots.empty()) {
+        free_slots.push_back(trace.slots++);
+      }
+      rec.out = record_slot[r] = free_slots.back();
+      free_slots.pop_back();
+    }
+    for (std::vector<uint32_t>::const_iterator child = children.begin(); child != children.end(); ++child) {
+      if (last_use[*child] == r) {
+        free_slots.push_back(record_slot[*child]);
+        last_use[*child] = 0;
+      }
+    }
+  }
+}
+
+class CacheMissCounter {
+  public:
+    CacheMissCounter() {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~CacheMissCounter() {
+      if (fd_ >= 0) close(fd_);
+    }
+
+    bool Available() const { return fd_ >= 0; }
+
+    void Start() {
+      if (fd_ < 0) return;
+      ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    uint64_t Stop() {
+      uint64_t count = 0;
+      if (fd_ < 0) return count;
+      ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fd_, &count, sizeof(count)) != sizeof(count)) count = 0;
+      return count;
+    }
+
+  private:
+    int fd_;
+};
+
+template <class Model> void Replay(const char *lm_file, const Trace &trace, unsigned int repeat) {
+  lm::ngram::Config config;
+  Model model(lm_file, config);
+  std::vector<lm::WordIndex> vocab(trace.words.size());
+  for (std::size_t i = 0; i < trace.words.size(); ++i) {
+    vocab[i] = model.GetVocabulary().Index(trace.words[i]);
+  }
+  std::vector<lm::ngram::ChartState> slots(trace.slots + 1);
+  lm::ngram::ChartState &scratch = slots.back();
+  const lm::ngram::ChartState empty = lm::ngram::ChartState();
+
+  CacheMissCounter counter;
+  double best = std::numeric_limits<double>::max();
+  uint64_t misses = 0;
+  double total = 0.0;
+  for (unsigned int round = 0; round < repeat; ++round) {
+    total = 0.0;
+    counter.Start();
+    double start = WallTime();
+    for (std::vector<Record>::const_iterator rec = trace.records.begin(); rec != trace.records.end(); ++rec) {
+      lm::ngram::ChartState &out = rec->out == kNoSlot ? scratch : slots[rec->out];
+      lm::ngram::RuleScore<Model> score(model, out);
+      for (const Op *op = trace.ops.data() + rec->begin; op != trace.ops.data() + rec->end; ++op) {
+        switch (op->code) {
+          case LMTRACE_BEGIN_SENTENCE:
+            score.BeginSentence();
+            break;
+          case LMTRACE_TERMINAL:
+            score.Terminal(vocab[op->arg]);
+            break;
+          case LMTRACE_NON_TERMINAL:
+            score.NonTerminal(op->arg == kNoSlot ? empty : slots[op->arg]);
+            break;
+        }
+      }
+      total += score.Finish();
+      out.ZeroRemaining();
+    }
+    double elapsed = WallTime() - start;
+    uint64_t round_misses = counter.Stop();
+    if (elapsed < best) {
+      best = elapsed;
+      misses = round_misses;
+    }
+  }
+  std::size_t queries = trace.terminals + trace.non_terminals;
+  std::cout << "model type " << Model::kModelType << ": " << trace.records.size() << " rules, " << queries << " queries ("
+    << trace.terminals << " terminals, " << trace.non_terminals << " non-terminals), " << trace.slots << " live states\n"
+    << "best of " << repeat << ": " << best << " s, " << queries / best << " queries/s, " << trace.records.size() / best << " rules/s\n";
+  if (counter.Available()) {
+    std::cout << "cache misses: " << misses << " (" << static_cast<double>(misses) / queries << " per query)\n";
+  } else {
+    std::cout << "cache misses: unavailable (perf_event_open failed)\n";
+  }
+  std::cout << "total log10 probability: " << total << std::endl;
+}
+
+void Usage(const char *name) {
+  std::cerr << "Usage: " << name << " [-r repeat] lm_file trace_file" << std::endl;
+  std::cerr << "Replays an lm trace recorded with [lm-trace-file] against any KenLM model." << std::endl;
+  exit(1);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  unsigned int repeat = 3;
+  const char *lm_file = NULL, *trace_file = NULL;
+  for (char **arg = argv + 1; arg != argv + argc; ++arg) {
+    if (!strcmp(*arg, "-r") && arg + 1 != argv + argc) {
+      repeat = atoi(*++arg);
+    } else if (!strcmp(*arg, "-h") || !strcmp(*arg, "--help") || trace_file) {
+      Usage(argv[0]);
+    } else if (lm_file) {
+      trace_file = *arg;
+    } else {
+      lm_file = *arg;
+    }
+  }
+  if (!trace_file || !repeat) Usage(argv[0]);
+  try {
+    Trace trace;
+    ReadTrace(trace_file, trace);
+    using namespace lm::ngram;
+    ModelType model_type;
+    if (!RecognizeBinary(lm_file, model_type)) model_type = PROBING;
+    switch(model_type) {
+      case PROBING:
+        Replay<ProbingModel>(lm_file, trace, repeat);
+        break;
+      case REST_PROBING:
+        Replay<RestProbingModel>(lm_file, trace, repeat);
+        break;
+      case TRIE:
+        Replay<TrieModel>(lm_file, trace, repeat);
+        break;
+      case QUANT_TRIE:
+        Replay<QuantTrieModel>(lm_file, trace, repeat);
+        break;
+      case ARRAY_TRIE:
+        Replay<ArrayTrieModel>(lm_file, trace, repeat);
+        break;
+      case QUANT_ARRAY_TRIE:
+        Replay<QuantArrayTrieModel>(lm_file, trace, repeat);
+        break;
+      default:
+        std::cerr << "Unrecognized kenlm model type " << model_type << std::endl;
+        abort();
+    }
+    util::PrintUsage(std::cerr);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,179 @@
+#include "lmtrace.h"
+#include "cand.h"
+#include "vocab.h"
+
+const uint64_t LMTRACE_EOS_INDEX = 0;
+const uint64_t LMTRACE_UNK_INDEX = 1;
+const size_t LMTRACE_FLUSH_BYTES = 1<<20;				//线程缓冲区达到该大小时写入文件
+
+//保护各记录器的缓冲区列表, 跟踪文件以及缓冲区所属的记录器; 只在缓冲区满, 线程开始记录和结束时加锁
+static pthread_mutex_t lm_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//线程结束时写出缓冲区中剩余的打分并释放缓冲区; 嵌套的OpenMP线程组每次会创建新线程, 不释放会持续占用内存
+struct ThreadLMTraceBuffer
+{
+	LMQueryRecorder::ThreadBuffer *buffer = NULL;
+	void release()
+	{
+		if (buffer == NULL)
+			return;
+		pthread_mutex_lock(&lm_trace_mutex);
+		LMQueryRecorder *recorder = buffer->recorder;
+		if (recorder != NULL)
+		{
+			recorder->flush(buffer);
+			recorder->buffers.erase(find(recorder->buffers.begin(),recorder->buffers.end(),buffer));
+		}
+		pthread_mutex_unlock(&lm_trace_mutex);
+		delete buffer;
+		buffer = NULL;
+	}
+	~ThreadLMTraceBuffer() {release();};
+};
+
+LMQueryRecorder::LMQueryRecorder(const string &trace_file, Vocab *i_tgt_vocab) : finish_num(0)
+{
+	tgt_vocab = i_tgt_vocab;
+	max_wid = -1;
+	fout.open(trace_file.c_str(),ios::binary);
+	if (!fout.is_open())
+	{
+		cerr<<"cannot open lm trace file!\n";
+		return;
+	}
+	uint64_t words_offset = 0;
+	fout.write(LMTRACE_MAGIC,sizeof(LMTRACE_MAGIC));
+	fout.write((char*)&words_offset,sizeof(uint64_t));
+}
+
+LMQueryRecorder::~LMQueryRecorder()
+{
+	close();
+}
+
+LMQueryRecorder::ThreadBuffer* LMQueryRecorder::get_thread_buffer()
+{
+	static thread_local ThreadLMTraceBuffer thread_buffer;
+	if (thread_buffer.buffer == NULL || thread_buffer.buffer->recorder != this)
+	{
+		thread_buffer.release();											//之前的记录器已经关闭
+		ThreadBuffer *buffer = new ThreadBuffer;
+		buffer->recorder = this;
+		buffer->max_wid = -1;
+		pthread_mutex_lock(&lm_trace_mutex);
+		buffers.push_back(buffer);
+		pthread_mutex_unlock(&lm_trace_mutex);
+		thread_buffer.buffer = buffer;
+	}
+	return thread_buffer.buffer;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 记录一次规则打分对KenLM的调用
+ 2. 入口参数: 打分的候选, 是否为整句结束时的打分
+ 3. 出口参数: 这次打分的编号加1, 由调用者保存到候选中
+ 4. 算法简介: 调用序列与KenLanguageModel中的打分过程一致; 子候选的状态用其中保存的打分编号表示.
+ 			  整句结束时的打分生成的状态不保存到候选中, 但同样占用一个编号
+************************************************************************************* */
+uint64_t LMQueryRecorder::record(const Cand *cand, bool final)
+{
+	ThreadBuffer *buffer = get_thread_buffer();
+	string &buf = buffer->data;
+	auto write_child = [&](const Cand *child)
+	{
+		buf.push_back(LMTRACE_NON_TERMINAL);
+		write_varint(buf,child==NULL?0:child->lm_record);
+	};
+	auto write_word = [&](int wid)
+	{
+		buf.push_back(LMTRACE_TERMINAL);
+		if (wid < 0)
+		{
+			write_varint(buf,LMTRACE_UNK_INDEX);								//OOV候选的目标端为负的源端id
+			return;
+		}
+		write_varint(buf,wid+2);
+		buffer->max_wid = max(buffer->max_wid,wid);
+	};
+	if (final)
+	{
+		buf.push_back(LMTRACE_BEGIN_SENTENCE);
+		write_child(cand);
+		buf.push_back(LMTRACE_TERMINAL);
+		write_varint(buf,LMTRACE_EOS_INDEX);
+	}
+	else if (cand->applied_rule.tgt_rule == NULL)
+	{
+		write_word(cand->tgt_wids.at(0));
+	}
+	else
+	{
+		const TgtPhrase *tgt = cand->applied_rule.tgt_rule->tgt;
+		const Cand *children[2] = {cand->child_x1,cand->child_x2};
+		for (int i=0;i<tgt->len;i++)
+		{
+			if (i == tgt->nt_pos[0] || i == tgt->nt_pos[1])
+			{
+				write_child(children[i==tgt->nt_pos[0]?0:1]);
+			}
+			else
+			{
+				write_word(tgt->wids[i]);
+			}
+		}
+	}
+	uint64_t id = finish_num++;
+	buf.push_back(LMTRACE_FINISH);
+	write_varint(buf,id);
+	if (buf.size() >= LMTRACE_FLUSH_BYTES)
+	{
+		pthread_mutex_lock(&lm_trace_mutex);
+		flush(buffer);
+		pthread_mutex_unlock(&lm_trace_mutex);
+	}
+	return id+1;
+}
+
+//将缓冲区中的打分追加到跟踪文件并清空缓冲区, 调用者持有lm_trace_mutex
+void LMQueryRecorder::flush(ThreadBuffer *buffer)
+{
+	if (fout.is_open())
+	{
+		fout.write(buffer->data.data(),buffer->data.size());
+	}
+	max_wid = max(max_wid,buffer->max_wid);
+	buffer->data.clear();
+}
+
+//写出所有线程剩余的打分, 在文件末尾写入词表, 并把词表偏移写回文件头
+void LMQueryRecorder::close()
+{
+	pthread_mutex_lock(&lm_trace_mutex);
+	for (auto buffer : buffers)
+	{
+		flush(buffer);
+		buffer->recorder = NULL;											//由所属线程在结束或再次记录时释放
+	}
+	buffers.clear();
+	if (!fout.is_open())
+	{
+		pthread_mutex_unlock(&lm_trace_mutex);
+		return;
+	}
+	uint64_t words_offset = fout.tellp();
+	string buf;
+	size_t word_num = max_wid+3;
+	write_varint(buf,word_num);
+	for (size_t i=0;i<word_num;i++)
+	{
+		string word = i==LMTRACE_EOS_INDEX ? "</s>" : (i==LMTRACE_UNK_INDEX ? "<unk>" : tgt_vocab->get_word(i-2));
+		write_varint(buf,word.size());
+		buf += word;
+	}
+	fout.write(buf.data(),buf.size());
+	fout.seekp(sizeof(LMTRACE_MAGIC));
+	fout.write((char*)&words_offset,sizeof(uint64_t));
+	fout.close();
+	pthread_mutex_unlock(&lm_trace_mutex);
+	cout<<"lm trace: "<<finish_num<<" rule scorings, "<<word_num<<" words\n";
+}
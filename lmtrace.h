@@ -0,0 +1,98 @@
+#ifndef LMTRACE_H
+#define LMTRACE_H
+
+#include "stdafx.h"
+#include <atomic>
+
+struct Cand;
+class Vocab;
+
+//语言模型查询轨迹的文件格式
+//文件头为8字节魔数和8字节的词表偏移, 之后是若干次规则打分, 每次打分为若干操作, 每个操作为1字节操作码加可选的变长整数参数:
+//  BEGIN_SENTENCE      对应RuleScore::BeginSentence
+//  TERMINAL w          对应RuleScore::Terminal, w为词表中的下标
+//  NON_TERMINAL r      对应RuleScore::NonTerminal, 子状态由编号为r-1的打分生成, r为0表示空状态
+//  FINISH n            对应RuleScore::Finish, 一次规则打分结束, n为这次打分的编号
+//打分的编号从0开始连续分配, 子状态的编号总是小于使用它的打分; 各线程的打分成块写入, 回放时按编号排序
+//词表位于文件末尾, 为单词数加上每个单词的长度和内容, 回放时按字符串映射到具体模型的词表
+//词表的前两个单词固定为</s>和<unk>, 之后第i个单词是目标端词表中id为i-2的单词
+const char LMTRACE_MAGIC[8] = {'H','I','E','R','O','L','Q','2'};
+enum LMTraceOp
+{
+	LMTRACE_BEGIN_SENTENCE,
+	LMTRACE_TERMINAL,
+	LMTRACE_NON_TERMINAL,
+	LMTRACE_FINISH
+};
+
+inline void write_varint(string &buf, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		buf.push_back((char)(v|0x80));
+		v >>= 7;
+	}
+	buf.push_back((char)v);
+}
+
+inline uint64_t read_varint(const char *&p)
+{
+	uint64_t v = 0;
+	for (int shift=0;;shift+=7)
+	{
+		unsigned char c = *p++;
+		v |= (uint64_t)(c&0x7f)<<shift;
+		if (c < 0x80)
+			break;
+	}
+	return v;
+}
+
+//带边界检查的read_varint, 用于解析不可信的数据; 数据在end之前结束或超过64位时返回false
+inline bool read_varint(const char *&p, const char *end, uint64_t &v)
+{
+	v = 0;
+	for (int shift=0;shift<64;shift+=7)
+	{
+		if (p >= end)
+			return false;
+		unsigned char c = *p++;
+		v |= (uint64_t)(c&0x7f)<<shift;
+		if (c < 0x80)
+			return true;
+	}
+	return false;
+}
+
+//记录解码过程中对KenLM的调用序列
+//子候选的语言模型状态用生成它的那次打分的编号表示, 编号保存在候选和得分缓存中;
+//命中缓存时不调用KenLM, 也不记录, 候选沿用缓存项的编号
+//每个线程写自己的缓冲区, 记录时只对编号做一次原子加; 缓冲区满或线程结束时加锁追加到文件
+class LMQueryRecorder
+{
+	public:
+		LMQueryRecorder(const string &trace_file, Vocab *i_tgt_vocab);
+		~LMQueryRecorder();
+		uint64_t record(const Cand *cand, bool final);
+		void close();
+
+	private:
+		struct ThreadBuffer
+		{
+			LMQueryRecorder *recorder;				//关闭后为NULL
+			string data;
+			int max_wid;							//记录过的最大目标端单词id
+		};
+		friend struct ThreadLMTraceBuffer;
+		ThreadBuffer* get_thread_buffer();
+		void flush(ThreadBuffer *buffer);
+
+	private:
+		ofstream fout;
+		Vocab *tgt_vocab;
+		atomic<uint64_t> finish_num;					//已经分配的打分编号数
+		int max_wid;									//已写入文件的打分中最大的目标端单词id
+		vector<ThreadBuffer*> buffers;					//还未结束的线程的缓冲区
+};
+
+#endif
@@ -1,146 +1,11 @@
 #include "translator.h"
-
-void read_config(Filenames &fns,Parameter &para, Weight &weight, const string &config_file)
-{
-	ifstream fin;
-	fin.open(config_file.c_str());
-	if (!fin.is_open())
-	{
-		cerr<<"fail to open config file\n";
-		return;
-	}
-	string line;
-	while(getline(fin,line))
-	{
-		TrimLine(line);
-		if (line == "[input-file]")
-		{
-			getline(fin,line);
-			fns.input_file = line;
-		}
-		else if (line == "[output-file]")
-		{
-			getline(fin,line);
-			fns.output_file = line;
-		}
-		else if (line == "[nbest-file]")
-		{
-			getline(fin,line);
-			fns.nbest_file = line;
-		}
-		else if (line == "[src-vocab-file]")
-		{
-			getline(fin,line);
-			fns.src_vocab_file = line;
-		}
-		else if (line == "[tgt-vocab-file]")
-		{
-			getline(fin,line);
-			fns.tgt_vocab_file = line;
-		}
-		else if (line == "[rule-table-file]")
-		{
-			getline(fin,line);
-			fns.rule_table_file = line;
-		}
-		else if (line == "[lm-file]")
-		{
-			getline(fin,line);
-			fns.lm_file = line;
-		}
-		else if (line == "[function-words-file]")
-		{
-			getline(fin,line);
-			fns.fw_file = line;
-		}
-		else if (line == "[BEAM-SIZE]")
-		{
-			getline(fin,line);
-			para.BEAM_SIZE = stoi(line);
-		}
-		else if (line == "[CUBE-SIZE]")
-		{
-			getline(fin,line);
-			para.CUBE_SIZE = stoi(line);
-		}
-		else if (line == "[SEN-THREAD-NUM]")
-		{
-			getline(fin,line);
-			para.SEN_THREAD_NUM = stoi(line);
-		}
-		else if (line == "[SPAN-THREAD-NUM]")
-		{
-			getline(fin,line);
-			para.SPAN_THREAD_NUM = stoi(line);
-		}
-		else if (line == "[NBEST-NUM]")
-		{
-			getline(fin,line);
-			para.NBEST_NUM = stoi(line);
-		}
-		else if (line == "[RULE-NUM-LIMIT]")
-		{
-			getline(fin,line);
-			para.RULE_NUM_LIMIT = stoi(line);
-		}
-		else if (line == "[PRINT-NBEST]")
-		{
-			getline(fin,line);
-			para.PRINT_NBEST = stoi(line);
-		}
-		else if (line == "[DUMP-RULE]")
-		{
-			getline(fin,line);
-			para.DUMP_RULE = stoi(line);
-		}
-		else if (line == "[DROP-OOV]")
-		{
-			getline(fin,line);
-			para.DROP_OOV = stoi(line);
-		}
-		else if (line == "[weight]")
-		{
-			while(getline(fin,line))
-			{
-				if (line == "")
-					break;
-				stringstream ss(line);
-				string feature;
-				ss >> feature;
-				if (feature.find("trans") != string::npos)
-				{
-					double w;
-					ss>>w;
-					weight.trans.push_back(w);
-				}
-				else if(feature == "len")
-				{
-					ss>>weight.len;
-				}
-				else if(feature == "lm")
-				{
-					ss>>weight.lm;
-				}
-				else if(feature == "rule-num")
-				{
-					ss>>weight.rule_num;
-				}
-				else if(feature == "glue")
-				{
-					ss>>weight.glue;
-				}
-				else if(feature == "fw")
-				{
-					ss>>weight.fw;
-				}
-				else if(feature == "fwverb")
-				{
-					ss>>weight.fwverb;
-				}
-			}
-		}
-	}
-}
+#include "scheduler.h"
+#include "pipeline.h"
+#include "modelmanager.h"
+#include "config.h"
+#include "transcache.h"
+#include <signal.h>
+#include <atomic>
 
 void parse_args(int argc, char *argv[],Filenames &fns,Parameter &para, Weight &weight)
 {
@@ -153,11 +18,18 @@ void parse_args(int argc, char *argv[],Filenames &fns,Parameter &para, Weight &w
 			fns.nbest_file = argv[++i];
 			para.NBEST_NUM = stoi(argv[++i]);
 		}
+		else if( arg == "-rule-server" && i+3 < argc )				//-rule-server 分片编号 分片数 监听地址
+		{
+			para.RULE_SHARD_ID = stoi(argv[++i]);
+			para.RULE_SHARD_NUM = stoi(argv[++i]);
+			fns.rule_server_address = argv[++i];
+		}
 
 	}
 }
 
-void translate_file(const Models &models, const Parameter &para, const Weight &weight, const string &input_file, const string &output_file)
+//翻译记忆只在当前模型的版本与计算其模型签名时的版本(trans_cache_version)相同时查找, 在其他版本上解码的结果也不加入
+void translate_file(ModelManager &model_manager, const Parameter &para, const string &input_file, const string &output_file, TransCache &trans_cache, size_t trans_cache_version, Profiler &profiler)
 {
 	ifstream fin(input_file.c_str());
 	if (!fin.is_open())
@@ -180,31 +52,142 @@ void translate_file(const Models &models, const Parameter &para, const Weight &w
 	{
 		TrimLine(line);
 		input_sen.push_back(line);
-		vector<string> vs;
-		Split(vs,line);
-		for (const auto &word : vs)
-		{
-			models.src_vocab->get_id(word);                                             //避免并行时同时修改vocab发生冲突
-		}
 	}
 	int sen_num = input_sen.size();
 	output_sen.resize(sen_num);
 	nbest_tune_info_list.resize(sen_num);
 	applied_rules_list.resize(sen_num);
-#pragma omp parallel for num_threads(para.SEN_THREAD_NUM)
+
+	//查找翻译记忆, 并合并本批次中重复的句子, 每个不同的句子只解码一次
+	vector<TransResult> results(sen_num);
+	vector<size_t> sen2uniq(sen_num);												//每个句子对应的第一次出现的相同句子
+	vector<size_t> uncached_sens;													//需要解码的句子
+	unordered_map<string,size_t> key2sen;
+	size_t cache_hit_num = 0;
+	bool use_trans_cache = (model_manager.get_version() == trans_cache_version);
 	for (size_t i=0;i<sen_num;i++)
 	{
-		SentenceTranslator sen_translator(models,para,weight,input_sen.at(i));
-		output_sen.at(i) = sen_translator.translate_sentence();
+		string key = TransCache::normalize(input_sen.at(i));
+		auto it = key2sen.find(key);
+		if (it != key2sen.end())
+		{
+			sen2uniq.at(i) = it->second;
+			continue;
+		}
+		key2sen.insert(make_pair(key,i));
+		sen2uniq.at(i) = i;
+		if (use_trans_cache && trans_cache.find(key,results.at(i)))
+		{
+			cache_hit_num++;
+		}
+		else
+		{
+			uncached_sens.push_back(i);
+		}
+	}
+	double decode_beg = wall_time();
+	double first_sen_latency = 0.0;													//第一个解码完成的句子的延迟, 句子按代价调度, 不一定是k为0的句子
+	atomic<bool> first_sen_finished(false);
+	vector<SenProfile> sen_profiles(para.PROFILE?uncached_sens.size():0);
+	vector<SenMemory> sen_memories(para.PROFILE?uncached_sens.size():0);
+	vector<pair<size_t,double> > sen_lens_and_times(uncached_sens.size());
+	vector<size_t> sen_model_versions(uncached_sens.size());
+	//取出一个句子的解码结果, 流水线模式下在输出线程中调用
+	auto finish_sentence = [&](size_t k, SentenceTranslator &sen_translator, size_t model_version, double sen_beg)
+	{
+		size_t i = uncached_sens.at(k);
+		sen_model_versions.at(k) = model_version;
+		results.at(i).translation = sen_translator.get_translation();
+		if (!first_sen_finished.exchange(true))
+		{
+			first_sen_latency = wall_time() - decode_beg;
+		}
 		if (para.PRINT_NBEST == true)
 		{
-			nbest_tune_info_list.at(i) = sen_translator.get_tune_info(i);
+			results.at(i).nbest_tune_info = sen_translator.get_tune_info(i);
 		}
 		if (para.DUMP_RULE == true)
 		{
-			applied_rules_list.at(i) = sen_translator.get_applied_rules(i);
+			results.at(i).applied_rules = sen_translator.get_applied_rules(i);
+		}
+		if (para.PROFILE)
+		{
+			sen_profiles.at(k) = sen_translator.get_profile();
+			sen_memories.at(k) = sen_translator.get_memory();
 		}
+		sen_lens_and_times.at(k) = make_pair(sen_translator.get_src_sen_len(),wall_time()-sen_beg);
+	};
+	if (para.MATCH_THREAD_NUM > 0)
+	{
+		DecodePipeline pipeline(model_manager,para);
+		pipeline.run(input_sen,uncached_sens,finish_sentence);
+		pipeline.print_stats();
 	}
+	else
+	{
+		//多线程时先估计每个句子的解码代价, 长句先解码, 避免批次末尾只剩一个线程在解码长句
+		vector<double> costs(uncached_sens.size(),0.0);
+		if (para.SEN_THREAD_NUM > 1)
+		{
+#pragma omp parallel for num_threads(para.SEN_THREAD_NUM) schedule(dynamic,16)
+			for (size_t k=0;k<uncached_sens.size();k++)
+			{
+				ModelSnapshot *snapshot = model_manager.acquire();
+				costs.at(k) = SentenceScheduler::estimate_cost(snapshot->models,para,input_sen.at(uncached_sens.at(k)));
+				model_manager.release(snapshot);
+			}
+		}
+		SentenceScheduler scheduler(para.SEN_THREAD_NUM,para.SPAN_THREAD_NUM);
+		scheduler.schedule(costs);
+#pragma omp parallel num_threads(para.SEN_THREAD_NUM)
+		{
+			size_t k;
+			while (scheduler.next(k))
+			{
+				size_t i = uncached_sens.at(k);
+				double sen_beg = wall_time();
+				TraceScope trace("sentence",i);
+				ModelSnapshot *snapshot = model_manager.acquire();
+				{
+					SentenceTranslator sen_translator(snapshot->models,para,snapshot->weight,input_sen.at(i));
+					sen_translator.set_scheduler(&scheduler);
+					sen_translator.search();
+					finish_sentence(k,sen_translator,snapshot->version,sen_beg);
+				}
+				model_manager.release(snapshot);
+			}
+		}
+	}
+	for (size_t k=0;k<sen_profiles.size();k++)
+	{
+		profiler.add_sentence(uncached_sens.at(k),sen_lens_and_times.at(k).first,sen_lens_and_times.at(k).second,sen_profiles.at(k),sen_memories.at(k));
+	}
+	for (size_t k=0;k<uncached_sens.size();k++)
+	{
+		if (sen_model_versions.at(k) == trans_cache_version)
+		{
+			size_t i = uncached_sens.at(k);
+			trans_cache.insert(TransCache::normalize(input_sen.at(i)),results.at(i));
+		}
+	}
+	for (size_t i=0;i<sen_num;i++)
+	{
+		const TransResult &result = results.at(sen2uniq.at(i));
+		output_sen.at(i) = result.translation;
+		nbest_tune_info_list.at(i) = result.nbest_tune_info;
+		for (auto &tune_info : nbest_tune_info_list.at(i))
+		{
+			tune_info.sen_id = i;
+		}
+		applied_rules_list.at(i) = result.applied_rules;
+	}
+	cout<<"decoded "<<uncached_sens.size()<<" of "<<sen_num<<" sentences, "<<cache_hit_num<<" found in translation cache\n";
+	cout<<"first sentence latency: "<<first_sen_latency<<endl;
+	if (para.PROFILE)
+	{
+		profiler.write_summary(wall_time()-decode_beg,sen_num);
+	}
+
 	for (const auto &sen : output_sen)
 	{
 		fout<<sen<<endl;
@@ -252,46 +235,168 @@ void translate_file(const Models &models, const Parameter &para, const Weight &w
 	}
 }
 
-void load_function_words(set<int> &src_function_words,const string &function_words_file,Vocab *src_vocab)
+/**************************************************************************************
+ 1. 函数功能: 正式解码前用输入文件的前几个句子预热, 使模型用到的页以及各种缓存驻留内存
+ 2. 入口参数: 模型, 参数, 特征权重, 输入文件
+ 3. 出口参数: 无
+ 4. 算法简介: 解码结果直接丢弃, 也不加入翻译记忆
+************************************************************************************* */
+void warm_up(ModelManager &model_manager, const Parameter &para, const string &input_file)
 {
-	ifstream fin(function_words_file.c_str());
+	ifstream fin(input_file.c_str());
 	if (!fin.is_open())
 	{
-		cerr<<"cannot open function words file!\n";
+		cerr<<"cannot open input file!\n";
 		return;
 	}
 	string line;
-	while(getline(fin,line))
+	ModelSnapshot *snapshot = model_manager.acquire();
+	for (size_t i=0;i<para.WARM_UP && getline(fin,line);i++)
 	{
 		TrimLine(line);
-		src_function_words.insert(src_vocab->get_id(line));
+		SentenceTranslator sen_translator(snapshot->models,para,snapshot->weight,line);
+		sen_translator.translate_sentence();
 	}
+	model_manager.release(snapshot);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 后台重新加载模型的线程
+ 2. 入口参数: 模型管理器
+ 3. 出口参数: 无
+ 4. 算法简介: 所有线程都屏蔽SIGHUP, 由本线程用sigwait同步等待; 每收到一次SIGHUP重新读取config.ini,
+ 			  按其中的模型文件和特征权重加载新的模型快照并替换当前快照, 解码参数不重新读取
+************************************************************************************* */
+void* reload_thread(void *arg)
+{
+	ModelManager *model_manager = (ModelManager*)arg;
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs,SIGHUP);
+	while (true)
+	{
+		int sig;
+		if (sigwait(&sigs,&sig) != 0)
+			continue;
+		Filenames fns;
+		Parameter para;
+		Weight weight;
+		read_config(fns,para,weight,"config.ini");
+		cout<<"SIGHUP received, reloading models\n";
+		model_manager->reload(fns,weight);
+	}
+	return NULL;
 }
 
 int main( int argc, char *argv[])
 {
-	clock_t a,b;
-	a = clock();
+	double a,b;
+	a = wall_time();
 
 	omp_set_nested(1);
 	Filenames fns;
 	Parameter para;
 	Weight weight;
 	parse_args(argc,argv,fns,para,weight);
+	Tracer::open(fns.trace_file);
 
-	Vocab *src_vocab = new Vocab(fns.src_vocab_file);
-	Vocab *tgt_vocab = new Vocab(fns.tgt_vocab_file);
-	RuleTable *ruletable = new RuleTable(para.RULE_NUM_LIMIT,weight,fns.rule_table_file);
-	LanguageModel *lm_model = new LanguageModel(fns.lm_file,tgt_vocab);
-	set<int> src_function_words;
-	load_function_words(src_function_words,fns.fw_file,src_vocab);
+	double load_beg = wall_time();
+	if (fns.rule_server_address != "")											//只作为规则表分片服务运行, 不加载语言模型
+	{
+		LoadOption load_option = {para.LOAD_METHOD,para.HUGE_PAGES,para.PREFAULT};
+		Vocab *src_vocab = new Vocab(fns.src_vocab_file);
+		src_vocab->add_word("[X][X]");
+		if (para.RULE_SHARD_NUM == 0 || para.RULE_SHARD_ID >= para.RULE_SHARD_NUM || BlockRuleTable::is_block_file(fns.rule_table_file))
+		{
+			cerr<<"bad rule server shard "<<para.RULE_SHARD_ID<<"/"<<para.RULE_SHARD_NUM<<" or rule table format, bye\n";
+			exit(EXIT_FAILURE);
+		}
+		RuleTable *table = new RuleTable(para.RULE_NUM_LIMIT,weight,fns.rule_table_file,load_option,para.RULE_SHARD_ID,para.RULE_SHARD_NUM,src_vocab->get_id("[X][X]"));
+		cout<<"rule table shard memory: "<<table->memory_bytes()/1024/1024<<"MB"<<endl;
+		RuleShardServer server(table,para.RULE_SHARD_ID,para.RULE_SHARD_NUM);
+		server.serve(fns.rule_server_address);
+		return 0;
+	}
+	//在创建任何线程之前屏蔽SIGHUP, 之后创建的线程继承屏蔽字, SIGHUP只由reload_thread接收
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs,SIGHUP);
+	pthread_sigmask(SIG_BLOCK,&sigs,NULL);
+	ModelManager *model_manager = new ModelManager(fns,para,weight);
+	ModelSnapshot *snapshot = model_manager->acquire();
+	size_t initial_version = snapshot->version;
+	Profiler profiler(fns.profile_file);
+	if (para.PROFILE)
+	{
+		profiler.add_model_bytes("rule_table",snapshot->models.ruletable->memory_bytes());
+		profiler.add_model_bytes("lm",snapshot->models.lm_model->memory_bytes());
+		profiler.add_model_bytes("src_vocab",snapshot->models.src_vocab->memory_bytes());
+		profiler.add_model_bytes("tgt_vocab",snapshot->models.tgt_vocab->memory_bytes());
+	}
+	double rule_table_time = snapshot->rule_table_time;
+	double lm_time = snapshot->lm_time;
+	model_manager->release(snapshot);
+	pthread_t reload_tid;
+	if (pthread_create(&reload_tid,NULL,reload_thread,model_manager) == 0)
+	{
+		pthread_detach(reload_tid);
+	}
 
-	b = clock();
-	cout<<"loading time: "<<double(b-a)/CLOCKS_PER_SEC<<endl;
+	b = wall_time();
+	cout<<"loading time: "<<b-a<<endl;
 
-	Models models = {src_vocab,tgt_vocab,ruletable,lm_model,&src_function_words};
-	translate_file(models,para,weight,fns.input_file,fns.output_file);
-	b = clock();
-	cout<<"time cost: "<<double(b-a)/CLOCKS_PER_SEC<<endl;
+	double warm_up_beg = wall_time();
+	warm_up(*model_manager,para,fns.input_file);
+	double warm_up_end = wall_time();
+	cout<<"load method: "<<load_method_name(para.LOAD_METHOD)<<" huge pages: "<<para.HUGE_PAGES<<" prefault: "<<para.PREFAULT
+		<<" rule table: "<<rule_table_time<<"s language model: "<<lm_time<<"s warm up ("<<para.WARM_UP<<" sentences): "
+		<<warm_up_end-warm_up_beg<<"s startup: "<<warm_up_end-load_beg<<"s"<<endl;
+	LMQueryRecorder *lm_recorder = NULL;
+	size_t lm_trace_version = 0;
+	if (fns.lm_trace_file != "")												//预热之后再开始记录, 只记录此时的语言模型
+	{
+		snapshot = model_manager->acquire();
+		lm_trace_version = snapshot->version;
+		lm_recorder = new LMQueryRecorder(fns.lm_trace_file,snapshot->models.tgt_vocab);
+		snapshot->models.lm_model->set_recorder(lm_recorder);
+		model_manager->release(snapshot);
+	}
+	TransCache trans_cache(fns.trans_cache_file,TransCache::cal_model_sig(fns,para,weight));
+	translate_file(*model_manager,para,fns.input_file,fns.output_file,trans_cache,initial_version,profiler);
+	trans_cache.save();
+	snapshot = model_manager->acquire();
+	if (lm_recorder != NULL)
+	{
+		if (snapshot->version == lm_trace_version)
+		{
+			snapshot->models.lm_model->set_recorder(NULL);
+		}
+		delete lm_recorder;
+	}
+	if (snapshot->version != initial_version)
+	{
+		cout<<"models reloaded during decoding, current version "<<snapshot->version<<", statistics below are for the current version\n";
+	}
+	if (para.LM_CACHE_SIZE > 0)
+	{
+		size_t hit_num,miss_num;
+		snapshot->models.lm_model->get_cache_stats(hit_num,miss_num);
+		cout<<"lm cache hits: "<<hit_num<<" misses: "<<miss_num<<" hit rate: "<<(hit_num+miss_num==0?0.0:double(hit_num)/(hit_num+miss_num))<<endl;
+	}
+	if (snapshot->block_table != NULL)
+	{
+		size_t hit_num,miss_num;
+		snapshot->block_table->get_cache_stats(hit_num,miss_num);
+		cout<<"rule block cache hits: "<<hit_num<<" misses: "<<miss_num<<" hit rate: "<<(hit_num+miss_num==0?0.0:double(hit_num)/(hit_num+miss_num))<<endl;
+	}
+	if (snapshot->remote_table != NULL)
+	{
+		size_t hit_num,miss_num;
+		snapshot->remote_table->get_cache_stats(hit_num,miss_num);
+		cout<<"rule server sentence cache hits: "<<hit_num<<" misses: "<<miss_num<<" hit rate: "<<(hit_num+miss_num==0?0.0:double(hit_num)/(hit_num+miss_num))<<endl;
+	}
+	model_manager->release(snapshot);
+	b = wall_time();
+	cout<<"time cost: "<<b-a<<endl;
 	return 0;
 }
@@ -0,0 +1,210 @@
+#include "modelmanager.h"
+#include "sagrammar.h"
+#include <sys/stat.h>
+
+static void load_function_words(set<int> &src_function_words,const string &function_words_file,Vocab *src_vocab)
+{
+	ifstream fin(function_words_file.c_str());
+	if (!fin.is_open())
+	{
+		cerr<<"cannot open function words file!\n";
+		return;
+	}
+	string line;
+	while(getline(fin,line))
+	{
+		TrimLine(line);
+		src_function_words.insert(src_vocab->add_word(line));
+	}
+}
+
+ModelManager::ModelManager(const Filenames &fns, const Parameter &i_para, const Weight &weight)
+{
+	para = i_para;
+	pthread_mutex_init(&mutex,NULL);
+	pthread_mutex_init(&reload_mutex,NULL);
+	next_version = 1;
+	current = load_snapshot(fns,weight);
+}
+
+ModelManager::~ModelManager()
+{
+	free_snapshot(current);
+	for (auto snapshot : retired_snapshots)
+	{
+		free_snapshot(snapshot);
+	}
+	pthread_mutex_destroy(&mutex);
+	pthread_mutex_destroy(&reload_mutex);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 按配置加载规则来源
+ 2. 入口参数: 模型文件名, 参数, 特征权重, 中英文词表
+ 3. 出口参数: 规则来源; 是按块压缩的规则表或规则表分片服务时通过block_table或remote_table返回, 否则二者为NULL
+ 4. 算法简介: 依次检查规则表分片服务的地址, 后缀数组索引, 规则表文件是否为按块压缩的格式, 否则加载普通规则表
+ 			  (包括量化的规则表); 不调用fill_kenlm_ids
+************************************************************************************* */
+RuleSource* ModelManager::load_rule_source(const Filenames &fns, const Parameter &para, const Weight &weight, Vocab *src_vocab, Vocab *tgt_vocab,
+										   BlockRuleTable *&block_table, RemoteRuleTable *&remote_table)
+{
+	LoadOption load_option = {para.LOAD_METHOD,para.HUGE_PAGES,para.PREFAULT};
+	block_table = NULL;
+	remote_table = NULL;
+	if (fns.rule_servers != "")
+	{
+		vector<string> addresses;
+		stringstream ss(fns.rule_servers);
+		string address;
+		while (ss >> address)
+		{
+			addresses.push_back(address);
+		}
+		remote_table = new RemoteRuleTable(addresses,weight,src_vocab->get_id("[X][X]"),para.RULE_SERVER_CACHE_SIZE);
+		return remote_table;
+	}
+	if (fns.sa_corpus_file != "")
+	{
+		return new SAGrammar(fns.sa_corpus_file,src_vocab->get_id("[X][X]"),tgt_vocab->add_word("[X][X]"),para,weight,load_option);
+	}
+	if (BlockRuleTable::is_block_file(fns.rule_table_file))
+	{
+		block_table = new BlockRuleTable(para.RULE_NUM_LIMIT,weight,fns.rule_table_file,para.RULE_BLOCK_CACHE_SIZE,load_option);
+		if (fns.rule_filter_file != "")
+		{
+			block_table->load_filter(fns.rule_filter_file,load_option);
+		}
+		return block_table;
+	}
+	RuleTable *table = new RuleTable(para.RULE_NUM_LIMIT,weight,fns.rule_table_file,load_option);
+	if (fns.rule_filter_file != "")
+	{
+		table->load_filter(fns.rule_filter_file,load_option);
+	}
+	return table;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 加载一组模型
+ 2. 入口参数: 模型文件名, 特征权重
+ 3. 出口参数: 引用计数为0的新快照
+ 4. 算法简介: 规则来源见load_rule_source; 每个快照有自己的词表, 加载时加入词表的单词不影响正在解码的旧快照
+************************************************************************************* */
+ModelSnapshot* ModelManager::load_snapshot(const Filenames &fns, const Weight &weight)
+{
+	LoadOption load_option = {para.LOAD_METHOD,para.HUGE_PAGES,para.PREFAULT};
+	ModelSnapshot *snapshot = new ModelSnapshot;
+	snapshot->version = next_version++;
+	snapshot->weight = weight;
+	snapshot->ref_num = 0;
+	Vocab *src_vocab = new Vocab(fns.src_vocab_file);
+	Vocab *tgt_vocab = new Vocab(fns.tgt_vocab_file);
+	src_vocab->add_word("[X][X]");
+	double rule_table_beg = wall_time();
+	RuleSource *ruletable = load_rule_source(fns,para,weight,src_vocab,tgt_vocab,snapshot->block_table,snapshot->remote_table);
+	double lm_beg = wall_time();
+	LanguageModel *lm_model = LanguageModel::create(fns.lm_file,tgt_vocab,para.LM_CACHE_SIZE,load_option);
+	double lm_end = wall_time();
+	ruletable->fill_kenlm_ids(lm_model);
+	load_function_words(snapshot->src_function_words,fns.fw_file,src_vocab);
+	snapshot->models = {src_vocab,tgt_vocab,ruletable,lm_model,&snapshot->src_function_words};
+	snapshot->rule_table_time = lm_beg-rule_table_beg;
+	snapshot->lm_time = lm_end-lm_beg;
+	return snapshot;
+}
+
+void ModelManager::free_snapshot(ModelSnapshot *snapshot)
+{
+	delete snapshot->models.ruletable;
+	delete snapshot->models.lm_model;
+	delete snapshot->models.src_vocab;
+	delete snapshot->models.tgt_vocab;
+	delete snapshot;
+}
+
+//取得当前快照, 调用者用完后必须release
+ModelSnapshot* ModelManager::acquire()
+{
+	pthread_mutex_lock(&mutex);
+	ModelSnapshot *snapshot = current;
+	snapshot->ref_num++;
+	pthread_mutex_unlock(&mutex);
+	return snapshot;
+}
+
+void ModelManager::release(ModelSnapshot *snapshot)
+{
+	bool to_free = false;
+	pthread_mutex_lock(&mutex);
+	snapshot->ref_num--;
+	if (snapshot->ref_num == 0 && snapshot != current)
+	{
+		retired_snapshots.erase(find(retired_snapshots.begin(),retired_snapshots.end(),snapshot));
+		to_free = true;
+	}
+	pthread_mutex_unlock(&mutex);
+	if (to_free)
+	{
+		cout<<"models version "<<snapshot->version<<" released\n";
+		free_snapshot(snapshot);
+	}
+}
+
+/**************************************************************************************
+ 1. 函数功能: 重新加载模型并替换当前快照
+ 2. 入口参数: 新的模型文件名和特征权重
+ 3. 出口参数: 是否替换成功
+ 4. 算法简介: 加载时不持有mutex, 解码线程照常acquire旧快照; 加载完成后在锁内替换,
+ 			  之后开始的句子使用新快照, 旧快照没有句子使用时立即释放, 否则由最后一个句子的release释放.
+ 			  加载模型的各个类遇到错误时直接退出进程, 因此先检查必需的文件是否存在, 不存在时保留旧快照
+************************************************************************************* */
+bool ModelManager::reload(const Filenames &fns, const Weight &weight)
+{
+	vector<string> model_files = {fns.src_vocab_file,fns.tgt_vocab_file,fns.lm_file};
+	if (fns.rule_servers == "")
+	{
+		model_files.push_back(fns.sa_corpus_file != "" ? fns.sa_corpus_file : fns.rule_table_file);
+	}
+	for (const auto &model_file : model_files)
+	{
+		struct stat st;
+		if (stat(model_file.c_str(),&st) != 0)
+		{
+			cerr<<"cannot find model file "<<model_file<<", keep models version "<<get_version()<<endl;
+			return false;
+		}
+	}
+	pthread_mutex_lock(&reload_mutex);
+	double beg = wall_time();
+	ModelSnapshot *snapshot = load_snapshot(fns,weight);
+	bool to_free = false;
+	pthread_mutex_lock(&mutex);
+	ModelSnapshot *old_snapshot = current;
+	current = snapshot;
+	size_t in_flight = old_snapshot->ref_num;
+	if (in_flight == 0)
+	{
+		to_free = true;
+	}
+	else
+	{
+		retired_snapshots.push_back(old_snapshot);
+	}
+	pthread_mutex_unlock(&mutex);
+	cout<<"models version "<<snapshot->version<<" loaded in "<<wall_time()-beg<<"s, replacing version "<<old_snapshot->version
+		<<" ("<<in_flight<<" sentences in flight)\n";
+	if (to_free)
+	{
+		free_snapshot(old_snapshot);
+	}
+	pthread_mutex_unlock(&reload_mutex);
+	return true;
+}
+
+size_t ModelManager::get_version()
+{
+	pthread_mutex_lock(&mutex);
+	size_t version = current->version;
+	pthread_mutex_unlock(&mutex);
+	return version;
+}
@@ -0,0 +1,51 @@
+#ifndef MODELMANAGER_H
+#define MODELMANAGER_H
+
+#include "stdafx.h"
+#include "translator.h"
+#include "blockruletable.h"
+#include "remoteruletable.h"
+
+//一次加载的词表、规则来源、语言模型、功能词和特征权重, 加载完成后只读;
+//解码一个句子前acquire, 句子的所有结果取出后release, 被替换的快照在最后一个使用它的句子结束时释放
+struct ModelSnapshot
+{
+	size_t version;								//从1开始, 每次重新加载加1
+	Models models;
+	Weight weight;
+	set<int> src_function_words;
+	BlockRuleTable *block_table;				//规则来源的具体类型, 用于输出缓存统计, 不是该类型时为NULL
+	RemoteRuleTable *remote_table;
+	double rule_table_time;						//加载规则来源和语言模型的耗时
+	double lm_time;
+	size_t ref_num;								//正在使用该快照的句子数
+};
+
+//管理当前的模型快照, 重新加载在调用者的线程(通常是后台线程)中完成, 加载期间解码照常使用旧快照,
+//加载完成后在锁内替换当前快照的指针; 加载的参数(规则数限制, 加载方式, 缓存大小等)在进程启动时确定, 重新加载时不变
+class ModelManager
+{
+	public:
+		ModelManager(const Filenames &fns, const Parameter &i_para, const Weight &weight);
+		~ModelManager();
+		ModelSnapshot* acquire();
+		void release(ModelSnapshot *snapshot);
+		bool reload(const Filenames &fns, const Weight &weight);
+		size_t get_version();
+		static RuleSource* load_rule_source(const Filenames &fns, const Parameter &para, const Weight &weight, Vocab *src_vocab, Vocab *tgt_vocab,
+											BlockRuleTable *&block_table, RemoteRuleTable *&remote_table);
+
+	private:
+		ModelSnapshot* load_snapshot(const Filenames &fns, const Weight &weight);
+		void free_snapshot(ModelSnapshot *snapshot);
+
+	private:
+		Parameter para;
+		pthread_mutex_t mutex;						//保护current和所有快照的ref_num
+		ModelSnapshot *current;
+		vector<ModelSnapshot*> retired_snapshots;	//已被替换但还有句子在使用的快照
+		pthread_mutex_t reload_mutex;				//同一时刻只进行一次重新加载
+		size_t next_version;
+};
+
+#endif
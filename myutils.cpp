@@ -24,6 +24,25 @@ void Split(vector <string> &vs, string &s, string &sep)
 	vs.push_back(s.substr(cur));
 }
 
+//按空白切分, 切出的单词指向s的内存, 不拷贝
+void Split(vector<StringPiece> &vs, const StringPiece &s)
+{
+	vs.clear();
+	const char *p = s.data();
+	const char *end = s.data()+s.size();
+	while (true)
+	{
+		while (p != end && isspace((unsigned char)*p))
+			p++;
+		if (p == end)
+			break;
+		const char *word_beg = p;
+		while (p != end && !isspace((unsigned char)*p))
+			p++;
+		vs.push_back(StringPiece(word_beg,p-word_beg));
+	}
+}
+
 void TrimLine(string &line)
 {
 	line.erase(0,line.find_first_not_of(" \t\r\n"));
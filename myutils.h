@@ -1,5 +1,7 @@
 #include "stdafx.h"
+#include "util/string_piece.hh"
 
 void TrimLine(string &line);
 void Split(vector<string> &vs, string &s);
 void Split(vector<string> &vs, string &s, string &sep);
+void Split(vector<StringPiece> &vs, const StringPiece &s);
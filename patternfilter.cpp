@@ -0,0 +1,152 @@
+#include "patternfilter.h"
+#include "util/exception.hh"
+
+const char PATTERN_FILTER_MAGIC[8] = {'H','I','E','R','O','B','F','1'};
+const uint64_t PATTERN_FILTER_MAX_HASH_NUM = 7;		//每个比特位置用9位, 一个64位哈希值最多提供7个
+
+//MurmurHash3的64位终结函数
+static inline uint64_t fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+PatternFilter::PatternFilter()
+{
+	key_num = 0;
+	block_num = 0;
+	hash_num = 0;
+	blocks = NULL;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 按键数和期望的假阳性率创建空的过滤器
+ 2. 入口参数: 键数, 假阳性率
+ 3. 出口参数: 无
+ 4. 算法简介: 按标准Bloom过滤器的公式计算每个键的比特数 -ln(p)/ln(2)^2 和哈希个数 ln(2)*比特数;
+ 			  分块后实际的假阳性率略高于p
+************************************************************************************* */
+PatternFilter::PatternFilter(size_t i_key_num, double fp_rate)
+{
+	fp_rate = min(max(fp_rate,1e-6),0.5);
+	double bits_per_key = -log(fp_rate)/(log(2.0)*log(2.0));
+	key_num = i_key_num;
+	block_num = max((uint64_t)ceil(key_num*bits_per_key/(BLOCK_WORDS*64)),(uint64_t)1);
+	hash_num = min(max((uint64_t)(bits_per_key*log(2.0)+0.5),(uint64_t)1),PATTERN_FILTER_MAX_HASH_NUM);
+	own_blocks.resize(block_num*BLOCK_WORDS,0);
+	blocks = own_blocks.data();
+}
+
+uint64_t PatternFilter::extend_hash(uint64_t h, int wid)
+{
+	return fmix64(h*0x9e3779b97f4a7c15ULL + (uint32_t)wid + 1);
+}
+
+//规则表的内容哈希为所有规则源端的哈希值之和, 与规则的顺序无关, prob.bin和按块压缩的规则表得到相同的值;
+//过滤器只取决于规则源端, 源端相同而目标端或概率不同(如量化)的规则表可以共用过滤器
+uint64_t PatternFilter::add_rule_source(uint64_t sum, const int *src_wids, size_t len)
+{
+	uint64_t h = start_hash();
+	for (size_t i=0;i<len;i++)
+	{
+		h = extend_hash(h,src_wids[i]);
+	}
+	return sum + fmix64(h ^ len);
+}
+
+//高32位选块, 低位经过再次混合后每9位给出块内的一个比特位置
+void PatternFilter::insert(uint64_t h)
+{
+	uint64_t *block = blocks + ((h>>32)*block_num>>32)*BLOCK_WORDS;
+	uint64_t g = (h^(h>>29))*0xbf58476d1ce4e5b9ULL;
+	for (uint64_t i=0;i<hash_num;i++,g>>=9)
+	{
+		block[(g&511)>>6] |= 1ULL<<(g&63);
+	}
+}
+
+bool PatternFilter::may_contain(uint64_t h) const
+{
+	const uint64_t *block = blocks + ((h>>32)*block_num>>32)*BLOCK_WORDS;
+	uint64_t g = (h^(h>>29))*0xbf58476d1ce4e5b9ULL;
+	for (uint64_t i=0;i<hash_num;i++,g>>=9)
+	{
+		if ((block[(g&511)>>6] & (1ULL<<(g&63))) == 0)
+			return false;
+	}
+	return true;
+}
+
+//按块内已置位比特的比例估计假阳性率
+double PatternFilter::expected_fp_rate() const
+{
+	size_t set_bits = 0;
+	for (size_t i=0;i<block_num*BLOCK_WORDS;i++)
+	{
+		set_bits += __builtin_popcountll(blocks[i]);
+	}
+	return pow((double)set_bits/(block_num*BLOCK_WORDS*64),(double)hash_num);
+}
+
+bool PatternFilter::write(const string &filter_file, uint64_t rule_source_hash)
+{
+	PatternFilterHeader header;
+	memset(&header,0,sizeof(header));
+	memcpy(header.magic,PATTERN_FILTER_MAGIC,sizeof(header.magic));
+	header.key_num = key_num;
+	header.block_num = block_num;
+	header.hash_num = hash_num;
+	header.rule_source_hash = rule_source_hash;
+	ofstream fout(filter_file.c_str(),ios::binary);
+	if (!fout.is_open())
+	{
+		cerr<<"fail open pattern filter file to write!\n";
+		return false;
+	}
+	fout.write((char*)&header,sizeof(header));
+	fout.write((char*)blocks,memory_bytes());
+	fout.close();
+	return true;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 加载过滤器文件
+ 2. 入口参数: 过滤器文件, 当前规则表的内容哈希, 加载方式
+ 3. 出口参数: 是否加载成功
+ 4. 算法简介: 过滤器与规则表不匹配时不能使用, 否则会把存在的pattern误判为不存在
+************************************************************************************* */
+bool PatternFilter::load(const string &filter_file, uint64_t rule_source_hash, const LoadOption &load_option)
+{
+	size_t file_size = 0;
+	try
+	{
+		file_size = load_file(filter_file,load_option,mem);
+	}
+	catch (util::Exception &e)
+	{
+		cerr<<"cannot open pattern filter file!\n";
+		return false;
+	}
+	const PatternFilterHeader *header = (const PatternFilterHeader*)mem.begin();
+	if (file_size < sizeof(PatternFilterHeader) || memcmp(header->magic,PATTERN_FILTER_MAGIC,sizeof(header->magic)) != 0
+		|| file_size != sizeof(PatternFilterHeader)+header->block_num*BLOCK_WORDS*sizeof(uint64_t) || header->hash_num > PATTERN_FILTER_MAX_HASH_NUM)
+	{
+		cerr<<filter_file<<" is not a pattern filter file\n";
+		return false;
+	}
+	if (header->rule_source_hash != rule_source_hash)
+	{
+		cerr<<"pattern filter "<<filter_file<<" was built for another rule table, ignored\n";
+		return false;
+	}
+	key_num = header->key_num;
+	block_num = header->block_num;
+	hash_num = header->hash_num;
+	blocks = (uint64_t*)(mem.begin()+sizeof(PatternFilterHeader));
+	cout<<"load pattern filter file "<<filter_file<<" over, "<<key_num<<" patterns, "<<memory_bytes()<<" bytes\n";
+	return true;
+}
@@ -0,0 +1,46 @@
+#ifndef PATTERNFILTER_H
+#define PATTERNFILTER_H
+
+#include "stdafx.h"
+#include "fileloader.h"
+
+//过滤器文件头, 之后为block_num个64字节的块; 文件头补齐到64字节, 使mmap后每个块正好占一条缓存行
+struct PatternFilterHeader
+{
+	char magic[8];
+	uint64_t key_num;
+	uint64_t block_num;
+	uint64_t hash_num;							//每个键在块内置位的比特数
+	uint64_t rule_source_hash;					//生成过滤器时规则表的内容哈希, 见add_rule_source, 用来检查两者是否匹配
+	char padding[24];
+};
+
+//规则源端pattern及其所有前缀的分块Bloom过滤器, 由ruletable2bin生成
+//每个键只访问一个64字节(一条缓存行)的块, 块内的各个比特由同一个哈希值的不同位段决定;
+//pattern的哈希值逐个单词累加计算, 查询前缀时不需要重新计算
+class PatternFilter
+{
+	public:
+		PatternFilter();
+		PatternFilter(size_t key_num, double fp_rate);
+		static uint64_t start_hash() {return 0x9e3779b97f4a7c15ULL;};
+		static uint64_t extend_hash(uint64_t h, int wid);
+		static uint64_t add_rule_source(uint64_t sum, const int *src_wids, size_t len);
+		void insert(uint64_t h);
+		bool may_contain(uint64_t h) const;
+		bool write(const string &filter_file, uint64_t rule_source_hash);
+		bool load(const string &filter_file, uint64_t rule_source_hash, const LoadOption &load_option);
+		double expected_fp_rate() const;
+		size_t memory_bytes() const {return block_num*BLOCK_WORDS*sizeof(uint64_t);};
+
+	private:
+		static const size_t BLOCK_WORDS = 8;	//每个块的64位字数
+		uint64_t key_num;
+		uint64_t block_num;
+		uint64_t hash_num;
+		uint64_t *blocks;
+		vector<uint64_t> own_blocks;			//生成过滤器时使用
+		util::scoped_memory mem;				//加载的过滤器文件
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include "pipeline.h"
+
+static const char* STAGE_NAMES[STAGE_NUM] = {"match","search","output"};
+
+DecodePipeline::DecodePipeline(ModelManager &i_model_manager, const Parameter &i_para) : model_manager(i_model_manager), para(i_para)
+{
+	size_t thread_nums[STAGE_NUM] = {para.MATCH_THREAD_NUM,para.SEARCH_THREAD_NUM,para.OUTPUT_THREAD_NUM};
+	for (size_t stage=0;stage<STAGE_NUM;stage++)
+	{
+		memset(&stats[stage],0,sizeof(StageStats));
+		stats[stage].thread_num = max(thread_nums[stage],(size_t)1);
+	}
+	wall_time_used = 0.0;
+	pthread_mutex_init(&stats_mutex,NULL);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 流水线解码一批句子
+ 2. 入口参数: 所有输入句子, 需要解码的句子编号, 每个句子输出阶段完成后的回调
+ 3. 出口参数: 无
+ 4. 算法简介: 匹配线程按顺序领取句子, 构造SentenceTranslator后放入匹配-搜索队列; 搜索线程完成立方体剪枝后
+ 			  放入搜索-输出队列; 输出线程调用回调取出结果后释放SentenceTranslator和模型快照.
+ 			  一个阶段的最后一个线程结束时向下一阶段的每个线程发送一个结束标记.
+ 			  队列容量为下游线程数的两倍, 限制同时存在的chart数
+************************************************************************************* */
+void DecodePipeline::run(const vector<string> &i_input_sen, const vector<size_t> &i_sens, FinishFunc i_finish)
+{
+	input_sen = &i_input_sen;
+	sens = &i_sens;
+	finish = i_finish;
+	next_k = 0;
+	for (size_t stage=0;stage<STAGE_NUM;stage++)
+	{
+		finished_thread_nums[stage] = 0;
+	}
+	match2search = new BoundedQueue<Item>(2*stats[STAGE_SEARCH].thread_num);
+	search2output = new BoundedQueue<Item>(2*stats[STAGE_OUTPUT].thread_num);
+
+	double beg = wall_time();
+	vector<pthread_t> threads;
+	vector<ThreadArg> args;
+	for (size_t stage=0;stage<STAGE_NUM;stage++)
+	{
+		for (size_t t=0;t<stats[stage].thread_num;t++)
+		{
+			ThreadArg arg = {this,(PipelineStage)stage};
+			args.push_back(arg);
+		}
+	}
+	threads.resize(args.size());
+	for (size_t t=0;t<args.size();t++)
+	{
+		if (pthread_create(&threads[t],NULL,stage_thread,&args[t]) != 0)
+		{
+			cerr<<"fail to create pipeline thread, bye\n";
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (auto thread : threads)
+	{
+		pthread_join(thread,NULL);
+	}
+	wall_time_used += wall_time()-beg;
+
+	delete match2search;
+	delete search2output;
+}
+
+void* DecodePipeline::stage_thread(void *arg)
+{
+	ThreadArg *thread_arg = (ThreadArg*)arg;
+	switch (thread_arg->stage)
+	{
+		case STAGE_MATCH:
+			thread_arg->pipeline->run_match();
+			break;
+		case STAGE_SEARCH:
+			thread_arg->pipeline->run_search();
+			break;
+		default:
+			thread_arg->pipeline->run_output();
+	}
+	return NULL;
+}
+
+void DecodePipeline::run_match()
+{
+	StageStats thread_stats;
+	memset(&thread_stats,0,sizeof(StageStats));
+	while (true)
+	{
+		size_t k = next_k++;
+		if (k >= sens->size())
+			break;
+		double beg = wall_time();
+		size_t i = sens->at(k);
+		Item item = {k,NULL,model_manager.acquire(),beg};
+		{
+			TraceScope trace("pipeline_match",i);
+			item.sen_translator = new SentenceTranslator(item.snapshot->models,para,item.snapshot->weight,input_sen->at(i));
+		}
+		double end = wall_time();
+		match2search->push(item);
+		thread_stats.busy_time += end-beg;
+		thread_stats.blocked_time += wall_time()-end;
+		thread_stats.sen_num++;
+	}
+	add_stats(STAGE_MATCH,thread_stats);
+	finish_stage(STAGE_MATCH,match2search);
+}
+
+void DecodePipeline::run_search()
+{
+	StageStats thread_stats;
+	memset(&thread_stats,0,sizeof(StageStats));
+	while (true)
+	{
+		double beg = wall_time();
+		Item item = match2search->pop();
+		double pop_end = wall_time();
+		thread_stats.starved_time += pop_end-beg;
+		if (item.sen_translator == NULL)
+			break;
+		{
+			TraceScope trace("pipeline_search",sens->at(item.k));
+			item.sen_translator->search();
+		}
+		double end = wall_time();
+		search2output->push(item);
+		thread_stats.busy_time += end-pop_end;
+		thread_stats.blocked_time += wall_time()-end;
+		thread_stats.sen_num++;
+	}
+	add_stats(STAGE_SEARCH,thread_stats);
+	finish_stage(STAGE_SEARCH,search2output);
+}
+
+void DecodePipeline::run_output()
+{
+	StageStats thread_stats;
+	memset(&thread_stats,0,sizeof(StageStats));
+	while (true)
+	{
+		double beg = wall_time();
+		Item item = search2output->pop();
+		double pop_end = wall_time();
+		thread_stats.starved_time += pop_end-beg;
+		if (item.sen_translator == NULL)
+			break;
+		{
+			TraceScope trace("pipeline_output",sens->at(item.k));
+			finish(item.k,*item.sen_translator,item.snapshot->version,item.sen_beg);
+			delete item.sen_translator;
+			model_manager.release(item.snapshot);
+		}
+		thread_stats.busy_time += wall_time()-pop_end;
+		thread_stats.sen_num++;
+	}
+	add_stats(STAGE_OUTPUT,thread_stats);
+}
+
+//阶段的最后一个线程结束时, 通知下一阶段的所有线程结束
+void DecodePipeline::finish_stage(PipelineStage stage, BoundedQueue<Item> *next_queue)
+{
+	if (++finished_thread_nums[stage] < stats[stage].thread_num)
+		return;
+	Item end_item = {0,NULL,NULL,0.0};
+	for (size_t t=0;t<stats[stage+1].thread_num;t++)
+	{
+		next_queue->push(end_item);
+	}
+}
+
+void DecodePipeline::add_stats(PipelineStage stage, const StageStats &thread_stats)
+{
+	pthread_mutex_lock(&stats_mutex);
+	stats[stage].sen_num += thread_stats.sen_num;
+	stats[stage].busy_time += thread_stats.busy_time;
+	stats[stage].starved_time += thread_stats.starved_time;
+	stats[stage].blocked_time += thread_stats.blocked_time;
+	pthread_mutex_unlock(&stats_mutex);
+}
+
+//输出各阶段的利用率, 即处理句子的时间占线程数乘以总时间的比例; 利用率低且等待上游时间长的阶段线程过多
+void DecodePipeline::print_stats()
+{
+	cout<<"pipeline stages (wall time "<<wall_time_used<<"s):\n";
+	for (size_t stage=0;stage<STAGE_NUM;stage++)
+	{
+		const StageStats &s = stats[stage];
+		double capacity = s.thread_num*wall_time_used;
+		cout<<"  "<<STAGE_NAMES[stage]<<": "<<s.thread_num<<" threads, "<<s.sen_num<<" sentences, utilization "
+			<<(capacity>0?100.0*s.busy_time/capacity:0.0)<<"%, busy "<<s.busy_time<<"s, starved "<<s.starved_time
+			<<"s, blocked "<<s.blocked_time<<"s\n";
+	}
+}
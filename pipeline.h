@@ -0,0 +1,122 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "stdafx.h"
+#include "translator.h"
+#include "modelmanager.h"
+#include <atomic>
+
+//有界阻塞队列, 队列满时push等待, 队列空时pop等待
+template <class T> class BoundedQueue
+{
+	public:
+		BoundedQueue(size_t i_capacity) : capacity(max(i_capacity,(size_t)1))
+		{
+			pthread_mutex_init(&mutex,NULL);
+			pthread_cond_init(&not_full,NULL);
+			pthread_cond_init(&not_empty,NULL);
+		};
+		~BoundedQueue()
+		{
+			pthread_mutex_destroy(&mutex);
+			pthread_cond_destroy(&not_full);
+			pthread_cond_destroy(&not_empty);
+		};
+		void push(const T &item)
+		{
+			pthread_mutex_lock(&mutex);
+			while (items.size() >= capacity)
+			{
+				pthread_cond_wait(&not_full,&mutex);
+			}
+			items.push(item);
+			pthread_cond_signal(&not_empty);
+			pthread_mutex_unlock(&mutex);
+		};
+		T pop()
+		{
+			pthread_mutex_lock(&mutex);
+			while (items.empty())
+			{
+				pthread_cond_wait(&not_empty,&mutex);
+			}
+			T item = items.front();
+			items.pop();
+			pthread_cond_signal(&not_full);
+			pthread_mutex_unlock(&mutex);
+			return item;
+		};
+
+	private:
+		size_t capacity;
+		queue<T> items;
+		pthread_mutex_t mutex;
+		pthread_cond_t not_full;
+		pthread_cond_t not_empty;
+};
+
+enum PipelineStage
+{
+	STAGE_MATCH,								//规则匹配, 即SentenceTranslator的构造
+	STAGE_SEARCH,								//立方体剪枝
+	STAGE_OUTPUT,								//生成译文, n-best和所用规则
+	STAGE_NUM
+};
+
+//每个阶段所有线程的时间统计
+struct StageStats
+{
+	size_t thread_num;
+	size_t sen_num;
+	double busy_time;							//处理句子的时间
+	double starved_time;						//等待上一阶段的时间
+	double blocked_time;						//等待下一阶段腾出队列的时间
+};
+
+//流水线解码, 规则匹配、立方体剪枝和输出分别由不同的线程组完成, 阶段之间用有界队列连接,
+//使访存密集的规则查找与语言模型密集的搜索能够重叠; 每个句子同一时刻只属于一个阶段,
+//匹配阶段取得当前的模型快照, 输出阶段释放, 模型热替换时已经开始的句子在旧快照上完成
+class DecodePipeline
+{
+	public:
+		typedef function<void(size_t k, SentenceTranslator &sen_translator, size_t model_version, double sen_beg)> FinishFunc;
+		DecodePipeline(ModelManager &i_model_manager, const Parameter &i_para);
+		void run(const vector<string> &input_sen, const vector<size_t> &sens, FinishFunc i_finish);
+		void print_stats();
+
+	private:
+		struct Item
+		{
+			size_t k;							//句子在sens中的下标
+			SentenceTranslator *sen_translator;	//为NULL表示上一阶段已经结束
+			ModelSnapshot *snapshot;			//解码该句子所用的模型
+			double sen_beg;
+		};
+		struct ThreadArg
+		{
+			DecodePipeline *pipeline;
+			PipelineStage stage;
+		};
+		static void* stage_thread(void *arg);
+		void run_match();
+		void run_search();
+		void run_output();
+		void finish_stage(PipelineStage stage, BoundedQueue<Item> *next_queue);
+		void add_stats(PipelineStage stage, const StageStats &thread_stats);
+
+	private:
+		ModelManager &model_manager;
+		const Parameter &para;
+		const vector<string> *input_sen;
+		const vector<size_t> *sens;
+		FinishFunc finish;
+		atomic<size_t> next_k;							//下一个待匹配的句子
+		atomic<size_t> finished_thread_nums[STAGE_NUM];	//各阶段已经结束的线程数
+		BoundedQueue<Item> *match2search;
+		BoundedQueue<Item> *search2output;
+		StageStats stats[STAGE_NUM];
+		double wall_time_used;
+		pthread_mutex_t stats_mutex;
+};
+
+#endif
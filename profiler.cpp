@@ -0,0 +1,129 @@
+#include "profiler.h"
+#include "util/usage.hh"
+#include <sys/resource.h>
+
+const char* PHASE_NAMES[PHASE_NUM] = {"phrase","AX_XA_XAX","AXB_AXBX_XAXB","AXBXC","glue","cube_pruning","lm","recombination","output"};
+const char* COUNTER_NAMES[COUNTER_NUM] = {"patterns_probed","rules_matched","cubes_seeded","pops","lm_queries","recombinations"};
+
+void SenProfile::clear()
+{
+	for (size_t i=0;i<PHASE_NUM;i++)
+	{
+		phase_times[i] = 0.0;
+	}
+	for (size_t i=0;i<COUNTER_NUM;i++)
+	{
+		counters[i] = 0;
+	}
+}
+
+void SenProfile::merge(const SenProfile &other)
+{
+	for (size_t i=0;i<PHASE_NUM;i++)
+	{
+		phase_times[i] += other.phase_times[i];
+	}
+	for (size_t i=0;i<COUNTER_NUM;i++)
+	{
+		counters[i] += other.counters[i];
+	}
+}
+
+//输出形如 "phases":{...},"counters":{...} 的JSON片段
+string SenProfile::to_json() const
+{
+	ostringstream ss;
+	ss<<"\"phases\":{";
+	for (size_t i=0;i<PHASE_NUM;i++)
+	{
+		ss<<(i==0?"":",")<<"\""<<PHASE_NAMES[i]<<"\":"<<phase_times[i];
+	}
+	ss<<"},\"counters\":{";
+	for (size_t i=0;i<COUNTER_NUM;i++)
+	{
+		ss<<(i==0?"":",")<<"\""<<COUNTER_NAMES[i]<<"\":"<<counters[i];
+	}
+	ss<<"}";
+	return ss.str();
+}
+
+string SenMemory::to_json() const
+{
+	ostringstream ss;
+	ss<<"\"memory\":{\"cand_bytes\":"<<cand_bytes<<",\"rule_bytes\":"<<rule_bytes<<",\"hyps\":"<<hyp_num
+	  <<",\"beam_size\":"<<beam_size<<",\"rule_num_limit\":"<<rule_num_limit<<",\"degraded\":"<<(degraded?"true":"false")<<"}";
+	return ss.str();
+}
+
+size_t peak_rss_kb()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF,&usage) != 0)
+		return 0;
+	return usage.ru_maxrss;
+}
+
+Profiler::Profiler(const string &profile_file)
+{
+	total_sen_time = 0.0;
+	profiled_sen_num = 0;
+	max_chart_bytes = 0;
+	max_hyp_num = 0;
+	degraded_sen_num = 0;
+	if (profile_file == "")
+		return;
+	fout.open(profile_file.c_str());
+	if (!fout.is_open())
+	{
+		cerr<<"cannot open profile file!\n";
+	}
+}
+
+void Profiler::add_sentence(size_t sen_id, size_t src_sen_len, double total_time, const SenProfile &profile, const SenMemory &memory)
+{
+	total_profile.merge(profile);
+	total_sen_time += total_time;
+	profiled_sen_num++;
+	max_chart_bytes = max(max_chart_bytes,memory.cand_bytes+memory.rule_bytes);
+	max_hyp_num = max(max_hyp_num,memory.hyp_num);
+	degraded_sen_num += memory.degraded;
+	if (!fout.is_open())
+		return;
+	fout<<"{\"sen_id\":"<<sen_id<<",\"src_len\":"<<src_sen_len<<",\"time\":"<<total_time<<","<<profile.to_json()<<","<<memory.to_json()<<"}\n";
+}
+
+/**************************************************************************************
+ 1. 函数功能: 输出整个运行过程的汇总信息
+ 2. 入口参数: 解码的墙上时间, 输入句子数(包括翻译记忆命中的句子)
+ 3. 出口参数: 无
+ 4. 算法简介: 各阶段时间为所有线程的累加值, 因此可能大于墙上时间
+************************************************************************************* */
+void Profiler::write_summary(double wall_time_cost, size_t sen_num)
+{
+	cout<<"decoding wall time: "<<wall_time_cost<<"s, "<<(wall_time_cost>0?sen_num/wall_time_cost:0.0)<<" sentences/s\n";
+	for (size_t i=0;i<PHASE_NUM;i++)
+	{
+		cout<<"  "<<PHASE_NAMES[i]<<": "<<total_profile.phase_times[i]<<"s\n";
+	}
+	for (size_t i=0;i<COUNTER_NUM;i++)
+	{
+		cout<<"  "<<COUNTER_NAMES[i]<<": "<<total_profile.counters[i]<<"\n";
+	}
+	cout<<"memory:\n";
+	for (const auto &kv : model_bytes)
+	{
+		cout<<"  "<<kv.first<<": "<<kv.second/1048576.0<<"MB\n";
+	}
+	cout<<"  max chart: "<<max_chart_bytes/1048576.0<<"MB, max hypotheses: "<<max_hyp_num<<", degraded sentences: "<<degraded_sen_num<<"\n  ";
+	util::PrintUsage(cout);
+	if (!fout.is_open())
+		return;
+	fout<<"{\"summary\":{\"sentences\":"<<sen_num<<",\"decoded_sentences\":"<<profiled_sen_num<<",\"wall_time\":"<<wall_time_cost
+		<<",\"sentence_time\":"<<total_sen_time<<","<<total_profile.to_json()<<",\"memory\":{";
+	for (const auto &kv : model_bytes)
+	{
+		fout<<"\""<<kv.first<<"_bytes\":"<<kv.second<<",";
+	}
+	fout<<"\"max_chart_bytes\":"<<max_chart_bytes<<",\"max_hyps\":"<<max_hyp_num<<",\"degraded_sentences\":"<<degraded_sen_num
+		<<",\"peak_rss_kb\":"<<peak_rss_kb()<<"}}}\n";
+}
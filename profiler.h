@@ -0,0 +1,103 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "stdafx.h"
+
+//解码的各个阶段, 语言模型和假设重组包含在立方体剪枝或短语候选生成中, 单独统计
+enum Phase
+{
+	PHASE_PHRASE,							//根据短语规则生成候选
+	PHASE_AX_XA_XAX,						//匹配形如AX,XA和XAX的pattern
+	PHASE_AXB_AXBX_XAXB,					//匹配形如AXB,AXBX和XAXB的pattern
+	PHASE_AXBXC,							//匹配形如AXBXC的pattern
+	PHASE_GLUE,								//生成glue规则
+	PHASE_CUBE_PRUNING,						//立方体剪枝
+	PHASE_LM,								//语言模型打分
+	PHASE_RECOMBINATION,					//将候选加入列表并进行假设重组
+	PHASE_OUTPUT,							//生成译文, n-best信息以及规则
+	PHASE_NUM
+};
+
+enum Counter
+{
+	COUNTER_PATTERN_PROBED,					//在规则表中查找的pattern数
+	COUNTER_RULE_MATCHED,					//匹配到的规则数
+	COUNTER_CUBE_SEEDED,					//立方体剪枝时初始加入优先级队列的规则数
+	COUNTER_POP,							//从优先级队列中取出的候选数
+	COUNTER_LM_QUERY,						//语言模型打分次数
+	COUNTER_RECOMBINATION,					//因边界词相同而被合并的候选数
+	COUNTER_NUM
+};
+
+extern const char* PHASE_NAMES[PHASE_NUM];
+extern const char* COUNTER_NAMES[COUNTER_NUM];
+
+//单调时钟的墙上时间, 单位为秒
+inline double wall_time()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+//一个句子(或一个跨度)的各阶段耗时和计数
+struct SenProfile
+{
+	double phase_times[PHASE_NUM];
+	size_t counters[COUNTER_NUM];
+	SenProfile() {clear();};
+	void clear();
+	void merge(const SenProfile &other);
+	string to_json() const;
+};
+
+//一个句子解码结束时chart的内存占用, chart只增不减, 因此也是解码过程中的峰值(不含立方体剪枝的临时队列)
+struct SenMemory
+{
+	size_t cand_bytes = 0;					//span2cands中所有候选占用的字节数
+	size_t rule_bytes = 0;					//rule_chart占用的字节数
+	size_t hyp_num = 0;						//span2cands中的候选数
+	size_t beam_size = 0;					//解码结束时的beam大小, 超过内存上限时会减小
+	size_t rule_num_limit = 0;				//超过内存上限时rule_chart中每个pattern保留的规则数, 为0时没有限制
+	bool degraded = false;					//是否因超过内存上限而减小了beam或规则数
+	string to_json() const;
+};
+
+size_t peak_rss_kb();
+
+//构造时开始计时, 析构时将经过的时间累加到指定的阶段
+class PhaseTimer
+{
+	public:
+		PhaseTimer(SenProfile &i_profile, Phase i_phase, bool i_enabled)
+			: profile(i_profile), phase(i_phase), enabled(i_enabled), beg(i_enabled?wall_time():0.0) {};
+		~PhaseTimer() { if (enabled) profile.phase_times[phase] += wall_time()-beg; };
+	private:
+		SenProfile &profile;
+		Phase phase;
+		bool enabled;
+		double beg;
+};
+
+//汇总所有句子的统计信息, 并以每行一个JSON对象的格式输出
+class Profiler
+{
+	public:
+		Profiler(const string &profile_file);
+		bool enabled() {return fout.is_open();};
+		void add_sentence(size_t sen_id, size_t src_sen_len, double total_time, const SenProfile &profile, const SenMemory &memory);
+		void add_model_bytes(const string &name, size_t bytes) {model_bytes.push_back(make_pair(name,bytes));};
+		void write_summary(double wall_time_cost, size_t sen_num);
+
+	private:
+		ofstream fout;
+		SenProfile total_profile;
+		double total_sen_time;
+		size_t profiled_sen_num;
+		vector<pair<string,size_t> > model_bytes;	//各模型占用的内存
+		size_t max_chart_bytes;						//所有句子中chart占用内存的最大值
+		size_t max_hyp_num;
+		size_t degraded_sen_num;					//因超过内存上限而减小beam的句子数
+};
+
+#endif
@@ -0,0 +1,477 @@
+#include "remoteruletable.h"
+#include "lm.h"
+#include "util/murmur_hash.hh"
+#include <unistd.h>
+
+size_t RemoteRuleTable::PatternHasher::operator()(const vector<int> &pattern) const
+{
+	return util::MurmurHashNative(pattern.data(),pattern.size()*sizeof(int));
+}
+
+RemoteRuleTable::RemoteRuleTable(const vector<string> &addresses, const Weight &i_weight, int i_src_nt_id, size_t i_cache_size)
+{
+	weight = i_weight;
+	src_nt_id = i_src_nt_id;
+	cache_size = i_cache_size;
+	lm_model = NULL;
+	hit_num = 0;
+	miss_num = 0;
+	pthread_mutex_init(&mutex,NULL);
+	for (const auto &address : addresses)
+	{
+		ShardConnections *shard = new ShardConnections;
+		shard->address = address;
+		pthread_mutex_init(&shard->mutex,NULL);
+		int fd = connect_rule_server(address);									//启动时先连接一次, 尽早发现地址错误
+		if (fd < 0)
+		{
+			cerr<<"cannot connect to rule server "<<address<<", bye\n";
+			exit(EXIT_FAILURE);
+		}
+		shard->idle_fds.push_back(fd);
+		shards.push_back(shard);
+	}
+	cout<<"connect to "<<shards.size()<<" rule server shards over\n";
+}
+
+RemoteRuleTable::~RemoteRuleTable()
+{
+	for (auto &kv : sentence_map)
+	{
+		delete kv.second;
+	}
+	for (auto sentence : extra_sentences)
+	{
+		delete sentence;
+	}
+	for (auto shard : shards)
+	{
+		for (auto fd : shard->idle_fds)
+		{
+			close(fd);
+		}
+		pthread_mutex_destroy(&shard->mutex);
+		delete shard;
+	}
+	pthread_mutex_destroy(&mutex);
+}
+
+//编号是句子的规则的地址, 查找时据此直接找到调用方句子的规则
+size_t RemoteRuleTable::begin_sentence(const vector<int> &src_wids)
+{
+	return (size_t)acquire_sentence(src_wids);
+}
+
+void RemoteRuleTable::end_sentence(size_t ticket)
+{
+	vector<SentenceRules*> free_sentences;
+	pthread_mutex_lock(&mutex);
+	release_sentence((SentenceRules*)ticket,free_sentences);
+	pthread_mutex_unlock(&mutex);
+	for (auto sentence : free_sentences)
+	{
+		delete sentence;
+	}
+}
+
+//取得句子的规则, 缓存中没有时向各个分片请求; 请求在锁外进行, 多个线程同时请求同一个句子时保留先加入的结果
+RemoteRuleTable::SentenceRules* RemoteRuleTable::acquire_sentence(const vector<int> &src_wids)
+{
+	pthread_mutex_lock(&mutex);
+	auto it = sentence_map.find(src_wids);
+	if (it != sentence_map.end())
+	{
+		SentenceRules *sentence = it->second;
+		if (sentence->ref_num == 0)
+		{
+			lru.remove(sentence);
+		}
+		sentence->ref_num++;
+		hit_num++;
+		pthread_mutex_unlock(&mutex);
+		return sentence;
+	}
+	miss_num++;
+	pthread_mutex_unlock(&mutex);
+
+	SentenceRules *new_sentence = fetch_sentence(src_wids);
+	pthread_mutex_lock(&mutex);
+	if (new_sentence->failed)
+	{
+		new_sentence->ref_num++;								//不完整的规则不加入缓存, 句子结束后释放
+		pthread_mutex_unlock(&mutex);
+		return new_sentence;
+	}
+	auto ret = sentence_map.insert(make_pair(src_wids,new_sentence));
+	SentenceRules *sentence = ret.first->second;
+	if (sentence->ref_num == 0 && sentence != new_sentence)
+	{
+		lru.remove(sentence);
+	}
+	sentence->ref_num++;
+	pthread_mutex_unlock(&mutex);
+	if (sentence != new_sentence)
+	{
+		delete new_sentence;
+	}
+	return sentence;
+}
+
+//调用方持有mutex; 不再使用的句子放入lru, 超出缓存大小的句子和不完整的句子放入free_sentences, 由调用方在锁外释放
+void RemoteRuleTable::release_sentence(SentenceRules *sentence, vector<SentenceRules*> &free_sentences)
+{
+	sentence->ref_num--;
+	if (sentence->ref_num > 0)
+		return;
+	if (sentence->failed)
+	{
+		free_sentences.push_back(sentence);
+		return;
+	}
+	lru.push_front(sentence);
+	while (lru.size() > cache_size)
+	{
+		SentenceRules *victim = lru.back();
+		lru.pop_back();
+		sentence_map.erase(victim->src_wids);
+		free_sentences.push_back(victim);
+	}
+}
+
+/**************************************************************************************
+ 1. 函数功能: 向所有分片请求一个句子可能用到的规则
+ 2. 入口参数: 句子的单词id序列
+ 3. 出口参数: 句子的规则, ref_num为0; 某个分片重试后仍然失败时failed为true, 规则不完整
+ 4. 算法简介: 先向每个分片发出请求, 再依次读取应答, 各个分片并行查找; 每个分片使用一个空闲连接,
+ 			  没有空闲连接时新建连接, 用完后放回. 发送或读取失败时断开连接, 新建连接重试一次
+************************************************************************************* */
+RemoteRuleTable::SentenceRules* RemoteRuleTable::fetch_sentence(const vector<int> &src_wids)
+{
+	SentenceRules *sentence = new SentenceRules;
+	sentence->src_wids = src_wids;
+	sentence->ref_num = 0;
+	sentence->failed = false;
+	string body;
+	write_varint(body,src_wids.size());
+	for (auto wid : src_wids)
+	{
+		write_varint(body,wid);
+	}
+	vector<int> fds(shards.size(),-1);
+	for (size_t i=0;i<shards.size();i++)
+	{
+		ShardConnections *shard = shards[i];
+		pthread_mutex_lock(&shard->mutex);
+		if (!shard->idle_fds.empty())
+		{
+			fds[i] = shard->idle_fds.back();
+			shard->idle_fds.pop_back();
+		}
+		pthread_mutex_unlock(&shard->mutex);
+		if (fds[i] < 0)
+		{
+			fds[i] = connect_rule_server(shard->address);
+		}
+		fds[i] = send_shard_request(i,fds[i],body);
+	}
+	for (size_t i=0;i<shards.size();i++)
+	{
+		if (fds[i] < 0 || !read_shard_reply(i,fds[i],sentence))
+		{
+			if (fds[i] >= 0)
+			{
+				close(fds[i]);
+			}
+			fds[i] = send_shard_request(i,connect_rule_server(shards[i]->address),body);
+			if (fds[i] >= 0 && !read_shard_reply(i,fds[i],sentence))
+			{
+				close(fds[i]);
+				fds[i] = -1;
+			}
+		}
+		if (fds[i] < 0)
+		{
+			cerr<<"cannot fetch rules from rule server "<<shards[i]->address<<", the sentence is translated without them\n";
+			sentence->failed = true;
+			continue;
+		}
+		pthread_mutex_lock(&shards[i]->mutex);
+		shards[i]->idle_fds.push_back(fds[i]);
+		pthread_mutex_unlock(&shards[i]->mutex);
+	}
+	if (lm_model != NULL)
+	{
+		sentence->tgt_pool.fill_kenlm_ids(lm_model);
+	}
+	sentence->bytes = sentence_bytes(sentence);
+	return sentence;
+}
+
+//在连接fd上向分片发送请求, 返回fd; fd无效或发送失败时断开连接, 返回-1
+int RemoteRuleTable::send_shard_request(size_t shard_id, int fd, const string &body)
+{
+	RuleServerRequest request;
+	request.magic = RULE_SERVER_MAGIC;
+	request.shard_id = shard_id;
+	request.shard_num = shards.size();
+	request.body_size = body.size();
+	if (fd >= 0 && write_all(fd,(const char*)&request,sizeof(request)) && write_all(fd,body.data(),body.size()))
+		return fd;
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	return -1;
+}
+
+//解析一个分片的应答, 按RuleTable加载时的方式计算规则打分; 只含非终结符的pattern可能由多个分片返回, 保留有规则的一个
+//应答来自网络, 读取失败或格式错误(长度越界, 数据不完整, 有多余的字节)时返回false
+bool RemoteRuleTable::read_shard_reply(size_t shard_id, int fd, SentenceRules *sentence)
+{
+	RuleServerReply reply;
+	string body;
+	if (!read_all(fd,(char*)&reply,sizeof(reply)) || reply.magic != RULE_SERVER_MAGIC || reply.body_size > RULE_SERVER_MAX_REPLY_SIZE)
+		return false;
+	body.resize(reply.body_size);
+	if (!read_all(fd,&body[0],body.size()))
+		return false;
+	if (reply.status == RULE_SERVER_WRONG_SHARD)
+	{
+		cerr<<"rule server "<<shards[shard_id]->address<<" is not shard "<<shard_id<<"/"<<shards.size()<<", bye\n";
+		exit(EXIT_FAILURE);
+	}
+	if (reply.status != RULE_SERVER_OK)
+		return false;
+	const char *cur = body.data();
+	const char *end = body.data()+body.size();
+	const uint64_t max_wid = numeric_limits<int>::max();
+	uint64_t pattern_num, v;
+	if (!read_bounded_varint(cur,end,end-cur,pattern_num))
+		return false;
+	vector<int> pattern;
+	vector<int> tgt_wids;
+	for (size_t k=0;k<pattern_num;k++)
+	{
+		if (!read_bounded_varint(cur,end,RULE_LEN_MAX,v))
+			return false;
+		pattern.resize(v);
+		for (auto &wid : pattern)
+		{
+			if (!read_bounded_varint(cur,end,max_wid,v))
+				return false;
+			wid = v;
+		}
+		if (!read_bounded_varint(cur,end,(end-cur)/(2+sizeof(double)*PROB_NUM),v))	//每条规则至少有目标端长度, 规则类型和概率
+			return false;
+		vector<TgtRule> tgt_rules(v);
+		for (auto &tgt_rule : tgt_rules)
+		{
+			if (!read_bounded_varint(cur,end,RULE_LEN_MAX,v))
+				return false;
+			tgt_wids.resize(v);
+			for (auto &wid : tgt_wids)
+			{
+				if (!read_bounded_varint(cur,end,max_wid,v))
+					return false;
+				wid = v;
+			}
+			if ((size_t)(end-cur) < 1+sizeof(double)*PROB_NUM)
+				return false;
+			tgt_rule.tgt = sentence->tgt_pool.intern(tgt_wids.data(),tgt_wids.size());
+			tgt_rule.rule_type = (uint8_t)*cur++;
+			tgt_rule.probs.resize(PROB_NUM);
+			memcpy(&(tgt_rule.probs[0]),cur,sizeof(double)*PROB_NUM);
+			cur += sizeof(double)*PROB_NUM;
+			tgt_rule.score = 0;
+			for (size_t i=0;i<weight.trans.size() && i<PROB_NUM;i++)
+			{
+				tgt_rule.score += tgt_rule.probs[i]*weight.trans[i];
+			}
+		}
+		vector<TgtRule> &rules = sentence->pattern2rules[pattern];
+		if (rules.empty())
+		{
+			rules.swap(tgt_rules);
+		}
+	}
+	return cur == end;
+}
+
+//pattern能否嵌入句子, 与RuleTable::match_sentence的搜索方式一致: 每个非终结符至少覆盖一个单词,
+//终结符片段连续出现; 每个片段取最靠前的出现位置, 给之后的片段留下最多的单词
+bool RemoteRuleTable::covers(const vector<int> &src_wids, const vector<int> &pattern)
+{
+	size_t pos = 0;
+	size_t k = 0;
+	while (k < pattern.size())
+	{
+		if (pattern[k] == src_nt_id)
+		{
+			if (pos >= src_wids.size())
+				return false;
+			pos++;
+			k++;
+			continue;
+		}
+		size_t chunk_end = k;
+		while (chunk_end < pattern.size() && pattern[chunk_end] != src_nt_id)
+		{
+			chunk_end++;
+		}
+		auto it = search(src_wids.begin()+pos,src_wids.end(),pattern.begin()+k,pattern.begin()+chunk_end);
+		if (it == src_wids.end())
+			return false;
+		pos = (it-src_wids.begin()) + (chunk_end-k);
+		k = chunk_end;
+	}
+	return true;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 在调用方句子的规则中查找pattern
+ 2. 入口参数: pattern的单词id序列, 句子的编号
+ 3. 出口参数: pattern的规则, 没有时为NULL; exists表示pattern是否为Trie树中的节点
+ 4. 算法简介: 句子的规则取回后不再修改, 句子结束前不会释放, 多个线程可以不加锁同时查找;
+ 			  句子的规则中有该pattern时直接返回, 否则pattern能嵌入句子时不存在;
+ 			  不属于任何句子或不能嵌入句子的pattern由find_extra_pattern单独请求
+************************************************************************************* */
+vector<TgtRule>* RemoteRuleTable::find_pattern(const vector<int> &pattern, size_t ticket, bool &exists)
+{
+	if (ticket != NO_SENTENCE_TICKET)
+	{
+		SentenceRules *sentence = (SentenceRules*)ticket;
+		auto it = sentence->pattern2rules.find(pattern);
+		if (it != sentence->pattern2rules.end())
+		{
+			exists = true;
+			return &(it->second);
+		}
+		if (covers(sentence->src_wids,pattern))
+		{
+			exists = false;
+			return NULL;
+		}
+	}
+	return find_extra_pattern(pattern,exists);
+}
+
+//把pattern本身当作句子请求一次, 结果放入extra_sentences, 超过cache_size个时释放最久没有用到的;
+//因此返回的规则在之后的cache_size次这样的请求之前有效, 只用于ruletable_query等逐个查询pattern的场合
+vector<TgtRule>* RemoteRuleTable::find_extra_pattern(const vector<int> &pattern, bool &exists)
+{
+	pthread_mutex_lock(&mutex);
+	for (auto it=extra_sentences.begin();it!=extra_sentences.end();it++)
+	{
+		SentenceRules *sentence = *it;
+		auto rules_it = sentence->pattern2rules.find(pattern);
+		if (rules_it != sentence->pattern2rules.end() || covers(sentence->src_wids,pattern))
+		{
+			extra_sentences.splice(extra_sentences.begin(),extra_sentences,it);
+			pthread_mutex_unlock(&mutex);
+			exists = rules_it != sentence->pattern2rules.end();
+			return exists ? &(rules_it->second) : NULL;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+
+	SentenceRules *sentence = fetch_sentence(pattern);
+	vector<SentenceRules*> free_sentences;
+	pthread_mutex_lock(&mutex);
+	extra_sentences.push_front(sentence);
+	while (extra_sentences.size() > max(cache_size,(size_t)1))
+	{
+		free_sentences.push_back(extra_sentences.back());
+		extra_sentences.pop_back();
+	}
+	pthread_mutex_unlock(&mutex);
+	for (auto free_sentence : free_sentences)
+	{
+		delete free_sentence;
+	}
+	auto it = sentence->pattern2rules.find(pattern);
+	exists = it != sentence->pattern2rules.end();
+	return exists ? &(it->second) : NULL;
+}
+
+//与RuleTable::find_matched_rules_for_prefixes的结果相同, 前缀不是Trie树中的节点时停止
+vector<vector<TgtRule>* > RemoteRuleTable::find_matched_rules_for_prefixes(const vector<int> &src_wids,const size_t pos,size_t ticket)
+{
+	vector<vector<TgtRule>* > matched_rules_for_prefixes;
+	vector<int> prefix;
+	for (size_t i=pos;i<src_wids.size() && i-pos<RULE_LEN_MAX;i++)
+	{
+		prefix.push_back(src_wids[i]);
+		bool exists;
+		vector<TgtRule> *rules = find_pattern(prefix,ticket,exists);
+		matched_rules_for_prefixes.push_back(rules==NULL || rules->empty() ? NULL : rules);
+		if (!exists)
+			return matched_rules_for_prefixes;
+	}
+	return matched_rules_for_prefixes;
+}
+
+vector<TgtRule>* RemoteRuleTable::find_matched_rules(const vector<int> &src_ids,size_t ticket)
+{
+	if (src_ids.size() > RULE_LEN_MAX)
+		return NULL;
+	bool exists;
+	vector<TgtRule> *rules = find_pattern(src_ids,ticket,exists);
+	return rules==NULL || rules->empty() ? NULL : rules;
+}
+
+//已经取回的规则在此一并填写语言模型id, 之后取回的规则在加入缓存前填写
+void RemoteRuleTable::fill_kenlm_ids(LanguageModel *i_lm_model)
+{
+	pthread_mutex_lock(&mutex);
+	lm_model = i_lm_model;
+	for (auto &kv : sentence_map)
+	{
+		kv.second->tgt_pool.fill_kenlm_ids(lm_model);
+	}
+	for (auto sentence : extra_sentences)
+	{
+		sentence->tgt_pool.fill_kenlm_ids(lm_model);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+size_t RemoteRuleTable::sentence_bytes(SentenceRules *sentence)
+{
+	size_t bytes = sizeof(SentenceRules) + sentence->src_wids.capacity()*sizeof(int) + sentence->tgt_pool.memory_bytes()
+				 + sentence->pattern2rules.bucket_count()*sizeof(void*);
+	for (const auto &kv : sentence->pattern2rules)
+	{
+		bytes += 4*sizeof(void*) + kv.first.capacity()*sizeof(int) + kv.second.capacity()*sizeof(TgtRule);
+		for (const auto &tgt_rule : kv.second)
+		{
+			bytes += tgt_rule.probs.capacity()*sizeof(double);
+		}
+	}
+	return bytes;
+}
+
+//本地缓存的句子的规则占用的内存, 规则表本身在分片服务进程中
+size_t RemoteRuleTable::memory_bytes()
+{
+	pthread_mutex_lock(&mutex);
+	size_t bytes = 0;
+	for (auto &kv : sentence_map)
+	{
+		bytes += kv.second->bytes;
+	}
+	for (auto sentence : extra_sentences)
+	{
+		bytes += sentence->bytes;
+	}
+	pthread_mutex_unlock(&mutex);
+	return bytes;
+}
+
+//按句子统计的本地缓存命中次数
+void RemoteRuleTable::get_cache_stats(size_t &hit, size_t &miss)
+{
+	pthread_mutex_lock(&mutex);
+	hit = hit_num;
+	miss = miss_num;
+	pthread_mutex_unlock(&mutex);
+}
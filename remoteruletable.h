@@ -0,0 +1,76 @@
+#ifndef REMOTERULETABLE_H
+#define REMOTERULETABLE_H
+
+#include "stdafx.h"
+#include "ruletable.h"
+#include "ruleserver.h"
+#include <list>
+
+//规则表分片服务的客户端, 规则按rule_shard_of分布在多个分片服务进程中(hiero -rule-server启动)
+//begin_sentence时向每个分片发一个请求, 取回句子可能用到的所有pattern及其规则, 之后的查找都在本地完成;
+//分片服务按RuleTable::match_sentence返回所有能嵌入句子的pattern, 因此能嵌入某个正在解码的句子但没有返回的
+//pattern就是不存在的. begin_sentence返回的编号就是句子的规则的地址, 查找只在调用方句子的规则中进行, 不加锁;
+//句子结束后其规则留在按句子数限制大小的LRU缓存中, 同一个句子(如先估计代价再解码)再次开始时不再请求, 淘汰时没有句子在使用, 直接释放;
+//请求失败时断开连接, 新建连接重试一次, 仍然失败时句子缺少该分片的规则, 不加入缓存, 解码继续进行
+class RemoteRuleTable : public RuleSource
+{
+	public:
+		RemoteRuleTable(const vector<string> &addresses, const Weight &i_weight, int i_src_nt_id, size_t i_cache_size);
+		~RemoteRuleTable();
+		size_t begin_sentence(const vector<int> &src_wids);
+		void end_sentence(size_t ticket);
+		vector<vector<TgtRule>* > find_matched_rules_for_prefixes(const vector<int> &src_wids,const size_t pos,size_t ticket=NO_SENTENCE_TICKET);
+		vector<TgtRule>* find_matched_rules(const vector<int> &src_ids,size_t ticket=NO_SENTENCE_TICKET);
+		void fill_kenlm_ids(LanguageModel *i_lm_model);
+		size_t memory_bytes();
+		void get_cache_stats(size_t &hit_num, size_t &miss_num);
+
+	private:
+		struct PatternHasher
+		{
+			size_t operator()(const vector<int> &pattern) const;
+		};
+		//一个句子的所有规则, 规则没有时pattern对应空的vector, 表示该pattern是Trie树中的前缀
+		struct SentenceRules
+		{
+			vector<int> src_wids;
+			unordered_map<vector<int>,vector<TgtRule>,PatternHasher> pattern2rules;
+			TgtPool tgt_pool;
+			size_t ref_num;								//使用它的正在解码的句子数, 为0时在lru中
+			bool failed;								//有分片请求失败, 规则不完整, 不加入缓存
+			size_t bytes;
+		};
+		//到一个分片的空闲连接, 每个连接同一时刻只有一个请求
+		struct ShardConnections
+		{
+			string address;
+			pthread_mutex_t mutex;
+			vector<int> idle_fds;
+		};
+
+		SentenceRules* fetch_sentence(const vector<int> &src_wids);
+		int send_shard_request(size_t shard_id, int fd, const string &body);
+		bool read_shard_reply(size_t shard_id, int fd, SentenceRules *sentence);
+		bool covers(const vector<int> &src_wids, const vector<int> &pattern);
+		vector<TgtRule>* find_pattern(const vector<int> &pattern, size_t ticket, bool &exists);
+		vector<TgtRule>* find_extra_pattern(const vector<int> &pattern, bool &exists);
+		SentenceRules* acquire_sentence(const vector<int> &src_wids);
+		void release_sentence(SentenceRules *sentence, vector<SentenceRules*> &free_sentences);
+		size_t sentence_bytes(SentenceRules *sentence);
+
+	private:
+		Weight weight;
+		int src_nt_id;
+		size_t cache_size;								//句子结束后最多缓存的句子数
+		LanguageModel *lm_model;
+		vector<ShardConnections*> shards;
+
+		pthread_mutex_t mutex;							//保护以下各项
+		unordered_map<vector<int>,SentenceRules*,PatternHasher> sentence_map;	//正在解码的和缓存的句子
+		list<SentenceRules*> lru;						//已经结束的句子, 最近结束的在前面
+		list<SentenceRules*> extra_sentences;			//不属于任何句子的查找取回的规则, 最近用到的在前面, 最多保留cache_size个
+		size_t hit_num;
+		size_t miss_num;
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include "rulechart.h"
+
+static vector<RuleChart*> free_charts;						//已释放的RuleChart, 保留了之前句子的容量
+static pthread_mutex_t free_charts_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**************************************************************************************
+ 1. 函数功能: 为一个句子取一个空的RuleChart
+ 2. 入口参数: 句子长度
+ 3. 出口参数: RuleChart
+ 4. 算法简介: 优先复用已释放的RuleChart; 流水线模式下句子在不同线程之间传递,
+ 			  因此空闲的RuleChart由所有线程共用, 而不是每个线程一个
+************************************************************************************* */
+RuleChart* RuleChart::acquire(size_t src_sen_len)
+{
+	RuleChart *chart = NULL;
+	pthread_mutex_lock(&free_charts_mutex);
+	if (!free_charts.empty())
+	{
+		chart = free_charts.back();
+		free_charts.pop_back();
+	}
+	pthread_mutex_unlock(&free_charts_mutex);
+	if (chart == NULL)
+	{
+		chart = new RuleChart;
+	}
+	chart->clear(src_sen_len);
+	return chart;
+}
+
+void RuleChart::release(RuleChart *chart)
+{
+	pthread_mutex_lock(&free_charts_mutex);
+	free_charts.push_back(chart);
+	pthread_mutex_unlock(&free_charts_mutex);
+}
+
+void RuleChart::clear(size_t i_src_sen_len)
+{
+	src_sen_len = i_src_sen_len;
+	pattern_words.clear();
+	patterns.clear();
+	cell_offsets.assign(src_sen_len*src_sen_len+1,0);
+	refs.clear();
+	if (buffers.size() < src_sen_len)
+	{
+		buffers.resize(src_sen_len);
+	}
+	buffer_offsets.assign(src_sen_len,0);
+	rule_num_cap = numeric_limits<size_t>::max();
+}
+
+/**************************************************************************************
+ 1. 函数功能: 加入一个pattern在一个跨度上的切分
+ 2. 入口参数: pattern的源端符号序列, 匹配到的目标端, 所在单元, 按源端顺序的两个非终结符跨度, 虚词和动词标记
+ 3. 出口参数: pattern的编号
+ 4. 算法简介: 同一个pattern的各种切分是连续加入的, 与上一个pattern相同时共用源端符号序列
+************************************************************************************* */
+int RuleChart::add_pattern(const vector<int> &src_ids, TgtRule *tgt_rules, size_t tgt_rule_num, int cell, pair<int,int> span_src_x1, pair<int,int> span_src_x2, int fw_flag, int fwverb_flag)
+{
+	RulePattern pattern_info;
+	pattern_info.src_len = src_ids.size();
+	pattern_info.tgt_rules = tgt_rules;
+	pattern_info.tgt_rule_num = tgt_rule_num;
+	pattern_info.cell = cell;
+	pattern_info.span_src_x1 = span_src_x1;
+	pattern_info.span_src_x2 = span_src_x2;
+	pattern_info.generalize_fw_flag = fw_flag;
+	pattern_info.fwverb_terminal_flag = fwverb_flag;
+	return add_pattern(src_ids.data(),pattern_info);
+}
+
+//pattern_info中除src_beg以外的各项已经填好
+int RuleChart::add_pattern(const int *src_ids, const RulePattern &pattern_info)
+{
+	RulePattern pattern = pattern_info;
+	if (!patterns.empty() && patterns.back().src_len == pattern.src_len
+		&& equal(src_ids,src_ids+pattern.src_len,pattern_words.begin()+patterns.back().src_beg))
+	{
+		pattern.src_beg = patterns.back().src_beg;
+	}
+	else
+	{
+		pattern.src_beg = pattern_words.size();
+		pattern_words.insert(pattern_words.end(),src_ids,src_ids+pattern.src_len);
+	}
+	patterns.push_back(pattern);
+	if (pattern.cell >= 0)
+	{
+		cell_offsets[pattern.cell+1] += pattern.tgt_rule_num;
+	}
+	return patterns.size()-1;
+}
+
+//按起始位置的顺序把各缓冲区中的pattern加入chart, 并清空缓冲区
+void RuleChart::merge_buffers()
+{
+	for (size_t beg=0;beg<src_sen_len;beg++)
+	{
+		RulePatternBuffer &buffer = buffers[beg];
+		buffer_offsets[beg] = patterns.size();
+		for (const auto &pattern : buffer.patterns)
+		{
+			add_pattern(buffer.pattern_words.data()+pattern.src_beg,pattern);
+		}
+		buffer.clear();
+	}
+}
+
+//缓冲区中的pattern不共用源端符号序列, 合并时再与上一个pattern比较, 编号为在缓冲区中的位置
+int RulePatternBuffer::add_pattern(const vector<int> &src_ids, TgtRule *tgt_rules, size_t tgt_rule_num, int cell, pair<int,int> span_src_x1, pair<int,int> span_src_x2, int fw_flag, int fwverb_flag)
+{
+	RulePattern pattern;
+	pattern.src_beg = pattern_words.size();
+	pattern.src_len = src_ids.size();
+	pattern.tgt_rules = tgt_rules;
+	pattern.tgt_rule_num = tgt_rule_num;
+	pattern.cell = cell;
+	pattern.span_src_x1 = span_src_x1;
+	pattern.span_src_x2 = span_src_x2;
+	pattern.generalize_fw_flag = fw_flag;
+	pattern.fwverb_terminal_flag = fwverb_flag;
+	pattern_words.insert(pattern_words.end(),src_ids.begin(),src_ids.end());
+	patterns.push_back(pattern);
+	return patterns.size()-1;
+}
+
+//所有pattern加入后按单元计数排序生成refs, 单元内保持加入的顺序
+void RuleChart::build()
+{
+	for (size_t cell=0;cell+1<cell_offsets.size();cell++)
+	{
+		cell_offsets[cell+1] += cell_offsets[cell];
+	}
+	refs.resize(cell_offsets.back());
+	cell_cursors.assign(cell_offsets.begin(),cell_offsets.end()-1);
+	for (uint32_t pattern_id=0;pattern_id<patterns.size();pattern_id++)
+	{
+		const RulePattern &pattern = patterns[pattern_id];
+		if (pattern.cell < 0)
+			continue;
+		ranks.resize(pattern.tgt_rule_num);
+		for (uint32_t rank=0;rank<pattern.tgt_rule_num;rank++)
+		{
+			ranks[rank] = rank;
+		}
+		if (pattern.tgt_rule_num > rule_num_cap)									//只保留得分最高的规则, 保持它们原来的顺序
+		{
+			const TgtRule *tgt_rules = pattern.tgt_rules;
+			stable_sort(ranks.begin(),ranks.end(),[&](uint32_t a, uint32_t b){return tgt_rules[a].score > tgt_rules[b].score;});
+			ranks.resize(rule_num_cap);
+			sort(ranks.begin(),ranks.end());
+		}
+		uint32_t &cursor = cell_cursors[pattern.cell];
+		for (auto rank : ranks)
+		{
+			refs[cursor].pattern_id = pattern_id;
+			refs[cursor].tgt_rule_rank = rank;
+			cursor++;
+		}
+	}
+}
+
+/**************************************************************************************
+ 1. 函数功能: 限制build之后rule_chart占用的内存, 在build之前调用
+ 2. 入口参数: 内存上限(字节)
+ 3. 出口参数: 每个pattern最多保留的规则数, 没有超过上限时为0
+ 4. 算法简介: 单元中的规则引用占用的内存与规则数成正比, 超过上限时把每个pattern保留的规则数减半,
+ 			  直到估计值不超过上限或每个pattern只保留1条; build时保留每个pattern中得分最高的规则
+************************************************************************************* */
+size_t RuleChart::limit_rules(size_t limit_bytes)
+{
+	size_t fixed_bytes = pattern_words.size()*sizeof(int) + patterns.size()*sizeof(RulePattern) + cell_offsets.size()*sizeof(uint32_t);
+	auto count_refs = [&](size_t cap)
+	{
+		size_t ref_num = 0;
+		for (const auto &pattern : patterns)
+		{
+			ref_num += pattern.cell>=0 ? min<size_t>(pattern.tgt_rule_num,cap) : 0;
+		}
+		return ref_num;
+	};
+	size_t max_rule_num = 0;
+	for (const auto &pattern : patterns)
+	{
+		max_rule_num = pattern.cell>=0 ? max<size_t>(max_rule_num,pattern.tgt_rule_num) : max_rule_num;
+	}
+	size_t cap = max_rule_num;
+	while (cap > 1 && fixed_bytes+count_refs(cap)*sizeof(RuleRef) > limit_bytes)
+	{
+		cap = max<size_t>(1,cap/2);
+	}
+	if (cap == max_rule_num)
+		return 0;
+	rule_num_cap = cap;
+	fill(cell_offsets.begin(),cell_offsets.end(),0);
+	for (const auto &pattern : patterns)
+	{
+		if (pattern.cell >= 0)
+		{
+			cell_offsets[pattern.cell+1] += min<size_t>(pattern.tgt_rule_num,cap);
+		}
+	}
+	return cap;
+}
+
+//由refs中的第i条规则生成Rule, 逆序规则交换两个非终结符的跨度
+Rule RuleChart::get_rule(size_t i) const
+{
+	const RuleRef &ref = refs[i];
+	const RulePattern &pattern = patterns[ref.pattern_id];
+	Rule rule;
+	rule.pattern_id = ref.pattern_id;
+	rule.tgt_rule = pattern.tgt_rules+ref.tgt_rule_rank;
+	rule.tgt_rule_rank = ref.tgt_rule_rank;
+	rule.generalize_fw_flag = pattern.generalize_fw_flag;
+	rule.fwverb_terminal_flag = pattern.fwverb_terminal_flag;
+	if (rule.tgt_rule->rule_type == 3)
+	{
+		rule.span_x1 = pattern.span_src_x2;
+		rule.span_x2 = pattern.span_src_x1;
+	}
+	else
+	{
+		rule.span_x1 = pattern.span_src_x1;
+		rule.span_x2 = pattern.span_src_x2;
+	}
+	return rule;
+}
+
+//当前句子使用的字节数
+size_t RuleChart::memory_bytes() const
+{
+	return pattern_words.size()*sizeof(int) + patterns.size()*sizeof(RulePattern)
+		 + cell_offsets.size()*sizeof(uint32_t) + refs.size()*sizeof(RuleRef);
+}
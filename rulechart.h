@@ -0,0 +1,81 @@
+#ifndef RULECHART_H
+#define RULECHART_H
+
+#include "stdafx.h"
+#include "cand.h"
+
+//一个pattern在一个跨度上的一种切分, 该切分匹配到的所有目标端共用
+struct RulePattern
+{
+	uint32_t src_beg;							//源端符号序列在RuleChart::pattern_words中的起始位置
+	uint32_t src_len;
+	TgtRule *tgt_rules;							//匹配到的规则目标端, 按规则来源中的排名排列
+	uint32_t tgt_rule_num;
+	int cell;									//所在的单元(beg*src_sen_len+span), 短语和OOV为-1
+	pair<int,int> span_src_x1;					//按源端顺序的第一个非终结符的起始位置和跨度长度
+	pair<int,int> span_src_x2;
+	int generalize_fw_flag;
+	int fwverb_terminal_flag;
+};
+
+//规则匹配时一个起始位置的pattern, 按加入的顺序存放; 多个线程分别匹配不同的起始位置,
+//全部完成后由RuleChart::merge_buffers按起始位置的顺序合并, 合并结果与串行加入相同, 因此与线程数无关
+class RulePatternBuffer
+{
+	public:
+		int add_pattern(const vector<int> &src_ids, TgtRule *tgt_rules, size_t tgt_rule_num, int cell, pair<int,int> span_src_x1, pair<int,int> span_src_x2, int fw_flag, int fwverb_flag);
+		void clear() {pattern_words.clear(); patterns.clear();};
+
+	private:
+		friend class RuleChart;
+		vector<int> pattern_words;
+		vector<RulePattern> patterns;
+};
+
+//单元中的一条规则, 即pattern的编号和目标端的排名
+struct RuleRef
+{
+	uint32_t pattern_id;
+	uint32_t tgt_rule_rank;
+};
+
+//一个句子所有可用规则的紧凑存储: 规则按单元以CSR格式存放在refs中,
+//单元cell的规则为refs[cell_offsets[cell]]到refs[cell_offsets[cell+1]-1];
+//通过acquire/release在句子之间复用, 各数组(包括每个起始位置的RulePatternBuffer)保留之前句子的容量, 不必为每条规则分配内存
+class RuleChart
+{
+	public:
+		static RuleChart* acquire(size_t src_sen_len);
+		static void release(RuleChart *chart);
+		int add_pattern(const vector<int> &src_ids, TgtRule *tgt_rules, size_t tgt_rule_num, int cell, pair<int,int> span_src_x1, pair<int,int> span_src_x2, int fw_flag, int fwverb_flag);
+		RulePatternBuffer& get_buffer(size_t beg) {return buffers[beg];};
+		void merge_buffers();
+		uint32_t get_buffer_offset(size_t beg) const {return buffer_offsets[beg];};	//最近一次合并时该起始位置第一个pattern的编号
+		size_t limit_rules(size_t limit_bytes);
+		void build();
+		size_t cell_begin(size_t beg, size_t span) const {return cell_offsets[beg*src_sen_len+span];};
+		size_t cell_end(size_t beg, size_t span) const {return cell_offsets[beg*src_sen_len+span+1];};
+		Rule get_rule(size_t i) const;
+		const int* src_ids_begin(int pattern_id) const {return pattern_words.data()+patterns[pattern_id].src_beg;};
+		const int* src_ids_end(int pattern_id) const {return src_ids_begin(pattern_id)+patterns[pattern_id].src_len;};
+		size_t memory_bytes() const;
+
+	private:
+		RuleChart() {src_sen_len = 0;};
+		void clear(size_t i_src_sen_len);
+		int add_pattern(const int *src_ids, const RulePattern &pattern_info);
+
+	private:
+		size_t src_sen_len;
+		vector<int> pattern_words;				//所有pattern的源端符号, 连续加入的相同pattern只保存一份
+		vector<RulePattern> patterns;
+		vector<uint32_t> cell_offsets;
+		vector<RuleRef> refs;
+		vector<uint32_t> cell_cursors;			//build时每个单元的写位置
+		size_t rule_num_cap;					//build时每个pattern最多保留的规则数, 由limit_rules设置
+		vector<uint32_t> ranks;					//build时选出的规则排名
+		vector<RulePatternBuffer> buffers;		//每个起始位置的pattern缓冲区
+		vector<uint32_t> buffer_offsets;
+};
+
+#endif
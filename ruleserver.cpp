@@ -0,0 +1,273 @@
+#include "ruleserver.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+
+//把"主机:端口"拆开, 用getaddrinfo解析
+static struct addrinfo* resolve_tcp_address(const string &address, bool passive)
+{
+	size_t colon = address.rfind(':');
+	if (colon == string::npos)
+	{
+		cerr<<"bad rule server address "<<address<<", bye\n";
+		exit(EXIT_FAILURE);
+	}
+	string host = address.substr(0,colon);
+	string port = address.substr(colon+1);
+	struct addrinfo hints;
+	memset(&hints,0,sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	struct addrinfo *result = NULL;
+	if (getaddrinfo(host.empty()?NULL:host.c_str(),port.c_str(),&hints,&result) != 0)
+	{
+		cerr<<"cannot resolve rule server address "<<address<<", bye\n";
+		exit(EXIT_FAILURE);
+	}
+	return result;
+}
+
+static bool make_unix_address(const string &address, struct sockaddr_un &addr)
+{
+	string path = address.substr(5);
+	if (path.size() >= sizeof(addr.sun_path))
+		return false;
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path,path.c_str());
+	return true;
+}
+
+int listen_rule_server(const string &address)
+{
+	int fd = -1;
+	if (address.compare(0,5,"unix:") == 0)
+	{
+		struct sockaddr_un addr;
+		if (!make_unix_address(address,addr))
+		{
+			cerr<<"unix socket path too long: "<<address<<", bye\n";
+			exit(EXIT_FAILURE);
+		}
+		unlink(addr.sun_path);												//上次运行留下的套接字文件
+		fd = socket(AF_UNIX,SOCK_STREAM,0);
+		if (fd < 0 || bind(fd,(struct sockaddr*)&addr,sizeof(addr)) != 0)
+		{
+			cerr<<"cannot bind "<<address<<", bye\n";
+			exit(EXIT_FAILURE);
+		}
+	}
+	else
+	{
+		struct addrinfo *result = resolve_tcp_address(address,true);
+		fd = socket(result->ai_family,result->ai_socktype,result->ai_protocol);
+		int on = 1;
+		if (fd >= 0)
+		{
+			setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+		}
+		if (fd < 0 || bind(fd,result->ai_addr,result->ai_addrlen) != 0)
+		{
+			cerr<<"cannot bind "<<address<<", bye\n";
+			exit(EXIT_FAILURE);
+		}
+		freeaddrinfo(result);
+	}
+	if (listen(fd,64) != 0)
+	{
+		cerr<<"cannot listen on "<<address<<", bye\n";
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+//连接失败时返回-1
+int connect_rule_server(const string &address)
+{
+	int fd = -1;
+	if (address.compare(0,5,"unix:") == 0)
+	{
+		struct sockaddr_un addr;
+		if (!make_unix_address(address,addr))
+			return -1;
+		fd = socket(AF_UNIX,SOCK_STREAM,0);
+		if (fd >= 0 && connect(fd,(struct sockaddr*)&addr,sizeof(addr)) != 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	else
+	{
+		struct addrinfo *result = resolve_tcp_address(address,false);
+		for (struct addrinfo *ai=result;ai!=NULL;ai=ai->ai_next)
+		{
+			fd = socket(ai->ai_family,ai->ai_socktype,ai->ai_protocol);
+			if (fd >= 0 && connect(fd,ai->ai_addr,ai->ai_addrlen) == 0)
+				break;
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+			fd = -1;
+		}
+		freeaddrinfo(result);
+		if (fd >= 0)
+		{
+			int on = 1;
+			setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));		//请求和应答都是一次写完的小包, 不等待合并
+		}
+	}
+	return fd;
+}
+
+bool write_all(int fd, const char *data, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t n = send(fd,data,size,MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool read_all(int fd, char *data, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t n = recv(fd,data,size,0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+RuleShardServer::RuleShardServer(RuleTable *i_ruletable, size_t i_shard_id, size_t i_shard_num)
+{
+	ruletable = i_ruletable;
+	shard_id = i_shard_id;
+	shard_num = i_shard_num;
+}
+
+void RuleShardServer::serve(const string &address)
+{
+	int listen_fd = listen_rule_server(address);
+	cout<<"rule server shard "<<shard_id<<"/"<<shard_num<<" listening on "<<address<<endl;
+	while (true)
+	{
+		int fd = accept(listen_fd,NULL,NULL);
+		if (fd < 0)
+			continue;
+		ConnectionArgs *args = new ConnectionArgs;
+		args->server = this;
+		args->fd = fd;
+		pthread_t thread;
+		if (pthread_create(&thread,NULL,connection_thread,args) != 0)
+		{
+			close(fd);
+			delete args;
+			continue;
+		}
+		pthread_detach(thread);
+	}
+}
+
+void* RuleShardServer::connection_thread(void *arg)
+{
+	ConnectionArgs *args = (ConnectionArgs*)arg;
+	args->server->handle_connection(args->fd);
+	close(args->fd);
+	delete args;
+	return NULL;
+}
+
+//连接关闭或请求格式错误时返回, 由connection_thread断开连接
+void RuleShardServer::handle_connection(int fd)
+{
+	string body;
+	string reply_body;
+	while (true)
+	{
+		RuleServerRequest request;
+		if (!read_all(fd,(char*)&request,sizeof(request)) || request.magic != RULE_SERVER_MAGIC
+			|| request.body_size > RULE_SERVER_MAX_REQUEST_SIZE)
+			return;
+		body.resize(request.body_size);
+		if (!read_all(fd,&body[0],body.size()))
+			return;
+		RuleServerReply reply;
+		reply.magic = RULE_SERVER_MAGIC;
+		reply_body.clear();
+		if (request.shard_id != shard_id || request.shard_num != shard_num)
+		{
+			reply.status = RULE_SERVER_WRONG_SHARD;
+		}
+		else
+		{
+			reply.status = RULE_SERVER_OK;
+			if (!match_sentence(body,reply_body))
+				return;
+		}
+		reply.body_size = reply_body.size();
+		if (!write_all(fd,(const char*)&reply,sizeof(reply)) || !write_all(fd,reply_body.data(),reply_body.size()))
+			return;
+	}
+}
+
+//请求体格式错误(单词数与长度不符, 单词id越界, 有多余的字节)时返回false
+bool RuleShardServer::match_sentence(const string &body, string &reply_body)
+{
+	const char *cur = body.data();
+	const char *end = body.data()+body.size();
+	uint64_t v;
+	if (!read_bounded_varint(cur,end,end-cur,v))					//每个单词id至少占一个字节
+		return false;
+	vector<int> src_wids(v);
+	for (auto &wid : src_wids)
+	{
+		if (!read_bounded_varint(cur,end,numeric_limits<int>::max(),v))
+			return false;
+		wid = v;
+	}
+	if (cur != end)
+		return false;
+	vector<pair<vector<int>,const vector<TgtRule>*> > matched_patterns;
+	size_t ticket = ruletable->begin_sentence(src_wids);				//量化的规则表解码出的规则在回复写完前有效
+	ruletable->match_sentence(src_wids,matched_patterns,ticket);
+	write_varint(reply_body,matched_patterns.size());
+	for (const auto &pattern_rules : matched_patterns)
+	{
+		write_varint(reply_body,pattern_rules.first.size());
+		for (auto wid : pattern_rules.first)
+		{
+			write_varint(reply_body,wid);
+		}
+		write_varint(reply_body,pattern_rules.second->size());
+		for (const auto &tgt_rule : *pattern_rules.second)
+		{
+			write_varint(reply_body,tgt_rule.tgt->len);
+			for (size_t i=0;i<tgt_rule.tgt->len;i++)
+			{
+				write_varint(reply_body,tgt_rule.tgt->wids[i]);
+			}
+			reply_body.push_back((char)tgt_rule.rule_type);
+			reply_body.append((const char*)&(tgt_rule.probs[0]),PROB_NUM*sizeof(double));
+		}
+	}
+	ruletable->end_sentence(ticket);
+	return true;
+}
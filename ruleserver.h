@@ -0,0 +1,69 @@
+#ifndef RULESERVER_H
+#define RULESERVER_H
+
+#include "stdafx.h"
+#include "ruletable.h"
+#include "lmtrace.h"
+
+const uint32_t RULE_SERVER_MAGIC = 0x31535248;		//"HRS1"
+const uint32_t RULE_SERVER_OK = 0;
+const uint32_t RULE_SERVER_WRONG_SHARD = 1;			//请求的分片编号或分片数与服务进程不一致
+const uint32_t RULE_SERVER_MAX_REQUEST_SIZE = 1<<20;	//请求体的最大字节数, 超过时服务进程断开连接
+const uint64_t RULE_SERVER_MAX_REPLY_SIZE = 1ULL<<31;	//应答体的最大字节数, 超过时客户端断开连接
+
+//规则表分片服务的请求头, 之后为句子的单词数和单词id(均为write_varint编码)
+//每个请求取回一个句子在本分片上可能用到的所有规则, 见RuleTable::match_sentence
+struct RuleServerRequest
+{
+	uint32_t magic;
+	uint32_t shard_id;
+	uint32_t shard_num;
+	uint32_t body_size;
+};
+
+//应答头, 之后为pattern数, 每个pattern依次为: 源端长度, 源端单词id, 规则数, 每条规则的目标端长度,
+//目标端单词id(以上均为write_varint编码), 1个字节的规则类型, PROB_NUM个double类型的概率;
+//量化的规则表发送按码本解码后的概率, 与在进程内加载时查到的规则相同
+struct RuleServerReply
+{
+	uint32_t magic;
+	uint32_t status;
+	uint64_t body_size;
+};
+
+//地址为"unix:路径"时使用Unix域套接字, 否则为"主机:端口"形式的TCP地址
+int listen_rule_server(const string &address);
+int connect_rule_server(const string &address);
+bool write_all(int fd, const char *data, size_t size);
+bool read_all(int fd, char *data, size_t size);
+
+//读取一个不超过max_value的varint, 请求和应答都来自网络, 每个长度和单词id都要检查
+inline bool read_bounded_varint(const char *&p, const char *end, uint64_t max_value, uint64_t &v)
+{
+	return read_varint(p,end,v) && v <= max_value;
+}
+
+//规则表分片服务, 持有按rule_shard_of划分的一片规则表, 每个连接一个线程, 按顺序处理连接上的请求
+class RuleShardServer
+{
+	public:
+		RuleShardServer(RuleTable *i_ruletable, size_t i_shard_id, size_t i_shard_num);
+		void serve(const string &address);
+
+	private:
+		struct ConnectionArgs
+		{
+			RuleShardServer *server;
+			int fd;
+		};
+		static void* connection_thread(void *arg);
+		void handle_connection(int fd);
+		bool match_sentence(const string &body, string &reply_body);
+
+	private:
+		RuleTable *ruletable;
+		size_t shard_id;
+		size_t shard_num;
+};
+
+#endif
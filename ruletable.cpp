@@ -1,73 +1,157 @@
 #include "ruletable.h"
+#include "lm.h"
+#include "util/exception.hh"
 
-void RuleTable::load_rule_table(const string &rule_table_file)
+//从内存中的规则表读取一个值, 并将读位置后移; 剩余的字节不够时说明文件不完整, 退出
+template <class T> static void read_from_mem(const char *&cur, const char *end, T *to, size_t num)
 {
-	ifstream fin(rule_table_file.c_str(),ios::binary);
-	if (!fin.is_open())
+	if (num > (size_t)(end-cur)/sizeof(T))
+	{
+		cout<<"error, rule table file is truncated, bye\n";
+		exit(EXIT_FAILURE);
+	}
+	memcpy(to,cur,sizeof(T)*num);
+	cur += sizeof(T)*num;
+}
+
+void RuleTable::load_rule_table(const string &rule_table_file,const LoadOption &load_option)
+{
+	util::scoped_memory mem;
+	size_t file_size = 0;
+	try
+	{
+		file_size = load_file(rule_table_file,load_option,mem);
+	}
+	catch (util::Exception &e)
 	{
 		cerr<<"cannot open rule table file!\n";
 		return;
 	}
+	const char *cur = mem.begin();
+	const char *end = mem.begin()+file_size;
+	if (file_size >= sizeof(RuleQuantHeader) && memcmp(cur,RULE_QUANT_MAGIC,sizeof(RULE_QUANT_MAGIC)) == 0)
+	{
+		RuleQuantHeader header;
+		read_from_mem(cur,end,&header,1);
+		if (header.bits != 8 && header.bits != 16)
+		{
+			cout<<"error, unsupported quantization bits "<<header.bits<<", bye\n";
+			exit(EXIT_FAILURE);
+		}
+		code_bits = header.bits;
+		codebook = new RuleCodebook;
+		for (size_t i=0;i<PROB_NUM;i++)
+		{
+			codebook->centers[i].resize(1<<header.bits);
+			read_from_mem(cur,end,&(codebook->centers[i][0]),codebook->centers[i].size());
+		}
+	}
 	short int src_rule_len=0;
-	while(fin.read((char*)&src_rule_len,sizeof(short int)))
+	vector<int> tgt_wids;
+	while(cur+sizeof(short int) <= end)
 	{
+		read_from_mem(cur,end,&src_rule_len,1);
+		if (src_rule_len <= 0 || src_rule_len > RULE_LEN_MAX)
+		{
+			cout<<"error, rule length exceed, bye\n";
+			exit(EXIT_FAILURE);
+		}
 		vector<int> src_wids;
 		src_wids.resize(src_rule_len);
-		fin.read((char*)&src_wids[0],sizeof(int)*src_rule_len);
+		read_from_mem(cur,end,&src_wids[0],src_rule_len);
+		rule_source_hash = PatternFilter::add_rule_source(rule_source_hash,src_wids.data(),src_wids.size());
 
 		short int tgt_rule_len=0;
-		fin.read((char*)&tgt_rule_len,sizeof(short int));
-		if (tgt_rule_len > RULE_LEN_MAX)
+		read_from_mem(cur,end,&tgt_rule_len,1);
+		if (tgt_rule_len < 0 || tgt_rule_len > RULE_LEN_MAX)
 		{
 			cout<<"error, rule length exceed, bye\n";
 			exit(EXIT_FAILURE);
 		}
-		TgtRule tgt_rule;
-		tgt_rule.word_num = tgt_rule_len;
-		tgt_rule.wids.resize(tgt_rule_len);
-		fin.read((char*)&(tgt_rule.wids[0]),sizeof(int)*tgt_rule_len);
-
-		tgt_rule.probs.resize(PROB_NUM);
-		fin.read((char*)&(tgt_rule.probs[0]),sizeof(double)*PROB_NUM);
-
-		tgt_rule.score = 0;
-		if( tgt_rule.probs.size() != weight.trans.size() )
+		tgt_wids.resize(tgt_rule_len);
+		read_from_mem(cur,end,&tgt_wids[0],tgt_rule_len);
+		bool in_shard = shard_num <= 1 || rule_shard_of(src_wids.data(),src_wids.size(),src_nt_id,shard_num) == shard_id;
+		const TgtPhrase *tgt = NULL;
+		if (in_shard)												//不属于本分片的规则只跳过, 目标端不加入目标端池
 		{
-			cout<<"number of probability in rule is wrong!"<<endl;
+			tgt = tgt_pool.intern(tgt_wids.data(),tgt_rule_len);
 		}
-		for( size_t i=0; i<weight.trans.size(); i++ )
+		if( PROB_NUM != weight.trans.size() )
 		{
-			tgt_rule.score += tgt_rule.probs[i]*weight.trans[i];
+			cout<<"number of probability in rule is wrong!"<<endl;
 		}
 
-		short int rule_type;
-		fin.read((char*)&rule_type,sizeof(short int));
-		tgt_rule.rule_type = rule_type;
-		add_rule_to_trie(src_wids,tgt_rule);
+		if (code_bits == 8)
+		{
+			QuantTgtRule<uint8_t> quant_rule;
+			quant_rule.tgt = tgt;
+			read_from_mem(cur,end,quant_rule.prob_codes,PROB_NUM);
+			short int rule_type;
+			read_from_mem(cur,end,&rule_type,1);
+			quant_rule.rule_type = rule_type;
+			if (in_shard)
+			{
+				add_quant_rule_to_trie(src_wids,quant_rule);
+			}
+		}
+		else if (code_bits == 16)
+		{
+			QuantTgtRule<uint16_t> quant_rule;
+			quant_rule.tgt = tgt;
+			read_from_mem(cur,end,quant_rule.prob_codes,PROB_NUM);
+			short int rule_type;
+			read_from_mem(cur,end,&rule_type,1);
+			quant_rule.rule_type = rule_type;
+			if (in_shard)
+			{
+				add_quant_rule_to_trie(src_wids,quant_rule);
+			}
+		}
+		else
+		{
+			TgtRule tgt_rule;
+			tgt_rule.tgt = tgt;
+			tgt_rule.probs.resize(PROB_NUM);
+			read_from_mem(cur,end,&(tgt_rule.probs[0]),PROB_NUM);
+			tgt_rule.score = 0;
+			for( size_t i=0; i<weight.trans.size() && i<PROB_NUM; i++ )
+			{
+				tgt_rule.score += tgt_rule.probs[i]*weight.trans[i];
+			}
+			short int rule_type;
+			read_from_mem(cur,end,&rule_type,1);
+			tgt_rule.rule_type = rule_type;
+			if (in_shard)
+			{
+				add_rule_to_trie(src_wids,tgt_rule);
+			}
+		}
 	}
-	fin.close();
-	cout<<"load rule table file "<<rule_table_file<<" over\n";
+	cout<<"load rule table file "<<rule_table_file<<" over, "<<tgt_pool.size()<<" distinct target sides\n";
 }
 
-vector<vector<TgtRule>* > RuleTable::find_matched_rules_for_prefixes(const vector<int> &src_wids,const size_t pos)
+vector<vector<TgtRule>* > RuleTable::find_matched_rules_for_prefixes(const vector<int> &src_wids,const size_t pos,size_t ticket)
 {
 	vector<vector<TgtRule>* > matched_rules_for_prefixes;
 	RuleTrieNode* current = root;
+	uint64_t h = PatternFilter::start_hash();
 	for (size_t i=pos;i<src_wids.size() && i-pos<RULE_LEN_MAX;i++)
 	{
-		auto it = current->id2subtrie_map.find(src_wids.at(i));
-		if (it != current->id2subtrie_map.end())
+		if (filter != NULL)
 		{
-			current = it->second;
-			if (current->tgt_rules.size() == 0)
+			h = PatternFilter::extend_hash(h,src_wids[i]);
+			if (!filter->may_contain(h))							//没有以当前前缀开头的规则
 			{
 				matched_rules_for_prefixes.push_back(NULL);
-			}
-			else
-			{
-				matched_rules_for_prefixes.push_back(&(current->tgt_rules));
+				return matched_rules_for_prefixes;
 			}
 		}
+		auto it = current->id2subtrie_map.find(src_wids.at(i));
+		if (it != current->id2subtrie_map.end())
+		{
+			current = it->second;
+			matched_rules_for_prefixes.push_back(rules_of(current,ticket));
+		}
 		else
 		{
 			matched_rules_for_prefixes.push_back(NULL);
@@ -77,7 +161,123 @@ vector<vector<TgtRule>* > RuleTable::find_matched_rules_for_prefixes(const vecto
 	return matched_rules_for_prefixes;
 }
 
-void RuleTable::add_rule_to_trie(const vector<int> &src_wids, const TgtRule &tgt_rule)
+/**************************************************************************************
+ 1. 函数功能: 查找源端与给定pattern完全相同的规则
+ 2. 入口参数: pattern的单词id序列
+ 3. 出口参数: 匹配的规则目标端, 没有时为NULL
+ 4. 算法简介: 先用整个pattern查过滤器, 不存在的pattern只访问过滤器的一个块, 不遍历Trie树
+************************************************************************************* */
+vector<TgtRule>* RuleTable::find_matched_rules(const vector<int> &src_ids,size_t ticket)
+{
+	if (src_ids.size() > RULE_LEN_MAX)
+		return NULL;
+	if (filter != NULL)
+	{
+		uint64_t h = PatternFilter::start_hash();
+		for (auto wid : src_ids)
+		{
+			h = PatternFilter::extend_hash(h,wid);
+		}
+		if (!filter->may_contain(h))
+			return NULL;
+	}
+	RuleTrieNode* current = root;
+	for (auto wid : src_ids)
+	{
+		auto it = current->id2subtrie_map.find(wid);
+		if (it == current->id2subtrie_map.end())
+			return NULL;
+		current = it->second;
+	}
+	return rules_of(current,ticket);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 找出一个句子可能用到的所有pattern, 供规则表分片服务一次返回整个句子的规则
+ 2. 入口参数: 句子的单词id序列, 句子的编号(量化规则表解码出的规则在该句子结束前有效)
+ 3. 出口参数: 匹配的pattern及其规则, 有规则的pattern全部给出, 没有规则的只给出不含非终结符的pattern,
+ 			  以便调用方判断find_matched_rules_for_prefixes中的前缀是否存在
+ 4. 算法简介: 在Trie树上深度优先搜索, 终结符片段必须连续出现在句子中, 每个非终结符至少覆盖一个单词;
+ 			  非终结符之后(以及句首)的终结符片段可以从之后的任意位置开始. 状态为(Trie节点, 句子位置,
+ 			  是否可以跳过单词), 访问过的状态不再展开. 凡是按此方式能嵌入句子的pattern都会被访问到,
+ 			  RemoteRuleTable据此把未返回的pattern当作不存在
+************************************************************************************* */
+void RuleTable::match_sentence(const vector<int> &src_wids, vector<pair<vector<int>,const vector<TgtRule>*> > &matched_patterns,size_t ticket)
+{
+	matched_patterns.clear();
+	vector<int> pattern;
+	set<pair<RuleTrieNode*,size_t> > visited;
+	match_sentence_from(root,0,true,src_wids,ticket,pattern,visited,matched_patterns);
+}
+
+void RuleTable::match_sentence_from(RuleTrieNode *node, size_t pos, bool gap_open, const vector<int> &src_wids, size_t ticket, vector<int> &pattern,
+									set<pair<RuleTrieNode*,size_t> > &visited, vector<pair<vector<int>,const vector<TgtRule>*> > &matched_patterns)
+{
+	if (!visited.insert(make_pair(node,pos*2+(gap_open?1:0))).second)
+		return;
+	if (node != root && visited.count(make_pair(node,(size_t)-1)) == 0)		//(节点, -1)表示节点已经输出, 每个节点只输出一次
+	{
+		visited.insert(make_pair(node,(size_t)-1));
+		vector<TgtRule> *tgt_rules = rules_of(node,ticket);
+		if (tgt_rules != NULL || find(pattern.begin(),pattern.end(),src_nt_id) == pattern.end())
+		{
+			matched_patterns.push_back(make_pair(pattern,tgt_rules == NULL ? &(node->tgt_rules) : tgt_rules));	//没有规则时给出空的tgt_rules
+		}
+	}
+	size_t last_beg = gap_open ? src_wids.size() : pos+1;
+	for (size_t beg=pos;beg<last_beg && beg<src_wids.size();beg++)
+	{
+		auto it = node->id2subtrie_map.find(src_wids[beg]);
+		if (it == node->id2subtrie_map.end() || src_wids[beg] == src_nt_id)
+			continue;
+		pattern.push_back(src_wids[beg]);
+		match_sentence_from(it->second,beg+1,false,src_wids,ticket,pattern,visited,matched_patterns);
+		pattern.pop_back();
+	}
+	auto it = node->id2subtrie_map.find(src_nt_id);
+	if (it != node->id2subtrie_map.end() && pos < src_wids.size())
+	{
+		pattern.push_back(src_nt_id);
+		match_sentence_from(it->second,pos+1,true,src_wids,ticket,pattern,visited,matched_patterns);
+		pattern.pop_back();
+	}
+}
+
+RuleTable::~RuleTable()
+{
+	free_subtrie(root);
+	delete filter;
+	delete codebook;
+}
+
+void RuleTable::free_subtrie(RuleTrieNode *node)
+{
+	for (const auto &kvp : node->id2subtrie_map)
+	{
+		free_subtrie(kvp.second);
+	}
+	if (code_bits == 8)
+	{
+		delete (vector<QuantTgtRule<uint8_t> >*)node->quant_rules;
+	}
+	else if (code_bits == 16)
+	{
+		delete (vector<QuantTgtRule<uint16_t> >*)node->quant_rules;
+	}
+	delete node;
+}
+
+void RuleTable::load_filter(const string &filter_file,const LoadOption &load_option)
+{
+	filter = new PatternFilter;
+	if (!filter->load(filter_file,rule_source_hash,load_option))
+	{
+		delete filter;
+		filter = NULL;
+	}
+}
+
+RuleTrieNode* RuleTable::insert_to_trie(const vector<int> &src_wids)
 {
 	RuleTrieNode* current = root;
 	for (const auto &wid : src_wids)
@@ -94,16 +294,228 @@ void RuleTable::add_rule_to_trie(const vector<int> &src_wids, const TgtRule &tgt
 			current = tmp;
 		}
 	}
-	if (current->tgt_rules.size() < RULE_NUM_LIMIT)
+	return current;
+}
+
+void RuleTable::add_rule_to_trie(const vector<int> &src_wids, const TgtRule &tgt_rule)
+{
+	add_rule_with_limit(insert_to_trie(src_wids)->tgt_rules,tgt_rule,RULE_NUM_LIMIT);
+}
+
+//量化的规则不保存打分, 需要时由码本解码后加权
+template <class Code> double RuleTable::quant_rule_score(const QuantTgtRule<Code> &quant_rule)
+{
+	double score = 0;
+	for( size_t i=0; i<weight.trans.size() && i<PROB_NUM; i++ )
+	{
+		score += codebook->centers[i][quant_rule.prob_codes[i]]*weight.trans[i];
+	}
+	return score;
+}
+
+//与add_rule_with_limit相同, 超过上限时替换得分最低(得分相同时取最前)的一个
+template <class Code> void RuleTable::add_quant_rule_to_trie(const vector<int> &src_wids, const QuantTgtRule<Code> &quant_rule)
+{
+	RuleTrieNode *node = insert_to_trie(src_wids);
+	if (node->quant_rules == NULL)
+	{
+		node->quant_rules = new vector<QuantTgtRule<Code> >;
+	}
+	vector<QuantTgtRule<Code> > &quant_rules = *(vector<QuantTgtRule<Code> >*)node->quant_rules;
+	if (quant_rules.size() < (size_t)RULE_NUM_LIMIT)
+	{
+		quant_rules.push_back(quant_rule);
+		return;
+	}
+	size_t min_idx = 0;
+	double min_score = 0;
+	for (size_t i=0;i<quant_rules.size();i++)
+	{
+		double score = quant_rule_score(quant_rules[i]);
+		if (i == 0 || score < min_score)
+		{
+			min_idx = i;
+			min_score = score;
+		}
+	}
+	if (!quant_rules.empty() && min_score < quant_rule_score(quant_rule))
+	{
+		quant_rules[min_idx] = quant_rule;
+	}
+}
+
+template <class Code> void RuleTable::decode_quant_rules(const RuleTrieNode *node, vector<TgtRule> &tgt_rules)
+{
+	const vector<QuantTgtRule<Code> > &quant_rules = *(const vector<QuantTgtRule<Code> >*)node->quant_rules;
+	tgt_rules.resize(quant_rules.size());
+	for (size_t j=0;j<quant_rules.size();j++)
+	{
+		TgtRule &tgt_rule = tgt_rules[j];
+		tgt_rule.tgt = quant_rules[j].tgt;
+		tgt_rule.rule_type = quant_rules[j].rule_type;
+		tgt_rule.probs.resize(PROB_NUM);
+		for (size_t i=0;i<PROB_NUM;i++)
+		{
+			tgt_rule.probs[i] = codebook->centers[i][quant_rules[j].prob_codes[i]];
+		}
+		tgt_rule.score = quant_rule_score(quant_rules[j]);
+	}
+}
+
+template <class Code> size_t RuleTable::quant_rule_num(const RuleTrieNode *node)
+{
+	return node->quant_rules == NULL ? 0 : ((const vector<QuantTgtRule<Code> >*)node->quant_rules)->size();
+}
+
+size_t RuleTable::rule_num_of(const RuleTrieNode *node)
+{
+	if (code_bits == 8)
+		return quant_rule_num<uint8_t>(node);
+	if (code_bits == 16)
+		return quant_rule_num<uint16_t>(node);
+	return node->tgt_rules.size();
+}
+
+//量化规则表的每个句子有自己的解码结果, 编号即DecodedSentence的地址; 全精度的规则表不需要编号
+size_t RuleTable::begin_sentence(const vector<int> &)
+{
+	if (codebook == NULL)
+		return 0;
+	return (size_t)(new DecodedSentence);
+}
+
+void RuleTable::end_sentence(size_t ticket)
+{
+	if (codebook != NULL && ticket != NO_SENTENCE_TICKET)
+	{
+		delete (DecodedSentence*)ticket;
+	}
+}
+
+/**************************************************************************************
+ 1. 函数功能: 取出Trie节点上的规则
+ 2. 入口参数: Trie节点, 所在句子的编号
+ 3. 出口参数: 节点的规则, 没有规则时为NULL
+ 4. 算法简介: 全精度的规则表直接返回节点的tgt_rules; 量化的规则表把节点的规则解码到所在句子的DecodedSentence,
+ 			  同一句子再次查到该节点时直接返回, 句子的各个span线程共享解码结果, 因此加锁
+************************************************************************************* */
+vector<TgtRule>* RuleTable::rules_of(const RuleTrieNode *node, size_t ticket)
+{
+	if (codebook == NULL)
+		return node->tgt_rules.empty() ? NULL : (vector<TgtRule>*)&(node->tgt_rules);
+	if (node->quant_rules == NULL)
+		return NULL;
+	DecodedSentence *sentence = ticket == NO_SENTENCE_TICKET ? &unticketed : (DecodedSentence*)ticket;
+	pthread_mutex_lock(&sentence->mutex);
+	auto it = sentence->node2rules.find(node);
+	if (it == sentence->node2rules.end())
+	{
+		it = sentence->node2rules.insert(make_pair(node,vector<TgtRule>())).first;
+		if (code_bits == 8)
+		{
+			decode_quant_rules<uint8_t>(node,it->second);
+		}
+		else
+		{
+			decode_quant_rules<uint16_t>(node,it->second);
+		}
+	}
+	pthread_mutex_unlock(&sentence->mutex);
+	return &(it->second);
+}
+
+//源端相同的目标端超过上限时替换其中得分最低的一个
+void add_rule_with_limit(vector<TgtRule> &tgt_rules, const TgtRule &tgt_rule, size_t rule_num_limit)
+{
+	if (tgt_rules.size() < rule_num_limit)
 	{
-		current->tgt_rules.push_back(tgt_rule);
+		tgt_rules.push_back(tgt_rule);
 	}
 	else
 	{
-		auto it = min_element(current->tgt_rules.begin(), current->tgt_rules.end());
+		auto it = min_element(tgt_rules.begin(), tgt_rules.end());
 		if( it->score < tgt_rule.score )
 		{
 			(*it) = tgt_rule;
 		}
 	}
 }
+
+/**************************************************************************************
+ 1. 函数功能: 为规则表中所有规则的目标端计算语言模型id以及非终结符的位置
+ 2. 入口参数: 语言模型
+ 3. 出口参数: 无
+ 4. 算法简介: 语言模型加载后规则目标端到语言模型id的映射就固定了, 因此在解码前一次性完成转换,
+ 			  解码时计算语言模型得分只需顺序扫描kenlm_wids; 目标端已经去重, 相同的目标端只转换一次
+************************************************************************************* */
+void RuleTable::fill_kenlm_ids(LanguageModel *lm_model)
+{
+	tgt_pool.fill_kenlm_ids(lm_model);
+}
+
+size_t RuleTable::memory_bytes()
+{
+	size_t bytes = memory_bytes_for_subtrie(root)+tgt_pool.memory_bytes()+(filter==NULL?0:filter->memory_bytes());
+	if (codebook != NULL)
+	{
+		for (size_t i=0;i<PROB_NUM;i++)
+		{
+			bytes += codebook->centers[i].size()*sizeof(double);
+		}
+	}
+	return bytes;
+}
+
+bool RuleTable::get_trie_stats(vector<TrieLevelStats> &levels)
+{
+	levels.clear();
+	add_subtrie_stats(root,0,levels);
+	return true;
+}
+
+void RuleTable::add_subtrie_stats(RuleTrieNode *node, size_t depth, vector<TrieLevelStats> &levels)
+{
+	if (depth >= levels.size())
+	{
+		TrieLevelStats level;
+		memset(&level,0,sizeof(level));
+		levels.resize(depth+1,level);
+	}
+	TrieLevelStats &level = levels[depth];
+	size_t fanout = node->id2subtrie_map.size();
+	level.node_num++;
+	size_t rule_num = rule_num_of(node);
+	level.rule_node_num += rule_num == 0 ? 0 : 1;
+	level.rule_num += rule_num;
+	level.internal_node_num += fanout == 0 ? 0 : 1;
+	level.child_num += fanout;
+	level.max_fanout = max(level.max_fanout,fanout);
+	for (const auto &kvp : node->id2subtrie_map)
+	{
+		add_subtrie_stats(kvp.second,depth+1,levels);
+	}
+}
+
+//子树占用的内存, map的每个节点按键值对加红黑树节点的三个指针和颜色估计
+size_t RuleTable::memory_bytes_for_subtrie(RuleTrieNode *node)
+{
+	size_t bytes = sizeof(RuleTrieNode) + node->tgt_rules.capacity()*sizeof(TgtRule);
+	for (const auto &tgt_rule : node->tgt_rules)
+	{
+		bytes += tgt_rule.probs.capacity()*sizeof(double);
+	}
+	if (code_bits == 8 && node->quant_rules != NULL)
+	{
+		bytes += sizeof(vector<QuantTgtRule<uint8_t> >)+((vector<QuantTgtRule<uint8_t> >*)node->quant_rules)->capacity()*sizeof(QuantTgtRule<uint8_t>);
+	}
+	else if (code_bits == 16 && node->quant_rules != NULL)
+	{
+		bytes += sizeof(vector<QuantTgtRule<uint16_t> >)+((vector<QuantTgtRule<uint16_t> >*)node->quant_rules)->capacity()*sizeof(QuantTgtRule<uint16_t>);
+	}
+	bytes += node->id2subtrie_map.size()*(sizeof(pair<const int,RuleTrieNode*>)+4*sizeof(void*));
+	for (auto &kv : node->id2subtrie_map)
+	{
+		bytes += memory_bytes_for_subtrie(kv.second);
+	}
+	return bytes;
+}
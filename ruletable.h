@@ -1,40 +1,169 @@
+#ifndef RULETABLE_H
+#define RULETABLE_H
 #include "stdafx.h"
+#include "lm/word_index.hh"
+#include "fileloader.h"
+#include "patternfilter.h"
+#include "tgtpool.h"
 //#include "cand.h"
+class LanguageModel;
+
+const char RULE_QUANT_MAGIC[8] = {'H','I','E','R','O','Q','R','1'};
+
+//量化规则表(ruletable2bin -quantize生成)的文件头, 之后为PROB_NUM个特征各自的码本(double, 2^bits个),
+//再之后的规则与prob.bin相同, 只是每个翻译概率和词汇权重换成bits/8个字节的编码
+struct RuleQuantHeader
+{
+	char magic[8];
+	uint64_t bits;								//每个特征的编码位数, 8或16
+};
+
+//量化规则表中各个特征的码本, 按Federico and Bertoldi (2006)的等频分箱训练, 与KenLM的lm/quantize.cc相同;
+//编码0和1固定为LogP_PseudoZero和LogP_One, 使不存在的概率和glue规则的特征保持精确
+struct RuleCodebook
+{
+	vector<double> centers[PROB_NUM];
+};
 
 struct TgtRule
 {
 	bool operator<(const TgtRule &rhs) const{return score<rhs.score;};
 	short int rule_type; 						// 规则类型，0和1表示包含0或1个非终结符，2和3表示正序和逆序hiero规则，4表示glue规则
-	int word_num;                               // 规则目标端的终结符（单词）数
-	vector<int> wids;                           // 规则目标端的符号（包括终结符和非终结符）id序列
+	const TgtPhrase *tgt;                       // 规则目标端, 由规则来源的TgtPool保存
 	double score;                               // 规则打分, 即翻译概率与词汇权重的加权
 	vector<double> probs;                       // 翻译概率和词汇权重
+	TgtRule() {rule_type = 0; tgt = NULL; score = 0;};
+};
+
+//量化规则表中的一条规则, 编码的位数与码本相同(uint8_t或uint16_t); 不保存概率和打分, 查找时按码本解码成TgtRule
+template <class Code> struct QuantTgtRule
+{
+	const TgtPhrase *tgt;
+	Code prob_codes[PROB_NUM];
+	uint8_t rule_type;
 };
 
 struct RuleTrieNode 
 {
-	vector<TgtRule> tgt_rules;                  // 一个规则源端对应的所有目标端
+	vector<TgtRule> tgt_rules;                  // 全精度规则表中一个规则源端对应的所有目标端
+	void *quant_rules;                          // 量化规则表中的目标端, 为vector<QuantTgtRule<Code> >*, Code由码本的位数决定; 没有规则时为NULL
 	map <int, RuleTrieNode*> id2subtrie_map;    // 当前规则节点到下个规则节点的转换表
+	RuleTrieNode() {quant_rules = NULL;};
 };
 
-class RuleTable
+//规则前缀树中一层节点的统计, 第d层是源端长度为d的节点, 根节点在第0层
+struct TrieLevelStats
+{
+	size_t node_num;
+	size_t rule_node_num;						//有规则的节点数, 即不同的规则源端数
+	size_t rule_num;
+	size_t internal_node_num;					//有子节点的节点数
+	size_t child_num;							//所有节点的子节点数之和
+	size_t max_fanout;
+};
+
+const size_t NO_SENTENCE_TICKET = (size_t)-1;		//不属于任何句子的查找, 如直接查询一个规则源端
+
+//规则来源的接口, 可以是预先生成的规则表, 按块压缩的规则表, 规则表分片服务, 也可以是解码时从平行语料中抽取规则的后缀数组
+//查找时传入所在句子begin_sentence返回的编号, 远程的规则来源只在该句子取回的规则中查找, 量化的规则表把规则解码到该句子;
+//解码直接保存规则的指针, 返回的规则至少在所在句子的begin_sentence和end_sentence之间地址不变;
+//目标端被释放后地址可能被新的目标端复用, 语言模型得分缓存因此同时比较目标端的指针和serial
+//begin_sentence给出整个句子, 远程的规则来源据此一次取回句子可能用到的所有规则
+class RuleSource
+{
+	public:
+		virtual ~RuleSource() {};
+		virtual size_t begin_sentence(const vector<int> &) {return 0;};
+		virtual void end_sentence(size_t) {};
+		virtual vector<vector<TgtRule>* > find_matched_rules_for_prefixes(const vector<int> &src_wids,const size_t pos,size_t ticket=NO_SENTENCE_TICKET)=0;
+		virtual vector<TgtRule>* find_matched_rules(const vector<int> &src_ids,size_t ticket=NO_SENTENCE_TICKET)=0;
+		virtual void fill_kenlm_ids(LanguageModel *lm_model)=0;
+		virtual size_t memory_bytes()=0;
+		virtual bool get_trie_stats(vector<TrieLevelStats> &) {return false;};	//不是前缀树存储时返回false
+};
+
+//规则表分片服务中源端所在的分片, 按源端第一个终结符划分, 使以非终结符开头的规则也分散到各个分片;
+//只含非终结符的源端(glue规则)放在0号分片
+inline size_t rule_shard_of(const int *src_wids, size_t len, int src_nt_id, size_t shard_num)
+{
+	for (size_t i=0;i<len;i++)
+	{
+		if (src_wids[i] != src_nt_id)
+			return (size_t)src_wids[i]%shard_num;
+	}
+	return 0;
+}
+
+class RuleTable : public RuleSource
 {
 	public:
-		RuleTable(const size_t size_limit,const Weight &i_weight,const string &rule_table_file)
+		//shard_num大于1时只加载rule_shard_of为shard_id的规则, 用于规则表分片服务
+		RuleTable(const size_t size_limit,const Weight &i_weight,const string &rule_table_file,const LoadOption &load_option,
+				  size_t i_shard_id=0,size_t i_shard_num=1,int i_src_nt_id=-1)
 		{
 			RULE_NUM_LIMIT=size_limit;
 			weight=i_weight;
 			root=new RuleTrieNode;
-			load_rule_table(rule_table_file);
+			filter=NULL;
+			codebook=NULL;
+			code_bits=0;
+			rule_source_hash=0;
+			shard_id=i_shard_id;
+			shard_num=i_shard_num;
+			src_nt_id=i_src_nt_id;
+			load_rule_table(rule_table_file,load_option);
 		};
-		vector<vector<TgtRule>* > find_matched_rules_for_prefixes(const vector<int> &src_wids,const size_t pos);
+		~RuleTable();
+		void load_filter(const string &filter_file,const LoadOption &load_option);
+		size_t begin_sentence(const vector<int> &);
+		void end_sentence(size_t ticket);
+		vector<vector<TgtRule>* > find_matched_rules_for_prefixes(const vector<int> &src_wids,const size_t pos,size_t ticket=NO_SENTENCE_TICKET);
+		vector<TgtRule>* find_matched_rules(const vector<int> &src_ids,size_t ticket=NO_SENTENCE_TICKET);
+		void match_sentence(const vector<int> &src_wids, vector<pair<vector<int>,const vector<TgtRule>*> > &matched_patterns,size_t ticket=NO_SENTENCE_TICKET);
+		void fill_kenlm_ids(LanguageModel *lm_model);
+		size_t memory_bytes();
+		bool get_trie_stats(vector<TrieLevelStats> &levels);
 
 	private:
-		void load_rule_table(const string &rule_table_file);
+		//量化规则表中一个句子查到的规则, 按Trie节点解码一次, 句子结束时释放
+		struct DecodedSentence
+		{
+			pthread_mutex_t mutex;
+			unordered_map<const RuleTrieNode*,vector<TgtRule> > node2rules;
+			DecodedSentence() {pthread_mutex_init(&mutex,NULL);};
+			~DecodedSentence() {pthread_mutex_destroy(&mutex);};
+		};
+
+		void load_rule_table(const string &rule_table_file,const LoadOption &load_option);
 		void add_rule_to_trie(const vector<int> &src_wids, const TgtRule &tgt_rule);
+		RuleTrieNode* insert_to_trie(const vector<int> &src_wids);
+		template <class Code> void add_quant_rule_to_trie(const vector<int> &src_wids, const QuantTgtRule<Code> &quant_rule);
+		template <class Code> double quant_rule_score(const QuantTgtRule<Code> &quant_rule);
+		template <class Code> void decode_quant_rules(const RuleTrieNode *node, vector<TgtRule> &tgt_rules);
+		template <class Code> size_t quant_rule_num(const RuleTrieNode *node);
+		size_t rule_num_of(const RuleTrieNode *node);
+		vector<TgtRule>* rules_of(const RuleTrieNode *node, size_t ticket);
+		size_t memory_bytes_for_subtrie(RuleTrieNode *node);
+		void free_subtrie(RuleTrieNode *node);
+		void add_subtrie_stats(RuleTrieNode *node, size_t depth, vector<TrieLevelStats> &levels);
+		void match_sentence_from(RuleTrieNode *node, size_t pos, bool gap_open, const vector<int> &src_wids, size_t ticket, vector<int> &pattern,
+								 set<pair<RuleTrieNode*,size_t> > &visited, vector<pair<vector<int>,const vector<TgtRule>*> > &matched_patterns);
 
 	private:
 		int RULE_NUM_LIMIT;                      // 每个规则源端最多加载的目标端个数 
 		RuleTrieNode *root;                      // 规则Trie树根节点
 		Weight weight;                           // 特征权重
+		PatternFilter *filter;                   // 规则源端及其前缀的过滤器, 为NULL时直接查Trie树
+		uint64_t rule_source_hash;               // 规则表的内容哈希, 用来检查过滤器是否匹配
+		RuleCodebook *codebook;                  // 量化规则表的码本, 全精度的规则表为NULL
+		size_t code_bits;                        // 量化规则表的编码位数, 8或16
+		DecodedSentence unticketed;              // 不属于任何句子的查找解码出的规则, 规则表释放时才释放
+		TgtPool tgt_pool;                        // 所有规则去重后的目标端
+		size_t shard_id;                         // 作为分片加载时的分片编号和分片数, 不分片时分片数为1
+		size_t shard_num;
+		int src_nt_id;                           // 源端非终结符的id, 只在分片加载和match_sentence时使用
 };
+
+void add_rule_with_limit(vector<TgtRule> &tgt_rules, const TgtRule &tgt_rule, size_t rule_num_limit);
+
+#endif
@@ -1,8 +1,358 @@
 #include "myutils.h"
+#include "vocab.h"
+#include "patternfilter.h"
+#include "blockruletable.h"
+#include "lm/model.hh"
+#include "lm/enumerate_vocab.hh"
+#include <sys/stat.h>
+#include <numeric>
 const int LEN = 4096;
 
-void ruletable2bin(string rule_filename)
+//按KenLM的编号顺序收集语言模型的词表
+struct LMVocabCollector : public lm::EnumerateVocab
 {
+	void Add(lm::WordIndex index, const StringPiece &str)
+	{
+		if (index >= words.size())
+		{
+			words.resize(index+1);
+		}
+		words[index] = str.as_string();
+	}
+	vector<string> words;
+};
+
+/**************************************************************************************
+ 1. 函数功能: 写中英文词表, 包括文本格式和二进制格式
+ 2. 入口参数: 中英文词表, 语言模型文件(可以为空)
+ 3. 出口参数: 无
+ 4. 算法简介: 给出语言模型时, 把不在英文词表中的语言模型单词按KenLM的编号顺序加到英文词表末尾,
+ 			  与解码器加载语言模型时加词的顺序一致, 并把英文单词id到KenLM id的映射写入二进制词表
+************************************************************************************* */
+void write_vocabs(const vector<string> &ch_vocab_vec, unordered_map<string,int> &en_vocab, vector<string> &en_vocab_vec, const string &lm_filename)
+{
+	vector<lm::WordIndex> lm_ids;
+	uint64_t lm_bound = 0;
+	uint64_t lm_file_size = 0;
+	if (lm_filename != "")
+	{
+		LMVocabCollector collector;
+		lm::ngram::Config conf;
+		conf.enumerate_vocab = &collector;
+		conf.load_method = util::LAZY;
+		delete lm::ngram::LoadVirtual(lm_filename.c_str(),conf);
+		lm_bound = collector.words.size();							//KenLM的单词编号为[0,Bound())
+		struct stat st;
+		lm_file_size = stat(lm_filename.c_str(),&st)==0 ? st.st_size : 0;
+		for (lm::WordIndex index=0;index<collector.words.size();index++)
+		{
+			const string &word = collector.words[index];
+			auto it = en_vocab.find(word);
+			if (it == en_vocab.end())
+			{
+				it = en_vocab.insert(make_pair(word,(int)en_vocab_vec.size())).first;
+				en_vocab_vec.push_back(word);
+			}
+			if (it->second >= lm_ids.size())
+			{
+				lm_ids.resize(it->second+1,0);					//不在语言模型中的单词对应<unk>, 即0
+			}
+			lm_ids[it->second] = index;
+		}
+		lm_ids.resize(en_vocab_vec.size(),0);
+	}
+
+	ofstream f_ch_vocab("vocab.ch");
+	if (!f_ch_vocab.is_open())
+	{
+		cout<<"fail open ch vocab file to write!\n";
+		return;
+	}
+	for(size_t i=0;i<ch_vocab_vec.size();i++)
+	{
+		f_ch_vocab<<ch_vocab_vec.at(i)+" "+to_string(i)+"\n";
+	}
+	f_ch_vocab.close();
+
+	ofstream f_en_vocab("vocab.en");
+	if (!f_en_vocab.is_open())
+	{
+		cout<<"fail open en vocab file to write!\n";
+		return;
+	}
+	for(size_t i=0;i<en_vocab_vec.size();i++)
+	{
+		f_en_vocab<<en_vocab_vec.at(i)+" "+to_string(i)+"\n";
+	}
+	f_en_vocab.close();
+	Vocab::write_binary("vocab.ch.bin",ch_vocab_vec,vector<lm::WordIndex>(),0,0);
+	Vocab::write_binary("vocab.en.bin",en_vocab_vec,lm_ids,lm_bound,lm_file_size);
+}
+
+//把规则源端的所有前缀(包括整个源端)的哈希值加入列表
+void add_pattern_prefixes(vector<uint64_t> &pattern_hashes, const vector<int> &ch_id_vec)
+{
+	uint64_t h = PatternFilter::start_hash();
+	for (auto wid : ch_id_vec)
+	{
+		h = PatternFilter::extend_hash(h,wid);
+		pattern_hashes.push_back(h);
+	}
+}
+
+//生成规则源端pattern的过滤器, 记录规则表的内容哈希, 解码器据此检查两者是否匹配
+void write_pattern_filter(vector<uint64_t> &pattern_hashes, double fp_rate, uint64_t rule_source_hash)
+{
+	sort(pattern_hashes.begin(),pattern_hashes.end());
+	pattern_hashes.erase(unique(pattern_hashes.begin(),pattern_hashes.end()),pattern_hashes.end());
+	PatternFilter filter(pattern_hashes.size(),fp_rate);
+	for (auto h : pattern_hashes)
+	{
+		filter.insert(h);
+	}
+	if (filter.write("prob.bloom",rule_source_hash))
+	{
+		cout<<"pattern filter: "<<pattern_hashes.size()<<" patterns, "<<filter.memory_bytes()<<" bytes, expected false positive rate "<<filter.expected_fp_rate()<<endl;
+	}
+}
+
+//读入prob.bin, 并找出每条规则的起始位置
+void read_rule_records(const string &bin_filename, string &bin, vector<size_t> &rule_offsets)
+{
+	ifstream fin(bin_filename.c_str(),ios::binary);
+	bin.assign((istreambuf_iterator<char>(fin)),istreambuf_iterator<char>());
+	fin.close();
+	for (size_t offset=0;offset+sizeof(short int)<=bin.size();)
+	{
+		rule_offsets.push_back(offset);
+		short int src_len = *(short int*)(bin.data()+offset);
+		offset += sizeof(short int)+sizeof(int)*src_len;
+		short int tgt_len = *(short int*)(bin.data()+offset);
+		offset += sizeof(short int)+sizeof(int)*tgt_len+sizeof(double)*PROB_NUM+sizeof(short int);
+	}
+}
+
+//按等频分箱训练一个特征的码本, 与lm/quantize.cc的MakeBins相同, 每个箱的中心为箱内取值的平均值;
+//编码0和1保留给LogP_PseudoZero和LogP_One, 这两个值不参与分箱
+void make_codebook(vector<double> &values, size_t bits, vector<double> &centers)
+{
+	centers.resize(1<<bits);
+	centers[0] = LogP_PseudoZero;
+	centers[1] = LogP_One;
+	sort(values.begin(),values.end());
+	size_t bin_num = centers.size()-2;
+	auto start = values.begin();
+	for (size_t i=0;i<bin_num;i++)
+	{
+		auto finish = values.begin()+values.size()*(i+1)/bin_num;
+		if (finish == start)												//空箱
+		{
+			centers[i+2] = i==0 ? LogP_PseudoZero : centers[i+1];
+		}
+		else
+		{
+			centers[i+2] = accumulate(start,finish,0.0)/(finish-start);
+		}
+		start = finish;
+	}
+}
+
+//取与value最近的箱, 箱的中心是递增的
+uint16_t encode_prob(double value, const vector<double> &centers)
+{
+	if (value == LogP_PseudoZero)
+		return 0;
+	if (value == LogP_One)
+		return 1;
+	auto it = lower_bound(centers.begin()+2,centers.end(),value);
+	if (it == centers.end())
+		return centers.size()-1;
+	if (it != centers.begin()+2 && value-*(it-1) < *it-value)
+		return it-1-centers.begin();
+	return it-centers.begin();
+}
+
+/**************************************************************************************
+ 1. 函数功能: 把prob.bin中的翻译概率和词汇权重量化为8位或16位编码
+ 2. 入口参数: prob.bin文件名, 编码位数
+ 3. 出口参数: 无
+ 4. 算法简介: 每个特征用所有规则的取值训练各自的码本, 然后按RuleQuantHeader的格式重写prob.bin,
+ 			  并输出每个特征的平均量化误差, 用来选择编码位数
+************************************************************************************* */
+void quantize_rule_table(const string &bin_filename, size_t bits)
+{
+	string bin;
+	vector<size_t> rule_offsets;
+	read_rule_records(bin_filename,bin,rule_offsets);
+	auto probs_of = [&bin](size_t offset)
+	{
+		const char *cur = bin.data()+offset;
+		cur += sizeof(short int)+sizeof(int)*(*(short int*)cur);
+		cur += sizeof(short int)+sizeof(int)*(*(short int*)cur);
+		return (const double*)cur;
+	};
+	RuleCodebook codebook;
+	for (size_t i=0;i<PROB_NUM;i++)
+	{
+		vector<double> values;
+		for (auto offset : rule_offsets)
+		{
+			double value = probs_of(offset)[i];
+			if (value != LogP_PseudoZero && value != LogP_One)
+			{
+				values.push_back(value);
+			}
+		}
+		make_codebook(values,bits,codebook.centers[i]);
+	}
+
+	string quant_filename = bin_filename+".quant";
+	ofstream fout(quant_filename.c_str(),ios::binary);
+	if (!fout.is_open())
+	{
+		cout<<"fail open quantized rule table file to write!\n";
+		return;
+	}
+	RuleQuantHeader header;
+	memcpy(header.magic,RULE_QUANT_MAGIC,sizeof(header.magic));
+	header.bits = bits;
+	fout.write((char*)&header,sizeof(header));
+	for (size_t i=0;i<PROB_NUM;i++)
+	{
+		fout.write((char*)codebook.centers[i].data(),sizeof(double)*codebook.centers[i].size());
+	}
+	vector<double> error_sums(PROB_NUM,0.0);
+	for (auto offset : rule_offsets)
+	{
+		const double *probs = probs_of(offset);
+		fout.write(bin.data()+offset,(const char*)probs-(bin.data()+offset));		//源端和目标端不变
+		for (size_t i=0;i<PROB_NUM;i++)
+		{
+			uint16_t code = encode_prob(probs[i],codebook.centers[i]);
+			error_sums[i] += fabs(codebook.centers[i][code]-probs[i]);
+			fout.write((char*)&code,bits/8);										//小端序, 8位编码只写低字节
+		}
+		fout.write((const char*)(probs+PROB_NUM),sizeof(short int));
+	}
+	size_t quant_file_size = fout.tellp();
+	fout.close();
+	rename(quant_filename.c_str(),bin_filename.c_str());
+	cout<<"quantized rule table: "<<bits<<" bits, "<<quant_file_size<<" bytes ("<<bin.size()<<" bytes unquantized), mean absolute error of each feature:";
+	for (size_t i=0;i<PROB_NUM;i++)
+	{
+		cout<<' '<<(rule_offsets.empty()?0.0:error_sums[i]/rule_offsets.size());
+	}
+	cout<<endl;
+}
+
+//把一个块压缩后写入文件, 并在块索引中记录它的位置和第一个规则源端
+void flush_rule_block(ofstream &fout, string &raw, const vector<int> &key, vector<RuleBlockIndexEntry> &index, vector<int> &key_words)
+{
+	uLongf compressed_size = compressBound(raw.size());
+	string compressed(compressed_size,'\0');
+	compress2((Bytef*)&compressed[0],&compressed_size,(const Bytef*)raw.data(),raw.size(),Z_DEFAULT_COMPRESSION);
+	RuleBlockIndexEntry entry;
+	entry.offset = fout.tellp();
+	entry.compressed_size = compressed_size;
+	entry.raw_size = raw.size();
+	entry.key_beg = key_words.size();
+	entry.key_len = key.size();
+	index.push_back(entry);
+	key_words.insert(key_words.end(),key.begin(),key.end());
+	fout.write(compressed.data(),compressed_size);
+	raw.clear();
+}
+
+/**************************************************************************************
+ 1. 函数功能: 把prob.bin转换为按块压缩的规则表
+ 2. 入口参数: prob.bin文件名, 输出文件名
+ 3. 出口参数: 无
+ 4. 算法简介: 按源端对所有规则稳定排序, 源端相同时保持原来的顺序, 解码器据此按与RuleTable相同的方式
+ 			  限制每个源端的目标端个数; 依次编码后每积累RULE_BLOCK_SIZE字节且源端改变时结束一个块,
+ 			  块索引和key写在压缩数据之后, 最后回填文件头, 格式见blockruletable.h
+************************************************************************************* */
+void write_block_table(const string &bin_filename, const string &block_filename)
+{
+	string bin;
+	vector<size_t> rule_offsets;
+	read_rule_records(bin_filename,bin,rule_offsets);
+	const char *data = bin.data();
+	auto src_beg = [data](size_t offset){return (const int*)(data+offset+sizeof(short int));};
+	auto src_end = [data,src_beg](size_t offset){return src_beg(offset)+*(short int*)(data+offset);};
+	stable_sort(rule_offsets.begin(),rule_offsets.end(),[&](size_t a, size_t b)
+			{
+				return lexicographical_compare(src_beg(a),src_end(a),src_beg(b),src_end(b));
+			});
+
+	ofstream fout(block_filename.c_str(),ios::binary);
+	if (!fout.is_open())
+	{
+		cout<<"fail open block rule table file to write!\n";
+		return;
+	}
+	RuleBlockHeader header;
+	memset(&header,0,sizeof(header));
+	fout.write((char*)&header,sizeof(header));
+	vector<RuleBlockIndexEntry> index;
+	vector<int> key_words;
+	vector<int> key;
+	string raw;
+	for (size_t k=0;k<rule_offsets.size();k++)
+	{
+		size_t offset = rule_offsets[k];
+		header.rule_source_hash = PatternFilter::add_rule_source(header.rule_source_hash,src_beg(offset),src_end(offset)-src_beg(offset));
+		bool new_src = k == 0 || src_end(offset)-src_beg(offset) != src_end(rule_offsets[k-1])-src_beg(rule_offsets[k-1])
+					   || !equal(src_beg(offset),src_end(offset),src_beg(rule_offsets[k-1]));
+		if (new_src && raw.size() >= RULE_BLOCK_SIZE)
+		{
+			flush_rule_block(fout,raw,key,index,key_words);
+		}
+		if (raw.empty())
+		{
+			key.assign(src_beg(offset),src_end(offset));
+		}
+		const char *cur = data+offset;
+		for (int side=0;side<2;side++)									//源端和目标端
+		{
+			short int len = *(short int*)cur;
+			cur += sizeof(short int);
+			write_varint(raw,len);
+			for (short int i=0;i<len;i++)
+			{
+				write_varint(raw,((const int*)cur)[i]);
+			}
+			cur += sizeof(int)*len;
+		}
+		raw.append(cur,sizeof(double)*PROB_NUM);
+		cur += sizeof(double)*PROB_NUM;
+		raw.push_back((char)*(short int*)cur);
+	}
+	if (!raw.empty())
+	{
+		flush_rule_block(fout,raw,key,index,key_words);
+	}
+	while (fout.tellp()%8 != 0)
+	{
+		fout.put(0);
+	}
+	memcpy(header.magic,RULE_BLOCK_MAGIC,sizeof(header.magic));
+	header.block_num = index.size();
+	header.rule_num = rule_offsets.size();
+	header.index_offset = fout.tellp();
+	header.key_word_num = key_words.size();
+	fout.write((char*)index.data(),sizeof(RuleBlockIndexEntry)*index.size());
+	fout.write((char*)key_words.data(),sizeof(int)*key_words.size());
+	size_t block_file_size = fout.tellp();
+	fout.seekp(0);
+	fout.write((char*)&header,sizeof(header));
+	fout.close();
+	cout<<"block rule table: "<<header.rule_num<<" rules, "<<header.block_num<<" blocks, "<<block_file_size<<" bytes ("<<bin.size()<<" bytes uncompressed)\n";
+}
+
+void ruletable2bin(string rule_filename, string lm_filename, double fp_rate, size_t quant_bits, bool blocks)
+{
+	vector<uint64_t> pattern_hashes;
+	uint64_t rule_source_hash = 0;								//所有规则源端的内容哈希, 写入过滤器
 	unordered_map <string,int> ch_vocab;
 	unordered_map <string,int> en_vocab;
 	vector<string> ch_vocab_vec;
@@ -125,6 +475,8 @@ void ruletable2bin(string rule_filename)
 				}
 			}
 		}
+		add_pattern_prefixes(pattern_hashes,ch_id_vec);
+		rule_source_hash = PatternFilter::add_rule_source(rule_source_hash,ch_id_vec.data(),ch_id_vec.size());
 		short int ch_rule_len = ch_id_vec.size();
 		short int en_rule_len = en_id_vec.size();
 		fout.write((char*)&ch_rule_len,sizeof(short int));
@@ -146,42 +498,60 @@ void ruletable2bin(string rule_filename)
 	fout.write((char*)&en_id_vec[0],sizeof(int)*en_rule_len);
 	fout.write((char*)&prob_vec[0],sizeof(double)*prob_vec.size());
 	fout.write((char*)&rule_type,sizeof(short int));
+	add_pattern_prefixes(pattern_hashes,ch_id_vec);
+	rule_source_hash = PatternFilter::add_rule_source(rule_source_hash,ch_id_vec.data(),ch_id_vec.size());
 	gzclose(gzfp);
 	fout.close();
-
-	ofstream f_ch_vocab("vocab.ch");
-	if (!f_ch_vocab.is_open())
+	if (quant_bits > 0)
 	{
-		cout<<"fail open ch vocab file to write!\n";
-		return;
+		quantize_rule_table("prob.bin",quant_bits);
 	}
-	for(size_t i=0;i<ch_vocab_vec.size();i++)
+	if (blocks)
 	{
-		f_ch_vocab<<ch_vocab_vec.at(i)+" "+to_string(i)+"\n";
+		write_block_table("prob.bin","prob.blk");
+		remove("prob.bin");
 	}
-	f_ch_vocab.close();
+	write_pattern_filter(pattern_hashes,fp_rate,rule_source_hash);
 
-	ofstream f_en_vocab("vocab.en");
-	if (!f_en_vocab.is_open())
-	{
-		cout<<"fail open en vocab file to write!\n";
-		return;
-	}
-	for(size_t i=0;i<en_vocab_vec.size();i++)
-	{
-		f_en_vocab<<en_vocab_vec.at(i)+" "+to_string(i)+"\n";
-	}
-	f_en_vocab.close();
+	write_vocabs(ch_vocab_vec,en_vocab,en_vocab_vec,lm_filename);
 }
 
 int main(int argc,char* argv[])
 {
-    if(argc == 1)
-    {
-		cout<<"usage: ./ruletable2bin ruletable.gz\n";
+	string rule_filename;
+	string lm_filename;
+	double fp_rate = 0.01;
+	size_t quant_bits = 0;
+	bool blocks = false;
+	for (int i=1;i<argc;i++)
+	{
+		string arg(argv[i]);
+		if (arg == "-fp" && i+1 < argc)
+		{
+			fp_rate = stod(argv[++i]);
+		}
+		else if (arg == "-quantize" && i+1 < argc)
+		{
+			quant_bits = stoi(argv[++i]);
+		}
+		else if (arg == "-blocks")
+		{
+			blocks = true;
+		}
+		else if (rule_filename == "")
+		{
+			rule_filename = arg;
+		}
+		else
+		{
+			lm_filename = arg;
+		}
+	}
+	if (rule_filename == "" || (quant_bits != 0 && quant_bits != 8 && quant_bits != 16) || (quant_bits != 0 && blocks))
+	{
+		cout<<"usage: ./ruletable2bin [-fp false_positive_rate] [-quantize 8|16 | -blocks] ruletable.gz [lm_file]\n";
 		return 0;
-    }
-    string rule_filename(argv[1]);
-    ruletable2bin(rule_filename);
+	}
+	ruletable2bin(rule_filename,lm_filename,fp_rate,quant_bits,blocks);
 	return 0;
 }
@@ -0,0 +1,307 @@
+#include "config.h"
+#include "modelmanager.h"
+#include "profiler.h"
+
+//查询选项
+struct QueryOption
+{
+	bool print_rules;							//是否输出匹配到的规则
+	bool sentence_mode;							//输入的每行是句子而不是规则源端
+	size_t repeat;								//每次查找重复的次数, 用总时间除以次数作为查找的耗时
+};
+
+//查找耗时等统计
+struct QueryStats
+{
+	vector<double> lookup_times;				//每次查找的耗时(微秒)
+	vector<double> sentence_times;				//每个句子或pattern的begin_sentence的耗时(微秒)
+	size_t lookup_num;
+	size_t found_num;							//找到规则的查找数
+	size_t rule_num;
+	size_t depth_sum;							//每次查找在规则来源中能匹配的最长前缀长度之和
+	size_t len_sum;
+};
+
+//把空格分隔的单词转换为源端id, 规则源端中的非终结符写作[X][X]
+vector<int> get_src_wids(const string &line, bool sentence_mode, VocabOverlay &overlay)
+{
+	vector<int> src_wids;
+	vector<StringPiece> word_tags;
+	Split(word_tags,line);
+	for (const auto &word_tag : word_tags)
+	{
+		StringPiece word = word_tag;
+		if (sentence_mode)
+		{
+			bool is_verb;
+			SentenceTranslator::parse_word_tag(word_tag,word,is_verb);
+		}
+		src_wids.push_back(overlay.get_id(word));
+	}
+	return src_wids;
+}
+
+void print_rules(const vector<int> &pattern, const vector<TgtRule> &tgt_rules, const Models &models, VocabOverlay &overlay)
+{
+	string src;
+	for (auto wid : pattern)
+	{
+		src += overlay.get_word(wid)+" ";
+	}
+	for (const auto &tgt_rule : tgt_rules)
+	{
+		cout<<src<<"|||";
+		for (size_t i=0;i<tgt_rule.tgt->len;i++)
+		{
+			cout<<' '<<models.tgt_vocab->get_word(tgt_rule.tgt->wids[i]);
+		}
+		cout<<" |||";
+		for (size_t i=0;i<PROB_NUM;i++)
+		{
+			cout<<' '<<tgt_rule.probs[i];
+		}
+		cout<<" ||| "<<tgt_rule.rule_type<<" ||| "<<tgt_rule.score<<endl;
+	}
+}
+
+//规则来源中能匹配的pattern最长前缀的长度, 即查找在前缀树中到达的深度
+size_t get_match_depth(RuleSource *ruletable, const vector<int> &pattern, size_t ticket)
+{
+	return ruletable->find_matched_rules_for_prefixes(pattern,0,ticket).size();
+}
+
+/**************************************************************************************
+ 1. 函数功能: 查找一个规则源端, 记录耗时, 按需输出匹配到的规则
+ 2. 入口参数: 模型, 源端, 查询选项
+ 3. 出口参数: 查找统计
+ 4. 算法简介: 查找方式与解码时带非终结符的pattern相同, 即find_matched_rules;
+ 			  pattern本身作为一个句子, 查找前begin_sentence, 结束后end_sentence, 使规则来源能释放淘汰的块;
+ 			  远程规则来源在begin_sentence中取回规则, 网络请求的时间计入begin_sentence的耗时
+************************************************************************************* */
+void query_pattern(const Models &models, const vector<int> &pattern, const QueryOption &option, VocabOverlay &overlay, QueryStats &stats)
+{
+	double beg = wall_time();
+	size_t ticket = models.ruletable->begin_sentence(pattern);
+	stats.sentence_times.push_back((wall_time()-beg)*1e6);
+	vector<TgtRule> *matched_rules = NULL;
+	beg = wall_time();
+	for (size_t r=0;r<option.repeat;r++)
+	{
+		matched_rules = models.ruletable->find_matched_rules(pattern,ticket);
+	}
+	stats.lookup_times.push_back((wall_time()-beg)*1e6/option.repeat);
+	stats.lookup_num++;
+	stats.len_sum += pattern.size();
+	stats.depth_sum += get_match_depth(models.ruletable,pattern,ticket);
+	if (matched_rules != NULL && !matched_rules->empty())
+	{
+		stats.found_num++;
+		stats.rule_num += matched_rules->size();
+		if (option.print_rules)
+		{
+			print_rules(pattern,*matched_rules,models,overlay);
+		}
+	}
+	models.ruletable->end_sentence(ticket);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 按解码器的方式查找一个句子的短语规则, 记录耗时
+ 2. 入口参数: 模型, 句子, 查询选项
+ 3. 出口参数: 查找统计
+ 4. 算法简介: 与解码时相同, 先begin_sentence, 再对每个起始位置调用一次find_matched_rules_for_prefixes,
+ 			  每个起始位置算一次查找
+************************************************************************************* */
+void query_sentence(const Models &models, const vector<int> &src_wids, const QueryOption &option, VocabOverlay &overlay, QueryStats &stats)
+{
+	double beg = wall_time();
+	size_t ticket = models.ruletable->begin_sentence(src_wids);
+	stats.sentence_times.push_back((wall_time()-beg)*1e6);
+	for (size_t pos=0;pos<src_wids.size();pos++)
+	{
+		vector<vector<TgtRule>* > matched_rules_for_prefixes;
+		beg = wall_time();
+		for (size_t r=0;r<option.repeat;r++)
+		{
+			matched_rules_for_prefixes = models.ruletable->find_matched_rules_for_prefixes(src_wids,pos,ticket);
+		}
+		stats.lookup_times.push_back((wall_time()-beg)*1e6/option.repeat);
+		stats.lookup_num++;
+		stats.len_sum += min(src_wids.size()-pos,RULE_LEN_MAX);
+		stats.depth_sum += matched_rules_for_prefixes.size();
+		bool found = false;
+		for (size_t span=0;span<matched_rules_for_prefixes.size();span++)
+		{
+			vector<TgtRule> *matched_rules = matched_rules_for_prefixes.at(span);
+			if (matched_rules == NULL || matched_rules->empty())
+				continue;
+			found = true;
+			stats.rule_num += matched_rules->size();
+			if (option.print_rules)
+			{
+				vector<int> pattern(src_wids.begin()+pos,src_wids.begin()+pos+span+1);
+				print_rules(pattern,*matched_rules,models,overlay);
+			}
+		}
+		stats.found_num += found ? 1 : 0;
+	}
+	models.ruletable->end_sentence(ticket);
+}
+
+//输出耗时的平均值和分位数
+void print_latency(const string &name, vector<double> &times)
+{
+	if (times.empty())
+		return;
+	sort(times.begin(),times.end());
+	double sum = 0.0;
+	for (auto t : times)
+	{
+		sum += t;
+	}
+	auto percentile = [&](double p) {return times.at(min((size_t)(p*times.size()),times.size()-1));};
+	cout<<name<<" latency (us): mean "<<sum/times.size()<<" p50 "<<percentile(0.5)<<" p90 "<<percentile(0.9)
+		<<" p99 "<<percentile(0.99)<<" max "<<times.back()<<" total "<<sum/1e6<<"s\n";
+}
+
+void print_trie_stats(RuleSource *ruletable)
+{
+	vector<TrieLevelStats> levels;
+	if (!ruletable->get_trie_stats(levels))
+	{
+		cout<<"trie statistics not available for this rule source\n";
+		return;
+	}
+	cout<<"trie levels (depth nodes rule_nodes rules internal_nodes mean_fanout max_fanout):\n";
+	size_t node_num = 0;
+	size_t internal_node_num = 0;
+	size_t child_num = 0;
+	for (size_t depth=0;depth<levels.size();depth++)
+	{
+		const TrieLevelStats &level = levels.at(depth);
+		cout<<"  "<<depth<<' '<<level.node_num<<' '<<level.rule_node_num<<' '<<level.rule_num<<' '<<level.internal_node_num<<' '
+			<<(level.internal_node_num==0?0.0:double(level.child_num)/level.internal_node_num)<<' '<<level.max_fanout<<endl;
+		node_num += level.node_num;
+		internal_node_num += level.internal_node_num;
+		child_num += level.child_num;
+	}
+	//根节点的子节点数接近源端词表大小, 不计入平均
+	double below_root_fanout = internal_node_num<=1 ? 0.0 : double(child_num-levels.at(0).child_num)/(internal_node_num-levels.at(0).internal_node_num);
+	cout<<"trie nodes: "<<node_num<<" max depth: "<<levels.size()-1<<" mean fanout below root: "<<below_root_fanout<<endl;
+}
+
+int main(int argc,char* argv[])
+{
+	QueryOption option = {true,false,1};
+	string config_file = "config.ini";
+	string rule_table_file;
+	bool bad_args = false;
+	for (int i=1;i<argc;i++)
+	{
+		string arg(argv[i]);
+		if (arg == "-n")
+		{
+			option.print_rules = false;
+		}
+		else if (arg == "-s")
+		{
+			option.sentence_mode = true;
+		}
+		else if (arg == "-repeat" && i+1 < argc)
+		{
+			char *end = NULL;
+			long repeat = strtol(argv[++i],&end,10);
+			if (end == argv[i] || *end != '\0' || repeat < 1)
+			{
+				bad_args = true;
+			}
+			option.repeat = max(repeat,1L);
+		}
+		else if (arg == "-config" && i+1 < argc)
+		{
+			config_file = argv[++i];
+		}
+		else if (arg == "-rule-table" && i+1 < argc)
+		{
+			rule_table_file = argv[++i];
+		}
+		else
+		{
+			bad_args = true;
+		}
+	}
+	if (bad_args)
+	{
+		cerr<<"usage: ./ruletable_query [-n] [-s] [-repeat N] [-config config.ini] [-rule-table file] < input\n"
+			<<"  input lines are rule source sides ([X][X] for nonterminals), or sentences with -s\n"
+			<<"  -n: do not print matched rules  -repeat: a positive integer\n"
+			<<"  -rule-table: query this rule table instead of the grammar in the config\n";
+		return 1;
+	}
+	Filenames fns;
+	Parameter para;
+	Weight weight;
+	read_config(fns,para,weight,config_file);
+	if (rule_table_file != "")
+	{
+		fns.rule_table_file = rule_table_file;
+		fns.rule_filter_file = "";
+		fns.sa_corpus_file = "";
+		fns.rule_servers = "";
+	}
+
+	double load_beg = wall_time();
+	Vocab *src_vocab = new Vocab(fns.src_vocab_file);
+	Vocab *tgt_vocab = new Vocab(fns.tgt_vocab_file);
+	src_vocab->add_word("[X][X]");
+	BlockRuleTable *block_table = NULL;
+	RemoteRuleTable *remote_table = NULL;
+	RuleSource *ruletable = ModelManager::load_rule_source(fns,para,weight,src_vocab,tgt_vocab,block_table,remote_table);
+	double load_time = wall_time()-load_beg;
+	Models models = {src_vocab,tgt_vocab,ruletable,NULL,NULL};
+
+	QueryStats stats;
+	stats.lookup_num = 0;
+	stats.found_num = 0;
+	stats.rule_num = 0;
+	stats.depth_sum = 0;
+	stats.len_sum = 0;
+	string line;
+	while (getline(cin,line))
+	{
+		TrimLine(line);
+		VocabOverlay overlay(src_vocab);
+		vector<int> src_wids = get_src_wids(line,option.sentence_mode,overlay);
+		if (src_wids.empty())
+			continue;
+		if (option.sentence_mode)
+		{
+			query_sentence(models,src_wids,option,overlay,stats);
+		}
+		else
+		{
+			query_pattern(models,src_wids,option,overlay,stats);
+		}
+	}
+
+	cout<<"load time: "<<load_time<<"s memory: "<<ruletable->memory_bytes()/1024/1024<<"MB"<<endl;
+	cout<<"lookups: "<<stats.lookup_num<<" found: "<<stats.found_num<<" rules: "<<stats.rule_num
+		<<" mean depth: "<<(stats.lookup_num==0?0.0:double(stats.depth_sum)/stats.lookup_num)
+		<<" mean length: "<<(stats.lookup_num==0?0.0:double(stats.len_sum)/stats.lookup_num)<<endl;
+	print_latency("lookup",stats.lookup_times);
+	print_latency("begin_sentence",stats.sentence_times);
+	if (block_table != NULL)
+	{
+		size_t hit_num,miss_num;
+		block_table->get_cache_stats(hit_num,miss_num);
+		cout<<"rule block cache hits: "<<hit_num<<" misses: "<<miss_num<<endl;
+	}
+	if (remote_table != NULL)
+	{
+		size_t hit_num,miss_num;
+		remote_table->get_cache_stats(hit_num,miss_num);
+		cout<<"rule server sentence cache hits: "<<hit_num<<" misses: "<<miss_num<<endl;
+	}
+	print_trie_stats(ruletable);
+	return 0;
+}
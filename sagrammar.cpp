@@ -0,0 +1,597 @@
+#include "sagrammar.h"
+#include "lm.h"
+#include "util/exception.hh"
+#include "util/murmur_hash.hh"
+
+static double to_log_prob(double prob)
+{
+	return prob <= numeric_limits<double>::epsilon() ? LogP_PseudoZero : log10(prob);
+}
+
+size_t SAGrammar::PatternHasher::operator()(const vector<int> &pattern) const
+{
+	return util::MurmurHashNative(pattern.data(),pattern.size()*sizeof(int));
+}
+
+SAGrammar::SAGrammar(const string &index_file, int i_src_nt_id, int i_tgt_nt_id, const Parameter &para, const Weight &i_weight, const LoadOption &load_option)
+{
+	src_nt_id = i_src_nt_id;
+	tgt_nt_id = i_tgt_nt_id;
+	sample_size = max(para.SA_SAMPLE_SIZE,(size_t)1);
+	rule_num_limit = para.RULE_NUM_LIMIT;
+	weight = i_weight;
+	lm_model = NULL;
+	for (size_t i=0;i<SA_CACHE_SHARD_NUM;i++)
+	{
+		pthread_mutex_init(&shards[i].mutex,NULL);
+	}
+	make_glue_entry();
+	absent_entry.occurs = false;
+	empty_entry.occurs = true;
+
+	size_t file_size = 0;
+	try
+	{
+		file_size = load_file(index_file,load_option,mem);
+	}
+	catch (util::Exception &e)
+	{
+		cerr<<"cannot open suffix array index file, bye\n";
+		exit(EXIT_FAILURE);
+	}
+	header = (const SAIndexHeader*)mem.begin();
+	if (file_size < sizeof(SAIndexHeader) || memcmp(header->magic,SA_INDEX_MAGIC,sizeof(header->magic)) != 0
+		|| file_size != sizeof(SAIndexHeader)+(header->src_token_num+header->sa_size+header->tgt_token_num+header->align_num)*4
+						+(header->sen_num+1)*3*sizeof(uint32_t)+header->lex_num*sizeof(SALexEntry))
+	{
+		cerr<<index_file<<" is not a suffix array index file, bye\n";
+		exit(EXIT_FAILURE);
+	}
+	const char *cur = mem.begin()+sizeof(SAIndexHeader);
+	src_tokens = (const int*)cur;
+	cur += header->src_token_num*sizeof(int);
+	sa = (const uint32_t*)cur;
+	cur += header->sa_size*sizeof(uint32_t);
+	src_sen_starts = (const uint32_t*)cur;
+	cur += (header->sen_num+1)*sizeof(uint32_t);
+	tgt_tokens = (const int*)cur;
+	cur += header->tgt_token_num*sizeof(int);
+	tgt_sen_starts = (const uint32_t*)cur;
+	cur += (header->sen_num+1)*sizeof(uint32_t);
+	align_starts = (const uint32_t*)cur;
+	cur += (header->sen_num+1)*sizeof(uint32_t);
+	links = (const uint16_t*)cur;
+	cur += header->align_num*2*sizeof(uint16_t);
+	lex_entries = (const SALexEntry*)cur;
+	cout<<"load suffix array index file "<<index_file<<" over, "<<header->sen_num<<" sentence pairs, "<<header->src_token_num-header->sen_num<<" source words\n";
+}
+
+SAGrammar::~SAGrammar()
+{
+	for (size_t i=0;i<SA_CACHE_SHARD_NUM;i++)
+	{
+		for (auto &kv : shards[i].pattern2entry)
+		{
+			delete kv.second;
+		}
+		pthread_mutex_destroy(&shards[i].mutex);
+	}
+}
+
+//[X][X] [X][X]只用于glue规则, 不从语料中抽取
+void SAGrammar::make_glue_entry()
+{
+	TgtRule glue_rule;
+	glue_rule.rule_type = 4;
+	const int glue_wids[2] = {tgt_nt_id,tgt_nt_id};
+	glue_rule.tgt = tgt_pool.intern(glue_wids,2);
+	glue_rule.probs.resize(PROB_NUM,0.0);
+	glue_rule.score = 0;
+	glue_entry.occurs = true;
+	glue_entry.rules.push_back(glue_rule);
+}
+
+//已经抽取的规则的目标端在此一并填写语言模型id, 之后抽取的规则在加入目标端池时填写
+void SAGrammar::fill_kenlm_ids(LanguageModel *i_lm_model)
+{
+	lm_model = i_lm_model;
+	tgt_pool.fill_kenlm_ids(lm_model);
+}
+
+vector<vector<TgtRule>* > SAGrammar::find_matched_rules_for_prefixes(const vector<int> &src_wids,const size_t pos,size_t)
+{
+	vector<vector<TgtRule>* > matched_rules_for_prefixes;
+	vector<int> pattern;
+	for (size_t i=pos;i<src_wids.size() && i-pos<RULE_LEN_MAX;i++)
+	{
+		pattern.push_back(src_wids[i]);
+		PatternEntry *entry = get_entry(pattern);
+		if (!entry->occurs)
+		{
+			matched_rules_for_prefixes.push_back(NULL);
+			return matched_rules_for_prefixes;
+		}
+		matched_rules_for_prefixes.push_back(entry->rules.empty() ? NULL : &(entry->rules));
+	}
+	return matched_rules_for_prefixes;
+}
+
+vector<TgtRule>* SAGrammar::find_matched_rules(const vector<int> &src_ids,size_t)
+{
+	if (src_ids.size() > RULE_LEN_MAX || src_ids.empty())
+		return NULL;
+	if (src_ids.size() == 2 && src_ids[0] == src_nt_id && src_ids[1] == src_nt_id)
+		return &(glue_entry.rules);
+	PatternEntry *entry = get_entry(src_ids);
+	return entry->rules.empty() ? NULL : &(entry->rules);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 获取pattern的抽取结果
+ 2. 入口参数: pattern的单词id序列
+ 3. 出口参数: 抽取结果, 在对象的生命周期内有效
+ 4. 算法简介: 抽取在锁外进行, 多个线程同时抽取同一个pattern时保留先加入缓存的结果;
+ 			  抽取不出规则的pattern不加入缓存, 返回共用的absent_entry或empty_entry
+************************************************************************************* */
+SAGrammar::PatternEntry* SAGrammar::get_entry(const vector<int> &pattern)
+{
+	CacheShard &shard = shards[PatternHasher()(pattern)%SA_CACHE_SHARD_NUM];
+	pthread_mutex_lock(&shard.mutex);
+	auto it = shard.pattern2entry.find(pattern);
+	PatternEntry *entry = it==shard.pattern2entry.end() ? NULL : it->second;
+	pthread_mutex_unlock(&shard.mutex);
+	if (entry != NULL)
+		return entry;
+
+	PatternEntry *new_entry = extract_pattern(pattern);
+	if (new_entry->rules.empty())
+	{
+		entry = new_entry->occurs ? &empty_entry : &absent_entry;
+		delete new_entry;
+		return entry;
+	}
+	pthread_mutex_lock(&shard.mutex);
+	auto ret = shard.pattern2entry.insert(make_pair(pattern,new_entry));
+	entry = ret.first->second;
+	pthread_mutex_unlock(&shard.mutex);
+	if (entry != new_entry)
+	{
+		delete new_entry;
+	}
+	return entry;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 从语料中抽取源端为pattern的所有规则
+ 2. 入口参数: pattern的单词id序列, 非终结符为src_nt_id
+ 3. 出口参数: 抽取结果
+ 4. 算法简介: a) pattern按非终结符切分为终结符片段, 用后缀数组找出每个片段的出现范围;
+ 			  b) 以出现次数最少的片段为锚点, 在其出现范围内均匀采样至多sample_size个位置,
+ 			     在锚点所在句子中匹配其余片段, 得到至多sample_size个pattern实例;
+ 			  c) 对每个实例抽取目标端, 按目标端合并, 计算特征:
+ 			     [p(f|e), lex(f|e), p(e|f), lex(e|f)], 其中p(e|f)为目标端的实例数除以pattern的实例数,
+ 			     p(f|e)需要目标端在整个语料中的次数, 用MaxLex(f|e)近似; 词汇权重取所有实例的平均值
+************************************************************************************* */
+SAGrammar::PatternEntry* SAGrammar::extract_pattern(const vector<int> &pattern)
+{
+	PatternEntry *entry = new PatternEntry;
+	entry->occurs = false;
+	vector<vector<int> > chunks(1);
+	int x_num = 0;
+	for (size_t k=0;k<pattern.size();k++)
+	{
+		if (pattern[k] == src_nt_id)
+		{
+			x_num++;
+			if (k > 0 && pattern[k-1] == src_nt_id)
+				return entry;								//不抽取源端非终结符相邻的规则
+			if (!chunks.back().empty())
+			{
+				chunks.push_back(vector<int>());
+			}
+		}
+		else
+		{
+			chunks.back().push_back(pattern[k]);
+		}
+	}
+	if (chunks.back().empty())
+	{
+		chunks.pop_back();
+	}
+	if (chunks.empty() || x_num > 2)
+		return entry;
+	bool lead_x = pattern.front() == src_nt_id;
+	bool tail_x = pattern.back() == src_nt_id;
+
+	size_t anchor = 0;
+	size_t anchor_lo = 0, anchor_hi = 0;
+	for (size_t k=0;k<chunks.size();k++)
+	{
+		size_t lo,hi;
+		find_range(chunks[k].data(),chunks[k].size(),lo,hi);
+		if (lo == hi)
+			return entry;
+		if (k == 0 || hi-lo < anchor_hi-anchor_lo)
+		{
+			anchor = k;
+			anchor_lo = lo;
+			anchor_hi = hi;
+		}
+	}
+	entry->occurs = true;
+
+	vector<SAMatch> matches;
+	size_t occur_num = anchor_hi-anchor_lo;
+	size_t sample_num = min(occur_num,sample_size);
+	for (size_t s=0;s<sample_num && matches.size()<sample_size;s++)
+	{
+		size_t idx = anchor_lo + s*occur_num/sample_num;
+		match_chunks(chunks,anchor,sa[idx],lead_x,tail_x,matches);
+	}
+	if (matches.size() > sample_size)
+	{
+		matches.resize(sample_size);
+	}
+
+	map<pair<vector<int>,short int>,TgtStats> tgt2stats;
+	for (const auto &match : matches)
+	{
+		vector<int> tgt_wids;
+		short int rule_type;
+		TgtStats stats;
+		if (!extract_rule(match,chunks,lead_x,tail_x,tgt_wids,rule_type,stats))
+			continue;
+		auto ret = tgt2stats.insert(make_pair(make_pair(tgt_wids,rule_type),stats));
+		if (!ret.second)
+		{
+			TgtStats &sum = ret.first->second;
+			sum.count++;
+			sum.lex_e_given_f_sum += stats.lex_e_given_f_sum;
+			sum.lex_f_given_e_sum += stats.lex_f_given_e_sum;
+		}
+	}
+
+	for (const auto &kv : tgt2stats)
+	{
+		const TgtStats &stats = kv.second;
+		TgtRule tgt_rule;
+		tgt_rule.rule_type = kv.first.second;
+		tgt_rule.tgt = tgt_pool.intern(kv.first.first.data(),kv.first.first.size());
+		tgt_rule.probs = {to_log_prob(stats.max_lex_f_given_e),to_log_prob(stats.lex_f_given_e_sum/stats.count),
+						  to_log_prob((double)stats.count/matches.size()),to_log_prob(stats.lex_e_given_f_sum/stats.count)};
+		tgt_rule.score = 0;
+		for (size_t i=0;i<weight.trans.size() && i<PROB_NUM;i++)
+		{
+			tgt_rule.score += tgt_rule.probs[i]*weight.trans[i];
+		}
+		entry->rules.push_back(tgt_rule);
+	}
+	stable_sort(entry->rules.begin(),entry->rules.end(),[](const TgtRule &a, const TgtRule &b){return a.score > b.score;});
+	if (entry->rules.size() > rule_num_limit)
+	{
+		entry->rules.erase(entry->rules.begin()+rule_num_limit,entry->rules.end());
+	}
+	return entry;
+}
+
+//后缀数组中前len个单词与chunk相同的后缀的范围[lo,hi)
+void SAGrammar::find_range(const int *chunk, size_t len, size_t &lo, size_t &hi)
+{
+	size_t l = 0, r = header->sa_size;
+	while (l < r)
+	{
+		size_t mid = l+(r-l)/2;
+		if (compare_sa_suffix(src_tokens+sa[mid],chunk,len) < 0)
+			l = mid+1;
+		else
+			r = mid;
+	}
+	lo = l;
+	r = header->sa_size;
+	while (l < r)
+	{
+		size_t mid = l+(r-l)/2;
+		if (compare_sa_suffix(src_tokens+sa[mid],chunk,len) <= 0)
+			l = mid+1;
+		else
+			r = mid;
+	}
+	hi = l;
+}
+
+size_t SAGrammar::sen_of_pos(uint32_t pos)
+{
+	return upper_bound(src_sen_starts,src_sen_starts+header->sen_num+1,pos)-src_sen_starts-1;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 在锚点片段的一次出现所在的句子中匹配pattern的其余终结符片段
+ 2. 入口参数: 终结符片段, 锚点片段的序号, 锚点片段在语料中的位置, pattern首尾是否为非终结符
+ 3. 出口参数: pattern的实例
+ 4. 算法简介: 相邻片段之间至少间隔一个单词(非终结符), 所有片段和首尾非终结符(至少一个单词)
+ 			  的跨度不超过SA_MAX_INITIAL_SIZE
+************************************************************************************* */
+void SAGrammar::match_chunks(const vector<vector<int> > &chunks, size_t anchor, uint32_t anchor_pos, bool lead_x, bool tail_x, vector<SAMatch> &matches)
+{
+	size_t sen = sen_of_pos(anchor_pos);
+	const int *src = src_tokens+src_sen_starts[sen];
+	int src_len = src_sen_starts[sen+1]-src_sen_starts[sen]-1;
+	int pos = anchor_pos-src_sen_starts[sen];
+	int max_len = SA_MAX_INITIAL_SIZE-(lead_x?1:0)-(tail_x?1:0);
+	int win_beg = max(lead_x?1:0,pos+(int)chunks[anchor].size()-max_len);
+	int win_end = min(src_len-(tail_x?1:0),pos+max_len);
+	if (pos < win_beg || pos+(int)chunks[anchor].size() > win_end)
+		return;
+	SAMatch match;
+	match.sen = sen;
+	match.chunk_begs.resize(chunks.size());
+	match.chunk_begs[anchor] = pos;
+	match_chunks_from(src,win_beg,win_end,max_len,chunks,0,anchor,match,matches);
+}
+
+//从第k个片段开始递归地枚举各片段的位置, 锚点片段的位置已经确定
+void SAGrammar::match_chunks_from(const int *src, int win_beg, int win_end, int max_len, const vector<vector<int> > &chunks, size_t k, size_t anchor, SAMatch &match, vector<SAMatch> &matches)
+{
+	if (k == chunks.size())
+	{
+		if (match.chunk_begs.back()+(int)chunks.back().size()-match.chunk_begs[0] <= max_len)
+		{
+			matches.push_back(match);
+		}
+		return;
+	}
+	int min_beg = k==0 ? win_beg : match.chunk_begs[k-1]+(int)chunks[k-1].size()+1;
+	if (k == anchor)
+	{
+		if (match.chunk_begs[k] >= min_beg)
+		{
+			match_chunks_from(src,win_beg,win_end,max_len,chunks,k+1,anchor,match,matches);
+		}
+		return;
+	}
+	for (int beg=min_beg;beg+(int)chunks[k].size()<=win_end;beg++)
+	{
+		if (k < anchor && beg+(int)chunks[k].size() >= match.chunk_begs[anchor])
+			break;
+		if (equal(chunks[k].begin(),chunks[k].end(),src+beg))
+		{
+			match.chunk_begs[k] = beg;
+			match_chunks_from(src,win_beg,win_end,max_len,chunks,k+1,anchor,match,matches);
+		}
+	}
+}
+
+/**************************************************************************************
+ 1. 函数功能: 从pattern的一个实例中抽取规则目标端
+ 2. 入口参数: pattern的实例, 终结符片段, pattern首尾是否为非终结符
+ 3. 出口参数: 目标端单词id序列, 规则类型, 该实例的词汇权重
+ 4. 算法简介: 片段之间的非终结符跨度已经确定; pattern首尾的非终结符从一个单词开始逐渐加长,
+ 			  取第一个满足一致性约束的跨度
+************************************************************************************* */
+bool SAGrammar::extract_rule(const SAMatch &match, const vector<vector<int> > &chunks, bool lead_x, bool tail_x, vector<int> &tgt_wids, short int &rule_type, TgtStats &stats)
+{
+	size_t sen = match.sen;
+	const int *src = src_tokens+src_sen_starts[sen];
+	const int *tgt = tgt_tokens+tgt_sen_starts[sen];
+	int src_len = src_sen_starts[sen+1]-src_sen_starts[sen]-1;
+	int tgt_len = tgt_sen_starts[sen+1]-tgt_sen_starts[sen];
+	SenAlignment align;
+	align.src2tgt.resize(src_len);
+	align.tgt2src.resize(tgt_len);
+	for (uint32_t a=align_starts[sen];a<align_starts[sen+1];a++)
+	{
+		int i = links[2*a], j = links[2*a+1];
+		if (i < src_len && j < tgt_len)
+		{
+			align.src2tgt[i].push_back(j);
+			align.tgt2src[j].push_back(i);
+		}
+	}
+
+	int beg = match.chunk_begs.front();
+	int end = match.chunk_begs.back()+chunks.back().size();
+	vector<pair<int,int> > inner_xs;
+	for (size_t k=0;k+1<chunks.size();k++)
+	{
+		inner_xs.push_back(make_pair(match.chunk_begs[k]+(int)chunks[k].size(),match.chunk_begs[k+1]));
+	}
+	int max_lead_len = lead_x ? min(beg,SA_MAX_INITIAL_SIZE-(end-beg)-(tail_x?1:0)) : 0;
+	for (int lead_len=lead_x?1:0;lead_len<=max_lead_len;lead_len++)
+	{
+		int max_tail_len = tail_x ? min(src_len-end,SA_MAX_INITIAL_SIZE-(end-beg)-lead_len) : 0;
+		for (int tail_len=tail_x?1:0;tail_len<=max_tail_len;tail_len++)
+		{
+			vector<pair<int,int> > xs;
+			if (lead_x)
+			{
+				xs.push_back(make_pair(beg-lead_len,beg));
+			}
+			xs.insert(xs.end(),inner_xs.begin(),inner_xs.end());
+			if (tail_x)
+			{
+				xs.push_back(make_pair(end,end+tail_len));
+			}
+			if (extract_span(align,src,tgt,beg-lead_len,end+tail_len,xs,tgt_wids,rule_type,stats))
+				return true;
+		}
+	}
+	return false;
+}
+
+//源端跨度[beg,end)对齐到的目标端跨度[tgt_beg,tgt_end], 跨度内没有单词对齐或者目标端有单词对齐到跨度以外时不一致
+bool SAGrammar::consistent_tgt_span(const SenAlignment &align, int beg, int end, int &tgt_beg, int &tgt_end)
+{
+	tgt_beg = numeric_limits<int>::max();
+	tgt_end = -1;
+	for (int i=beg;i<end;i++)
+	{
+		for (int j : align.src2tgt[i])
+		{
+			tgt_beg = min(tgt_beg,j);
+			tgt_end = max(tgt_end,j);
+		}
+	}
+	if (tgt_end < 0)
+		return false;
+	for (int j=tgt_beg;j<=tgt_end;j++)
+	{
+		for (int i : align.tgt2src[j])
+		{
+			if (i < beg || i >= end)
+				return false;
+		}
+	}
+	return true;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 按给定的源端跨度和非终结符跨度抽取规则目标端
+ 2. 入口参数: 句对的词对齐, 源端和目标端句子, 源端跨度[beg,end), 按源端顺序排列的非终结符跨度
+ 3. 出口参数: 目标端单词id序列, 规则类型, 该实例的词汇权重
+ 4. 算法简介: 规则和每个非终结符的跨度都要满足一致性约束, 源端终结符中至少有一个单词有对齐;
+ 			  lex(e|f)和lex(f|e)按Koehn(2003)计算, 未对齐的单词对齐到空词
+************************************************************************************* */
+bool SAGrammar::extract_span(const SenAlignment &align, const int *src, const int *tgt, int beg, int end, const vector<pair<int,int> > &xs, vector<int> &tgt_wids, short int &rule_type, TgtStats &stats)
+{
+	int tgt_beg,tgt_end;
+	if (!consistent_tgt_span(align,beg,end,tgt_beg,tgt_end))
+		return false;
+	vector<int> x_tgt_begs(xs.size()), x_tgt_ends(xs.size());
+	for (size_t k=0;k<xs.size();k++)
+	{
+		if (!consistent_tgt_span(align,xs[k].first,xs[k].second,x_tgt_begs[k],x_tgt_ends[k]))
+			return false;
+	}
+	vector<int> src_terms;
+	bool has_aligned_term = false;
+	for (int i=beg;i<end;i++)
+	{
+		bool in_x = false;
+		for (const auto &x : xs)
+		{
+			in_x = in_x || (i >= x.first && i < x.second);
+		}
+		if (!in_x)
+		{
+			src_terms.push_back(i);
+			has_aligned_term = has_aligned_term || !align.src2tgt[i].empty();
+		}
+	}
+	if (!has_aligned_term)
+		return false;
+
+	tgt_wids.clear();
+	vector<int> tgt_terms;
+	vector<size_t> nt_order;
+	for (int j=tgt_beg;j<=tgt_end;j++)
+	{
+		int x = -1;
+		for (size_t k=0;k<xs.size();k++)
+		{
+			if (j >= x_tgt_begs[k] && j <= x_tgt_ends[k])
+			{
+				x = k;
+			}
+		}
+		if (x < 0)
+		{
+			tgt_wids.push_back(tgt[j]);
+			tgt_terms.push_back(j);
+		}
+		else if (j == x_tgt_begs[x])
+		{
+			tgt_wids.push_back(tgt_nt_id);
+			nt_order.push_back(x);
+		}
+	}
+	if (tgt_wids.size() > RULE_LEN_MAX)
+		return false;
+	rule_type = xs.size()<2 ? xs.size() : (nt_order[0]==0 ? 2 : 3);
+
+	double e_given_f,f_given_e;
+	stats.count = 1;
+	stats.lex_e_given_f_sum = 1.0;
+	for (int j : tgt_terms)
+	{
+		if (align.tgt2src[j].empty())
+		{
+			lex_prob(SA_NULL_WORD,tgt[j],e_given_f,f_given_e);
+			stats.lex_e_given_f_sum *= e_given_f;
+			continue;
+		}
+		double sum = 0.0;
+		for (int i : align.tgt2src[j])
+		{
+			lex_prob(src[i],tgt[j],e_given_f,f_given_e);
+			sum += e_given_f;
+		}
+		stats.lex_e_given_f_sum *= sum/align.tgt2src[j].size();
+	}
+	stats.lex_f_given_e_sum = 1.0;
+	stats.max_lex_f_given_e = 1.0;
+	for (int i : src_terms)
+	{
+		lex_prob(src[i],SA_NULL_WORD,e_given_f,f_given_e);
+		double max_f_given_e = f_given_e;
+		if (align.src2tgt[i].empty())
+		{
+			stats.lex_f_given_e_sum *= f_given_e;
+		}
+		else
+		{
+			double sum = 0.0;
+			for (int j : align.src2tgt[i])
+			{
+				lex_prob(src[i],tgt[j],e_given_f,f_given_e);
+				sum += f_given_e;
+			}
+			stats.lex_f_given_e_sum *= sum/align.src2tgt[i].size();
+		}
+		for (int j : tgt_terms)
+		{
+			lex_prob(src[i],tgt[j],e_given_f,f_given_e);
+			max_f_given_e = max(max_f_given_e,f_given_e);
+		}
+		stats.max_lex_f_given_e *= max_f_given_e;
+	}
+	return true;
+}
+
+//查词汇翻译表, 词对不存在时返回下限
+void SAGrammar::lex_prob(int f, int e, double &e_given_f, double &f_given_e)
+{
+	const SALexEntry *entries_end = lex_entries+header->lex_num;
+	const SALexEntry *it = lower_bound(lex_entries,entries_end,make_pair(f,e),
+			[](const SALexEntry &entry, const pair<int,int> &key){return entry.f<key.first || (entry.f==key.first && entry.e<key.second);});
+	if (it != entries_end && it->f == f && it->e == e)
+	{
+		e_given_f = max((double)it->e_given_f,SA_LEX_FLOOR);
+		f_given_e = max((double)it->f_given_e,SA_LEX_FLOOR);
+	}
+	else
+	{
+		e_given_f = SA_LEX_FLOOR;
+		f_given_e = SA_LEX_FLOOR;
+	}
+}
+
+//映射的索引文件和已经抽取的规则
+size_t SAGrammar::memory_bytes()
+{
+	size_t bytes = mem.size() + tgt_pool.memory_bytes();
+	for (size_t i=0;i<SA_CACHE_SHARD_NUM;i++)
+	{
+		pthread_mutex_lock(&shards[i].mutex);
+		for (const auto &kv : shards[i].pattern2entry)
+		{
+			bytes += sizeof(PatternEntry)+kv.first.capacity()*sizeof(int);
+			for (const auto &tgt_rule : kv.second->rules)
+			{
+				bytes += sizeof(TgtRule)+tgt_rule.probs.capacity()*sizeof(double);
+			}
+		}
+		pthread_mutex_unlock(&shards[i].mutex);
+	}
+	return bytes;
+}
@@ -0,0 +1,142 @@
+#ifndef SAGRAMMAR_H
+#define SAGRAMMAR_H
+
+#include "stdafx.h"
+#include "ruletable.h"
+#include "fileloader.h"
+
+const char SA_INDEX_MAGIC[8] = {'H','I','E','R','O','S','A','1'};
+const int SA_SEPARATOR = -1;					//源端语料中句子之间的分隔符, 小于所有单词id
+const int SA_NULL_WORD = -1;					//词汇翻译表中的空词
+const int SA_MAX_INITIAL_SIZE = 15;				//抽取规则时源端跨度的最大长度, 与Lopez(2007)的设置相同
+const size_t SA_CACHE_SHARD_NUM = 64;
+const double SA_LEX_FLOOR = 1e-7;				//词汇翻译概率的下限, 避免一个未见过的词对使词汇权重为0
+
+//后缀数组索引文件的文件头, 之后依次为:
+//源端单词id(int32, src_token_num个, 每个句子后面跟一个SA_SEPARATOR), 后缀数组(uint32, sa_size个),
+//每个句子在源端单词中的起始位置(uint32, sen_num+1个), 目标端单词id(int32, tgt_token_num个),
+//每个句子在目标端单词中的起始位置(uint32, sen_num+1个), 每个句子的词对齐的起始位置(uint32, sen_num+1个),
+//词对齐(uint16对, 句内的源端位置和目标端位置, align_num个), 词汇翻译表(SALexEntry, lex_num个, 按(f,e)排序)
+//单词id与ruletable2bin生成的词表一致, 由corpus2sa生成
+struct SAIndexHeader
+{
+	char magic[8];
+	uint64_t src_token_num;
+	uint64_t sa_size;
+	uint64_t sen_num;
+	uint64_t tgt_token_num;
+	uint64_t align_num;
+	uint64_t lex_num;
+};
+
+struct SALexEntry
+{
+	int32_t f;
+	int32_t e;
+	float e_given_f;								//t(e|f)
+	float f_given_e;								//t(f|e)
+};
+
+//后缀数组排序和查找时比较两个位置开始的最多depth个单词, 遇到分隔符时停止
+inline int compare_sa_suffix(const int *a, const int *b, size_t depth)
+{
+	for (size_t k=0;k<depth;k++)
+	{
+		if (a[k] != b[k])
+			return a[k]<b[k] ? -1 : 1;
+		if (a[k] == SA_SEPARATOR)
+			return 0;
+	}
+	return 0;
+}
+
+//解码时从词对齐的平行语料中抽取规则, 参见Lopez(2007) Hierarchical Phrase-Based Translation with Suffix Arrays
+//pattern的每个终结符片段用后缀数组查找, 以出现次数最少的片段为锚点均匀采样至多SA_SAMPLE_SIZE个出现位置,
+//在锚点所在句子中匹配其余片段, 再按Chiang(2007)的一致性约束抽取规则目标端并计算特征
+//抽取出规则的pattern按pattern缓存, 缓存只增不减, 规则的地址在对象的生命周期内不变;
+//抽取不出规则的pattern(大多是带间隔的pattern)不缓存, 每次查找时重新判断, 避免缓存随句子数无限增长
+class SAGrammar : public RuleSource
+{
+	public:
+		SAGrammar(const string &index_file, int i_src_nt_id, int i_tgt_nt_id, const Parameter &para, const Weight &i_weight, const LoadOption &load_option);
+		~SAGrammar();
+		vector<vector<TgtRule>* > find_matched_rules_for_prefixes(const vector<int> &src_wids,const size_t pos,size_t ticket=NO_SENTENCE_TICKET);
+		vector<TgtRule>* find_matched_rules(const vector<int> &src_ids,size_t ticket=NO_SENTENCE_TICKET);
+		void fill_kenlm_ids(LanguageModel *i_lm_model);
+		size_t memory_bytes();
+
+	private:
+		//一个pattern的抽取结果, occurs为false表示pattern的某个终结符片段在语料中不出现, 以它为前缀的pattern也不会出现
+		struct PatternEntry
+		{
+			bool occurs;
+			vector<TgtRule> rules;
+		};
+		//pattern的终结符片段在语料中的一次出现, 位置都是句内位置; pattern首尾的非终结符在抽取时确定长度
+		struct SAMatch
+		{
+			size_t sen;
+			vector<int> chunk_begs;
+		};
+		//一个句对的词对齐, 按源端和目标端位置索引
+		struct SenAlignment
+		{
+			vector<vector<int> > src2tgt;
+			vector<vector<int> > tgt2src;
+		};
+		//同一个目标端的出现次数和词汇权重之和, 抽取单个实例时count为1
+		struct TgtStats
+		{
+			size_t count;
+			double lex_e_given_f_sum;
+			double lex_f_given_e_sum;
+			double max_lex_f_given_e;
+		};
+		struct PatternHasher
+		{
+			size_t operator()(const vector<int> &pattern) const;
+		};
+		struct CacheShard
+		{
+			pthread_mutex_t mutex;
+			unordered_map<vector<int>,PatternEntry*,PatternHasher> pattern2entry;
+		};
+
+		PatternEntry* get_entry(const vector<int> &pattern);
+		PatternEntry* extract_pattern(const vector<int> &pattern);
+		void find_range(const int *chunk, size_t len, size_t &lo, size_t &hi);
+		void match_chunks(const vector<vector<int> > &chunks, size_t anchor, uint32_t anchor_pos, bool lead_x, bool tail_x, vector<SAMatch> &matches);
+		void match_chunks_from(const int *src, int win_beg, int win_end, int max_len, const vector<vector<int> > &chunks, size_t k, size_t anchor, SAMatch &match, vector<SAMatch> &matches);
+		bool extract_rule(const SAMatch &match, const vector<vector<int> > &chunks, bool lead_x, bool tail_x, vector<int> &tgt_wids, short int &rule_type, TgtStats &stats);
+		bool extract_span(const SenAlignment &align, const int *src, const int *tgt, int beg, int end, const vector<pair<int,int> > &xs, vector<int> &tgt_wids, short int &rule_type, TgtStats &stats);
+		bool consistent_tgt_span(const SenAlignment &align, int beg, int end, int &tgt_beg, int &tgt_end);
+		void lex_prob(int f, int e, double &e_given_f, double &f_given_e);
+		size_t sen_of_pos(uint32_t pos);
+		void make_glue_entry();
+
+	private:
+		util::scoped_memory mem;
+		const SAIndexHeader *header;
+		const int *src_tokens;
+		const uint32_t *sa;
+		const uint32_t *src_sen_starts;
+		const int *tgt_tokens;
+		const uint32_t *tgt_sen_starts;
+		const uint32_t *align_starts;
+		const uint16_t *links;
+		const SALexEntry *lex_entries;
+
+		int src_nt_id;
+		int tgt_nt_id;
+		size_t sample_size;
+		size_t rule_num_limit;
+		Weight weight;
+		LanguageModel *lm_model;
+		PatternEntry glue_entry;					//[X][X] [X][X]对应的glue规则
+		PatternEntry absent_entry;					//在语料中不出现的pattern共用的抽取结果
+		PatternEntry empty_entry;					//在语料中出现但抽取不出规则的pattern共用的抽取结果
+		TgtPool tgt_pool;							//抽取出的规则的目标端, 缓存的规则不淘汰, 目标端也不释放
+		CacheShard shards[SA_CACHE_SHARD_NUM];
+};
+
+#endif
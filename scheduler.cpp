@@ -0,0 +1,83 @@
+#include "translator.h"
+#include "scheduler.h"
+#include "ruletable.h"
+
+SentenceScheduler::SentenceScheduler(size_t i_thread_num, size_t i_span_thread_num)
+{
+	thread_num = max(i_thread_num,(size_t)1);
+	span_thread_num = max(i_span_thread_num,(size_t)1);
+	next_pos = 0;
+	idle_thread_num = 0;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 估计一个句子的解码代价
+ 2. 入口参数: 模型, 参数, 输入句子
+ 3. 出口参数: 相对代价, 只用于句子之间的比较
+ 4. 算法简介: 每个跨度最多做CUBE_SIZE次立方体剪枝扩展, 每次扩展都要查询语言模型, 因此代价主要
+ 			  由跨度数决定; 再加上以每个位置开头匹配到的短语规则数, 反映短语候选生成和hiero规则匹配的开销.
+ 			  规则匹配只查前缀树, 不生成候选
+************************************************************************************* */
+double SentenceScheduler::estimate_cost(const Models &models, const Parameter &para, const string &input_sen)
+{
+	vector<StringPiece> word_tags;
+	Split(word_tags,input_sen);
+	VocabOverlay overlay(models.src_vocab);
+	vector<int> src_wids;
+	for (const auto &word_tag : word_tags)
+	{
+		StringPiece word;
+		bool is_verb;
+		SentenceTranslator::parse_word_tag(word_tag,word,is_verb);
+		src_wids.push_back(overlay.get_id(word));
+	}
+	double len = src_wids.size();
+	double matched_rule_num = 0;
+	size_t rule_ticket = models.ruletable->begin_sentence(src_wids);
+	for (size_t beg=0;beg<src_wids.size();beg++)
+	{
+		for (auto matched_rules : models.ruletable->find_matched_rules_for_prefixes(src_wids,beg,rule_ticket))
+		{
+			if (matched_rules != NULL)
+			{
+				matched_rule_num += matched_rules->size();
+			}
+		}
+	}
+	models.ruletable->end_sentence(rule_ticket);
+	return len*(len+1)/2*para.CUBE_SIZE + matched_rule_num;
+}
+
+//按代价从大到小排列待解码的句子, 代价相同时保持输入顺序
+void SentenceScheduler::schedule(const vector<double> &costs)
+{
+	order.resize(costs.size());
+	for (size_t k=0;k<order.size();k++)
+	{
+		order[k] = k;
+	}
+	stable_sort(order.begin(),order.end(),[&](size_t a, size_t b){return costs[a]>costs[b];});
+	next_pos = 0;
+	idle_thread_num = 0;
+}
+
+//领取队列中的下一个句子, 返回它在待解码句子中的下标; 队列为空时当前线程变为空闲
+bool SentenceScheduler::next(size_t &k)
+{
+	size_t pos = next_pos++;
+	if (pos < order.size())
+	{
+		k = order[pos];
+		return true;
+	}
+	idle_thread_num++;
+	return false;
+}
+
+//仍在解码的句子平分空闲线程
+size_t SentenceScheduler::get_span_thread_num()
+{
+	size_t idle = min((size_t)idle_thread_num,thread_num-1);
+	size_t running = thread_num-idle;
+	return span_thread_num + idle/running;
+}
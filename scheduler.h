@@ -0,0 +1,29 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "stdafx.h"
+#include <atomic>
+
+struct Models;
+
+//批量解码时的句子调度器
+//按估计的解码代价从大到小分发句子, 各线程从共享队列中动态领取; 领不到句子的线程变为空闲,
+//空闲线程平均分给仍在解码的句子, 用于增加这些句子的span级并行数
+class SentenceScheduler
+{
+	public:
+		SentenceScheduler(size_t i_thread_num, size_t i_span_thread_num);
+		static double estimate_cost(const Models &models, const Parameter &para, const string &input_sen);
+		void schedule(const vector<double> &costs);
+		bool next(size_t &k);
+		size_t get_span_thread_num();
+
+	private:
+		size_t thread_num;
+		size_t span_thread_num;
+		vector<size_t> order;						//按代价从大到小排列的句子下标
+		atomic<size_t> next_pos;					//order中下一个待分发的位置
+		atomic<size_t> idle_thread_num;				//已经领不到句子的线程数
+};
+
+#endif
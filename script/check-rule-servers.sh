@@ -0,0 +1,51 @@
+#!/bin/sh
+# 检查用规则表分片服务解码与在进程内加载规则表解码的结果完全相同, 使用当前目录的config.ini和输入文件
+# 用法: check-rule-servers.sh 分片数 [hiero路径]
+# 依次在进程内和用分片数个分片服务解码, 逐字节比较译文和n-best文件; 相同时退出码为0, 否则输出差异, 退出码为1
+# 两次解码都去掉翻译记忆和语言模型调用记录, 避免读到或改写已有的文件; config.ini在结束时恢复
+if [ $# -lt 1 ]; then
+	echo "usage: check-rule-servers.sh shard-num [hiero]"
+	exit 1
+fi
+shard_num=$1
+hiero=${2:-./hiero}
+script_dir=$(dirname $0)
+work_dir=$(mktemp -d)
+value_of() {
+	sed -n "/^\[$1\]\$/{n;p;q}" $work_dir/config.orig
+}
+cp config.ini $work_dir/config.orig
+output_file=$(value_of output-file)
+nbest_file=$(value_of nbest-file)
+if [ -z "$output_file" ] || [ -z "$nbest_file" ]; then
+	echo "config.ini has no [output-file] or [nbest-file]"
+	rm -rf $work_dir
+	exit 1
+fi
+pids=""
+cleanup() {
+	cp $work_dir/config.orig config.ini
+	[ -n "$pids" ] && kill $pids 2>/dev/null
+	rm -rf $work_dir
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+# 去掉翻译记忆, 调用记录和已有的[rule-servers], 并输出n-best
+awk '/^\[(trans-cache-file|lm-trace-file|rule-servers|PRINT-NBEST)\]$/{getline; next} {print}' $work_dir/config.orig > $work_dir/config.local
+{ printf '[PRINT-NBEST]\n1\n'; cat $work_dir/config.local; } > config.ini
+$hiero > $work_dir/local.log 2>&1 || { echo "in-process decoding failed, log:"; cat $work_dir/local.log; exit 1; }
+cp $output_file $work_dir/local.out
+cp $nbest_file $work_dir/local.nbest
+
+addresses=$(sh $script_dir/start-rule-servers.sh $shard_num $work_dir $hiero 2>$work_dir/servers.log) || { cat $work_dir/servers.log; exit 1; }
+pids=$(sed -n 's/^shard [0-9]* pid //p' $work_dir/servers.log)
+{ printf '[PRINT-NBEST]\n1\n[rule-servers]\n%s\n' "$addresses"; cat $work_dir/config.local; } > config.ini
+$hiero > $work_dir/remote.log 2>&1 || { echo "decoding with $shard_num rule server shards failed, log:"; cat $work_dir/remote.log; exit 1; }
+
+status=0
+diff $work_dir/local.out $output_file || status=1
+diff $work_dir/local.nbest $nbest_file || status=1
+if [ $status -eq 0 ]; then
+	echo "output and n-best with $shard_num rule server shards are identical to the in-process rule table"
+fi
+exit $status
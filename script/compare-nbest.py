@@ -0,0 +1,63 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+# 比较同一输入用全精度规则表和量化规则表解码得到的nbest文件, 用来选择量化的编码位数
+# 用法: compare-nbest.py full-nbest.txt quantized-nbest.txt [reference ...]
+# 输出: 1-best译文相同的句子比例, 1-best模型得分之差, 以量化前的1-best为参考的BLEU, 给出参考译文时两者各自的BLEU
+from __future__ import print_function
+import sys
+import math
+from collections import Counter
+
+def read_1best(nbest_file):
+	sen2best = {}
+	for line in open(nbest_file):
+		fields = line.rstrip('\n').split(' ||| ')
+		sen_id = int(fields[0])
+		if sen_id not in sen2best:											# nbest按得分从高到低排列
+			sen2best[sen_id] = (fields[1].split(), float(fields[-1]))
+	return [sen2best[k] for k in sorted(sen2best)]
+
+def ngram_counts(words, n):
+	return Counter(tuple(words[i:i+n]) for i in range(len(words)-n+1))
+
+# 语料级BLEU-4, 多个参考译文时取最大n元组计数和最接近的长度
+def bleu(hyps, refs_list):
+	matches = [0]*4
+	totals = [0]*4
+	hyp_len = 0
+	ref_len = 0
+	for hyp, refs in zip(hyps, refs_list):
+		hyp_len += len(hyp)
+		ref_len += min((abs(len(ref)-len(hyp)), len(ref)) for ref in refs)[1]
+		for n in range(1, 5):
+			hyp_counts = ngram_counts(hyp, n)
+			max_ref_counts = Counter()
+			for ref in refs:
+				for ngram, count in ngram_counts(ref, n).items():
+					max_ref_counts[ngram] = max(max_ref_counts[ngram], count)
+			matches[n-1] += sum(min(count, max_ref_counts[ngram]) for ngram, count in hyp_counts.items())
+			totals[n-1] += max(len(hyp)-n+1, 0)
+	if min(matches) == 0:
+		return 0.0
+	log_precision = sum(math.log(float(m)/t) for m, t in zip(matches, totals))/4
+	brevity_penalty = min(0.0, 1-float(ref_len)/hyp_len)
+	return 100*math.exp(log_precision+brevity_penalty)
+
+if len(sys.argv) < 3:
+	print('usage: compare-nbest.py full-nbest.txt quantized-nbest.txt [reference ...]')
+	sys.exit(0)
+full = read_1best(sys.argv[1])
+quant = read_1best(sys.argv[2])
+if len(full) != len(quant):
+	print('sentence numbers differ: %d vs %d' % (len(full), len(quant)))
+	sys.exit(1)
+same_num = sum(1 for f, q in zip(full, quant) if f[0] == q[0])
+score_diffs = [q[1]-f[1] for f, q in zip(full, quant)]
+print('sentences: %d, identical 1-best: %d (%.2f%%)' % (len(full), same_num, 100.0*same_num/max(len(full), 1)))
+print('model score difference (quantized - full): mean %.6f, mean absolute %.6f, max absolute %.6f'
+	  % (sum(score_diffs)/max(len(full), 1), sum(abs(d) for d in score_diffs)/max(len(full), 1), max([0.0]+[abs(d) for d in score_diffs])))
+print('BLEU of quantized 1-best against full precision 1-best: %.2f' % bleu([q[0] for q in quant], [[f[0]] for f in full]))
+if len(sys.argv) > 3:
+	refs_list = list(zip(*[[line.split() for line in open(ref_file)] for ref_file in sys.argv[3:]]))
+	print('BLEU against references: full %.2f, quantized %.2f'
+		  % (bleu([f[0] for f in full], refs_list), bleu([q[0] for q in quant], refs_list)))
@@ -0,0 +1,39 @@
+#!/bin/sh
+# 在本机启动规则表分片服务, 每个分片一个进程, 使用当前目录的config.ini, 监听Unix域套接字
+# 用法: start-rule-servers.sh 分片数 [套接字目录] [hiero路径]
+# 输出: 填入解码器config.ini中[rule-servers]的地址列表; 用kill停止输出的进程号即可关闭服务
+# 某个分片在加载时退出(配置错误, 无法监听, 内存不足等)时输出它的日志, 停止其余分片, 退出码非0
+if [ $# -lt 1 ]; then
+	echo "usage: start-rule-servers.sh shard-num [socket-dir] [hiero]"
+	exit 1
+fi
+shard_num=$1
+socket_dir=${2:-/tmp}
+hiero=${3:-./hiero}
+addresses=""
+pids=""
+i=0
+while [ $i -lt $shard_num ]; do
+	address=unix:$socket_dir/hiero-rule-shard-$i.sock
+	$hiero -rule-server $i $shard_num $address > $socket_dir/hiero-rule-shard-$i.log 2>&1 &
+	echo "shard $i pid $!" 1>&2
+	addresses="$addresses $address"
+	pids="$pids $!"
+	i=$((i+1))
+done
+# 等待所有分片加载完规则表
+i=0
+for pid in $pids; do
+	log=$socket_dir/hiero-rule-shard-$i.log
+	while ! grep -q listening $log 2>/dev/null; do
+		if ! kill -0 $pid 2>/dev/null; then
+			echo "rule server shard $i (pid $pid) exited before listening, log $log:" 1>&2
+			cat $log 1>&2
+			kill $pids 2>/dev/null
+			exit 1
+		fi
+		sleep 1
+	done
+	i=$((i+1))
+done
+echo $addresses
@@ -26,6 +26,7 @@
 #include <pthread.h>
 #include <omp.h>
 
+#include "util/mmap.hh"
 
 using namespace std;
 
@@ -52,8 +53,16 @@ struct Filenames
 	string src_vocab_file;
 	string tgt_vocab_file;
 	string rule_table_file;
+	string rule_filter_file;			//规则源端pattern的过滤器(ruletable2bin生成的prob.bloom), 为空时不使用
+	string sa_corpus_file;				//平行语料的后缀数组索引(corpus2sa生成), 不为空时解码时抽取规则, 不加载规则表
+	string rule_servers;				//规则表分片服务的地址, 以空格分隔, 按分片编号排列; 不为空时不加载规则表
+	string rule_server_address;			//以规则表分片服务运行时监听的地址(命令行-rule-server), 为空时正常解码
 	string lm_file;
 	string fw_file;
+	string trans_cache_file;			//翻译记忆的磁盘文件, 为空时只在内存中缓存
+	string profile_file;				//每个句子各阶段耗时和计数的输出文件, 为空时不统计
+	string trace_file;					//各线程时间轴的跟踪文件(Chrome trace格式), 为空时不跟踪
+	string lm_trace_file;				//对KenLM的调用序列的记录文件, 为空时不记录
 };
 
 struct Parameter
@@ -67,6 +76,21 @@ struct Parameter
 	bool PRINT_NBEST;
 	bool DUMP_RULE;						//是否输出所使用的规则
 	bool DROP_OOV;						//是否在译文中显示OOV
+	size_t LM_CACHE_SIZE = 0;			//每个线程的规则语言模型得分缓存的项数, 为0时不使用缓存
+	util::LoadMethod LOAD_METHOD = util::LAZY;	//语言模型和规则表的加载方式
+	bool HUGE_PAGES = false;			//加载模型时是否使用大页
+	bool PREFAULT = false;				//加载后是否预先访问所有页
+	size_t WARM_UP = 0;					//正式解码前用输入文件的前几个句子预热
+	bool PROFILE = false;				//是否统计各阶段耗时和计数, 设置了profile-file时打开
+	size_t SEN_MEMORY_LIMIT = 0;		//每个句子的chart最多占用的内存(MB), 超过时减少规则数和beam, 为0时不限制
+	size_t MATCH_THREAD_NUM = 0;		//流水线模式下规则匹配、立方体剪枝和输出各阶段的线程数,
+	size_t SEARCH_THREAD_NUM = 0;		//MATCH_THREAD_NUM为0时不使用流水线, 按SEN_THREAD_NUM并行解码句子
+	size_t OUTPUT_THREAD_NUM = 0;
+	size_t SA_SAMPLE_SIZE = 300;		//从后缀数组抽取规则时每个pattern最多采样的实例数
+	size_t RULE_BLOCK_CACHE_SIZE = 256;	//按块压缩的规则表解压后的块最多占用的内存(MB)
+	size_t RULE_SERVER_CACHE_SIZE = 64;	//使用规则表分片服务时, 句子结束后在本地缓存其规则的句子数
+	size_t RULE_SHARD_ID = 0;			//以规则表分片服务运行时的分片编号和分片数
+	size_t RULE_SHARD_NUM = 1;
 };
 
 struct Weight
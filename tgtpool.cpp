@@ -0,0 +1,108 @@
+#include "tgtpool.h"
+#include "lm.h"
+#include "util/murmur_hash.hh"
+
+static atomic<uint32_t> pool_serial_counter(0);
+
+size_t TgtPool::PhraseHasher::operator()(const TgtPhrase *phrase) const
+{
+	return util::MurmurHashNative(phrase->wids,phrase->len*sizeof(int));
+}
+
+TgtPool::TgtPool()
+{
+	chunk_words = 0;
+	chunk_used = 0;
+	allocated_words = 0;
+	lm_model = NULL;
+	serial = ++pool_serial_counter;
+	pthread_mutex_init(&mutex,NULL);
+}
+
+TgtPool::~TgtPool()
+{
+	for (size_t i=0;i<word_chunks.size();i++)
+	{
+		delete[] word_chunks[i];
+		delete[] kenlm_chunks[i];
+	}
+	pthread_mutex_destroy(&mutex);
+}
+
+/**************************************************************************************
+ 1. 函数功能: 取与给定符号序列相同的目标端, 没有时加入
+ 2. 入口参数: 目标端的符号id序列及长度
+ 3. 出口参数: 去重后的目标端
+ 4. 算法简介: 用一个只引用调用方数组的临时目标端查哈希表, 没找到时把符号序列复制到当前块的末尾,
+ 			  当前块放不下时分配新的块, 一个目标端不跨块
+************************************************************************************* */
+const TgtPhrase* TgtPool::intern(const int *wids, size_t len)
+{
+	TgtPhrase probe;
+	probe.wids = wids;
+	probe.len = len;
+	pthread_mutex_lock(&mutex);
+	auto it = phrase_set.find(&probe);
+	if (it != phrase_set.end())
+	{
+		const TgtPhrase *phrase = *it;
+		pthread_mutex_unlock(&mutex);
+		return phrase;
+	}
+	if (word_chunks.empty() || chunk_used+len > chunk_words)
+	{
+		chunk_words = word_chunks.empty() ? MIN_CHUNK_WORDS : min(chunk_words*2,(size_t)MAX_CHUNK_WORDS);
+		chunk_words = max(chunk_words,len);
+		word_chunks.push_back(new int[chunk_words]);
+		kenlm_chunks.push_back(new lm::WordIndex[chunk_words]);
+		allocated_words += chunk_words;
+		chunk_used = 0;
+	}
+	int *words = word_chunks.back()+chunk_used;
+	copy(wids,wids+len,words);
+	phrases.push_back(probe);
+	TgtPhrase &phrase = phrases.back();
+	phrase.wids = words;
+	phrase.kenlm_wids = kenlm_chunks.back()+chunk_used;
+	phrase.nt_pos[0] = -1;										// 语言模型加载后由fill_kenlm_ids填写
+	phrase.nt_pos[1] = -1;
+	phrase.serial = serial;
+	if (lm_model != NULL)
+	{
+		lm_model->fill_kenlm_ids(phrase);
+	}
+	chunk_used += len;
+	phrase_set.insert(&phrase);
+	pthread_mutex_unlock(&mutex);
+	return &phrase;
+}
+
+//已经加入的目标端在此一并填写语言模型id, 之后加入的目标端在加入时填写
+void TgtPool::fill_kenlm_ids(LanguageModel *i_lm_model)
+{
+	pthread_mutex_lock(&mutex);
+	lm_model = i_lm_model;
+	for (auto &phrase : phrases)
+	{
+		lm_model->fill_kenlm_ids(phrase);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+size_t TgtPool::size()
+{
+	pthread_mutex_lock(&mutex);
+	size_t phrase_num = phrases.size();
+	pthread_mutex_unlock(&mutex);
+	return phrase_num;
+}
+
+//哈希表的每个节点按指针加下一个节点的指针和缓存的哈希值估计
+size_t TgtPool::memory_bytes()
+{
+	pthread_mutex_lock(&mutex);
+	size_t bytes = allocated_words*(sizeof(int)+sizeof(lm::WordIndex)) + phrases.size()*sizeof(TgtPhrase)
+				 + phrase_set.size()*3*sizeof(void*) + phrase_set.bucket_count()*sizeof(void*);
+	pthread_mutex_unlock(&mutex);
+	return bytes;
+}
@@ -0,0 +1,61 @@
+#ifndef TGTPOOL_H
+#define TGTPOOL_H
+
+#include "stdafx.h"
+#include "lm/word_index.hh"
+#include <deque>
+#include <unordered_set>
+#include <atomic>
+class LanguageModel;
+
+//去重后的规则目标端, 源端不同但目标端相同的规则共用一个
+struct TgtPhrase
+{
+	const int *wids;                            // 目标端的符号（包括终结符和非终结符）id序列, 在TgtPool中连续存放
+	lm::WordIndex *kenlm_wids;                  // 与wids对应的语言模型id序列, 非终结符位置的值无意义
+	uint16_t len;                               // 目标端的符号数
+	short int nt_pos[2];                        // 两个非终结符在wids中的位置, 不存在时为-1
+	uint32_t serial;                            // 所在TgtPool的编号, 语言模型得分缓存用它区分先后占用同一地址的目标端
+};
+
+//规则目标端的去重存储, 目标端的单词id和语言模型id分别连续存放在只增不减的块中, 地址在对象的生命周期内不变;
+//语言模型加载后加入的目标端在加入时填写语言模型id; 可以多线程同时加入
+class TgtPool
+{
+	public:
+		TgtPool();
+		~TgtPool();
+		const TgtPhrase* intern(const int *wids, size_t len);
+		void fill_kenlm_ids(LanguageModel *i_lm_model);
+		size_t size();
+		size_t memory_bytes();
+
+	private:
+		struct PhraseHasher
+		{
+			size_t operator()(const TgtPhrase *phrase) const;
+		};
+		struct PhraseEqual
+		{
+			bool operator()(const TgtPhrase *a, const TgtPhrase *b) const
+			{
+				return a->len == b->len && equal(a->wids,a->wids+a->len,b->wids);
+			}
+		};
+
+	private:
+		static const size_t MIN_CHUNK_WORDS = 256;		//第一个块的单词数, 之后每个块加倍, 直到MAX_CHUNK_WORDS
+		static const size_t MAX_CHUNK_WORDS = 1<<16;
+		vector<int*> word_chunks;
+		vector<lm::WordIndex*> kenlm_chunks;
+		size_t chunk_words;							//当前块的容量
+		size_t chunk_used;							//当前块已用的单词数
+		size_t allocated_words;						//所有块的容量之和
+		deque<TgtPhrase> phrases;
+		unordered_set<const TgtPhrase*,PhraseHasher,PhraseEqual> phrase_set;
+		LanguageModel *lm_model;
+		uint32_t serial;
+		pthread_mutex_t mutex;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "tracer.h"
+#include <unistd.h>
+#include <sys/syscall.h>
+
+const size_t TRACE_FLUSH_EVENT_NUM = 1<<16;			//线程缓冲区的事件数达到该值时写入文件
+
+bool Tracer::trace_on = false;
+string Tracer::trace_file;
+double Tracer::start_time = 0.0;
+ofstream Tracer::fout;
+bool Tracer::first_event = true;
+vector<Tracer::ThreadBuffer*> Tracer::buffers;
+pthread_mutex_t Tracer::mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//线程的缓冲区, 线程结束时写出剩余的事件并释放; 嵌套的OpenMP线程组每次会创建新线程, 不释放会持续占用内存
+struct ThreadTraceBuffer
+{
+	Tracer::ThreadBuffer *buffer = NULL;
+	~ThreadTraceBuffer()
+	{
+		if (buffer != NULL)
+		{
+			Tracer::unregister(buffer);
+		}
+	}
+};
+
+static void close_trace_at_exit()
+{
+	Tracer::close();
+}
+
+/**************************************************************************************
+ 1. 函数功能: 打开跟踪文件并开始记录
+ 2. 入口参数: 跟踪文件名, 为空时不跟踪
+ 3. 出口参数: 无
+ 4. 算法简介: 输出Trace Event Format的JSON对象, 先写文件头, 事件在缓冲区满, 线程结束和进程退出时追加,
+ 			  每个线程的事件按记录顺序输出, 开始和结束事件在同一线程内成对嵌套
+************************************************************************************* */
+void Tracer::open(const string &i_trace_file)
+{
+	if (i_trace_file == "")
+		return;
+	trace_file = i_trace_file;
+	fout.open(trace_file.c_str());
+	if (!fout.is_open())
+	{
+		cerr<<"cannot open trace file!\n";
+		return;
+	}
+	fout.setf(ios::fixed);
+	fout.precision(3);
+	fout<<"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	start_time = wall_time();
+	trace_on = true;
+	atexit(close_trace_at_exit);
+}
+
+Tracer::ThreadBuffer* Tracer::get_thread_buffer()
+{
+	thread_local ThreadTraceBuffer thread_buffer;
+	if (thread_buffer.buffer == NULL)
+	{
+		ThreadBuffer *buffer = new ThreadBuffer;
+		buffer->tid = syscall(SYS_gettid);
+		pthread_mutex_lock(&mutex);
+		buffers.push_back(buffer);
+		pthread_mutex_unlock(&mutex);
+		thread_buffer.buffer = buffer;
+	}
+	return thread_buffer.buffer;
+}
+
+void Tracer::record(const char *name, char ph, int sen_id, int beg, int span)
+{
+	TraceEvent event = {name,ph,(wall_time()-start_time)*1e6,sen_id,beg,span};
+	ThreadBuffer *buffer = get_thread_buffer();
+	buffer->events.push_back(event);
+	if (buffer->events.size() >= TRACE_FLUSH_EVENT_NUM)
+	{
+		pthread_mutex_lock(&mutex);
+		flush(buffer);
+		pthread_mutex_unlock(&mutex);
+	}
+}
+
+//将缓冲区中的事件追加到跟踪文件并清空缓冲区, 调用者持有mutex
+void Tracer::flush(ThreadBuffer *buffer)
+{
+	if (fout.is_open())
+	{
+		long pid = getpid();
+		for (const auto &event : buffer->events)
+		{
+			fout<<(first_event?"":",\n")<<"{\"name\":\""<<event.name<<"\",\"ph\":\""<<event.ph<<"\",\"ts\":"<<event.ts
+				<<",\"pid\":"<<pid<<",\"tid\":"<<buffer->tid;
+			if (event.sen_id >= 0 || event.beg >= 0 || event.span >= 0)
+			{
+				fout<<",\"args\":{";
+				string sep = "";
+				if (event.sen_id >= 0) {fout<<"\"sen_id\":"<<event.sen_id; sep = ",";}
+				if (event.beg >= 0) {fout<<sep<<"\"beg\":"<<event.beg; sep = ",";}
+				if (event.span >= 0) {fout<<sep<<"\"span\":"<<event.span;}
+				fout<<"}";
+			}
+			fout<<"}";
+			first_event = false;
+		}
+	}
+	buffer->events.clear();
+}
+
+//线程结束时写出剩余的事件并释放缓冲区
+void Tracer::unregister(ThreadBuffer *buffer)
+{
+	pthread_mutex_lock(&mutex);
+	flush(buffer);
+	buffers.erase(find(buffers.begin(),buffers.end(),buffer));
+	pthread_mutex_unlock(&mutex);
+	delete buffer;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 写出所有线程剩余的事件和文件尾, 结束跟踪
+ 2. 入口参数: 无
+ 3. 出口参数: 无
+ 4. 算法简介: 在进程退出时调用, 此时所有线程都已停止记录; 之后结束的线程不再写文件, 只释放缓冲区
+************************************************************************************* */
+void Tracer::close()
+{
+	if (!trace_on)
+		return;
+	trace_on = false;
+	pthread_mutex_lock(&mutex);
+	for (auto buffer : buffers)
+	{
+		flush(buffer);
+	}
+	fout<<"\n]}\n";
+	fout.close();
+	pthread_mutex_unlock(&mutex);
+	cout<<"trace written to "<<trace_file<<endl;
+}
@@ -0,0 +1,64 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include "stdafx.h"
+#include "profiler.h"
+
+//一个开始或结束事件, name必须指向静态字符串
+struct TraceEvent
+{
+	const char *name;
+	char ph;									//'B'表示开始, 'E'表示结束
+	double ts;									//相对于开始跟踪的时间, 单位为微秒
+	int sen_id;									//以下参数为-1时不输出
+	int beg;
+	int span;
+};
+
+//记录各线程在时间轴上的活动, 输出chrome://tracing和Perfetto可以读取的JSON文件
+//每个线程写自己的缓冲区, 记录事件时不加锁; 缓冲区满或线程结束时加锁追加到文件, 退出时写完文件尾;
+//未开启时每个埋点只有一次分支判断
+class Tracer
+{
+	public:
+		static void open(const string &trace_file);
+		static bool enabled() {return trace_on;};
+		static void record(const char *name, char ph, int sen_id, int beg, int span);
+		static void close();
+
+	private:
+		struct ThreadBuffer
+		{
+			long tid;
+			vector<TraceEvent> events;
+		};
+		friend struct ThreadTraceBuffer;
+		static ThreadBuffer* get_thread_buffer();
+		static void flush(ThreadBuffer *buffer);
+		static void unregister(ThreadBuffer *buffer);
+
+	private:
+		static bool trace_on;
+		static string trace_file;
+		static double start_time;
+		static ofstream fout;
+		static bool first_event;				//是否还没有向文件写入事件
+		static vector<ThreadBuffer*> buffers;	//还未结束的线程的缓冲区, 只在线程第一次记录事件和结束时加锁修改
+		static pthread_mutex_t mutex;			//保护buffers和跟踪文件
+};
+
+//构造时记录开始事件, 析构时记录结束事件
+class TraceScope
+{
+	public:
+		TraceScope(const char *i_name, int i_sen_id=-1, int i_beg=-1, int i_span=-1) : name(i_name), on(Tracer::enabled())
+		{
+			if (on) Tracer::record(name,'B',i_sen_id,i_beg,i_span);
+		};
+		~TraceScope() { if (on) Tracer::record(name,'E',-1,-1,-1); };
+	private:
+		const char *name;
+		bool on;
+};
+
+#endif
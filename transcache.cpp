@@ -0,0 +1,310 @@
+#include "transcache.h"
+#include "util/murmur_hash.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+const char TRANS_CACHE_MAGIC[8] = {'H','I','E','R','O','T','M','1'};
+const size_t TRANS_CACHE_HEADER_LEN = sizeof(TRANS_CACHE_MAGIC)+sizeof(uint64_t);
+
+TransCache::TransCache(const string &i_cache_file, uint64_t i_model_sig)
+{
+	cache_file = i_cache_file;
+	model_sig = i_model_sig;
+	sig_matched = false;
+	if (cache_file != "")
+	{
+		load_cache_file();
+	}
+}
+
+/**************************************************************************************
+ 1. 函数功能: 将输入句子规范化, 作为缓存的键
+ 2. 入口参数: 输入句子
+ 3. 出口参数: 去掉首尾空白并将连续空白合并为一个空格后的句子
+ 4. 算法简介: 解码器按空白切分输入, 因此规范化不改变解码结果
+************************************************************************************* */
+string TransCache::normalize(const string &line)
+{
+	string key;
+	key.reserve(line.size());
+	vector<StringPiece> vs;
+	Split(vs,line);
+	for (const auto &word : vs)
+	{
+		if (!key.empty())
+			key += ' ';
+		key.append(word.data(),word.size());
+	}
+	return key;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 计算模型文件、特征权重以及影响解码结果的参数的哈希值
+ 2. 入口参数: 文件名, 参数, 特征权重
+ 3. 出口参数: 64位哈希值
+ 4. 算法简介: 模型文件用路径、大小和修改时间代替文件内容参与哈希, 避免读取整个模型;
+ 			  新增影响译文的参数或模型来源时需要加入这里
+************************************************************************************* */
+uint64_t TransCache::cal_model_sig(const Filenames &fns, const Parameter &para, const Weight &weight)
+{
+	ostringstream ss;
+	ss.precision(17);
+	vector<string> model_files = {fns.src_vocab_file,fns.tgt_vocab_file,fns.rule_table_file,fns.lm_file,fns.fw_file};
+	for (const auto &model_file : model_files)
+	{
+		struct stat st;
+		ss<<model_file<<' ';
+		if (stat(model_file.c_str(),&st) == 0)
+		{
+			ss<<st.st_size<<' '<<st.st_mtime<<' ';
+		}
+	}
+	for (auto w : weight.trans)
+	{
+		ss<<w<<' ';
+	}
+	ss<<weight.lm<<' '<<weight.len<<' '<<weight.rule_num<<' '<<weight.glue<<' '<<weight.fw<<' '<<weight.fwverb<<' ';
+	ss<<para.BEAM_SIZE<<' '<<para.CUBE_SIZE<<' '<<para.RULE_NUM_LIMIT<<' '<<para.NBEST_NUM<<' '
+	  <<para.PRINT_NBEST<<' '<<para.DUMP_RULE<<' '<<para.DROP_OOV<<' '<<para.SEN_MEMORY_LIMIT;
+	if (fns.rule_servers != "")
+	{
+		//规则表分片服务加载的规则表不在本机, 只能用地址列表区分
+		ss<<' '<<fns.rule_servers;
+	}
+	if (fns.sa_corpus_file != "")
+	{
+		struct stat st;
+		ss<<' '<<fns.sa_corpus_file<<' '<<para.SA_SAMPLE_SIZE;
+		if (stat(fns.sa_corpus_file.c_str(),&st) == 0)
+		{
+			ss<<' '<<st.st_size<<' '<<st.st_mtime;
+		}
+	}
+	string sig_str = ss.str();
+	return util::MurmurHash64A(sig_str.data(),sig_str.size());
+}
+
+/**************************************************************************************
+ 1. 函数功能: 加载磁盘缓存文件
+ 2. 入口参数: 无
+ 3. 出口参数: 无
+ 4. 算法简介: 文件格式为8字节魔数, 8字节模型哈希, 之后是若干条记录,
+ 			  每条记录为: 键长度(uint32), 键, 值长度(uint32), 值
+ 			  文件整体mmap到内存, 只为每条记录建立 键的哈希值->偏移 的索引
+************************************************************************************* */
+void TransCache::load_cache_file()
+{
+	int fd = open(cache_file.c_str(),O_RDONLY);
+	if (fd == -1)
+		return;
+	struct stat st;
+	if (fstat(fd,&st) != 0 || (size_t)st.st_size < TRANS_CACHE_HEADER_LEN)
+	{
+		close(fd);
+		return;
+	}
+	util::MapRead(util::LAZY,fd,0,st.st_size,disk_mem);
+	close(fd);
+	const char *data = disk_mem.begin();
+	uint64_t file_sig;
+	memcpy(&file_sig,data+sizeof(TRANS_CACHE_MAGIC),sizeof(uint64_t));
+	if (memcmp(data,TRANS_CACHE_MAGIC,sizeof(TRANS_CACHE_MAGIC)) != 0 || file_sig != model_sig)
+	{
+		cout<<"translation cache "<<cache_file<<" was built with other models, ignore it\n";
+		disk_mem.reset();
+		return;
+	}
+	sig_matched = true;
+	size_t offset = TRANS_CACHE_HEADER_LEN;
+	while (offset+sizeof(uint32_t) <= disk_mem.size())
+	{
+		uint32_t key_len,val_len;
+		memcpy(&key_len,data+offset,sizeof(uint32_t));
+		size_t val_offset = offset+sizeof(uint32_t)+key_len;
+		if (val_offset+sizeof(uint32_t) > disk_mem.size())
+			break;
+		memcpy(&val_len,data+val_offset,sizeof(uint32_t));
+		if (val_offset+sizeof(uint32_t)+val_len > disk_mem.size())
+			break;															//最后一条记录不完整
+		uint64_t key_hash = util::MurmurHash64A(data+offset+sizeof(uint32_t),key_len);
+		disk_index[key_hash] = offset;										//损坏的记录重新解码后追加在后面, 后面的记录优先
+		offset = val_offset+sizeof(uint32_t)+val_len;
+	}
+	cout<<"load translation cache "<<cache_file<<" over, "<<disk_index.size()<<" entries\n";
+}
+
+bool TransCache::find(const string &key, TransResult &result)
+{
+	auto it_new = new_index.find(key);
+	if (it_new != new_index.end())
+	{
+		result = new_entries.at(it_new->second).second;
+		return true;
+	}
+	auto it = disk_index.find(util::MurmurHash64A(key.data(),key.size()));
+	if (it == disk_index.end())
+		return false;
+	const char *data = disk_mem.begin()+it->second;
+	uint32_t key_len,val_len;
+	memcpy(&key_len,data,sizeof(uint32_t));
+	if (key_len != key.size() || memcmp(data+sizeof(uint32_t),key.data(),key_len) != 0)
+		return false;														//哈希冲突
+	data += sizeof(uint32_t)+key_len;
+	memcpy(&val_len,data,sizeof(uint32_t));
+	if (!deserialize(data+sizeof(uint32_t),val_len,result))
+	{
+		result = TransResult();
+		return false;														//记录损坏, 按未命中处理, 重新解码
+	}
+	return true;
+}
+
+void TransCache::insert(const string &key, const TransResult &result)
+{
+	if (new_index.find(key) != new_index.end())
+		return;
+	new_index.insert(make_pair(key,new_entries.size()));
+	new_entries.push_back(make_pair(key,result));
+}
+
+/**************************************************************************************
+ 1. 函数功能: 将本次运行新加入的缓存项写入磁盘文件
+ 2. 入口参数: 无
+ 3. 出口参数: 无
+ 4. 算法简介: 若磁盘文件与当前模型一致则追加写入, 否则重写整个文件
+************************************************************************************* */
+void TransCache::save()
+{
+	if (cache_file == "" || (sig_matched && new_entries.empty()))
+		return;
+	ofstream fout;
+	if (sig_matched)
+	{
+		fout.open(cache_file.c_str(),ios::binary|ios::app);
+	}
+	else
+	{
+		fout.open(cache_file.c_str(),ios::binary|ios::trunc);
+	}
+	if (!fout.is_open())
+	{
+		cerr<<"cannot open translation cache file to write!\n";
+		return;
+	}
+	if (!sig_matched)
+	{
+		fout.write(TRANS_CACHE_MAGIC,sizeof(TRANS_CACHE_MAGIC));
+		fout.write((char*)&model_sig,sizeof(uint64_t));
+	}
+	string buf;
+	for (const auto &entry : new_entries)
+	{
+		serialize(entry.second,buf);
+		uint32_t key_len = entry.first.size();
+		uint32_t val_len = buf.size();
+		fout.write((char*)&key_len,sizeof(uint32_t));
+		fout.write(entry.first.data(),key_len);
+		fout.write((char*)&val_len,sizeof(uint32_t));
+		fout.write(buf.data(),val_len);
+	}
+	fout.close();
+}
+
+static void append_str(string &buf, const string &s)
+{
+	uint32_t len = s.size();
+	buf.append((char*)&len,sizeof(uint32_t));
+	buf.append(s);
+}
+
+//以下读取函数在数据超出end时返回false, 磁盘上的记录可能损坏
+static bool read_uint32(const char *&p, const char *end, uint32_t &v)
+{
+	if ((size_t)(end-p) < sizeof(uint32_t))
+		return false;
+	memcpy(&v,p,sizeof(uint32_t));
+	p += sizeof(uint32_t);
+	return true;
+}
+
+static bool read_str(const char *&p, const char *end, string &s)
+{
+	uint32_t len;
+	if (!read_uint32(p,end,len) || (size_t)(end-p) < len)
+		return false;
+	s.assign(p,len);
+	p += len;
+	return true;
+}
+
+static bool read_double(const char *&p, const char *end, double &v)
+{
+	if ((size_t)(end-p) < sizeof(double))
+		return false;
+	memcpy(&v,p,sizeof(double));
+	p += sizeof(double);
+	return true;
+}
+
+//读取一个元素数, 每个元素至少占min_size个字节, 元素数超过剩余字节数能容纳的个数时返回false, 避免按损坏的元素数分配内存
+static bool read_count(const char *&p, const char *end, size_t min_size, uint32_t &num)
+{
+	return read_uint32(p,end,num) && num <= (size_t)(end-p)/min_size;
+}
+
+void TransCache::serialize(const TransResult &result, string &buf)
+{
+	buf.clear();
+	append_str(buf,result.translation);
+	uint32_t nbest_num = result.nbest_tune_info.size();
+	buf.append((char*)&nbest_num,sizeof(uint32_t));
+	for (const auto &tune_info : result.nbest_tune_info)
+	{
+		append_str(buf,tune_info.translation);
+		uint32_t feature_num = tune_info.feature_values.size();
+		buf.append((char*)&feature_num,sizeof(uint32_t));
+		buf.append((char*)tune_info.feature_values.data(),sizeof(double)*feature_num);
+		buf.append((char*)&tune_info.total_score,sizeof(double));
+	}
+	uint32_t rule_num = result.applied_rules.size();
+	buf.append((char*)&rule_num,sizeof(uint32_t));
+	for (const auto &rule : result.applied_rules)
+	{
+		append_str(buf,rule);
+	}
+}
+
+//记录损坏(长度或元素数超出记录, 或有多余的字节)时返回false
+bool TransCache::deserialize(const char *data, size_t len, TransResult &result)
+{
+	const char *p = data;
+	const char *end = data+len;
+	uint32_t num;
+	if (!read_str(p,end,result.translation) || !read_count(p,end,sizeof(uint32_t)*2+sizeof(double),num))
+		return false;
+	result.nbest_tune_info.resize(num);
+	for (auto &tune_info : result.nbest_tune_info)
+	{
+		tune_info.sen_id = 0;
+		if (!read_str(p,end,tune_info.translation) || !read_count(p,end,sizeof(double),num))
+			return false;
+		tune_info.feature_values.resize(num);
+		for (auto &v : tune_info.feature_values)
+		{
+			if (!read_double(p,end,v))
+				return false;
+		}
+		if (!read_double(p,end,tune_info.total_score))
+			return false;
+	}
+	if (!read_count(p,end,sizeof(uint32_t),num))
+		return false;
+	result.applied_rules.resize(num);
+	for (auto &rule : result.applied_rules)
+	{
+		if (!read_str(p,end,rule))
+			return false;
+	}
+	return p == end;
+}
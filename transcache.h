@@ -0,0 +1,44 @@
+#ifndef TRANSCACHE_H
+#define TRANSCACHE_H
+
+#include "stdafx.h"
+#include "myutils.h"
+#include "util/mmap.hh"
+
+//一个句子的解码结果
+struct TransResult
+{
+	string translation;							//最优译文
+	vector<TuneInfo> nbest_tune_info;			//n-best调参信息, sen_id在使用时重新填写
+	vector<string> applied_rules;				//最优译文所使用的规则
+};
+
+//翻译记忆, 以规范化后的输入句子为键缓存解码结果
+//可选的磁盘文件通过mmap加载, 使缓存在进程重启后仍然可用
+class TransCache
+{
+	public:
+		TransCache(const string &i_cache_file, uint64_t i_model_sig);
+		bool find(const string &key, TransResult &result);
+		void insert(const string &key, const TransResult &result);
+		void save();
+		size_t size() {return disk_index.size()+new_entries.size();};
+		static string normalize(const string &line);
+		static uint64_t cal_model_sig(const Filenames &fns, const Parameter &para, const Weight &weight);
+
+	private:
+		void load_cache_file();
+		static void serialize(const TransResult &result, string &buf);
+		static bool deserialize(const char *data, size_t len, TransResult &result);
+
+	private:
+		string cache_file;							//磁盘缓存文件, 为空时只使用内存缓存
+		uint64_t model_sig;							//模型文件及权重的哈希值, 与缓存文件头不一致时丢弃旧缓存
+		bool sig_matched;							//磁盘文件是否与当前模型一致
+		util::scoped_memory disk_mem;				//mmap映射的磁盘缓存
+		unordered_map<uint64_t,size_t> disk_index;	//键的哈希值到磁盘记录偏移的映射
+		vector<pair<string,TransResult> > new_entries;	//本次运行新加入, 尚未写盘的缓存项
+		unordered_map<string,size_t> new_index;		//键到new_entries下标的映射
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "translator.h"
+#include "scheduler.h"
 
-SentenceTranslator::SentenceTranslator(const Models &i_models, const Parameter &i_para, const Weight &i_weight, const string &input_sen)
+SentenceTranslator::SentenceTranslator(const Models &i_models, const Parameter &i_para, const Weight &i_weight, const string &input_sen) : src_overlay(i_models.src_vocab)
 {
 	src_vocab = i_models.src_vocab;
 	tgt_vocab = i_models.tgt_vocab;
@@ -12,28 +13,47 @@ SentenceTranslator::SentenceTranslator(const Models &i_models, const Parameter &
 
 	src_nt_id = src_vocab->get_id("[X][X]");
 	tgt_nt_id = tgt_vocab->get_id("[X][X]");
-	stringstream ss(input_sen);
-	string word_tag;
-	while(ss>>word_tag)
-	{
-		int sep = word_tag.find("#");
-		string word = word_tag.substr(0,sep);
-		src_wids.push_back(src_vocab->get_id(word));
-		verb_flags.push_back(word_tag.at(sep+1)=='V'?1:0);
+	scheduler = NULL;
+	vector<StringPiece> word_tags;
+	Split(word_tags,input_sen);
+	for (const auto &word_tag : word_tags)
+	{
+		StringPiece word;
+		bool is_verb;
+		parse_word_tag(word_tag,word,is_verb);
+		src_wids.push_back(src_overlay.get_id(word));
+		verb_flags.push_back(is_verb?1:0);
 		fw_flags.push_back(src_function_words->find(src_wids.back())!=src_function_words->end()?1:0);
 	}
 
 	src_sen_len = src_wids.size();
 	span2cands.resize(src_sen_len);
-	span2rules.resize(src_sen_len);
 	for (size_t beg=0;beg<src_sen_len;beg++)
 	{
 		span2cands.at(beg).resize(src_sen_len-beg);
-		span2rules.at(beg).resize(src_sen_len-beg);
 	}
+	rule_chart = RuleChart::acquire(src_sen_len);
+	rule_ticket = ruletable->begin_sentence(src_wids);
 
-	fill_span2cands_with_phrase_rules();
+	{
+		PhaseTimer timer(profile,PHASE_PHRASE,para.PROFILE);
+		TraceScope trace(PHASE_NAMES[PHASE_PHRASE]);
+		fill_span2cands_with_phrase_rules();
+	}
 	fill_span2rules_with_hiero_rules();
+	if (para.SEN_MEMORY_LIMIT > 0)
+	{
+		limit_rule_chart_memory();
+	}
+	rule_chart->build();
+}
+
+//输入格式为"单词#词性", 词性以最后一个#为界; 没有#的单词按非动词处理
+void SentenceTranslator::parse_word_tag(const StringPiece &word_tag, StringPiece &word, bool &is_verb)
+{
+	const char *sep = (const char*)memrchr(word_tag.data(),'#',word_tag.size());
+	word = sep==NULL ? word_tag : StringPiece(word_tag.data(),sep-word_tag.data());
+	is_verb = sep!=NULL && sep+1!=word_tag.data()+word_tag.size() && *(sep+1)=='V';
 }
 
 SentenceTranslator::~SentenceTranslator()
@@ -45,6 +65,8 @@ SentenceTranslator::~SentenceTranslator()
 			span2cands.at(i).at(j).free();
 		}
 	}
+	RuleChart::release(rule_chart);
+	ruletable->end_sentence(rule_ticket);
 }
 
 /**************************************************************************************
@@ -55,12 +77,18 @@ SentenceTranslator::~SentenceTranslator()
               a.1) 如果该跨度包含1个单词, 则生成对应的OOV候选
               a.2) 如果该跨度包含多个单词, 则不作处理
               b) 如果某个跨度匹配到了规则, 则根据规则生成候选
+              按起始位置并行, 每个起始位置只写span2cands的一行; pattern先放入该位置的缓冲区,
+              候选中记录的是缓冲区中的编号, 按起始位置的顺序合并到rule_chart后再加上该位置的偏移
 ************************************************************************************* */
 void SentenceTranslator::fill_span2cands_with_phrase_rules()
 {
+#pragma omp parallel for num_threads(get_span_thread_num()) schedule(dynamic,1)
 	for (size_t beg=0;beg<src_sen_len;beg++)
 	{
-		vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(src_wids,beg);
+		SenProfile beg_profile;
+		RulePatternBuffer &buffer = rule_chart->get_buffer(beg);
+		vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(src_wids,beg,rule_ticket);
+		beg_profile.counters[COUNTER_PATTERN_PROBED]++;
 		for (size_t span=0;span<matched_rules_for_prefixes.size();span++)	//span=0对应跨度包含1个词的情况
 		{
 			if (matched_rules_for_prefixes.at(span) == NULL)
@@ -70,122 +98,196 @@ void SentenceTranslator::fill_span2cands_with_phrase_rules()
 					Cand* cand = new Cand;
 					cand->tgt_wids.push_back(0 - src_wids.at(beg));
 					cand->trans_probs.resize(PROB_NUM,0.0);
-					cand->applied_rule.src_ids.push_back(src_wids.at(beg));
-					cand->lm_prob = lm_model->cal_increased_lm_score(cand);
+					vector<int> src_ids(1,src_wids.at(beg));
+					cand->applied_rule.pattern_id = buffer.add_pattern(src_ids,NULL,0,-1,make_pair(-1,-1),make_pair(-1,-1),0,0);
+					cand->lm_prob = cal_increased_lm_score(cand,beg_profile);
 					cand->score += feature_weight.rule_num*cand->rule_num 
 								+ feature_weight.len*cand->tgt_word_num + feature_weight.lm*cand->lm_prob;
 					span2cands.at(beg).at(span).add(cand,para.BEAM_SIZE);
 				}
 				continue;
 			}
-			for (auto &tgt_rule : *matched_rules_for_prefixes.at(span))
+			beg_profile.counters[COUNTER_RULE_MATCHED] += matched_rules_for_prefixes.at(span)->size();
+			vector<int> src_ids(src_wids.begin()+beg,src_wids.begin()+beg+span+1);
+			vector<TgtRule> &matched_rules = *matched_rules_for_prefixes.at(span);
+			int pattern_id = buffer.add_pattern(src_ids,matched_rules.data(),matched_rules.size(),-1,make_pair(-1,-1),make_pair(-1,-1),0,0);
+			for (auto &tgt_rule : matched_rules)
 			{
 				Cand* cand = new Cand;
-				cand->tgt_word_num = tgt_rule.word_num;
-				cand->tgt_wids = tgt_rule.wids;
+				cand->tgt_word_num = tgt_rule.tgt->len;
+				cand->tgt_wids.assign(tgt_rule.tgt->wids,tgt_rule.tgt->wids+tgt_rule.tgt->len);
 				cand->trans_probs = tgt_rule.probs;
 				cand->score = tgt_rule.score;
-				vector<int> src_ids(src_wids.begin()+beg,src_wids.begin()+beg+span+1);
-				cand->applied_rule.src_ids = src_ids;
+				cand->applied_rule.pattern_id = pattern_id;
 				cand->applied_rule.tgt_rule = &tgt_rule;
-				cand->lm_prob = lm_model->cal_increased_lm_score(cand);
+				cand->lm_prob = cal_increased_lm_score(cand,beg_profile);
 				cand->score += feature_weight.rule_num*cand->rule_num 
 					       + feature_weight.len*cand->tgt_word_num + feature_weight.lm*cand->lm_prob;
 				span2cands.at(beg).at(span).add(cand,para.BEAM_SIZE);
 			}
 		}
+		if (para.PROFILE)
+		{
+#pragma omp critical(merge_span_profile)
+			profile.merge(beg_profile);
+		}
+	}
+	rule_chart->merge_buffers();
+	for (size_t beg=0;beg<src_sen_len;beg++)
+	{
+		uint32_t offset = rule_chart->get_buffer_offset(beg);
+		for (auto &candbeam : span2cands.at(beg))
+		{
+			for (size_t i=0;i<candbeam.size();i++)
+			{
+				candbeam.at(i)->applied_rule.pattern_id += offset;
+			}
+		}
+	}
+	for (size_t beg=0;beg<src_sen_len;beg++)
+	{
+		for (auto &candbeam : span2cands.at(beg))
+		{
+			profile.counters[COUNTER_RECOMBINATION] += candbeam.get_recombined_num();
+		}
 	}
 }
 
 /**************************************************************************************
- 1. 函数功能: 找到每个跨度所有能用的hiero规则，并加入到span2rules中
+ 1. 函数功能: 找到每个跨度所有能用的hiero规则，并加入到rule_chart中
  2. 入口参数: 无
  3. 出口参数: 无
  4. 算法简介: 1) 找出当前句子所有可能的pattern，以及每个pattern对应的所有跨度
  			  2) 对每个pattern，检查规则表中是否存在可用的规则
- 			  3) 根据每个可用的规则更新span2rules
+ 			  3) 根据每个可用的规则更新rule_chart
+ 			  每种规则按pattern的起始位置并行匹配, 见match_patterns_by_beg
 ************************************************************************************* */
 void SentenceTranslator::fill_span2rules_with_hiero_rules()
 {
-	fill_span2rules_with_AX_XA_XAX_rule();                            //形如AX,XA和XAX的规则
-	fill_span2rules_with_AXB_AXBX_XAXB_rule();                        //形如AXB,AXBX和XAXB的规则
-	fill_span2rules_with_AXBXC_rule();                                //形如AXBXC的规则
-	fill_span2rules_with_glue_rule();                                 //起始位置为句首，形如X1X2的规则
+	{
+		PhaseTimer timer(profile,PHASE_AX_XA_XAX,para.PROFILE);
+		TraceScope trace(PHASE_NAMES[PHASE_AX_XA_XAX]);
+		match_patterns_by_beg(&SentenceTranslator::fill_span2rules_with_AX_XA_XAX_rule);         //形如AX,XA和XAX的规则
+	}
+	{
+		PhaseTimer timer(profile,PHASE_AXB_AXBX_XAXB,para.PROFILE);
+		TraceScope trace(PHASE_NAMES[PHASE_AXB_AXBX_XAXB]);
+		match_patterns_by_beg(&SentenceTranslator::fill_span2rules_with_AXB_AXBX_XAXB_rule);     //形如AXB,AXBX和XAXB的规则
+	}
+	{
+		PhaseTimer timer(profile,PHASE_AXBXC,para.PROFILE);
+		TraceScope trace(PHASE_NAMES[PHASE_AXBXC]);
+		match_patterns_by_beg(&SentenceTranslator::fill_span2rules_with_AXBXC_rule);             //形如AXBXC的规则
+	}
+	{
+		PhaseTimer timer(profile,PHASE_GLUE,para.PROFILE);
+		TraceScope trace(PHASE_NAMES[PHASE_GLUE]);
+		fill_span2rules_with_glue_rule();                             //起始位置为句首，形如X1X2的规则
+	}
 }
 
 /**************************************************************************************
- 1. 函数功能: 处理形如AX,XA,XAX的规则
- 2. 入口参数: 无
+ 1. 函数功能: 按起始位置并行匹配一种规则的所有pattern, 并加入rule_chart中
+ 2. 入口参数: 匹配一个起始位置的函数
  3. 出口参数: 无
- 4. 算法简介: 按照终结符序列的起始位置和长度遍历所有可能的pattern
+ 4. 算法简介: 各线程动态领取起始位置, 每个起始位置的pattern放入rule_chart中该位置的缓冲区, 计数先在本地统计;
+ 			  全部完成后按起始位置的顺序合并, 因此rule_chart中pattern的顺序与串行匹配相同, 与线程数无关
+************************************************************************************* */
+void SentenceTranslator::match_patterns_by_beg(PatternMatcher matcher)
+{
+#pragma omp parallel for num_threads(get_span_thread_num()) schedule(dynamic,1)
+	for (size_t beg=0;beg<src_sen_len;beg++)
+	{
+		SenProfile beg_profile;
+		(this->*matcher)(beg,rule_chart->get_buffer(beg),beg_profile);
+		if (para.PROFILE)
+		{
+#pragma omp critical(merge_span_profile)
+			profile.merge(beg_profile);
+		}
+	}
+	rule_chart->merge_buffers();
+}
+
+//span级并行数, 规则匹配和立方体剪枝共用
+size_t SentenceTranslator::get_span_thread_num()
+{
+	return scheduler==NULL ? para.SPAN_THREAD_NUM : scheduler->get_span_thread_num();
+}
+
+/**************************************************************************************
+ 1. 函数功能: 处理形如AX,XA,XAX的规则
+ 2. 入口参数: 终结符序列A的起始位置
+ 3. 出口参数: 该起始位置的pattern缓冲区, 该起始位置的计数
+ 4. 算法简介: 按照终结符序列的长度遍历所有可能的pattern
 			  p.s. beg_A+len_A为A的最后一个单词的位置
 ************************************************************************************* */
-void SentenceTranslator::fill_span2rules_with_AX_XA_XAX_rule()
+void SentenceTranslator::fill_span2rules_with_AX_XA_XAX_rule(int beg_A, RulePatternBuffer &buffer, SenProfile &beg_profile)
 {
-	for (int beg_A=0;beg_A<src_sen_len;beg_A++)
+	for (int len_A=0;beg_A+len_A<src_sen_len && len_A+1<=SPAN_LEN_MAX;len_A++)
 	{
-		for (int len_A=0;beg_A+len_A<src_sen_len && len_A+1<=SPAN_LEN_MAX;len_A++)
+		vector<int> ids_A(src_wids.begin()+beg_A,src_wids.begin()+beg_A+len_A+1);
+		//抽取形如XA的规则
+		if (beg_A != 0)
 		{
-			vector<int> ids_A(src_wids.begin()+beg_A,src_wids.begin()+beg_A+len_A+1);
-			//抽取形如XA的规则
-			if (beg_A != 0)
+			vector<int> ids_XA;
+			ids_XA.push_back(src_nt_id);
+			ids_XA.insert(ids_XA.end(),ids_A.begin(),ids_A.end());
+			vector<TgtRule>* matched_rules = ruletable->find_matched_rules(ids_XA,rule_ticket);
+			beg_profile.counters[COUNTER_PATTERN_PROBED]++;
+			if (matched_rules != NULL)         //找到了可用的规则
 			{
-				vector<int> ids_XA;
-				ids_XA.push_back(src_nt_id);
-				ids_XA.insert(ids_XA.end(),ids_A.begin(),ids_A.end());
-				vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_XA,0);
-				if (matched_rules_for_prefixes.size() == ids_XA.size() && matched_rules_for_prefixes.back() != NULL)         //找到了可用的规则
+				for (int len_X=0;len_X<beg_A && len_X+len_A+2<=SPAN_LEN_MAX;len_X++)
 				{
-					for (int len_X=0;len_X<beg_A && len_X+len_A+2<=SPAN_LEN_MAX;len_X++)
-					{
-						int beg_X = beg_A - len_X - 1;
-						pair<int,int> span = make_pair(beg_X,len_X+len_A+1);
-						pair<int,int> span_src_x1 = make_pair(beg_X,len_X);
-						pair<int,int> span_src_x2 = make_pair(-1,-1);
-						fill_span2rules_with_matched_rules(*matched_rules_for_prefixes.back(),ids_XA,span,span_src_x1,span_src_x2);
-					}
+					int beg_X = beg_A - len_X - 1;
+					pair<int,int> span = make_pair(beg_X,len_X+len_A+1);
+					pair<int,int> span_src_x1 = make_pair(beg_X,len_X);
+					pair<int,int> span_src_x2 = make_pair(-1,-1);
+					fill_span2rules_with_matched_rules(*matched_rules,ids_XA,span,span_src_x1,span_src_x2,buffer,beg_profile);
 				}
 			}
-			//抽取形如AX的规则
-			if (beg_A+len_A != src_sen_len - 1)
+		}
+		//抽取形如AX的规则
+		if (beg_A+len_A != src_sen_len - 1)
+		{
+			vector<int> ids_AX;
+			ids_AX = ids_A;
+			ids_AX.push_back(src_nt_id);
+			vector<TgtRule>* matched_rules = ruletable->find_matched_rules(ids_AX,rule_ticket);
+			beg_profile.counters[COUNTER_PATTERN_PROBED]++;
+			if (matched_rules != NULL)         //找到了可用的规则
 			{
-				vector<int> ids_AX;
-				ids_AX = ids_A;
-				ids_AX.push_back(src_nt_id);
-				vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_AX,0);
-				if (matched_rules_for_prefixes.size() == ids_AX.size() && matched_rules_for_prefixes.back() != NULL)         //找到了可用的规则
+				for (int len_X=0;beg_A+len_A+1+len_X<src_sen_len && len_A+len_X+2<=SPAN_LEN_MAX;len_X++)
 				{
-					for (int len_X=0;beg_A+len_A+1+len_X<src_sen_len && len_A+len_X+2<=SPAN_LEN_MAX;len_X++)
-					{
-						int beg_X = beg_A + len_A + 1;
-						pair<int,int> span = make_pair(beg_A,len_A+len_X+1);
-						pair<int,int> span_src_x1 = make_pair(beg_X,len_X);
-						pair<int,int> span_src_x2 = make_pair(-1,-1);
-						fill_span2rules_with_matched_rules(*matched_rules_for_prefixes.back(),ids_AX,span,span_src_x1,span_src_x2);
-					}
+					int beg_X = beg_A + len_A + 1;
+					pair<int,int> span = make_pair(beg_A,len_A+len_X+1);
+					pair<int,int> span_src_x1 = make_pair(beg_X,len_X);
+					pair<int,int> span_src_x2 = make_pair(-1,-1);
+					fill_span2rules_with_matched_rules(*matched_rules,ids_AX,span,span_src_x1,span_src_x2,buffer,beg_profile);
 				}
 			}
-			//抽取形如XAX的规则
-			if (beg_A != 0 && beg_A+len_A != src_sen_len - 1)
+		}
+		//抽取形如XAX的规则
+		if (beg_A != 0 && beg_A+len_A != src_sen_len - 1)
+		{
+			vector<int> ids_XAX;
+			ids_XAX.push_back(src_nt_id);
+			ids_XAX.insert(ids_XAX.end(),ids_A.begin(),ids_A.end());
+			ids_XAX.push_back(src_nt_id);
+			vector<TgtRule>* matched_rules = ruletable->find_matched_rules(ids_XAX,rule_ticket);
+			beg_profile.counters[COUNTER_PATTERN_PROBED]++;
+			if (matched_rules != NULL)         //找到了可用的规则
 			{
-				vector<int> ids_XAX;
-				ids_XAX.push_back(src_nt_id);
-				ids_XAX.insert(ids_XAX.end(),ids_A.begin(),ids_A.end());
-				ids_XAX.push_back(src_nt_id);
-				vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_XAX,0);
-				if (matched_rules_for_prefixes.size() == ids_XAX.size() && matched_rules_for_prefixes.back() != NULL)         //找到了可用的规则
+				for (int len_X1=0;len_X1<beg_A && len_X1+len_A+2<=SPAN_LEN_MAX-1;len_X1++)
 				{
-					for (int len_X1=0;len_X1<beg_A && len_X1+len_A+2<=SPAN_LEN_MAX-1;len_X1++)
+					int beg_X1 = beg_A - len_X1 - 1;
+					for (int len_X2=0;beg_A+len_A+1+len_X2<src_sen_len && len_X1+len_A+len_X2<=SPAN_LEN_MAX;len_X2++)
 					{
-						int beg_X1 = beg_A - len_X1 - 1;
-						for (int len_X2=0;beg_A+len_A+1+len_X2<src_sen_len && len_X1+len_A+len_X2<=SPAN_LEN_MAX;len_X2++)
-						{
-							int beg_X2 = beg_A + len_A + 1;
-							pair<int,int> span = make_pair(beg_X1,len_X1+len_A+len_X2+2);
-							pair<int,int> span_src_x1 = make_pair(beg_X1,len_X1);
-							pair<int,int> span_src_x2 = make_pair(beg_X2,len_X2);
-							fill_span2rules_with_matched_rules(*matched_rules_for_prefixes.back(),ids_XAX,span,span_src_x1,span_src_x2);
-						}
+						int beg_X2 = beg_A + len_A + 1;
+						pair<int,int> span = make_pair(beg_X1,len_X1+len_A+len_X2+2);
+						pair<int,int> span_src_x1 = make_pair(beg_X1,len_X1);
+						pair<int,int> span_src_x2 = make_pair(beg_X2,len_X2);
+						fill_span2rules_with_matched_rules(*matched_rules,ids_XAX,span,span_src_x1,span_src_x2,buffer,beg_profile);
 					}
 				}
 			}
@@ -195,70 +297,70 @@ void SentenceTranslator::fill_span2rules_with_AX_XA_XAX_rule()
 
 /**************************************************************************************
  1. 函数功能: 处理形如AXB,AXBX,XAXB的规则
- 2. 入口参数: 无
- 3. 出口参数: 无
- 4. 算法简介: 按照终结符序列的起始位置和长度遍历所有可能的pattern
+ 2. 入口参数: AXB的起始位置
+ 3. 出口参数: 该起始位置的pattern缓冲区, 该起始位置的计数
+ 4. 算法简介: 按照AXB的长度以及X的位置和长度遍历所有可能的pattern
 ************************************************************************************* */
-void SentenceTranslator::fill_span2rules_with_AXB_AXBX_XAXB_rule()
+void SentenceTranslator::fill_span2rules_with_AXB_AXBX_XAXB_rule(int beg_AXB, RulePatternBuffer &buffer, SenProfile &beg_profile)
 {
-	for (int beg_AXB=0;beg_AXB<src_sen_len;beg_AXB++)
+	for (int len_AXB=0;beg_AXB+len_AXB<src_sen_len && len_AXB<=SPAN_LEN_MAX;len_AXB++)
 	{
-		for (int len_AXB=0;beg_AXB+len_AXB<src_sen_len && len_AXB<=SPAN_LEN_MAX;len_AXB++)
+		for (int beg_X=beg_AXB+1;beg_X<beg_AXB+len_AXB;beg_X++)
 		{
-			for (int beg_X=beg_AXB+1;beg_X<beg_AXB+len_AXB;beg_X++)
+			for (int len_X=0;beg_X+len_X<beg_AXB+len_AXB;len_X++)
 			{
-				for (int len_X=0;beg_X+len_X<beg_AXB+len_AXB;len_X++)
+				vector<int> ids_AXB(src_wids.begin()+beg_AXB,src_wids.begin()+beg_X);
+				ids_AXB.push_back(src_nt_id);
+				ids_AXB.insert(ids_AXB.end(),src_wids.begin()+beg_X+len_X+1,src_wids.begin()+beg_AXB+len_AXB+1);
+				//抽取形如XAXB的pattern
+				if (beg_AXB != 0)
 				{
-					vector<int> ids_AXB(src_wids.begin()+beg_AXB,src_wids.begin()+beg_X);
-					ids_AXB.push_back(src_nt_id);
-					ids_AXB.insert(ids_AXB.end(),src_wids.begin()+beg_X+len_X+1,src_wids.begin()+beg_AXB+len_AXB+1);
-					//抽取形如XAXB的pattern
-					if (beg_AXB != 0)
+					vector<int> ids_XAXB;
+					ids_XAXB.push_back(src_nt_id);
+					ids_XAXB.insert(ids_XAXB.end(),ids_AXB.begin(),ids_AXB.end());
+					vector<TgtRule>* matched_rules = ruletable->find_matched_rules(ids_XAXB,rule_ticket);
+					beg_profile.counters[COUNTER_PATTERN_PROBED]++;
+					if (matched_rules != NULL)         //找到了可用的规则
 					{
-						vector<int> ids_XAXB;
-						ids_XAXB.push_back(src_nt_id);
-						ids_XAXB.insert(ids_XAXB.end(),ids_AXB.begin(),ids_AXB.end());
-						vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_XAXB,0);
-						if (matched_rules_for_prefixes.size() == ids_XAXB.size() && matched_rules_for_prefixes.back() != NULL)         //找到了可用的规则
+						for (int len_X1=0;len_X1<beg_AXB && len_X1+len_AXB+2<=SPAN_LEN_MAX;len_X1++)
 						{
-							for (int len_X1=0;len_X1<beg_AXB && len_X1+len_AXB+2<=SPAN_LEN_MAX;len_X1++)
-							{
-								int beg_X1 = beg_AXB - len_X1 - 1;
-								pair<int,int> span = make_pair(beg_X1,len_X1+len_AXB+1);
-								pair<int,int> span_src_x1 = make_pair(beg_X1,len_X1);
-								pair<int,int> span_src_x2 = make_pair(beg_X,len_X);
-								fill_span2rules_with_matched_rules(*matched_rules_for_prefixes.back(),ids_XAXB,span,span_src_x1,span_src_x2);
-							}
+							int beg_X1 = beg_AXB - len_X1 - 1;
+							pair<int,int> span = make_pair(beg_X1,len_X1+len_AXB+1);
+							pair<int,int> span_src_x1 = make_pair(beg_X1,len_X1);
+							pair<int,int> span_src_x2 = make_pair(beg_X,len_X);
+							fill_span2rules_with_matched_rules(*matched_rules,ids_XAXB,span,span_src_x1,span_src_x2,buffer,beg_profile);
 						}
 					}
-					//抽取形如AXBX的pattern
-					if (beg_AXB+len_AXB != src_sen_len - 1)
+				}
+				//抽取形如AXBX的pattern
+				if (beg_AXB+len_AXB != src_sen_len - 1)
+				{
+					vector<int> ids_AXBX;
+					ids_AXBX = ids_AXB;
+					ids_AXBX.push_back(src_nt_id);
+					vector<TgtRule>* matched_rules = ruletable->find_matched_rules(ids_AXBX,rule_ticket);
+					beg_profile.counters[COUNTER_PATTERN_PROBED]++;
+					if (matched_rules != NULL)         //找到了可用的规则
 					{
-						vector<int> ids_AXBX;
-						ids_AXBX = ids_AXB;
-						ids_AXBX.push_back(src_nt_id);
-						vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_AXBX,0);
-						if (matched_rules_for_prefixes.size() == ids_AXBX.size() && matched_rules_for_prefixes.back() != NULL)         //找到了可用的规则
+						for (int len_X2=0;beg_AXB+len_AXB+1+len_X2<src_sen_len && len_AXB+len_X2+2<=SPAN_LEN_MAX;len_X2++)
 						{
-							for (int len_X2=0;beg_AXB+len_AXB+1+len_X2<src_sen_len && len_AXB+len_X2+2<=SPAN_LEN_MAX;len_X2++)
-							{
-								int beg_X2 = beg_AXB + len_AXB + 1;
-								pair<int,int> span = make_pair(beg_AXB,len_AXB+len_X2+1);
-								pair<int,int> span_src_x1 = make_pair(beg_X,len_X);
-								pair<int,int> span_src_x2 = make_pair(beg_X2,len_X2);
-								fill_span2rules_with_matched_rules(*matched_rules_for_prefixes.back(),ids_AXBX,span,span_src_x1,span_src_x2);
-							}
+							int beg_X2 = beg_AXB + len_AXB + 1;
+							pair<int,int> span = make_pair(beg_AXB,len_AXB+len_X2+1);
+							pair<int,int> span_src_x1 = make_pair(beg_X,len_X);
+							pair<int,int> span_src_x2 = make_pair(beg_X2,len_X2);
+							fill_span2rules_with_matched_rules(*matched_rules,ids_AXBX,span,span_src_x1,span_src_x2,buffer,beg_profile);
 						}
 					}
-					//抽取形如AXB的pattern
-					vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_AXB,0);
-					if (matched_rules_for_prefixes.size() == ids_AXB.size() && matched_rules_for_prefixes.back() != NULL)         //找到了可用的规则
-					{
-						pair<int,int> span = make_pair(beg_AXB,len_AXB);
-						pair<int,int> span_src_x1 = make_pair(beg_X,len_X);
-						pair<int,int> span_src_x2 = make_pair(-1,-1);
-						fill_span2rules_with_matched_rules(*matched_rules_for_prefixes.back(),ids_AXB,span,span_src_x1,span_src_x2);
-					}
+				}
+				//抽取形如AXB的pattern
+				vector<TgtRule>* matched_rules = ruletable->find_matched_rules(ids_AXB,rule_ticket);
+				beg_profile.counters[COUNTER_PATTERN_PROBED]++;
+				if (matched_rules != NULL)         //找到了可用的规则
+				{
+					pair<int,int> span = make_pair(beg_AXB,len_AXB);
+					pair<int,int> span_src_x1 = make_pair(beg_X,len_X);
+					pair<int,int> span_src_x2 = make_pair(-1,-1);
+					fill_span2rules_with_matched_rules(*matched_rules,ids_AXB,span,span_src_x1,span_src_x2,buffer,beg_profile);
 				}
 			}
 		}
@@ -267,38 +369,36 @@ void SentenceTranslator::fill_span2rules_with_AXB_AXBX_XAXB_rule()
 
 /**************************************************************************************
  1. 函数功能: 处理形如AXBXC的规则
- 2. 入口参数: 无
- 3. 出口参数: 无
- 4. 算法简介: 按照终结符序列的起始位置和长度遍历所有可能的pattern
+ 2. 入口参数: AXBXC的起始位置
+ 3. 出口参数: 该起始位置的pattern缓冲区, 该起始位置的计数
+ 4. 算法简介: 按照AXBXC的长度以及各终结符序列的位置和长度遍历所有可能的pattern
 ************************************************************************************* */
-void SentenceTranslator::fill_span2rules_with_AXBXC_rule()
+void SentenceTranslator::fill_span2rules_with_AXBXC_rule(int beg_AXBXC, RulePatternBuffer &buffer, SenProfile &beg_profile)
 {
-	for (int beg_AXBXC=0;beg_AXBXC<src_sen_len;beg_AXBXC++)
+	for (int len_AXBXC=4;beg_AXBXC+len_AXBXC<src_sen_len && len_AXBXC<=SPAN_LEN_MAX;len_AXBXC++)
 	{
-		for (int len_AXBXC=4;beg_AXBXC+len_AXBXC<src_sen_len && len_AXBXC<=SPAN_LEN_MAX;len_AXBXC++)
+		for (int beg_XBX=beg_AXBXC+1;beg_XBX+2<beg_AXBXC+len_AXBXC;beg_XBX++)
 		{
-			for (int beg_XBX=beg_AXBXC+1;beg_XBX+2<beg_AXBXC+len_AXBXC;beg_XBX++)
+			for (int len_XBX=0;beg_XBX+len_XBX<beg_AXBXC+len_AXBXC;len_XBX++)
 			{
-				for (int len_XBX=0;beg_XBX+len_XBX<beg_AXBXC+len_AXBXC;len_XBX++)
+				for (int beg_B=beg_XBX+1;beg_B<beg_XBX+len_XBX;beg_B++)
 				{
-					for (int beg_B=beg_XBX+1;beg_B<beg_XBX+len_XBX;beg_B++)
+					for (int len_B=len_XBX+beg_XBX-beg_B-1;len_B>=0;len_B--)
 					{
-						for (int len_B=len_XBX+beg_XBX-beg_B-1;len_B>=0;len_B--)
+						//抽取形如AXBXC的pattern
+						vector<int> ids_AXBXC(src_wids.begin()+beg_AXBXC,src_wids.begin()+beg_XBX);
+						ids_AXBXC.push_back(src_nt_id);
+						ids_AXBXC.insert(ids_AXBXC.end(),src_wids.begin()+beg_B,src_wids.begin()+beg_B+len_B+1);
+						ids_AXBXC.push_back(src_nt_id);
+						ids_AXBXC.insert(ids_AXBXC.end(),src_wids.begin()+beg_XBX+len_XBX+1,src_wids.begin()+beg_AXBXC+len_AXBXC+1);
+						vector<TgtRule>* matched_rules = ruletable->find_matched_rules(ids_AXBXC,rule_ticket);
+						beg_profile.counters[COUNTER_PATTERN_PROBED]++;
+						if (matched_rules != NULL)         //找到了可用的规则
 						{
-							//抽取形如AXBXC的pattern
-							vector<int> ids_AXBXC(src_wids.begin()+beg_AXBXC,src_wids.begin()+beg_XBX);
-							ids_AXBXC.push_back(src_nt_id);
-							ids_AXBXC.insert(ids_AXBXC.end(),src_wids.begin()+beg_B,src_wids.begin()+beg_B+len_B+1);
-							ids_AXBXC.push_back(src_nt_id);
-							ids_AXBXC.insert(ids_AXBXC.end(),src_wids.begin()+beg_XBX+len_XBX+1,src_wids.begin()+beg_AXBXC+len_AXBXC+1);
-							vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_AXBXC,0);
-							if (matched_rules_for_prefixes.size() == ids_AXBXC.size() && matched_rules_for_prefixes.back() != NULL)         //找到了可用的规则
-							{
-								pair<int,int> span = make_pair(beg_AXBXC,len_AXBXC);
-								pair<int,int> span_src_x1 = make_pair(beg_XBX,beg_B-beg_XBX-1);
-								pair<int,int> span_src_x2 = make_pair(beg_B+len_B+1,len_XBX-len_B-(beg_B-beg_XBX-1)-2);
-								fill_span2rules_with_matched_rules(*matched_rules_for_prefixes.back(),ids_AXBXC,span,span_src_x1,span_src_x2);
-							}
+							pair<int,int> span = make_pair(beg_AXBXC,len_AXBXC);
+							pair<int,int> span_src_x1 = make_pair(beg_XBX,beg_B-beg_XBX-1);
+							pair<int,int> span_src_x2 = make_pair(beg_B+len_B+1,len_XBX-len_B-(beg_B-beg_XBX-1)-2);
+							fill_span2rules_with_matched_rules(*matched_rules,ids_AXBXC,span,span_src_x1,span_src_x2,buffer,beg_profile);
 						}
 					}
 				}
@@ -316,8 +416,9 @@ void SentenceTranslator::fill_span2rules_with_AXBXC_rule()
 void SentenceTranslator::fill_span2rules_with_glue_rule()
 {
 	vector<int> ids_X1X2 = {src_nt_id,src_nt_id};
-	vector<vector<TgtRule>* > matched_rules_for_prefixes = ruletable->find_matched_rules_for_prefixes(ids_X1X2,0);
-	//assert(matched_rules_for_prefixes.size() == 2 && matched_rules_for_prefixes.back() != NULL);
+	vector<TgtRule>* matched_rules = ruletable->find_matched_rules(ids_X1X2,rule_ticket);
+	profile.counters[COUNTER_PATTERN_PROBED]++;
+	//assert(matched_rules != NULL);
 	//for (int beg_X1X2=0;beg_X1X2+1<src_sen_len;beg_X1X2++)				  //使用不以句首为起始位置的glue规则
 	int beg_X1X2 = 0;
 	{
@@ -325,29 +426,23 @@ void SentenceTranslator::fill_span2rules_with_glue_rule()
 		{
 			for (int len_X1=0;len_X1<len_X1X2;len_X1++)
 			{
-				Rule rule;
-				rule.src_ids = ids_X1X2;
-				rule.tgt_rule = &((*matched_rules_for_prefixes.back()).at(0));
-				rule.tgt_rule_rank = 0;
-				rule.span_x1 = make_pair(beg_X1X2,len_X1);
-				rule.span_x2 = make_pair(beg_X1X2+len_X1+1,len_X1X2-len_X1-1);
-				if (is_only_function_words_in_span(rule.span_x1) || is_only_function_words_in_span(rule.span_x2))
-				{
-					rule.generalize_fw_flag = 1;
-				}
-				span2rules.at(beg_X1X2).at(len_X1X2).push_back(rule);
+				pair<int,int> span_x1 = make_pair(beg_X1X2,len_X1);
+				pair<int,int> span_x2 = make_pair(beg_X1X2+len_X1+1,len_X1X2-len_X1-1);
+				int fw_flag = is_only_function_words_in_span(span_x1) || is_only_function_words_in_span(span_x2) ? 1 : 0;
+				rule_chart->add_pattern(ids_X1X2,&(matched_rules->at(0)),1,beg_X1X2*src_sen_len+len_X1X2,span_x1,span_x2,fw_flag,0);
+				profile.counters[COUNTER_RULE_MATCHED]++;
 			}
 		}
 	}
 }
 
 /**************************************************************************************
- 1. 函数功能: 对给定的pattern以及该pattern对应的span，将匹配到的规则加入span2rules中
- 2. 入口参数: 无
- 3. 出口参数: 无
+ 1. 函数功能: 对给定的pattern以及该pattern对应的span，将匹配到的规则加入pattern缓冲区中
+ 2. 入口参数: 匹配到的规则, pattern, 跨度, 两个非终结符的跨度
+ 3. 出口参数: pattern所在起始位置的缓冲区, 该起始位置的计数
  4. 算法简介: 略
 ************************************************************************************* */
-void SentenceTranslator::fill_span2rules_with_matched_rules(vector<TgtRule> &matched_rules,vector<int> &src_ids,pair<int,int> span,pair<int,int> span_src_x1,pair<int,int> span_src_x2)
+void SentenceTranslator::fill_span2rules_with_matched_rules(vector<TgtRule> &matched_rules,vector<int> &src_ids,pair<int,int> span,pair<int,int> span_src_x1,pair<int,int> span_src_x2,RulePatternBuffer &buffer,SenProfile &beg_profile)
 {
 	int fw_flag = 0;
 	if (is_only_function_words_in_span(span_src_x1) || is_only_function_words_in_span(span_src_x2) )
@@ -395,25 +490,61 @@ void SentenceTranslator::fill_span2rules_with_matched_rules(vector<TgtRule> &mat
 		}
 	}
 	*/
-	for (int i=0;i<matched_rules.size();i++)
+	beg_profile.counters[COUNTER_RULE_MATCHED] += matched_rules.size();
+	buffer.add_pattern(src_ids,matched_rules.data(),matched_rules.size(),span.first*src_sen_len+span.second,span_src_x1,span_src_x2,fw_flag,fwverb_flag);
+}
+
+//统计长度为span+1的所有跨度的候选占用的内存, 在该对角线解码完成后调用
+void SentenceTranslator::add_chart_memory(size_t span)
+{
+	for (size_t beg=0;beg+span<src_sen_len;beg++)
 	{
-		Rule rule;
-		rule.generalize_fw_flag = fw_flag;
-		rule.fwverb_terminal_flag = fwverb_flag;
-		rule.src_ids = src_ids;
-		rule.tgt_rule = &matched_rules.at(i);
-		rule.tgt_rule_rank = i;
-		if (matched_rules.at(i).rule_type == 3)
-		{
-			rule.span_x1 = span_src_x2;
-			rule.span_x2 = span_src_x1;
-		}
-		else
+		CandBeam &candbeam = span2cands.at(beg).at(span);
+		memory.cand_bytes += sizeof(CandBeam) + candbeam.size()*sizeof(Cand*);
+		for (size_t i=0;i<candbeam.size();i++)
 		{
-			rule.span_x1 = span_src_x1;
-			rule.span_x2 = span_src_x2;
+			Cand *cand = candbeam.at(i);
+			memory.cand_bytes += sizeof(Cand) + cand->tgt_wids.capacity()*sizeof(int) + cand->trans_probs.capacity()*sizeof(double);
 		}
-		span2rules.at(span.first).at(span.second).push_back(rule);
+		memory.hyp_num += candbeam.size();
+	}
+}
+
+/**************************************************************************************
+ 1. 函数功能: 在解码长度为span+1的跨度之前检查chart的内存占用, 必要时减小beam
+ 2. 入口参数: 即将解码的对角线
+ 3. 出口参数: 无
+ 4. 算法简介: 用已有候选的平均大小估计剩余跨度都填满beam时chart的总内存,
+ 			  超过上限时把beam和立方体剪枝的大小减半, 直到估计值不超过上限或beam为1
+************************************************************************************* */
+void SentenceTranslator::limit_chart_memory(size_t span)
+{
+	size_t limit_bytes = para.SEN_MEMORY_LIMIT*1024*1024;
+	size_t avg_cand_bytes = memory.hyp_num>0 ? memory.cand_bytes/memory.hyp_num : sizeof(Cand);
+	size_t remaining_span_num = (src_sen_len-span)*(src_sen_len-span+1)/2;
+	size_t old_beam_size = para.BEAM_SIZE;
+	while (para.BEAM_SIZE > 1 && memory.cand_bytes+memory.rule_bytes+remaining_span_num*para.BEAM_SIZE*avg_cand_bytes > limit_bytes)
+	{
+		para.BEAM_SIZE = max<size_t>(1,para.BEAM_SIZE/2);
+		para.CUBE_SIZE = max<size_t>(1,para.CUBE_SIZE/2);
+	}
+	if (para.BEAM_SIZE != old_beam_size)
+	{
+		memory.degraded = true;
+		memory.beam_size = para.BEAM_SIZE;
+		cerr<<"sentence memory limit exceeded, beam size reduced to "<<para.BEAM_SIZE<<endl;
+	}
+}
+
+//规则匹配完成后限制rule_chart的内存, 最多占用上限的一半, 其余留给候选
+void SentenceTranslator::limit_rule_chart_memory()
+{
+	size_t rule_num_limit = rule_chart->limit_rules(para.SEN_MEMORY_LIMIT*1024*1024/2);
+	if (rule_num_limit > 0)
+	{
+		memory.degraded = true;
+		memory.rule_num_limit = rule_num_limit;
+		cerr<<"sentence memory limit exceeded, rules per pattern reduced to "<<rule_num_limit<<endl;
 	}
 }
 
@@ -440,7 +571,7 @@ string SentenceTranslator::words_to_str(vector<int> wids, int drop_oov)
 			}
 			else if (drop_oov == 0)
 			{
-				output += src_vocab->get_word(0-wid) + " ";
+				output += src_overlay.get_word(0-wid) + " ";
 			}
 		}
 		TrimLine(output);
@@ -449,6 +580,8 @@ string SentenceTranslator::words_to_str(vector<int> wids, int drop_oov)
 
 vector<TuneInfo> SentenceTranslator::get_tune_info(size_t sen_id)
 {
+	PhaseTimer timer(profile,PHASE_OUTPUT,para.PROFILE);
+	TraceScope trace(PHASE_NAMES[PHASE_OUTPUT],sen_id);
 	vector<TuneInfo> nbest_tune_info;
 	CandBeam &candbeam = span2cands.at(0).at(src_sen_len-1);
 	for (size_t i=0;i< (candbeam.size()<para.NBEST_NUM?candbeam.size():para.NBEST_NUM);i++)
@@ -474,6 +607,8 @@ vector<TuneInfo> SentenceTranslator::get_tune_info(size_t sen_id)
 
 vector<string> SentenceTranslator::get_applied_rules(size_t sen_id)
 {
+	PhaseTimer timer(profile,PHASE_OUTPUT,para.PROFILE);
+	TraceScope trace(PHASE_NAMES[PHASE_OUTPUT],sen_id);
 	vector<string> applied_rules;
 	if (span2cands.at(0).at(src_sen_len-1).size() == 0)
 		return applied_rules;
@@ -483,7 +618,7 @@ vector<string> SentenceTranslator::get_applied_rules(size_t sen_id)
 	string src_sen;
 	for (auto wid : src_wids)
 	{
-		src_sen += src_vocab->get_word(wid)+" ";
+		src_sen += src_overlay.get_word(wid)+" ";
 	}
 	applied_rules.push_back(src_sen);
 	return applied_rules;
@@ -517,8 +652,11 @@ void SentenceTranslator::dump_rules(vector<string> &applied_rules, Cand *cand)
 		reverse(tgt_nts.begin(),tgt_nts.end());
 		reverse(children.begin(),children.end());
 	}
-	for (auto src_wid : cand->applied_rule.src_ids)
+	const int *src_ids_begin = cand->applied_rule.pattern_id<0 ? NULL : rule_chart->src_ids_begin(cand->applied_rule.pattern_id);
+	const int *src_ids_end = cand->applied_rule.pattern_id<0 ? NULL : rule_chart->src_ids_end(cand->applied_rule.pattern_id);
+	for (const int *src_it=src_ids_begin;src_it!=src_ids_end;src_it++)
 	{
+		int src_wid = *src_it;
 		if (src_wid == src_nt_id)
 		{
 			rule += src_nts[nt_num];
@@ -527,7 +665,7 @@ void SentenceTranslator::dump_rules(vector<string> &applied_rules, Cand *cand)
 		}
 		else
 		{
-			rule += src_vocab->get_word(src_wid)+"_";
+			rule += src_overlay.get_word(src_wid)+"_";
 		}
 	}
 	rule += "|||_";
@@ -538,8 +676,10 @@ void SentenceTranslator::dump_rules(vector<string> &applied_rules, Cand *cand)
 	else
 	{
 		nt_num = 0;
-		for (auto tgt_wid : cand->applied_rule.tgt_rule->wids)
+		const TgtPhrase *tgt = cand->applied_rule.tgt_rule->tgt;
+		for (size_t i=0;i<tgt->len;i++)
 		{
+			int tgt_wid = tgt->wids[i];
 			if (tgt_wid == tgt_nt_id)
 			{
 				rule += tgt_nts[nt_num];
@@ -570,22 +710,54 @@ void SentenceTranslator::dump_rules(vector<string> &applied_rules, Cand *cand)
 }
 
 string SentenceTranslator::translate_sentence()
+{
+	search();
+	return get_translation();
+}
+
+//在chart上自底向上进行立方体剪枝, 结果保存在span2cands中
+void SentenceTranslator::search()
 {
 	if (src_sen_len == 0)
-		return "";
+		return;
+	bool count_memory = para.PROFILE || para.SEN_MEMORY_LIMIT > 0;
+	memory.beam_size = para.BEAM_SIZE;
+	if (count_memory)
+	{
+		memory.rule_bytes += rule_chart->memory_bytes();
+		add_chart_memory(0);
+	}
 	for(size_t beg=0;beg<src_sen_len;beg++)
 	{
 		span2cands.at(beg).at(0).sort();		               //对列表中的候选进行排序
 	}
 	for (size_t span=1;span<src_sen_len;span++)
 	{
-#pragma omp parallel for num_threads(para.SPAN_THREAD_NUM)
+		TraceScope trace("span_diagonal",-1,-1,span);
+		if (para.SEN_MEMORY_LIMIT > 0)
+		{
+			limit_chart_memory(span);
+		}
+#pragma omp parallel for num_threads(get_span_thread_num())
 		for(size_t beg=0;beg<src_sen_len-span;beg++)
 		{
 			generate_kbest_for_span(beg,span);
 			span2cands.at(beg).at(span).sort();
 		}
+		if (count_memory)
+		{
+			add_chart_memory(span);
+		}
 	}
+}
+
+//从search的结果中取出最优译文
+string SentenceTranslator::get_translation()
+{
+	if (src_sen_len == 0)
+		return "";
+	PhaseTimer timer(profile,PHASE_OUTPUT,para.PROFILE);
+	TraceScope trace(PHASE_NAMES[PHASE_OUTPUT]);
 	return words_to_str(span2cands.at(0).at(src_sen_len-1).top()->tgt_wids,para.DROP_OOV);
 }
 
@@ -597,13 +769,21 @@ string SentenceTranslator::translate_sentence()
 ************************************************************************************* */
 void SentenceTranslator::generate_kbest_for_span(const size_t beg,const size_t span)
 {
+	SenProfile span_profile;		//span级并行时各线程先在本地统计, 最后合并到profile中
+	TraceScope trace(PHASE_NAMES[PHASE_CUBE_PRUNING],-1,beg,span);
+	double beg_time = para.PROFILE?wall_time():0.0;
+	size_t phrase_recombined_num = span2cands.at(beg).at(span).get_recombined_num();	//已经在短语候选生成阶段统计过
 	Candpq candpq_merge;			//优先级队列,用来临时存储通过合并得到的候选
 
 	//对于当前跨度匹配到的每一条规则,取出非终结符对应的跨度中的最好候选,将合并得到的候选加入candpq_merge
-	for(auto &rule : span2rules.at(beg).at(span))
+	size_t rules_beg = rule_chart->cell_begin(beg,span);
+	size_t rules_end = rule_chart->cell_end(beg,span);
+	for(size_t i=rules_beg;i<rules_end;i++)
 	{
-		generate_cand_with_rule_and_add_to_pq(rule,0,0,candpq_merge);
+		Rule rule = rule_chart->get_rule(i);
+		generate_cand_with_rule_and_add_to_pq(rule,0,0,candpq_merge,span_profile);
 	}
+	span_profile.counters[COUNTER_CUBE_SEEDED] += rules_end-rules_beg;
 
 	set<vector<int> > duplicate_set;	//用来记录candpq_merge中的候选是否已经被扩展过
 	duplicate_set.clear();
@@ -615,8 +795,11 @@ void SentenceTranslator::generate_kbest_for_span(const size_t beg,const size_t s
 			break;
 		Cand* best_cand = candpq_merge.top();
 		candpq_merge.pop();
+		span_profile.counters[COUNTER_POP]++;
 		if (span == src_sen_len-1)
 		{
+			span_profile.counters[COUNTER_LM_QUERY]++;
+			PhaseTimer timer(span_profile,PHASE_LM,para.PROFILE);
 			double increased_lm_prob = lm_model->cal_final_increased_lm_score(best_cand);
 			best_cand->lm_prob += increased_lm_prob;
 			best_cand->score += feature_weight.lm*increased_lm_prob;
@@ -628,10 +811,13 @@ void SentenceTranslator::generate_kbest_for_span(const size_t beg,const size_t s
 						   best_cand->rank_x1,best_cand->rank_x2,best_cand->applied_rule.tgt_rule_rank};
 		if (duplicate_set.find(key) == duplicate_set.end())
 		{
-			add_neighbours_to_pq(best_cand,candpq_merge);
+			add_neighbours_to_pq(best_cand,candpq_merge,span_profile);
 			duplicate_set.insert(key);
 		}
-		span2cands.at(beg).at(span).add(best_cand,para.BEAM_SIZE);
+		{
+			PhaseTimer timer(span_profile,PHASE_RECOMBINATION,para.PROFILE);
+			span2cands.at(beg).at(span).add(best_cand,para.BEAM_SIZE);
+		}
 		added_cand_num++;
 	}
 	while(!candpq_merge.empty())
@@ -639,6 +825,24 @@ void SentenceTranslator::generate_kbest_for_span(const size_t beg,const size_t s
 		delete candpq_merge.top();
 		candpq_merge.pop();
 	}
+	span_profile.counters[COUNTER_RECOMBINATION] += span2cands.at(beg).at(span).get_recombined_num() - phrase_recombined_num;
+	if (para.PROFILE)
+	{
+		span_profile.phase_times[PHASE_CUBE_PRUNING] += wall_time()-beg_time;
+	}
+	if (para.PROFILE)
+	{
+#pragma omp critical(merge_span_profile)
+		profile.merge(span_profile);
+	}
+}
+
+//计算语言模型增量得分, 同时统计打分次数和耗时
+double SentenceTranslator::cal_increased_lm_score(Cand *cand, SenProfile &cur_profile)
+{
+	PhaseTimer timer(cur_profile,PHASE_LM,para.PROFILE);
+	cur_profile.counters[COUNTER_LM_QUERY]++;
+	return lm_model->cal_increased_lm_score(cand);
 }
 
 /**************************************************************************************
@@ -647,7 +851,7 @@ void SentenceTranslator::generate_kbest_for_span(const size_t beg,const size_t s
  3. 出口参数: 更新后的candpq_merge
  4. 算法简介: 顺序以及逆序合并两个子候选
 ************************************************************************************* */
-void SentenceTranslator::generate_cand_with_rule_and_add_to_pq(Rule &rule,int rank_x1,int rank_x2,Candpq &candpq_merge)
+void SentenceTranslator::generate_cand_with_rule_and_add_to_pq(Rule &rule,int rank_x1,int rank_x2,Candpq &candpq_merge,SenProfile &span_profile)
 {
 	if (rule.tgt_rule->rule_type >= 2)                                                                 //该规则有两个非终结符
 	{
@@ -674,10 +878,12 @@ void SentenceTranslator::generate_cand_with_rule_and_add_to_pq(Rule &rule,int ra
 		cand->rank_x2 = rank_x2;
 		cand->child_x1 = cand_x1;
 		cand->child_x2 = cand_x2;
-		cand->tgt_word_num = cand_x1->tgt_word_num + cand_x2->tgt_word_num + rule.tgt_rule->wids.size() - 2;
+		cand->tgt_word_num = cand_x1->tgt_word_num + cand_x2->tgt_word_num + rule.tgt_rule->tgt->len - 2;
 		int nt_idx = 1; 							//表示第几个非终结符
-		for (auto tgt_wid : rule.tgt_rule->wids)
+		const TgtPhrase *tgt = rule.tgt_rule->tgt;
+		for (size_t i=0;i<tgt->len;i++)
 		{
+			int tgt_wid = tgt->wids[i];
 			if (tgt_wid == tgt_nt_id)
 			{
 				if (nt_idx == 1)
@@ -699,18 +905,18 @@ void SentenceTranslator::generate_cand_with_rule_and_add_to_pq(Rule &rule,int ra
 		{
 			cand->trans_probs.push_back(cand_x1->trans_probs.at(i) + cand_x2->trans_probs.at(i) + rule.tgt_rule->probs.at(i));
 		}
-		double increased_lm_prob = lm_model->cal_increased_lm_score(cand);
+		double increased_lm_prob = cal_increased_lm_score(cand,span_profile);
 		cand->lm_prob = cand_x1->lm_prob + cand_x2->lm_prob + increased_lm_prob;
 		if (rule.tgt_rule->rule_type == 4)  //glue规则
 		{
 			cand->score = cand_x1->score + cand_x2->score + rule.tgt_rule->score + feature_weight.lm*increased_lm_prob
-					  + feature_weight.rule_num*1 + feature_weight.glue*1 + feature_weight.len*(rule.tgt_rule->wids.size() - 2)
+					  + feature_weight.rule_num*1 + feature_weight.glue*1 + feature_weight.len*(rule.tgt_rule->tgt->len - 2)
 					  + feature_weight.fw*rule.generalize_fw_flag + feature_weight.fwverb*rule.fwverb_terminal_flag;
 		}
 		else
 		{
 			cand->score = cand_x1->score + cand_x2->score + rule.tgt_rule->score + feature_weight.lm*increased_lm_prob
-					  + feature_weight.rule_num*1 + feature_weight.len*(rule.tgt_rule->wids.size() - 2)
+					  + feature_weight.rule_num*1 + feature_weight.len*(rule.tgt_rule->tgt->len - 2)
 					  + feature_weight.fw*rule.generalize_fw_flag + feature_weight.fwverb*rule.fwverb_terminal_flag;
 		}
 		candpq_merge.push(cand);
@@ -730,9 +936,11 @@ void SentenceTranslator::generate_cand_with_rule_and_add_to_pq(Rule &rule,int ra
 		cand->rank_x2 = -1;
 		cand->child_x1 = cand_x1;
 		cand->child_x2 = NULL;
-		cand->tgt_word_num = cand_x1->tgt_word_num + rule.tgt_rule->wids.size() - 1;
-		for (auto tgt_wid : rule.tgt_rule->wids)
+		cand->tgt_word_num = cand_x1->tgt_word_num + rule.tgt_rule->tgt->len - 1;
+		const TgtPhrase *tgt = rule.tgt_rule->tgt;
+		for (size_t i=0;i<tgt->len;i++)
 		{
+			int tgt_wid = tgt->wids[i];
 			if (tgt_wid == tgt_nt_id)
 			{
 				cand->tgt_wids.insert(cand->tgt_wids.end(),cand_x1->tgt_wids.begin(),cand_x1->tgt_wids.end());
@@ -746,10 +954,10 @@ void SentenceTranslator::generate_cand_with_rule_and_add_to_pq(Rule &rule,int ra
 		{
 			cand->trans_probs.push_back(cand_x1->trans_probs.at(i) + rule.tgt_rule->probs.at(i));
 		}
-		double increased_lm_prob = lm_model->cal_increased_lm_score(cand);
+		double increased_lm_prob = cal_increased_lm_score(cand,span_profile);
 		cand->lm_prob = cand_x1->lm_prob + increased_lm_prob;
 		cand->score = cand_x1->score + rule.tgt_rule->score + feature_weight.lm*increased_lm_prob
-					  + feature_weight.rule_num*1 + feature_weight.len*(rule.tgt_rule->wids.size() - 1)
+					  + feature_weight.rule_num*1 + feature_weight.len*(rule.tgt_rule->tgt->len - 1)
 					  + feature_weight.fw*rule.generalize_fw_flag + feature_weight.fwverb*rule.fwverb_terminal_flag;
 		candpq_merge.push(cand);
 	}
@@ -762,22 +970,22 @@ void SentenceTranslator::generate_cand_with_rule_and_add_to_pq(Rule &rule,int ra
  4. 算法简介: a) 取比当前候选左子候选差一名的候选与当前候选的右子候选合并
               b) 取比当前候选右子候选差一名的候选与当前候选的左子候选合并
 ************************************************************************************* */
-void SentenceTranslator::add_neighbours_to_pq(Cand* cur_cand, Candpq &candpq_merge)
+void SentenceTranslator::add_neighbours_to_pq(Cand* cur_cand, Candpq &candpq_merge, SenProfile &span_profile)
 {
 	if (cur_cand->rank_x2 != -1)                                                //如果生成当前候选的规则包括两个非终结符
 	{
 		int rank_x1 = cur_cand->rank_x1 + 1;
 		int rank_x2 = cur_cand->rank_x2;
-		generate_cand_with_rule_and_add_to_pq(cur_cand->applied_rule,rank_x1,rank_x2,candpq_merge);
+		generate_cand_with_rule_and_add_to_pq(cur_cand->applied_rule,rank_x1,rank_x2,candpq_merge,span_profile);
 
 		rank_x1 = cur_cand->rank_x1;
 		rank_x2 = cur_cand->rank_x2 + 1;
-		generate_cand_with_rule_and_add_to_pq(cur_cand->applied_rule,rank_x1,rank_x2,candpq_merge);
+		generate_cand_with_rule_and_add_to_pq(cur_cand->applied_rule,rank_x1,rank_x2,candpq_merge,span_profile);
 	}
 	else 																		//如果生成当前候选的规则包括一个非终结符
 	{
 		int rank_x1 = cur_cand->rank_x1 + 1;
 		int rank_x2 = cur_cand->rank_x2;
-		generate_cand_with_rule_and_add_to_pq(cur_cand->applied_rule,rank_x1,rank_x2,candpq_merge);
+		generate_cand_with_rule_and_add_to_pq(cur_cand->applied_rule,rank_x1,rank_x2,candpq_merge,span_profile);
 	}
 }
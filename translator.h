@@ -1,15 +1,23 @@
+#ifndef TRANSLATOR_H
+#define TRANSLATOR_H
+
 #include "stdafx.h"
 #include "cand.h"
 #include "vocab.h"
 //#include "ruletable.h"
 #include "lm.h"
 #include "myutils.h"
+#include "profiler.h"
+#include "tracer.h"
+#include "rulechart.h"
+
+class SentenceScheduler;
 
 struct Models
 {
 	Vocab *src_vocab;
 	Vocab *tgt_vocab;
-	RuleTable *ruletable;
+	RuleSource *ruletable;
 	LanguageModel *lm_model;
 	set<int> *src_function_words;
 };
@@ -20,27 +28,43 @@ class SentenceTranslator
 		SentenceTranslator(const Models &i_models, const Parameter &i_para, const Weight &i_weight, const string &input_sen);
 		~SentenceTranslator();
 		string translate_sentence();
+		void search();
+		string get_translation();
 		vector<TuneInfo> get_tune_info(size_t sen_id);
 		vector<string> get_applied_rules(size_t sen_id);
+		const SenProfile& get_profile() {return profile;};
+		const SenMemory& get_memory() {return memory;};
+		size_t get_src_sen_len() {return src_sen_len;};
+		void set_scheduler(SentenceScheduler *i_scheduler) {scheduler = i_scheduler;};
+		static void parse_word_tag(const StringPiece &word_tag, StringPiece &word, bool &is_verb);
 	private:
 		void fill_span2cands_with_phrase_rules();
 		void fill_span2rules_with_hiero_rules();
-		void fill_span2rules_with_AX_XA_XAX_rule();
-		void fill_span2rules_with_AXB_AXBX_XAXB_rule();
-		void fill_span2rules_with_AXBXC_rule();
+		typedef void (SentenceTranslator::*PatternMatcher)(int beg, RulePatternBuffer &buffer, SenProfile &beg_profile);
+		void match_patterns_by_beg(PatternMatcher matcher);
+		void fill_span2rules_with_AX_XA_XAX_rule(int beg_A, RulePatternBuffer &buffer, SenProfile &beg_profile);
+		void fill_span2rules_with_AXB_AXBX_XAXB_rule(int beg_AXB, RulePatternBuffer &buffer, SenProfile &beg_profile);
+		void fill_span2rules_with_AXBXC_rule(int beg_AXBXC, RulePatternBuffer &buffer, SenProfile &beg_profile);
 		void fill_span2rules_with_glue_rule();
-		void fill_span2rules_with_matched_rules(vector<TgtRule> &matched_rules,vector<int> &src_ids,pair<int,int> span,pair<int,int> span_src_x1,pair<int,int> span_src_x2);
+		void fill_span2rules_with_matched_rules(vector<TgtRule> &matched_rules,vector<int> &src_ids,pair<int,int> span,pair<int,int> span_src_x1,pair<int,int> span_src_x2,RulePatternBuffer &buffer,SenProfile &beg_profile);
+		size_t get_span_thread_num();
 		void generate_kbest_for_span(const size_t beg,const size_t span);
-		void generate_cand_with_rule_and_add_to_pq(Rule &rule,int rank_x1,int rank_x2,Candpq &new_cands_by_mergence);
-		void add_neighbours_to_pq(Cand *cur_cand, Candpq &new_cands_by_mergence);
+		void generate_cand_with_rule_and_add_to_pq(Rule &rule,int rank_x1,int rank_x2,Candpq &new_cands_by_mergence,SenProfile &span_profile);
+		void add_neighbours_to_pq(Cand *cur_cand, Candpq &new_cands_by_mergence,SenProfile &span_profile);
+		double cal_increased_lm_score(Cand *cand, SenProfile &cur_profile);
 		void dump_rules(vector<string> &applied_rules, Cand *cand);
 		string words_to_str(vector<int> wids, int drop_oov);
 		bool is_only_function_words_in_span(pair<int,int> span_X);
+		void add_chart_memory(size_t span);
+		void limit_chart_memory(size_t span);
+		void limit_rule_chart_memory();
 
 	private:
 		Vocab *src_vocab;
 		Vocab *tgt_vocab;
-		RuleTable *ruletable;
+		VocabOverlay src_overlay;						//当前句子的源端词表, 包括句子中的未登录词
+		RuleSource *ruletable;
+		size_t rule_ticket;								//句子在规则来源中的编号, 句子结束前查到的规则不会被释放
 		LanguageModel *lm_model;
 		set<int> *src_function_words;
 		Parameter para;
@@ -48,7 +72,7 @@ class SentenceTranslator
 
 		vector<vector<CandBeam> > span2cands;		    //存储解码过程中所有跨度对应的候选列表, 
 													    //span2cands[i][j]存储起始位置为i, 跨度为j的候选列表
-		vector<vector<vector<Rule> > > span2rules;	    //存储每个跨度所有能用的hiero规则
+		RuleChart *rule_chart;							//存储每个跨度所有能用的hiero规则, 以及候选所用规则的源端
 
 		vector<int> src_wids;
 		vector<int> verb_flags;
@@ -56,4 +80,9 @@ class SentenceTranslator
 		size_t src_sen_len;
 		int src_nt_id;                                  //源端非终结符的id
 		int tgt_nt_id; 									//目标端非终结符的id
+		SenProfile profile;								//各阶段耗时和计数
+		SenMemory memory;								//chart的内存占用
+		SentenceScheduler *scheduler;					//批量调度时决定span级并行数, 为NULL时使用SPAN_THREAD_NUM; 规则匹配在构造时完成, 总是使用SPAN_THREAD_NUM
 };
+
+#endif
@@ -1,4 +1,41 @@
 #include "vocab.h"
+#include "util/murmur_hash.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+const char BINARY_VOCAB_MAGIC[8] = {'H','I','E','R','O','V','B','2'};
+const size_t BINARY_VOCAB_BUCKET_SIZE = 4;			//完美哈希每个桶的平均单词数
+const uint32_t BINARY_VOCAB_MAX_D0 = 1024;
+
+//完美哈希用到的两个哈希值, 第一个决定桶, 第二个与桶的位移一起决定槽
+static inline void hash_word(const char *word, size_t len, uint64_t &h, uint64_t &g)
+{
+	h = util::MurmurHash64A(word,len,0);
+	g = util::MurmurHash64A(word,len,1);
+}
+
+//d0与g混合后得到相互独立的槽位函数; 线性组合(g低位+d0*g高位)在词表很小时只有词数平方种取值, 可能无法构造
+static inline uint64_t cal_slot(uint64_t g, uint32_t d0, uint32_t d1, uint64_t word_num)
+{
+	uint64_t x = (g^((uint64_t)d0*0x9e3779b97f4a7c15ULL))*0xbf58476d1ce4e5b9ULL;
+	return ((x^(x>>31)) + d1) % word_num;
+}
+
+size_t StringPieceHasher::operator()(const StringPiece &str) const
+{
+	return util::MurmurHashNative(str.data(),str.size());
+}
+
+Vocab::Vocab(const string &vocab_file)
+{
+	binary_word_num = 0;
+	header = NULL;
+	if (!load_binary_vocab(vocab_file))
+	{
+		load_vocab(vocab_file);
+	}
+}
 
 void Vocab::load_vocab(const string &vocab_file)
 {
@@ -20,23 +57,243 @@ void Vocab::load_vocab(const string &vocab_file)
 			return;
 		}
 		word_list.push_back(word);
-		word2id.insert(make_pair(word,index));
+		word2id.insert(make_pair(StringPiece(word_list.back()),index));
+	}
+}
+
+/**************************************************************************************
+ 1. 函数功能: 加载二进制词表
+ 2. 入口参数: 词表文件
+ 3. 出口参数: 文件是否为二进制词表
+ 4. 算法简介: 文件整体mmap到内存, 只设置指向各个表的指针, 不做任何解析
+************************************************************************************* */
+bool Vocab::load_binary_vocab(const string &vocab_file)
+{
+	int fd = open(vocab_file.c_str(),O_RDONLY);
+	if (fd == -1)
+		return false;
+	struct stat st;
+	char magic[sizeof(BINARY_VOCAB_MAGIC)];
+	if (fstat(fd,&st) != 0 || (size_t)st.st_size < sizeof(BinaryVocabHeader) || pread(fd,magic,sizeof(magic),0) != sizeof(magic)
+		|| memcmp(magic,BINARY_VOCAB_MAGIC,sizeof(magic)) != 0)
+	{
+		close(fd);
+		return false;
 	}
+	util::MapRead(util::LAZY,fd,0,st.st_size,binary_mem);
+	close(fd);
+	const char *data = binary_mem.begin();
+	header = (const BinaryVocabHeader*)data;
+	binary_word_num = header->word_num;
+	offsets = (const uint64_t*)(data+sizeof(BinaryVocabHeader));
+	displacements = (const uint32_t*)(offsets+binary_word_num+1);
+	slot2id = displacements+2*header->bucket_num;
+	lm_id_table = slot2id+binary_word_num;
+	pool = (const char*)(lm_id_table+header->lm_id_num);
+	if (pool+header->pool_size > data+st.st_size)
+	{
+		cerr<<"binary vocab file "<<vocab_file<<" is truncated, bye\n";
+		exit(EXIT_FAILURE);
+	}
+	cout<<"load binary vocab file "<<vocab_file<<" over, "<<binary_word_num<<" words\n";
+	return true;
+}
+
+int Vocab::find_in_binary(const StringPiece &word) const
+{
+	if (binary_word_num == 0)
+		return -1;
+	uint64_t h,g;
+	hash_word(word.data(),word.size(),h,g);
+	const uint32_t *d = displacements+2*(h%header->bucket_num);
+	uint32_t id = slot2id[cal_slot(g,d[0],d[1],binary_word_num)];
+	size_t len = offsets[id+1]-offsets[id];
+	if (len != word.size() || memcmp(pool+offsets[id],word.data(),len) != 0)
+		return -1;															//完美哈希对不在词表中的单词也会给出一个槽
+	return id;
+}
+
+string Vocab::get_word(int id) const
+{
+	if (id < binary_word_num)
+		return string(pool+offsets[id],offsets[id+1]-offsets[id]);
+	return word_list.at(id-binary_word_num);
 }
 
-int Vocab::get_id(const string &word)
+//查找单词的id, 不存在时返回-1
+int Vocab::get_id(const StringPiece &word) const
 {
+	int id = find_in_binary(word);
+	if (id >= 0)
+		return id;
 	auto it=word2id.find(word);
 	if (it != word2id.end())
 	{
 		return it->second;
 	}
+	return -1;
+}
+
+//查找单词的id, 不存在时加入词表, 只在加载模型时使用
+int Vocab::add_word(const StringPiece &word)
+{
+	int id = get_id(word);
+	if (id >= 0)
+	{
+		return id;
+	}
 	else
 	{
-		int id = word_list.size();
-		word2id.insert(make_pair(word,id));
-		word_list.push_back(word);
+		id = size();
+		word_list.push_back(word.as_string());
+		word2id.insert(make_pair(StringPiece(word_list.back()),id));
 		return id;
 	}
 }
 
+int VocabOverlay::get_id(const StringPiece &word)
+{
+	int id = vocab->get_id(word);
+	if (id >= 0)
+		return id;
+	auto it = oov2id.find(word);
+	if (it != oov2id.end())
+		return it->second;
+	id = vocab->size()+oov_words.size();
+	oov_words.push_back(word.as_string());
+	oov2id.insert(make_pair(StringPiece(oov_words.back()),id));
+	return id;
+}
+
+string VocabOverlay::get_word(int id) const
+{
+	if (id < vocab->size())
+		return vocab->get_word(id);
+	return oov_words.at(id-vocab->size());
+}
+
+//词表占用的内存, 哈希表的节点按键值对加一个指针估计, 键指向word_list中的字符串
+size_t Vocab::memory_bytes()
+{
+	size_t bytes = sizeof(Vocab) + binary_mem.size() + word_list.size()*sizeof(string) + word2id.bucket_count()*sizeof(void*);
+	for (const auto &word : word_list)
+	{
+		bytes += word.capacity()+1;
+	}
+	bytes += word2id.size()*(sizeof(pair<const StringPiece,int>)+sizeof(void*));
+	return bytes;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 获取预先计算的单词id到KenLM id的映射
+ 2. 入口参数: 当前语言模型的词表大小和文件大小
+ 3. 出口参数: 映射表是否存在且与当前语言模型一致, 映射表
+ 4. 算法简介: 加载时加入的单词不在映射表中, 对应KenLM的<unk>
+************************************************************************************* */
+bool Vocab::get_lm_ids(uint64_t lm_bound, uint64_t lm_file_size, vector<lm::WordIndex> &lm_ids) const
+{
+	if (!has_lm_ids(lm_file_size) || header->lm_bound != lm_bound)
+		return false;
+	lm_ids.assign(lm_id_table,lm_id_table+header->lm_id_num);
+	return true;
+}
+
+/**************************************************************************************
+ 1. 函数功能: 写二进制词表
+ 2. 入口参数: 词表文件, 按id排列的单词, 单词id到KenLM id的映射(可以为空), KenLM词表大小和文件大小
+ 3. 出口参数: 是否成功
+ 4. 算法简介: 最小完美哈希采用hash-and-displace方法: 单词按第一个哈希值分到若干个桶中,
+ 			  从大到小依次为每个桶寻找位移(d0,d1), 使桶中所有单词的槽
+ 			  cal_slot(g,d0,d1,word_num)互不相同且未被占用; d0与g混合后再加d1,
+ 			  固定d0时d1只平移所有槽, 因此对每个d0依次尝试所有d1
+************************************************************************************* */
+bool Vocab::write_binary(const string &vocab_file, const vector<string> &words, const vector<lm::WordIndex> &lm_ids, uint64_t lm_bound, uint64_t lm_file_size)
+{
+	uint64_t word_num = words.size();
+	uint64_t bucket_num = word_num/BINARY_VOCAB_BUCKET_SIZE+1;
+	vector<uint64_t> gs(word_num);
+	vector<vector<uint32_t> > buckets(bucket_num);
+	for (size_t i=0;i<word_num;i++)
+	{
+		uint64_t h;
+		hash_word(words[i].data(),words[i].size(),h,gs[i]);
+		buckets[h%bucket_num].push_back(i);
+	}
+	vector<uint32_t> bucket_order(bucket_num);
+	for (size_t b=0;b<bucket_num;b++)
+	{
+		bucket_order[b] = b;
+	}
+	stable_sort(bucket_order.begin(),bucket_order.end(),[&](uint32_t a, uint32_t b){return buckets[a].size()>buckets[b].size();});
+	vector<uint32_t> displacements(2*bucket_num,0);
+	vector<uint32_t> slot2id(word_num,0);
+	vector<bool> taken(word_num,false);
+	vector<uint64_t> slots;
+	for (auto b : bucket_order)
+	{
+		const vector<uint32_t> &bucket = buckets[b];
+		if (bucket.empty())
+			break;
+		bool placed = false;
+		for (uint32_t d0=0;d0<BINARY_VOCAB_MAX_D0 && !placed;d0++)
+		{
+			for (uint32_t d1=0;d1<word_num && !placed;d1++)
+			{
+				slots.clear();
+				for (auto id : bucket)
+				{
+					uint64_t slot = cal_slot(gs[id],d0,d1,word_num);
+					if (taken[slot] || find(slots.begin(),slots.end(),slot) != slots.end())
+						break;
+					slots.push_back(slot);
+				}
+				if (slots.size() != bucket.size())
+					continue;
+				for (size_t i=0;i<bucket.size();i++)
+				{
+					taken[slots[i]] = true;
+					slot2id[slots[i]] = bucket[i];
+				}
+				displacements[2*b] = d0;
+				displacements[2*b+1] = d1;
+				placed = true;
+			}
+		}
+		if (!placed)
+		{
+			cerr<<"fail to build perfect hash for "<<vocab_file<<", duplicate words?\n";
+			return false;
+		}
+	}
+
+	BinaryVocabHeader header;
+	memcpy(header.magic,BINARY_VOCAB_MAGIC,sizeof(header.magic));
+	header.word_num = word_num;
+	header.bucket_num = bucket_num;
+	header.lm_id_num = lm_ids.size();
+	header.lm_bound = lm_bound;
+	header.lm_file_size = lm_file_size;
+	vector<uint64_t> offsets(word_num+1,0);
+	for (size_t i=0;i<word_num;i++)
+	{
+		offsets[i+1] = offsets[i]+words[i].size();
+	}
+	header.pool_size = offsets[word_num];
+	ofstream fout(vocab_file.c_str(),ios::binary);
+	if (!fout.is_open())
+	{
+		cerr<<"fail open binary vocab file to write!\n";
+		return false;
+	}
+	fout.write((char*)&header,sizeof(header));
+	fout.write((char*)&offsets[0],sizeof(uint64_t)*offsets.size());
+	fout.write((char*)displacements.data(),sizeof(uint32_t)*displacements.size());
+	fout.write((char*)slot2id.data(),sizeof(uint32_t)*slot2id.size());
+	fout.write((char*)lm_ids.data(),sizeof(lm::WordIndex)*lm_ids.size());
+	for (const auto &word : words)
+	{
+		fout.write(word.data(),word.size());
+	}
+	fout.close();
+	return true;
+}
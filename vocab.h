@@ -2,18 +2,75 @@
 #define VOCAB_H
 
 #include "stdafx.h"
+#include "lm/word_index.hh"
+#include "util/string_piece.hh"
+#include <deque>
 
+//二进制词表的文件头, 之后依次为: 每个单词在字符串池中的偏移(uint64, word_num+1个),
+//每个桶的位移(uint32对, bucket_num个), 完美哈希的槽到单词id的映射(uint32, word_num个),
+//单词id到KenLM id的映射(uint32, lm_id_num个), 字符串池
+struct BinaryVocabHeader
+{
+	char magic[8];
+	uint64_t word_num;
+	uint64_t bucket_num;
+	uint64_t pool_size;
+	uint64_t lm_id_num;						//为0表示没有预先计算KenLM id
+	uint64_t lm_bound;						//生成映射时KenLM词表的大小, 与文件大小一起用来校验语言模型
+	uint64_t lm_file_size;
+};
+
+//以StringPiece为键的哈希表用的哈希函数, 查询时不需要构造string
+struct StringPieceHasher
+{
+	size_t operator()(const StringPiece &str) const;
+};
+
+//加载完成后只读, 多个线程可以无锁地同时查询
+//add_word只能在加载模型时调用, 解码过程中的未登录词由每个句子的VocabOverlay编号
+//词表文件可以是"单词 id"格式的文本文件, 也可以是ruletable2bin生成的二进制文件,
+//二进制文件通过mmap加载, 用最小完美哈希查找, 加载时加入的单词存放在内存中, 编号接在文件中的单词之后
 class Vocab
 {
 	public:
-		Vocab(const string &vocab_file) {load_vocab(vocab_file);};
-		string get_word(int id){return word_list.at(id);};
-		int get_id(const string &word);
+		Vocab(const string &vocab_file);
+		string get_word(int id) const;
+		int get_id(const StringPiece &word) const;
+		int add_word(const StringPiece &word);
+		size_t size() const {return binary_word_num+word_list.size();};
+		size_t memory_bytes();
+		bool has_lm_ids(uint64_t lm_file_size) const {return header != NULL && header->lm_id_num > 0 && header->lm_file_size == lm_file_size;};
+		bool get_lm_ids(uint64_t lm_bound, uint64_t lm_file_size, vector<lm::WordIndex> &lm_ids) const;
+		static bool write_binary(const string &vocab_file, const vector<string> &words, const vector<lm::WordIndex> &lm_ids, uint64_t lm_bound, uint64_t lm_file_size);
 	private:
 		void load_vocab(const string &vocab_file);
+		bool load_binary_vocab(const string &vocab_file);
+		int find_in_binary(const StringPiece &word) const;
+	private:
+		deque<string> word_list;							//用deque保证单词的地址不变, word2id的键指向这里的字符串
+		unordered_map<StringPiece,int,StringPieceHasher> word2id;
+
+		util::scoped_memory binary_mem;			//mmap映射的二进制词表
+		size_t binary_word_num;
+		const BinaryVocabHeader *header;
+		const uint64_t *offsets;
+		const uint32_t *displacements;
+		const uint32_t *slot2id;
+		const uint32_t *lm_id_table;
+		const char *pool;
+};
+
+//句子内的未登录词表, 未登录词的id从共享词表的大小开始编号, 只在当前句子内有效
+class VocabOverlay
+{
+	public:
+		VocabOverlay(const Vocab *i_vocab) : vocab(i_vocab) {};
+		int get_id(const StringPiece &word);
+		string get_word(int id) const;
 	private:
-		vector<string> word_list;
-		unordered_map<string,int> word2id;
+		const Vocab *vocab;
+		deque<string> oov_words;
+		unordered_map<StringPiece,int,StringPieceHasher> oov2id;
 };
 
 #endif